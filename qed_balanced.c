@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_balanced.h"
+
+#include "qed_batch.h"
+#include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_resource.h"
+#include "qed_stats.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* How many operations to run between checking the clock. */
+#define QED_BALANCED_CLOCK_INTERVAL 1024
+
+/* The rank of a node while it is on the search stack, and the result of a
+ * search that found a cycle. */
+#define QED_BALANCED_CYCLE UINT_MAX
+
+struct qed_balanced{
+    const struct QED_Graph *graph;
+    struct QED_BatchBudget *budget;
+    struct timespec start;
+    unsigned long next_clock_check;
+    bool exhausted;
+    
+    unsigned cap;
+    
+    /* Rank of each node, zero if it is not known yet, or QED_BALANCED_CYCLE
+     * while it is being searched. */
+    unsigned *ranks;
+    
+    /* Order in which each node became ready. */
+    unsigned *sequence;
+    
+    /* Explicit stack for the rank search. */
+    unsigned *stack_nodes, *stack_edges, *stack_best;
+    
+    unsigned *heap, heap_count;
+};
+
+static unsigned long qed_balanced_elapsed(const struct qed_balanced *balanced){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)(now.tv_sec - balanced->start.tv_sec) * 1000000ul +
+        (unsigned long)((now.tv_nsec - balanced->start.tv_nsec) / 1000);
+}
+
+/* Charges operations to the budget. Returns false once it is used up. */
+static bool qed_balanced_spend(struct qed_balanced *balanced, unsigned long ops){
+    struct QED_BatchBudget *const budget = balanced->budget;
+    
+    if(balanced->exhausted)
+        return false;
+    
+    budget->used_operations += ops;
+    if(budget->max_operations != 0 &&
+        budget->used_operations >= budget->max_operations){
+        balanced->exhausted = true;
+    }
+    else if(budget->max_microseconds != 0 &&
+        budget->used_operations >= balanced->next_clock_check){
+        balanced->next_clock_check =
+            budget->used_operations + QED_BALANCED_CLOCK_INTERVAL;
+        if(qed_balanced_elapsed(balanced) >= budget->max_microseconds)
+            balanced->exhausted = true;
+    }
+    return !balanced->exhausted;
+}
+
+/* Finds the rank of a node with a depth-first search, memoizing every node it
+ * finishes. A node's other dependents are not searched once one of them has a
+ * rank of cap - 1 or more. Returns zero if the budget ran out first, or
+ * QED_BALANCED_CYCLE if the search found a cycle. */
+static unsigned qed_balanced_rank(struct qed_balanced *balanced, unsigned node){
+    
+    const struct QED_Graph *const graph = balanced->graph;
+    const unsigned cap = balanced->cap;
+    unsigned *const ranks = balanced->ranks,
+        *const stack_nodes = balanced->stack_nodes,
+        *const stack_edges = balanced->stack_edges,
+        *const stack_best = balanced->stack_best;
+    unsigned depth = 0;
+    
+    if(ranks[node] != 0)
+        return ranks[node];
+    
+    stack_nodes[0] = node;
+    stack_edges[0] = graph->succ_offsets[node];
+    stack_best[0] = 0;
+    ranks[node] = QED_BALANCED_CYCLE;
+    
+    for(;;){
+        const unsigned top = stack_nodes[depth];
+        unsigned rank;
+        
+        /* Stop looking once the rank has reached the cap. */
+        if(stack_edges[depth] < graph->succ_offsets[top + 1] &&
+            stack_best[depth] + 1 < cap){
+            
+            const unsigned succ = graph->succs[stack_edges[depth]];
+            
+            if(!qed_balanced_spend(balanced, 1)){
+                /* Forget the nodes on the stack so they are searched again. */
+                do{
+                    ranks[stack_nodes[depth]] = 0;
+                }while(depth-- != 0);
+                return 0;
+            }
+            
+            if((rank = ranks[succ]) == QED_BALANCED_CYCLE)
+                return QED_BALANCED_CYCLE;
+            if(rank == 0){
+                depth++;
+                stack_nodes[depth] = succ;
+                stack_edges[depth] = graph->succ_offsets[succ];
+                stack_best[depth] = 0;
+                ranks[succ] = QED_BALANCED_CYCLE;
+            }
+            else{
+                stack_edges[depth]++;
+                if(rank > stack_best[depth])
+                    stack_best[depth] = rank;
+            }
+            continue;
+        }
+        
+        rank = stack_best[depth] + 1;
+        ranks[top] = rank;
+        if(depth == 0)
+            return rank;
+        
+        depth--;
+        stack_edges[depth]++;
+        if(rank > stack_best[depth])
+            stack_best[depth] = rank;
+    }
+}
+
+/* Returns true if a should be scheduled before b. */
+static bool qed_balanced_before(const struct qed_balanced *balanced,
+    unsigned a,
+    unsigned b){
+    
+    if(balanced->ranks[a] != balanced->ranks[b])
+        return balanced->ranks[a] > balanced->ranks[b];
+    return balanced->sequence[a] < balanced->sequence[b];
+}
+
+static void qed_balanced_push(struct qed_balanced *balanced, unsigned node){
+    unsigned *const heap = balanced->heap;
+    unsigned i = balanced->heap_count++;
+    while(i != 0){
+        const unsigned parent = (i - 1) >> 1;
+        if(!qed_balanced_before(balanced, node, heap[parent]))
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = node;
+}
+
+static unsigned qed_balanced_pop(struct qed_balanced *balanced){
+    unsigned *const heap = balanced->heap;
+    const unsigned top = heap[0];
+    const unsigned last = heap[--balanced->heap_count];
+    const unsigned count = balanced->heap_count;
+    unsigned i = 0;
+    
+    for(;;){
+        unsigned child = (i << 1) + 1;
+        if(child >= count)
+            break;
+        if(child + 1 < count &&
+            qed_balanced_before(balanced, heap[child + 1], heap[child]))
+            child++;
+        if(!qed_balanced_before(balanced, heap[child], last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if(count != 0)
+        heap[i] = last;
+    return top;
+}
+
+/* Fills a batch from the heap and then the queue, keeping to the resource
+ * limits. Nodes that are passed over go back where they came from. Returns the
+ * number of nodes added to out_order. */
+static unsigned qed_balanced_fill(struct qed_balanced *balanced,
+    const struct QED_ResourceLimits *resources,
+    unsigned *fifo,
+    unsigned *fifo_head,
+    unsigned fifo_tail,
+    unsigned max_batch_size,
+    unsigned *out_order){
+    
+    struct QED_Dependency *const *const nodes = balanced->graph->nodes;
+    unsigned usage[QED_MAX_RESOURCE_CLASSES], skipped[QED_RESOURCE_MAX_SKIPPED];
+    unsigned num = 0, num_skipped = 0, heap_skipped, next = fifo_head[0], i;
+    
+    QED_ClearResources(usage);
+    while(balanced->heap_count != 0 && num < max_batch_size &&
+        num_skipped < QED_RESOURCE_MAX_SKIPPED){
+        const unsigned node = qed_balanced_pop(balanced);
+        if(QED_ReserveResources(resources, usage, nodes[node]->resources))
+            out_order[num++] = node;
+        else
+            skipped[num_skipped++] = node;
+    }
+    heap_skipped = num_skipped;
+    while(next != fifo_tail && num < max_batch_size &&
+        num_skipped < QED_RESOURCE_MAX_SKIPPED){
+        const unsigned node = fifo[next++];
+        if(QED_ReserveResources(resources, usage, nodes[node]->resources))
+            out_order[num++] = node;
+        else
+            skipped[num_skipped++] = node;
+    }
+    
+    for(i = 0; i < heap_skipped; i++)
+        qed_balanced_push(balanced, skipped[i]);
+    
+    /* The queue has room for its skipped nodes just before next. */
+    fifo_head[0] = next - (num_skipped - heap_skipped);
+    for(i = heap_skipped; i < num_skipped; i++)
+        fifo[fifo_head[0] + i - heap_skipped] = skipped[i];
+    return num;
+}
+
+bool QED_ScheduleBalanced(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    struct QED_BatchBudget *budget,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    const unsigned num_nodes = graph->num_nodes, stride = num_nodes + 1;
+    unsigned *const memory = (scratch != NULL) ? scratch :
+        malloc(QED_BALANCED_SCRATCH(num_nodes) * sizeof(unsigned));
+    unsigned *const fifo = memory + stride * 6,
+        *const pending = memory + stride * 7;
+    struct qed_balanced balanced;
+    unsigned num_scheduled = 0, num_batches = 0, fifo_head = 0, fifo_tail = 0, i;
+    bool cycle = false;
+    
+    if(memory == NULL)
+        return false;
+    
+    balanced.graph = graph;
+    balanced.budget = budget;
+    clock_gettime(CLOCK_MONOTONIC, &balanced.start);
+    balanced.exhausted = false;
+    balanced.cap = (budget->window == 0) ? UINT_MAX : budget->window;
+    balanced.ranks = memory;
+    balanced.sequence = memory + stride;
+    balanced.stack_nodes = memory + stride * 2;
+    balanced.stack_edges = memory + stride * 3;
+    balanced.stack_best = memory + stride * 4;
+    balanced.heap = memory + stride * 5;
+    balanced.heap_count = 0;
+    
+    budget->used_operations = 0;
+    balanced.next_clock_check = 0;
+    
+    if(max_batch_size == 0)
+        max_batch_size = num_nodes;
+    
+    /* Nodes that have become ready are first put in a FIFO queue, and are
+     * only ranked and moved into the heap when there are more ready nodes than
+     * fit in a batch. */
+    for(i = 0; i < num_nodes; i++){
+        balanced.ranks[i] = 0;
+        pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        if(pending[i] == 0){
+            balanced.sequence[i] = fifo_tail;
+            fifo[fifo_tail++] = i;
+        }
+    }
+    
+    while(fifo_head != fifo_tail || balanced.heap_count != 0){
+        const unsigned start = num_scheduled;
+        
+        if(fifo_tail - fifo_head + balanced.heap_count > max_batch_size){
+            while(fifo_head != fifo_tail && !balanced.exhausted){
+                const unsigned node = fifo[fifo_head],
+                    rank = qed_balanced_rank(&balanced, node);
+                if(rank == QED_BALANCED_CYCLE)
+                    cycle = true;
+                if(rank == 0 || cycle || !qed_balanced_spend(&balanced, 1))
+                    break;
+                qed_balanced_push(&balanced, node);
+                fifo_head++;
+            }
+            if(cycle)
+                break;
+        }
+        
+        /* Ranked nodes have been ready the longest, so take them before
+         * anything still in the queue. */
+        out_offsets[num_batches++] = start;
+        if(resources != NULL){
+            num_scheduled += qed_balanced_fill(&balanced, resources, fifo,
+                &fifo_head, fifo_tail, max_batch_size, out_order + start);
+        }
+        else{
+            while(balanced.heap_count != 0 && num_scheduled - start < max_batch_size)
+                out_order[num_scheduled++] = qed_balanced_pop(&balanced);
+            while(fifo_head != fifo_tail && num_scheduled - start < max_batch_size)
+                out_order[num_scheduled++] = fifo[fifo_head++];
+        }
+        QED_STATS_BATCH((num_scheduled - start) + QED_GraphSuccessorCount(graph,
+            out_order + start, num_scheduled - start));
+        
+        for(i = start; i < num_scheduled; i++){
+            const unsigned node = out_order[i];
+            unsigned e;
+            for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+                const unsigned succ = graph->succs[e];
+                assert(pending[succ] != 0);
+                if(--pending[succ] == 0){
+                    balanced.sequence[succ] = fifo_tail;
+                    fifo[fifo_tail++] = succ;
+                }
+            }
+        }
+    }
+    out_offsets[num_batches] = num_scheduled;
+    
+    budget->used_microseconds = qed_balanced_elapsed(&balanced);
+    budget->exhausted = balanced.exhausted;
+    
+    if(scratch == NULL)
+        free(memory);
+    out_num_batches[0] = num_batches;
+    
+    /* Any nodes which were never queued are part of a cycle. */
+    return !cycle && num_scheduled == num_nodes;
+}
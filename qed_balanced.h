@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_BALANCED_H
+#define LIBQED_BALANCED_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Graph;
+struct QED_BatchBudget;
+struct QED_ResourceLimits;
+
+#define QED_BALANCED_SCRATCH(NUM_NODES) (((unsigned long)(NUM_NODES) + 1) * 8)
+
+/**
+ * @brief Calculates batches with a bounded amount of lookahead.
+ *
+ * This schedules like QED_ScheduleGreedy, except that when there are more
+ * ready nodes than fit in a batch the nodes with the longest path to a sink
+ * are preferred, as in QED_ScheduleLookahead. Ranks are only calculated on
+ * demand, and stop being calculated once the budget runs out. From then on
+ * the remaining batches are greedy. If budget->window is not zero, the other
+ * dependents of a node are not searched once one of them is found to have a
+ * rank of window - 1 or more, so ranks past the window are approximate. This
+ * limits how many dependents are searched, not how deep the search goes.
+ *
+ * If resources is not NULL, nodes that would take a batch over a resource
+ * limit are passed over, and stay ready for the next batch.
+ *
+ * The budget is updated with how much of it was used.
+ *
+ * scratch must have room for QED_BALANCED_SCRATCH(graph->num_nodes) entries,
+ * or be NULL to allocate it internally.
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_ScheduleBalanced(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    struct QED_BatchBudget *budget,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches);
+
+#endif /* LIBQED_BALANCED_H */
@@ -8,27 +8,156 @@
 
 #include "qed_batch.h"
 
+#include "qed_balanced.h"
+#include "qed_cache.h"
 #include "qed_greedy.h"
 #include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_locality.h"
+#include "qed_lookahead.h"
+#include "qed_packed.h"
+#include "qed_pool.h"
+#include "qed_profile.h"
+#include "qed_reduce.h"
+#include "qed_stats.h"
 #include "qed_tinyhash.h"
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
-static void qed_add_depencies(struct QED_HashTable *const satisfied,
+/* Returns the number of deps which were added to the table. */
+static unsigned qed_add_depencies(struct QED_HashTable *const satisfied,
     struct QED_Dependency **deps,
     unsigned num_deps){
     
-    unsigned i;
+    unsigned i, num_added = 0;
     for(i = 0; i < num_deps; i++){
         uintptr_t unused;
         if(!QED_HashTableInsert(satisfied, (uintptr_t)deps[i], 0, &unused)){
-            qed_add_depencies(satisfied, deps[i]->dependencies, deps[i]->num_dependencies);
+            num_added += 1 + qed_add_depencies(satisfied,
+                deps[i]->dependencies, deps[i]->num_dependencies);
         }
         else{
             assert(unused == 0);
         }
     }
+    return num_added;
+}
+
+/* Allocates an array of batches, the batches, and the dependency arrays for
+ * all of them as a single block. Only the dependencies pointer of the first
+ * batch is set, to the start of the dependency arrays. */
+static struct QED_Batch **qed_allocate_batches(unsigned num_batches,
+    unsigned num_nodes){
+    
+    const size_t size = (num_batches * (sizeof(void*) + sizeof(struct QED_Batch))) +
+        (num_nodes * sizeof(void*));
+    struct QED_Batch **const batches = malloc(size + 1);
+    
+    QED_STATS_ALLOC(size + 1);
+    
+    if(batches != NULL){
+        struct QED_Batch *const structs = (struct QED_Batch*)(batches + num_batches);
+        unsigned i;
+        for(i = 0; i < num_batches; i++)
+            batches[i] = structs + i;
+        if(num_batches != 0)
+            structs[0].dependencies = (struct QED_Dependency**)(structs + num_batches);
+    }
+    return batches;
+}
+
+static bool qed_calculate_batches_iterate(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **deps,
+    unsigned num_deps,
+    unsigned max_batch_size){
+    
+    unsigned num_nodes, num_batches = 0, i;
+    struct QED_Batch **batches, **packed = NULL;
+    bool ok;
+    
+    struct QED_HashTable *const satisfied = calloc(1, QED_HASH_TABLE_SIZE);
+    
+    out_batches[0] = NULL;
+    out_num_batches[0] = 0;
+    if(satisfied == NULL)
+        return false;
+    
+    /* Add all deps with dependencies to the table. */
+    QED_STATS_TIME(closure_ns,
+        num_nodes = qed_add_depencies(satisfied, deps, num_deps));
+    
+    if(max_batch_size == 0)
+        max_batch_size = num_nodes;
+    
+    batches = malloc((num_nodes + 1) * sizeof(void*));
+    ok = (batches != NULL) && QED_CalculateBatchesGreedy(batches, &num_batches,
+        satisfied, deps, num_nodes, max_batch_size);
+    
+    QED_FreeHashTable(satisfied, NULL);
+    free(satisfied);
+    
+    /* Pack the result so that it can be freed with QED_FreeBatches. */
+    if(ok && (packed = qed_allocate_batches(num_batches, num_nodes)) != NULL){
+        struct QED_Dependency **dest =
+            (num_batches == 0) ? NULL : packed[0]->dependencies;
+        for(i = 0; i < num_batches; i++){
+            const unsigned num = batches[i]->num_dependencies;
+            packed[i]->num_dependencies = num;
+            packed[i]->dependencies = dest;
+            memcpy(dest, batches[i]->dependencies, num * sizeof(void*));
+            dest += num;
+        }
+    }
+    if(ok){
+        for(i = 0; i < num_batches; i++){
+            free(batches[i]->dependencies);
+            free(batches[i]);
+        }
+    }
+    free(batches);
+    
+    ok = (packed != NULL);
+    out_batches[0] = packed;
+    out_num_batches[0] = ok ? num_batches : 0;
+    return ok;
+}
+
+/* Converts a schedule in index form into the QED_Batch form. */
+static struct QED_Batch **qed_create_batches(const struct QED_Graph *graph,
+    const unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches){
+    
+    struct QED_Batch **const batches =
+        qed_allocate_batches(num_batches, offsets[num_batches]);
+    unsigned i;
+    
+    if(batches == NULL || num_batches == 0)
+        return batches;
+    
+    {
+        struct QED_Dependency **const dest = batches[0]->dependencies;
+        for(i = 0; i < offsets[num_batches]; i++)
+            dest[i] = graph->nodes[order[i]];
+        for(i = 0; i < num_batches; i++){
+            batches[i]->num_dependencies = offsets[i + 1] - offsets[i];
+            batches[i]->dependencies = dest + offsets[i];
+        }
+    }
+    
+    return batches;
+}
+
+void QED_FreeBatches(struct QED_Batch **batches){
+    free(batches);
+}
+
+void QED_InitBatchOptions(struct QED_BatchOptions *options){
+    memset(options, 0, sizeof(struct QED_BatchOptions));
+    options->algorithm = QED_eGreedy;
 }
 
 bool QED_CalculateBatches(struct QED_Batch ***out_batches,
@@ -38,36 +167,286 @@ bool QED_CalculateBatches(struct QED_Batch ***out_batches,
     unsigned max_batch_size,
     enum QED_BatchAlgorithm algorithm){
     
-    unsigned num_satisfied = 0, num_prev_satisfied = 0, num_batches = 0;
-    struct QED_Batch **batches = malloc(num_deps * sizeof(void*));
+    struct QED_BatchOptions options;
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = max_batch_size;
+    options.algorithm = algorithm;
+    return QED_CalculateBatchesWithOptions(out_batches, out_num_batches,
+        deps, num_deps, &options);
+}
+
+static bool qed_calculate_batches_with_options(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **deps,
+    unsigned num_deps,
+    const struct QED_BatchOptions *options){
+    
+    struct QED_Graph graph;
+    bool ok;
     
-    struct QED_HashTable *const satisfied = calloc(1, QED_HASH_TABLE_SIZE);
+    if(options->algorithm == QED_eGreedyIterate){
+        return qed_calculate_batches_iterate(out_batches, out_num_batches,
+            deps, num_deps, options->max_batch_size);
+    }
     
-    /* Add all deps with dependencies to the table. */
-    qed_add_depencies(satisfied, deps, num_deps);
+    QED_STATS_TIME(closure_ns, ok = QED_CompileGraph(&graph, deps, num_deps));
+    if(!ok){
+        out_batches[0] = NULL;
+        out_num_batches[0] = 0;
+        return false;
+    }
     
-    switch(algorithm){
-        case QED_eLookahead: /* FALLTHROUGH until implemented. */
-        case QED_eBalanced:  /* FALLTHROUGH until implemented. */
-        case QED_eGreedy:
+    if(options->reduce && !QED_ReduceGraph(&graph, options->stats, NULL)){
+        QED_FreeGraph(&graph);
+        out_batches[0] = NULL;
+        out_num_batches[0] = 0;
+        return false;
+    }
+    
+    ok = QED_CalculateBatchesFromGraph(out_batches, out_num_batches, &graph,
+        options);
+    QED_FreeGraph(&graph);
+    return ok;
+}
+
+bool QED_CalculateBatchesWithOptions(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **deps,
+    unsigned num_deps,
+    const struct QED_BatchOptions *options){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_calculate_batches_with_options(out_batches, out_num_batches,
+            deps, num_deps, options));
+}
+
+static bool qed_calculate_batches_from_graph(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options){
+    
+    const unsigned *order, *offsets;
+    unsigned num_batches;
+    
+    if(options->algorithm == QED_eGreedyIterate){
+        return qed_calculate_batches_iterate(out_batches, out_num_batches,
+            graph->nodes, graph->num_nodes, options->max_batch_size);
+    }
+    
+    if(!QED_ScheduleGraph(graph, options, &order, &offsets, &num_batches)){
+        out_batches[0] = NULL;
+        out_num_batches[0] = 0;
+        return false;
+    }
+    
+    QED_STATS_TIME(output_ns, out_batches[0] =
+        qed_create_batches(graph, order, offsets, num_batches));
+    if(out_batches[0] == NULL){
+        out_num_batches[0] = 0;
+        return false;
+    }
+    out_num_batches[0] = num_batches;
+    return true;
+}
+
+bool QED_CalculateBatchesFromGraph(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_calculate_batches_from_graph(out_batches, out_num_batches, graph,
+            options));
+}
+
+/* Runs the scheduler for the algorithm in the options. */
+static bool qed_run_scheduler(const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    const unsigned max_batch_size = options->max_batch_size;
+    const struct QED_ResourceLimits *const resources = options->resources;
+    
+    switch(options->algorithm){
+        case QED_eLookahead:
+            return QED_ScheduleLookahead(graph, max_batch_size, resources, scratch,
+                out_order, out_offsets, out_num_batches);
+        case QED_eBalanced:
+        {
+            struct QED_BatchBudget default_budget, *budget = options->budget;
+            if(budget == NULL){
+                memset(&default_budget, 0, sizeof(struct QED_BatchBudget));
+                default_budget.max_operations = QED_DEFAULT_BUDGET_OPERATIONS;
+                default_budget.window = QED_DEFAULT_BUDGET_WINDOW;
+                budget = &default_budget;
+            }
+            return QED_ScheduleBalanced(graph, max_batch_size, resources, budget,
+                scratch, out_order, out_offsets, out_num_batches);
+        }
+        case QED_ePacked:
         {
-            if(!QED_CalculateBatchesGreedy(batches, &num_batches, satisfied,
-                deps, num_deps, max_batch_size))
-                goto batch_error;
+            /* Profiled costs go first, so the packed scratch stays aligned. */
+            unsigned long *costs = NULL;
+            if(options->profile != NULL){
+                costs = (unsigned long*)scratch;
+                scratch += QED_PROFILE_COSTS_SCRATCH(graph->num_nodes);
+                QED_ProfileCosts(options->profile, graph, costs);
+            }
+            return QED_SchedulePacked(graph, max_batch_size, resources,
+                options->max_batch_cost, options->num_workers, costs, scratch,
+                out_order, out_offsets, out_num_batches);
         }
+        case QED_eGreedy:
+        default:
+            if(options->pool != NULL){
+                return QED_ScheduleGreedyParallel(options->pool, graph,
+                    max_batch_size, resources, scratch, out_order, out_offsets,
+                    out_num_batches);
+            }
+            return QED_ScheduleGreedy(graph, max_batch_size, resources, scratch,
+                out_order, out_offsets, out_num_batches);
     }
+}
+
+static bool qed_schedule_graph(struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    const unsigned **out_order,
+    const unsigned **out_offsets,
+    unsigned *out_num_batches){
     
-    out_batches[0] = batches;
-    QED_FreeHashTable(satisfied, NULL);
-    free(satisfied);
-    out_num_batches[0] = num_batches;
+    const unsigned num_nodes = graph->num_nodes;
+    const unsigned long stride = (unsigned long)num_nodes + 1;
+    unsigned long scratch_size;
+    unsigned long long fingerprint;
+    unsigned *scratch, *order, *offsets;
+    bool ok;
+    
+    switch(options->algorithm){
+        case QED_eLookahead:
+            scratch_size = QED_LOOKAHEAD_SCRATCH(num_nodes);
+            break;
+        case QED_eBalanced:
+            scratch_size = QED_BALANCED_SCRATCH(num_nodes);
+            break;
+        case QED_ePacked:
+            scratch_size = QED_PACKED_SCRATCH(num_nodes, options->num_workers) +
+                QED_PROFILE_COSTS_SCRATCH(num_nodes);
+            break;
+        default:
+            scratch_size = (options->pool != NULL) ?
+                QED_GREEDY_PARALLEL_SCRATCH(num_nodes,
+                    QED_ThreadPoolSize(options->pool)) :
+                QED_GREEDY_SCRATCH(num_nodes);
+    }
+    if(options->locality && scratch_size < QED_LOCALITY_SCRATCH(num_nodes))
+        scratch_size = QED_LOCALITY_SCRATCH(num_nodes);
+    
+    /* The order and offsets go at the start of the scratch memory, followed by
+     * the scratch memory for the scheduler. */
+    if((order = QED_GraphScratch(graph, (stride * 2) + scratch_size)) == NULL)
+        return false;
+    offsets = order + stride;
+    scratch = offsets + stride;
+    
+    fingerprint = (options->cache == NULL) ? 0 :
+        QED_ScheduleFingerprint(graph, options);
+    if(fingerprint == 0 || !QED_ScheduleCacheFind(options->cache, fingerprint,
+        graph, options, order, offsets, out_num_batches)){
+        
+        QED_STATS_TIME(schedule_ns, ok = qed_run_scheduler(graph, options,
+            scratch, order, offsets, out_num_batches));
+        if(!ok)
+            return false;
+        
+        /* Failing to store the schedule does not matter to this call. */
+        if(fingerprint != 0){
+            QED_ScheduleCacheAdd(options->cache, fingerprint, graph, options,
+                order, offsets, out_num_batches[0]);
+        }
+    }
+    
+    /* The cache only knows the shape of the graph, and the order also depends
+     * on the user data, so it is found after every lookup. */
+    if(options->locality){
+        QED_STATS_TIME(schedule_ns, ok = QED_OrderForLocality(graph, order,
+            offsets, out_num_batches[0], scratch));
+        if(!ok)
+            return false;
+    }
+    
+    out_order[0] = order;
+    out_offsets[0] = offsets;
     return true;
+}
 
-batch_error:
+bool QED_ScheduleGraph(struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    const unsigned **out_order,
+    const unsigned **out_offsets,
+    unsigned *out_num_batches){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_schedule_graph(graph, options, out_order, out_offsets,
+            out_num_batches));
+}
 
-    out_batches[0] = NULL;
-    QED_FreeHashTable(satisfied, NULL);
-    free(satisfied);
-    out_num_batches[0] = 0;
-    return false;
+void QED_InitSchedule(struct QED_Schedule *schedule,
+    void *buffer,
+    size_t buffer_size){
+    
+    memset(schedule, 0, sizeof(struct QED_Schedule));
+    schedule->buffer = buffer;
+    schedule->buffer_size = (buffer == NULL) ? 0 : buffer_size;
+}
+
+static bool qed_calculate_schedule(struct QED_Schedule *schedule,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options){
+    
+    const unsigned *order, *offsets;
+    unsigned num_batches, num_nodes, i;
+    size_t size;
+    
+    schedule->num_batches = schedule->num_nodes = 0;
+    
+    if(!QED_ScheduleGraph(graph, options, &order, &offsets, &num_batches))
+        return false;
+    
+    /* The pointers go first so they are aligned. */
+    num_nodes = offsets[num_batches];
+    size = (num_nodes * sizeof(void*)) + ((num_batches + 1) * sizeof(unsigned));
+    if(schedule->buffer_size < size){
+        void *const buffer = malloc(size);
+        QED_STATS_ALLOC(size);
+        if(buffer == NULL)
+            return false;
+        if(schedule->owns_buffer)
+            free(schedule->buffer);
+        schedule->buffer = buffer;
+        schedule->buffer_size = size;
+        schedule->owns_buffer = true;
+    }
+    
+    schedule->nodes = schedule->buffer;
+    schedule->offsets = (unsigned*)(schedule->nodes + num_nodes);
+    for(i = 0; i < num_nodes; i++)
+        schedule->nodes[i] = graph->nodes[order[i]];
+    memcpy(schedule->offsets, offsets, (num_batches + 1) * sizeof(unsigned));
+    
+    schedule->num_batches = num_batches;
+    schedule->num_nodes = num_nodes;
+    return true;
+}
+
+bool QED_CalculateSchedule(struct QED_Schedule *schedule,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_calculate_schedule(schedule, graph, options));
+}
+
+void QED_FreeSchedule(struct QED_Schedule *schedule){
+    if(schedule->owns_buffer)
+        free(schedule->buffer);
+    QED_InitSchedule(schedule, NULL, 0);
 }
@@ -11,8 +11,15 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct QED_Dependency;
+struct QED_Graph;
+struct QED_Profile;
+struct QED_ResourceLimits;
+struct QED_ScheduleCache;
+struct QED_Stats;
+struct QED_ThreadPool;
 
 struct QED_Batch{
     unsigned num_dependencies;
@@ -24,10 +31,113 @@ enum QED_BatchAlgorithm {
      * dependencies) are chosen for each batch. Mostly for testing.
      */
     QED_eGreedy,
-    QED_eLookahead, /**< The entire most efficient tree is calculated. */
-    QED_eBalanced /**< A heuristic is applied to limit computation. */
+    /** When there are more ready deps than fit in a batch, the deps with the
+     * longest chain of dependents are chosen first.
+     */
+    QED_eLookahead,
+    /** Like QED_eLookahead, but the amount of work spent ranking deps is
+     * limited by a QED_BatchBudget. Once it runs out the rest is greedy.
+     */
+    QED_eBalanced,
+    /** Greedy batches calculated by the original algorithm, which iterates
+     * the entire graph once per batch. For comparison only. These are the
+     * same batches as QED_eGreedy as long as no batch is cut short by
+     * max_batch_size; when one is, the two may pick different deps for it.
+     */
+    QED_eGreedyIterate,
+    /** Like QED_eLookahead, but ranks are weighted by the cost of each dep,
+     * and batches are packed against max_batch_cost and num_workers.
+     */
+    QED_ePacked
+};
+
+/* Limits the extra work that QED_eBalanced can do over QED_eGreedy. */
+struct QED_BatchBudget{
+    /** Number of edge visits and queue operations allowed. Zero is unlimited.
+     */
+    unsigned long max_operations;
+    /** Microseconds the scheduler may run before it stops ranking deps. Zero
+     * is unlimited.
+     */
+    unsigned long max_microseconds;
+    /** Once a dependent of a dep is found with a chain of at least this many
+     * deps below it, the dep's other dependents are not searched when ranking
+     * it. This limits how wide the search goes, not how deep. Zero is
+     * unlimited.
+     */
+    unsigned window;
+    
+    /* These are set by the scheduler. */
+    unsigned long used_operations;
+    unsigned long used_microseconds; /**< Total time spent scheduling. */
+    bool exhausted; /**< True if the scheduler fell back to greedy. */
+};
+
+/* The budget used when QED_eBalanced is requested without one. */
+#define QED_DEFAULT_BUDGET_OPERATIONS (1ul << 20)
+#define QED_DEFAULT_BUDGET_WINDOW 16
+
+struct QED_BatchOptions{
+    /** Maximum number of deps in each batch. Zero is unlimited. */
+    unsigned max_batch_size;
+    enum QED_BatchAlgorithm algorithm;
+    /** Used by QED_eBalanced. May be NULL to use the defaults. */
+    struct QED_BatchBudget *budget;
+    /** Used by QED_ePacked. Maximum total cost of the deps in each batch.
+     * Zero is unlimited.
+     */
+    unsigned long max_batch_cost;
+    /** Used by QED_ePacked. If not zero, batches are packed so that they
+     * would take no longer on this many workers than their longest dep.
+     */
+    unsigned num_workers;
+    /** Used by QED_ePacked. If not NULL, the measured run times of profiled
+     * deps are used as their costs. See qed_profile.h.
+     */
+    const struct QED_Profile *profile;
+    /** If not NULL, no batch has more deps of a resource class than its limit.
+     * Deps that do not fit wait for a later batch while other ready deps take
+     * their place. Ignored by QED_eGreedyIterate. See qed_resource.h.
+     */
+    const struct QED_ResourceLimits *resources;
+    /** If not NULL, scheduling counters are added to this. See qed_stats.h.
+     */
+    struct QED_Stats *stats;
+    /** If not NULL, schedules are looked up here by the shape of the graph
+     * before scheduling, and stored after. See qed_cache.h.
+     */
+    struct QED_ScheduleCache *cache;
+    /** If not NULL, QED_eGreedy schedules are computed by the workers of this
+     * pool, with the same result. See QED_ScheduleGreedyParallel.
+     */
+    struct QED_ThreadPool *pool;
+    /** If true, the deps in each batch are ordered so that deps which share
+     * an input are next to each other. Ignored by QED_eGreedyIterate. See
+     * QED_OrderForLocality.
+     */
+    bool locality;
+    /** If true, edges that are implied by other edges are removed from the
+     * graph before it is scheduled. Only used when the graph is compiled from
+     * deps, since this changes the graph. See QED_ReduceGraph.
+     */
+    bool reduce;
 };
 
+void QED_InitBatchOptions(struct QED_BatchOptions *options);
+
+bool QED_CalculateBatchesWithOptions(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **deps,
+    unsigned num_deps,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Calculates batches for a set of dependencies.
+ *
+ * Every dependency reachable from deps is scheduled. The batches, and the
+ * dependency arrays of all of the batches, are a single allocation which must
+ * be freed with QED_FreeBatches.
+ */
 bool QED_CalculateBatches(struct QED_Batch ***out_batches,
     unsigned *out_num_batches,
     struct QED_Dependency **deps,
@@ -35,4 +145,87 @@ bool QED_CalculateBatches(struct QED_Batch ***out_batches,
     unsigned max_batch_size,
     enum QED_BatchAlgorithm algorithm);
 
+/**
+ * @brief Frees the output of any of the QED_CalculateBatches functions.
+ */
+void QED_FreeBatches(struct QED_Batch **batches);
+
+/**
+ * @brief Calculates batches for a graph from QED_CompileGraph.
+ *
+ * This skips walking and hashing the dependencies, so it is much cheaper than
+ * QED_CalculateBatches when the same graph is scheduled repeatedly. Apart from
+ * the output, the only allocation is the graph's scratch memory on first use.
+ */
+bool QED_CalculateBatchesFromGraph(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Schedules a graph, giving the result as node indices.
+ *
+ * Batch i consists of the nodes order[offsets[i]] to order[offsets[i+1]-1].
+ * Both arrays are in the graph's scratch memory, so they are only valid until
+ * the graph is scheduled again or freed.
+ *
+ * QED_eGreedyIterate gives the same batches as QED_eGreedy here.
+ */
+bool QED_ScheduleGraph(struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    const unsigned **out_order,
+    const unsigned **out_offsets,
+    unsigned *out_num_batches);
+
+/* A schedule stored as one flat array of deps, split into batches by offsets.
+ *
+ * Batch i is nodes[offsets[i]] to nodes[offsets[i+1]-1]. Both arrays live in a
+ * single buffer, which may be supplied by the caller so that repeated
+ * scheduling does not allocate at all.
+ */
+struct QED_Schedule{
+    unsigned num_batches;
+    unsigned num_nodes;
+    struct QED_Dependency **nodes; /* num_nodes entries. */
+    unsigned *offsets; /* num_batches + 1 entries. */
+    
+    void *buffer;
+    size_t buffer_size;
+    bool owns_buffer;
+};
+
+/* Buffer size that is always enough to hold a schedule of num_nodes deps. */
+#define QED_SCHEDULE_BUFFER_SIZE(NUM_NODES) \
+    (((size_t)(NUM_NODES) * sizeof(void*)) + \
+    (((size_t)(NUM_NODES) + 1) * sizeof(unsigned)))
+
+/**
+ * @brief Initializes an empty schedule.
+ *
+ * @param buffer Memory to store the schedule in, which must be suitably
+ *   aligned for pointers. May be NULL, in which case the memory is allocated
+ *   as needed and kept until QED_FreeSchedule.
+ */
+void QED_InitSchedule(struct QED_Schedule *schedule,
+    void *buffer,
+    size_t buffer_size);
+
+/**
+ * @brief Schedules a graph into a QED_Schedule.
+ *
+ * Any previous contents of the schedule are replaced. The buffer is reused if
+ * it is large enough, otherwise a new one is allocated and owned by the
+ * schedule.
+ *
+ * @return false if an allocation failed.
+ */
+bool QED_CalculateSchedule(struct QED_Schedule *schedule,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Frees the schedule's buffer if it was allocated by libqed.
+ */
+void QED_FreeSchedule(struct QED_Schedule *schedule);
+
 #endif /* LIBQED_BATCH_H */
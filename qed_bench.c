@@ -0,0 +1,1505 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_batch.h"
+#include "qed_binary.h"
+#include "qed_builder.h"
+#include "qed_cache.h"
+#include "qed_dependency.h"
+#include "qed_execute.h"
+#include "qed_graph.h"
+#include "qed_greedy.h"
+#include "qed_incremental.h"
+#include "qed_multi.h"
+#include "qed_packed.h"
+#include "qed_pool.h"
+#include "qed_reduce.h"
+#include "qed_tinyhash.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* When linked with -Wl,--wrap=malloc and friends, every allocation made by
+ * libqed and the bench is counted. */
+#ifdef QED_BENCH_WRAP_MALLOC
+
+#include <stdatomic.h>
+
+static atomic_ulong qed_bench_allocations, qed_bench_allocated;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size){
+    atomic_fetch_add_explicit(&qed_bench_allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&qed_bench_allocated, size, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size){
+    atomic_fetch_add_explicit(&qed_bench_allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&qed_bench_allocated, count * size,
+        memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+    atomic_fetch_add_explicit(&qed_bench_allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&qed_bench_allocated, size, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+#define QED_BENCH_ALLOCATIONS() atomic_load(&qed_bench_allocations)
+#define QED_BENCH_ALLOCATED() atomic_load(&qed_bench_allocated)
+
+#else
+
+#define QED_BENCH_ALLOCATIONS() 0ul
+#define QED_BENCH_ALLOCATED() 0ul
+
+#endif
+
+static double qed_bench_now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + ((double)t.tv_nsec / 1e9);
+}
+
+static uint32_t qed_bench_random(uint32_t *state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return (*state = x);
+}
+
+/* Keys look like heap pointers to 48-byte structs, which is about what a
+ * QED_Dependency costs with malloc overhead. */
+#define QED_BENCH_KEY(I) ((qed_hashkey_t)0x7F0000001000ull + ((qed_hashkey_t)(I) * 48))
+
+#define QED_BENCH_LOOKUPS 2000000
+
+static int qed_bench_hash(void){
+    static const unsigned sizes[] = {
+        1000, 10000, 100000, 1000000, 10000000
+    };
+    unsigned s;
+    
+    printf("%10s %14s %14s %14s\n", "keys", "insert ns/key", "hit ns/get",
+        "miss ns/get");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+        double start, insert_time, hit_time, miss_time;
+        uint32_t state = 0x9E3779B9u;
+        qed_hashdata_t sum = 0, unused;
+        unsigned i;
+        
+        start = qed_bench_now();
+        for(i = 0; i < n; i++)
+            QED_HashTableInsert(table, QED_BENCH_KEY(i), i, &unused);
+        insert_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        for(i = 0; i < QED_BENCH_LOOKUPS; i++){
+            qed_hashdata_t data = 0;
+            QED_HashTableGet(table,
+                QED_BENCH_KEY(qed_bench_random(&state) % n), &data);
+            sum += data;
+        }
+        hit_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        for(i = 0; i < QED_BENCH_LOOKUPS; i++){
+            qed_hashdata_t data = 0;
+            QED_HashTableGet(table,
+                QED_BENCH_KEY(n + (qed_bench_random(&state) % n)), &data);
+            sum += data;
+        }
+        miss_time = qed_bench_now() - start;
+        
+        printf("%10u %14.1f %14.1f %14.1f\n", n,
+            insert_time * 1e9 / n,
+            hit_time * 1e9 / QED_BENCH_LOOKUPS,
+            miss_time * 1e9 / QED_BENCH_LOOKUPS);
+        
+        /* Keep the lookups from being optimized out. */
+        if(sum == 1)
+            putchar(' ');
+        
+        QED_FreeHashTable(table, NULL);
+        free(table);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Every node depends on up to four random earlier nodes in a window, which
+ * gives a graph that is both deep and wide. */
+static struct QED_Dependency *qed_bench_random_graph(unsigned num_nodes,
+    struct QED_Dependency ***out_ptrs){
+    
+    struct QED_Dependency *const deps =
+        calloc(num_nodes, sizeof(struct QED_Dependency));
+    struct QED_Dependency **const ptrs = malloc(num_nodes * sizeof(void*));
+    uint32_t state = 0x2545F491u;
+    unsigned i;
+    
+    for(i = 0; i < num_nodes; i++){
+        const unsigned window = (i < 256) ? i : 256;
+        unsigned e;
+        ptrs[i] = deps + i;
+        deps[i].num_dependencies = (i == 0) ? 0 : (qed_bench_random(&state) % 5);
+        deps[i].dependencies = malloc(4 * sizeof(void*));
+        for(e = 0; e < deps[i].num_dependencies; e++)
+            deps[i].dependencies[e] =
+                deps + i - 1 - (qed_bench_random(&state) % window);
+    }
+    out_ptrs[0] = ptrs;
+    return deps;
+}
+
+static void qed_bench_free_graph(struct QED_Dependency *deps,
+    struct QED_Dependency **ptrs,
+    unsigned num_nodes){
+    unsigned i;
+    for(i = 0; i < num_nodes; i++)
+        free(deps[i].dependencies);
+    free(deps);
+    free(ptrs);
+}
+
+/* Compares the linear greedy scheduler against the original one which
+ * iterates the whole graph for every batch. */
+static int qed_bench_greedy(void){
+    static const unsigned sizes[] = { 1000, 10000, 100000 };
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy, QED_eGreedyIterate
+    };
+    static const char *const names[] = { "greedy", "iterate" };
+    unsigned s;
+    
+    printf("%10s %10s %10s %14s\n", "nodes", "algorithm", "batches", "ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        unsigned a;
+        
+        for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            double start = qed_bench_now(), time;
+            
+            if(!QED_CalculateBatches(&batches, &num_batches, ptrs, n, 64,
+                algorithms[a]))
+                return EXIT_FAILURE;
+            time = qed_bench_now() - start;
+            printf("%10u %10s %10u %14.3f\n", n, names[a], num_batches,
+                time * 1e3);
+            QED_FreeBatches(batches);
+        }
+        
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Compares the number of batches the critical path ranking saves. */
+static int qed_bench_lookahead(void){
+    static const unsigned sizes[] = { 10000, 100000, 500000 };
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy, QED_eLookahead
+    };
+    static const char *const names[] = { "greedy", "lookahead" };
+    unsigned s;
+    
+    printf("%10s %10s %10s %14s\n", "nodes", "algorithm", "batches", "ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        unsigned a;
+        
+        for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            double start = qed_bench_now(), time;
+            
+            if(!QED_CalculateBatches(&batches, &num_batches, ptrs, n, 16,
+                algorithms[a]))
+                return EXIT_FAILURE;
+            time = qed_bench_now() - start;
+            printf("%10u %10s %10u %14.3f\n", n, names[a], num_batches,
+                time * 1e3);
+            QED_FreeBatches(batches);
+        }
+        
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Compares compiling the graph on every call against compiling it once. */
+static int qed_bench_compiled(void){
+    static const unsigned sizes[] = { 10000, 100000, 1000000 };
+    unsigned s;
+    
+    printf("%10s %14s %14s %14s\n", "nodes", "compile ms", "each call ms",
+        "compiled ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s], repeats = 10;
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        struct QED_BatchOptions options;
+        struct QED_Graph graph;
+        double start, compile_time, direct_time, compiled_time;
+        unsigned r;
+        
+        QED_InitBatchOptions(&options);
+        options.max_batch_size = 64;
+        
+        start = qed_bench_now();
+        if(!QED_CompileGraph(&graph, ptrs, n))
+            return EXIT_FAILURE;
+        compile_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        for(r = 0; r < repeats; r++){
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            QED_CalculateBatchesWithOptions(&batches, &num_batches, ptrs, n,
+                &options);
+            QED_FreeBatches(batches);
+        }
+        direct_time = (qed_bench_now() - start) / repeats;
+        
+        start = qed_bench_now();
+        for(r = 0; r < repeats; r++){
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            QED_CalculateBatchesFromGraph(&batches, &num_batches, &graph,
+                &options);
+            QED_FreeBatches(batches);
+        }
+        compiled_time = (qed_bench_now() - start) / repeats;
+        
+        printf("%10u %14.3f %14.3f %14.3f\n", n, compile_time * 1e3,
+            direct_time * 1e3, compiled_time * 1e3);
+        
+        QED_FreeGraph(&graph);
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Shows how the number of batches improves as the budget grows. */
+static int qed_bench_balanced(void){
+    static const unsigned long budgets[] = {
+        1, 1000, 10000, 100000, 1000000, 0
+    };
+    const unsigned n = 200000;
+    struct QED_Dependency **ptrs;
+    struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+    struct QED_BatchOptions options;
+    unsigned b;
+    
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 16;
+    options.algorithm = QED_eBalanced;
+    
+    printf("%10s %12s %12s %10s %10s\n", "nodes", "budget", "used ops",
+        "used us", "batches");
+    
+    for(b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++){
+        struct QED_BatchBudget budget;
+        struct QED_Batch **batches;
+        unsigned num_batches;
+        
+        memset(&budget, 0, sizeof(budget));
+        budget.max_operations = budgets[b];
+        budget.window = QED_DEFAULT_BUDGET_WINDOW;
+        options.budget = &budget;
+        
+        if(!QED_CalculateBatchesWithOptions(&batches, &num_batches, ptrs, n,
+            &options))
+            return EXIT_FAILURE;
+        printf("%10u %12lu %12lu %10lu %10u\n", n, budgets[b],
+            budget.used_operations, budget.used_microseconds, num_batches);
+        QED_FreeBatches(batches);
+    }
+    
+    qed_bench_free_graph(deps, ptrs, n);
+    return EXIT_SUCCESS;
+}
+
+/* The time a batch takes on num_workers workers, assigning the most costly
+ * deps first to whichever worker is least loaded. */
+static unsigned long long qed_bench_batch_makespan(const struct QED_Batch *batch,
+    unsigned num_workers){
+    
+    unsigned long long loads[64] = { 0 }, makespan = 0;
+    unsigned long *const costs = malloc(batch->num_dependencies * sizeof(unsigned long));
+    unsigned i, e;
+    
+    for(i = 0; i < batch->num_dependencies; i++)
+        costs[i] = QED_DependencyCost(batch->dependencies[i]);
+    
+    /* Batches are small, so a selection sort is fine. */
+    for(i = 0; i < batch->num_dependencies; i++){
+        unsigned best = i, worker = 0;
+        unsigned long cost;
+        for(e = i + 1; e < batch->num_dependencies; e++){
+            if(costs[e] > costs[best])
+                best = e;
+        }
+        cost = costs[best];
+        costs[best] = costs[i];
+        costs[i] = cost;
+        
+        for(e = 1; e < num_workers; e++){
+            if(loads[e] < loads[worker])
+                worker = e;
+        }
+        loads[worker] += cost;
+        if(loads[worker] > makespan)
+            makespan = loads[worker];
+    }
+    
+    free(costs);
+    return makespan;
+}
+
+/* Compares count-limited batches against cost-packed batches on a graph where
+ * one dep in sixteen costs a thousand times more than the rest. */
+static int qed_bench_packed(void){
+    static const unsigned sizes[] = { 10000, 100000 };
+    static const unsigned workers[] = { 4, 16, 64 };
+    unsigned s, w;
+    
+    printf("%10s %8s %10s %10s %14s %12s\n", "nodes", "workers", "algorithm",
+        "batches", "makespan", "ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        uint32_t state = 0xB5297A4Du;
+        unsigned i;
+        
+        for(i = 0; i < n; i++)
+            deps[i].cost = (qed_bench_random(&state) % 16 == 0) ? 2000 : 2;
+        
+        for(w = 0; w < sizeof(workers) / sizeof(workers[0]); w++){
+            struct QED_BatchOptions options;
+            unsigned a;
+            
+            QED_InitBatchOptions(&options);
+            for(a = 0; a < 2; a++){
+                struct QED_Batch **batches;
+                unsigned num_batches, b;
+                unsigned long long makespan = 0;
+                double start, time;
+                
+                if(a == 0){
+                    options.algorithm = QED_eLookahead;
+                    options.max_batch_size = workers[w];
+                }
+                else{
+                    options.algorithm = QED_ePacked;
+                    options.max_batch_size = 0;
+                    options.num_workers = workers[w];
+                }
+                
+                start = qed_bench_now();
+                if(!QED_CalculateBatchesWithOptions(&batches, &num_batches,
+                    ptrs, n, &options))
+                    return EXIT_FAILURE;
+                time = qed_bench_now() - start;
+                
+                for(b = 0; b < num_batches; b++)
+                    makespan += qed_bench_batch_makespan(batches[b], workers[w]);
+                
+                printf("%10u %8u %10s %10u %14llu %12.3f\n", n, workers[w],
+                    (a == 0) ? "lookahead" : "packed", num_batches, makespan,
+                    time * 1e3);
+                QED_FreeBatches(batches);
+            }
+        }
+        
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Spins for the number of microseconds in user_data. */
+static int qed_bench_spin(void *action_data, void *user_data){
+    const double end = qed_bench_now() + ((double)(uintptr_t)user_data / 1e6);
+    (void)action_data;
+    while(qed_bench_now() < end){}
+    return 0;
+}
+
+/* A layered graph of lanes, where each node depends on the previous node in
+ * its lane and on a random node of the previous layer. Most nodes take 50us,
+ * but one in sixteen takes 1ms. */
+static struct QED_Dependency *qed_bench_skewed_graph(unsigned num_lanes,
+    unsigned num_layers,
+    double *out_total_work){
+    
+    const unsigned n = num_lanes * num_layers;
+    struct QED_Dependency *const deps = calloc(n, sizeof(struct QED_Dependency));
+    uint32_t state = 0x1234567u;
+    double total_work = 0.0;
+    unsigned i;
+    
+    for(i = 0; i < n; i++){
+        const uintptr_t us = (qed_bench_random(&state) % 16 == 0) ? 1000 : 50;
+        deps[i].execute.func = qed_bench_spin;
+        deps[i].execute.user_data = (void*)us;
+        total_work += (double)us / 1e6;
+        deps[i].dependencies = malloc(2 * sizeof(void*));
+        if(i >= num_lanes){
+            deps[i].num_dependencies = 2;
+            deps[i].dependencies[0] = deps + i - num_lanes;
+            deps[i].dependencies[1] = deps + i - num_lanes -
+                (i % num_lanes) + (qed_bench_random(&state) % num_lanes);
+        }
+    }
+    out_total_work[0] = total_work;
+    return deps;
+}
+
+/* Compares batch-synchronous execution against dataflow execution on a graph
+ * where a few slow nodes hold up every batch they are in. */
+static int qed_bench_executor(void){
+    const unsigned num_lanes = 32, num_layers = 64, n = num_lanes * num_layers;
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(0);
+    const unsigned num_threads = QED_ThreadPoolSize(pool);
+    double total_work, start, batch_time, graph_time;
+    struct QED_Dependency *const deps =
+        qed_bench_skewed_graph(num_lanes, num_layers, &total_work);
+    struct QED_Dependency **const ptrs = malloc(n * sizeof(void*));
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    struct QED_Graph graph;
+    
+    for(i = 0; i < n; i++)
+        ptrs[i] = deps + i;
+    
+    if(!QED_CalculateBatches(&batches, &num_batches, ptrs, n, 0, QED_eGreedy) ||
+        !QED_CompileGraph(&graph, ptrs, n))
+        return EXIT_FAILURE;
+    
+    start = qed_bench_now();
+    QED_ExecuteBatches(pool, batches, num_batches, NULL);
+    batch_time = qed_bench_now() - start;
+    
+    start = qed_bench_now();
+    QED_ExecuteGraph(pool, &graph, NULL);
+    graph_time = qed_bench_now() - start;
+    
+    printf("%10s %8s %10s %10s %12s\n", "executor", "threads", "work s",
+        "wall s", "utilization");
+    printf("%10s %8u %10.3f %10.3f %11.1f%%\n", "batches", num_threads,
+        total_work, batch_time, 100.0 * total_work / (batch_time * num_threads));
+    printf("%10s %8u %10.3f %10.3f %11.1f%%\n", "dataflow", num_threads,
+        total_work, graph_time, 100.0 * total_work / (graph_time * num_threads));
+    
+    QED_FreeBatches(batches);
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    qed_bench_free_graph(deps, ptrs, n);
+    return EXIT_SUCCESS;
+}
+
+/* Graphs for the suite keep all of their edges in one array, since some of
+ * them are too big to allocate an array per node. */
+struct qed_bench_graph{
+    unsigned num_nodes;
+    unsigned long num_edges;
+    struct QED_Dependency *deps;
+    struct QED_Dependency **ptrs;
+    struct QED_Dependency **edges;
+};
+
+static bool qed_bench_alloc_graph(struct qed_bench_graph *graph,
+    unsigned num_nodes,
+    unsigned long max_edges){
+    
+    unsigned i;
+    graph->num_nodes = num_nodes;
+    graph->num_edges = 0;
+    graph->deps = calloc(num_nodes, sizeof(struct QED_Dependency));
+    graph->ptrs = malloc(num_nodes * sizeof(void*));
+    graph->edges = malloc((max_edges + 1) * sizeof(void*));
+    if(graph->deps == NULL || graph->ptrs == NULL || graph->edges == NULL)
+        return false;
+    for(i = 0; i < num_nodes; i++)
+        graph->ptrs[i] = graph->deps + i;
+    return true;
+}
+
+/* Starts the dependencies of a node. Nodes must be started in order. */
+static void qed_bench_begin_node(struct qed_bench_graph *graph, unsigned i){
+    graph->deps[i].dependencies = graph->edges + graph->num_edges;
+    graph->deps[i].num_dependencies = 0;
+}
+
+static void qed_bench_add_edge(struct qed_bench_graph *graph,
+    unsigned from,
+    unsigned to){
+    graph->edges[graph->num_edges++] = graph->deps + to;
+    graph->deps[from].num_dependencies++;
+}
+
+/* Every node depends on the one before it. */
+static void qed_bench_gen_chain(struct qed_bench_graph *graph, uint32_t *state){
+    unsigned i;
+    (void)state;
+    for(i = 0; i < graph->num_nodes; i++){
+        qed_bench_begin_node(graph, i);
+        if(i != 0)
+            qed_bench_add_edge(graph, i, i - 1);
+    }
+}
+
+/* The last node depends on every other node. */
+static void qed_bench_gen_fanin(struct qed_bench_graph *graph, uint32_t *state){
+    const unsigned last = graph->num_nodes - 1;
+    unsigned i;
+    (void)state;
+    for(i = 0; i < last; i++)
+        qed_bench_begin_node(graph, i);
+    qed_bench_begin_node(graph, last);
+    for(i = 0; i < last; i++)
+        qed_bench_add_edge(graph, last, i);
+}
+
+/* Every node depends on the first node. */
+static void qed_bench_gen_fanout(struct qed_bench_graph *graph, uint32_t *state){
+    unsigned i;
+    (void)state;
+    for(i = 0; i < graph->num_nodes; i++){
+        qed_bench_begin_node(graph, i);
+        if(i != 0)
+            qed_bench_add_edge(graph, i, 0);
+    }
+}
+
+/* Layers of 100 nodes, where each node depends on three random nodes of the
+ * previous layer. */
+#define QED_BENCH_LAYER_WIDTH 100
+
+static void qed_bench_gen_layered(struct qed_bench_graph *graph, uint32_t *state){
+    unsigned i;
+    for(i = 0; i < graph->num_nodes; i++){
+        qed_bench_begin_node(graph, i);
+        if(i >= QED_BENCH_LAYER_WIDTH){
+            const unsigned layer = i - (i % QED_BENCH_LAYER_WIDTH) - QED_BENCH_LAYER_WIDTH;
+            unsigned e;
+            for(e = 0; e < 3; e++){
+                qed_bench_add_edge(graph, i,
+                    layer + (qed_bench_random(state) % QED_BENCH_LAYER_WIDTH));
+            }
+        }
+    }
+}
+
+/* Each node depends on zero to eight nodes chosen uniformly from all earlier
+ * nodes. This is the usual random DAG, an Erdos-Renyi graph with its edges
+ * pointed from the higher index to the lower. */
+static void qed_bench_gen_random(struct qed_bench_graph *graph, uint32_t *state){
+    unsigned i;
+    for(i = 0; i < graph->num_nodes; i++){
+        qed_bench_begin_node(graph, i);
+        if(i != 0){
+            unsigned e;
+            const unsigned num = qed_bench_random(state) % 9;
+            for(e = 0; e < num; e++)
+                qed_bench_add_edge(graph, i, qed_bench_random(state) % i);
+        }
+    }
+}
+
+/* Shaped like a build. One node in twenty is a header, which includes a
+ * couple of earlier headers. Most nodes are objects, which include up to
+ * eight headers, favouring the first ones like a common prefix header. One
+ * node in a hundred is a library of the objects since the last library, and
+ * one in a thousand is an executable linking a few libraries. */
+#define QED_BENCH_IS_LIBRARY(I, HEADERS) (((I) - (HEADERS)) % 100 == 99)
+#define QED_BENCH_IS_EXECUTABLE(I, HEADERS) (((I) - (HEADERS)) % 1000 == 500)
+
+static void qed_bench_gen_build(struct qed_bench_graph *graph, uint32_t *state){
+    const unsigned num_headers = (graph->num_nodes / 20) + 1;
+    unsigned i, last_library = num_headers, num_libraries = 0;
+    for(i = 0; i < graph->num_nodes; i++){
+        unsigned e;
+        qed_bench_begin_node(graph, i);
+        if(i < num_headers){
+            const unsigned num = (i == 0) ? 0 : (qed_bench_random(state) % 3);
+            for(e = 0; e < num; e++)
+                qed_bench_add_edge(graph, i, qed_bench_random(state) % i);
+        }
+        else if(QED_BENCH_IS_LIBRARY(i, num_headers)){
+            for(e = last_library; e < i; e++){
+                if(!QED_BENCH_IS_EXECUTABLE(e, num_headers))
+                    qed_bench_add_edge(graph, i, e);
+            }
+            last_library = i + 1;
+            num_libraries++;
+        }
+        else if(QED_BENCH_IS_EXECUTABLE(i, num_headers)){
+            const unsigned num = 1 + (qed_bench_random(state) % 4);
+            for(e = 0; e < num; e++){
+                const unsigned library = qed_bench_random(state) % num_libraries;
+                qed_bench_add_edge(graph, i, num_headers + (library * 100) + 99);
+            }
+        }
+        else{
+            const unsigned num = 1 + (qed_bench_random(state) % 8);
+            for(e = 0; e < num; e++){
+                /* Squaring a uniform value skews it towards zero. */
+                const uint64_t r = qed_bench_random(state) % num_headers;
+                qed_bench_add_edge(graph, i, (unsigned)((r * r) / num_headers));
+            }
+        }
+    }
+}
+
+struct qed_bench_generator{
+    const char *name;
+    void (*function)(struct qed_bench_graph *graph, uint32_t *state);
+    unsigned max_edges_per_node;
+};
+
+static const struct qed_bench_generator qed_bench_generators[] = {
+    {"chain", qed_bench_gen_chain, 1},
+    {"fanin", qed_bench_gen_fanin, 1},
+    {"fanout", qed_bench_gen_fanout, 1},
+    {"layered", qed_bench_gen_layered, 3},
+    {"random", qed_bench_gen_random, 8},
+    {"build", qed_bench_gen_build, 10}
+};
+
+#define QED_NUM_GENERATORS \
+    (sizeof(qed_bench_generators) / sizeof(qed_bench_generators[0]))
+
+static void qed_bench_free_suite_graph(struct qed_bench_graph *graph){
+    free(graph->deps);
+    free(graph->ptrs);
+    free(graph->edges);
+}
+
+/* Reads a field in kB from /proc/self/status, or returns zero. */
+static unsigned long qed_bench_proc_status(const char *field){
+    const size_t field_len = strlen(field);
+    char line[256];
+    unsigned long value = 0;
+    FILE *const file = fopen("/proc/self/status", "r");
+    if(file == NULL)
+        return 0;
+    while(fgets(line, sizeof(line), file) != NULL){
+        if(strncmp(line, field, field_len) == 0 && line[field_len] == ':'){
+            value = strtoul(line + field_len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+/* Resets the peak RSS to the current RSS. Only works on Linux. */
+static void qed_bench_reset_peak_rss(void){
+    FILE *const file = fopen("/proc/self/clear_refs", "w");
+    if(file != NULL){
+        fputs("5", file);
+        fclose(file);
+    }
+}
+
+#define QED_BENCH_DEFAULT_MAX_NODES 1000000
+#define QED_BENCH_SUITE_BATCH_SIZE 64
+
+/* Limits the biggest graphs so that a full run fits in a few gigabytes. Set
+ * QED_BENCH_MAX_NODES=10000000 to run everything. */
+static unsigned qed_bench_max_nodes(void){
+    const char *const env = getenv("QED_BENCH_MAX_NODES");
+    return (env == NULL) ? QED_BENCH_DEFAULT_MAX_NODES :
+        (unsigned)strtoul(env, NULL, 10);
+}
+
+/* Schedules every generated graph with every algorithm. The output is CSV,
+ * one line per run, so that results can be compared between versions. */
+static int qed_bench_suite(void){
+    static const unsigned sizes[] = {
+        1000, 10000, 100000, 1000000, 10000000
+    };
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy, QED_eLookahead, QED_eBalanced, QED_eGreedyIterate
+    };
+    static const char *const names[] = {
+        "greedy", "lookahead", "balanced", "iterate"
+    };
+    const unsigned max_nodes = qed_bench_max_nodes();
+    unsigned g, s;
+    
+    printf("graph,nodes,edges,algorithm,max_batch_size,ms,peak_rss_kb,"
+        "allocations,allocated_bytes,batches,fill\n");
+    
+    for(g = 0; g < QED_NUM_GENERATORS; g++){
+        const struct qed_bench_generator *const generator = qed_bench_generators + g;
+        for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= max_nodes; s++){
+            const unsigned n = sizes[s];
+            struct qed_bench_graph graph;
+            uint32_t state = 0x6A09E667u;
+            unsigned a;
+            
+            if(!qed_bench_alloc_graph(&graph, n,
+                (unsigned long)n * generator->max_edges_per_node))
+                return EXIT_FAILURE;
+            generator->function(&graph, &state);
+            
+            for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+                struct QED_BatchOptions options;
+                struct QED_Batch **batches;
+                unsigned num_batches;
+                unsigned long rss, allocations, allocated;
+                double start, time;
+                
+                /* The original algorithm is quadratic. */
+                if(algorithms[a] == QED_eGreedyIterate && n > 10000)
+                    continue;
+                
+                QED_InitBatchOptions(&options);
+                options.max_batch_size = QED_BENCH_SUITE_BATCH_SIZE;
+                options.algorithm = algorithms[a];
+                
+                qed_bench_reset_peak_rss();
+                rss = qed_bench_proc_status("VmRSS");
+                allocations = QED_BENCH_ALLOCATIONS();
+                allocated = QED_BENCH_ALLOCATED();
+                
+                start = qed_bench_now();
+                if(!QED_CalculateBatchesWithOptions(&batches, &num_batches,
+                    graph.ptrs, n, &options))
+                    return EXIT_FAILURE;
+                time = qed_bench_now() - start;
+                
+                allocations = QED_BENCH_ALLOCATIONS() - allocations;
+                allocated = QED_BENCH_ALLOCATED() - allocated;
+                rss = qed_bench_proc_status("VmHWM") - rss;
+                
+                printf("%s,%u,%lu,%s,%u,%.3f,%lu,%lu,%lu,%u,%.4f\n",
+                    generator->name, n, graph.num_edges, names[a],
+                    QED_BENCH_SUITE_BATCH_SIZE, time * 1e3, rss, allocations,
+                    allocated, num_batches,
+                    (double)n / ((double)num_batches * QED_BENCH_SUITE_BATCH_SIZE));
+                fflush(stdout);
+                
+                QED_FreeBatches(batches);
+            }
+            
+            qed_bench_free_suite_graph(&graph);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Compares scheduling from scratch against keeping a schedule up to date
+ * through small edits. Each edit adds an edge to a random node, and then
+ * removes it again. */
+static int qed_bench_incremental(void){
+    static const unsigned sizes[] = { 10000, 100000, 1000000 };
+    unsigned s;
+    
+    printf("%10s %14s %14s %14s %14s\n", "nodes", "load ms", "full ms",
+        "edit us", "visited/edit");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s], edits = 1000;
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        struct QED_Incremental incremental;
+        struct QED_BatchOptions options;
+        struct QED_Batch **batches;
+        struct QED_Graph graph;
+        unsigned long visited = 0;
+        unsigned num_batches, e;
+        uint32_t state = 0x68E31DA4u;
+        double start, load_time, full_time, edit_time;
+        
+        if(!QED_CompileGraph(&graph, ptrs, n))
+            return EXIT_FAILURE;
+        
+        QED_InitBatchOptions(&options);
+        start = qed_bench_now();
+        if(!QED_CalculateBatchesFromGraph(&batches, &num_batches, &graph,
+            &options))
+            return EXIT_FAILURE;
+        full_time = qed_bench_now() - start;
+        QED_FreeBatches(batches);
+        
+        QED_InitIncremental(&incremental);
+        start = qed_bench_now();
+        if(!QED_IncrementalLoadGraph(&incremental, &graph))
+            return EXIT_FAILURE;
+        load_time = qed_bench_now() - start;
+        
+        /* Every dep was an input, so dep i has handle i. Depending on an
+         * earlier dep can never make a cycle. */
+        start = qed_bench_now();
+        for(e = 0; e < edits; e++){
+            const unsigned node = 1 + (qed_bench_random(&state) % (n - 1)),
+                dependency = qed_bench_random(&state) % node;
+            if(QED_IncrementalAddEdge(&incremental, node, dependency)){
+                visited += incremental.visited;
+                QED_IncrementalRemoveEdge(&incremental, node, dependency);
+                visited += incremental.visited;
+            }
+        }
+        edit_time = qed_bench_now() - start;
+        
+        printf("%10u %14.3f %14.3f %14.3f %14.1f\n", n, load_time * 1e3,
+            full_time * 1e3, edit_time * 1e6 / (edits * 2),
+            (double)visited / (edits * 2));
+        
+        QED_FreeIncremental(&incremental);
+        QED_FreeGraph(&graph);
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Compares scheduling against a hit in the schedule cache, which costs the
+ * fingerprint, the check against the stored shape and the output. */
+static int qed_bench_cache(void){
+    static const unsigned sizes[] = { 10000, 100000, 1000000 };
+    unsigned s;
+    
+    printf("%10s %14s %14s %14s\n", "nodes", "schedule ms", "hit ms",
+        "fingerprint ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s], repeats = 10;
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        struct QED_ScheduleCache cache;
+        struct QED_BatchOptions options;
+        struct QED_Batch **batches;
+        struct QED_Graph graph;
+        /* Volatile so that the fingerprints are not optimized away. */
+        volatile unsigned long long fingerprint;
+        unsigned num_batches, r;
+        double start, schedule_time, hit_time, fingerprint_time;
+        
+        if(!QED_CompileGraph(&graph, ptrs, n))
+            return EXIT_FAILURE;
+        QED_InitBatchOptions(&options);
+        options.algorithm = QED_eLookahead;
+        options.max_batch_size = 64;
+        
+        start = qed_bench_now();
+        for(r = 0; r < repeats; r++){
+            if(!QED_CalculateBatchesFromGraph(&batches, &num_batches, &graph,
+                &options))
+                return EXIT_FAILURE;
+            QED_FreeBatches(batches);
+        }
+        schedule_time = (qed_bench_now() - start) / repeats;
+        
+        /* The first call fills the cache. */
+        QED_InitScheduleCache(&cache, 4);
+        options.cache = &cache;
+        QED_CalculateBatchesFromGraph(&batches, &num_batches, &graph, &options);
+        QED_FreeBatches(batches);
+        start = qed_bench_now();
+        for(r = 0; r < repeats; r++){
+            if(!QED_CalculateBatchesFromGraph(&batches, &num_batches, &graph,
+                &options))
+                return EXIT_FAILURE;
+            QED_FreeBatches(batches);
+        }
+        hit_time = (qed_bench_now() - start) / repeats;
+        if(cache.hits != repeats)
+            return EXIT_FAILURE;
+        
+        start = qed_bench_now();
+        for(r = 0; r < repeats; r++)
+            fingerprint = QED_GraphFingerprint(&graph);
+        fingerprint_time = (qed_bench_now() - start) / repeats;
+        (void)fingerprint;
+        
+        printf("%10u %14.3f %14.3f %14.3f\n", n, schedule_time * 1e3,
+            hit_time * 1e3, fingerprint_time * 1e3);
+        
+        QED_FreeScheduleCache(&cache);
+        QED_FreeGraph(&graph);
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Compares compiling and scheduling a graph against mapping a saved copy. */
+static int qed_bench_binary(void){
+    static const unsigned sizes[] = { 100000, 1000000, 4000000 };
+    static const char path[] = "qed_bench_schedule.bin";
+    unsigned s;
+    
+    printf("%10s %14s %14s %14s %14s\n", "nodes", "build ms", "save ms",
+        "map ms", "MB");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        struct QED_MappedSchedule mapped;
+        struct QED_BatchOptions options;
+        struct QED_Graph graph;
+        const unsigned *order, *offsets;
+        unsigned num_batches;
+        double start, build_time, save_time, map_time;
+        
+        QED_InitBatchOptions(&options);
+        options.algorithm = QED_eLookahead;
+        options.max_batch_size = 64;
+        
+        start = qed_bench_now();
+        if(!QED_CompileGraph(&graph, ptrs, n) ||
+            !QED_ScheduleGraph(&graph, &options, &order, &offsets, &num_batches))
+            return EXIT_FAILURE;
+        build_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        if(!QED_SaveSchedule(path, &graph, order, offsets, num_batches, NULL))
+            return EXIT_FAILURE;
+        save_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        if(!QED_MapSchedule(&mapped, path))
+            return EXIT_FAILURE;
+        map_time = qed_bench_now() - start;
+        
+        printf("%10u %14.3f %14.3f %14.3f %14.1f\n", n, build_time * 1e3,
+            save_time * 1e3, map_time * 1e3, mapped.map_size / 1e6);
+        
+        QED_UnmapSchedule(&mapped);
+        remove(path);
+        QED_FreeGraph(&graph);
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Compares compiling a graph of deps against building the same graph from
+ * ids, including adding every node and edge to the builder. */
+static int qed_bench_builder(void){
+    static const unsigned sizes[] = { 10000, 100000, 1000000 };
+    unsigned s;
+    
+    printf("%10s %14s %14s %14s\n", "nodes", "compile ms", "add ms",
+        "build ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_Dependency **ptrs;
+        struct QED_Dependency *const deps = qed_bench_random_graph(n, &ptrs);
+        struct QED_GraphBuilder builder;
+        struct QED_Graph graph, built;
+        double start, compile_time, add_time, build_time;
+        unsigned i, e;
+        
+        start = qed_bench_now();
+        if(!QED_CompileGraph(&graph, ptrs, n))
+            return EXIT_FAILURE;
+        compile_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        QED_InitGraphBuilder(&builder);
+        for(i = 0; i < n; i++){
+            if(QED_BuilderAddNode(&builder, NULL, NULL) == QED_BUILDER_NO_NODE)
+                return EXIT_FAILURE;
+            for(e = 0; e < deps[i].num_dependencies; e++){
+                if(!QED_BuilderAddEdge(&builder, i, deps[i].dependencies[e] - deps))
+                    return EXIT_FAILURE;
+            }
+        }
+        add_time = qed_bench_now() - start;
+        
+        start = qed_bench_now();
+        if(!QED_BuildGraph(&builder, &built))
+            return EXIT_FAILURE;
+        build_time = qed_bench_now() - start;
+        
+        if(built.num_edges != graph.num_edges)
+            return EXIT_FAILURE;
+        printf("%10u %14.3f %14.3f %14.3f\n", n, compile_time * 1e3,
+            add_time * 1e3, build_time * 1e3);
+        
+        QED_FreeGraphBuilder(&builder);
+        QED_FreeGraph(&built);
+        QED_FreeGraph(&graph);
+        qed_bench_free_graph(deps, ptrs, n);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Schedules many small graphs, one call each against one call for all of
+ * them, and reports the throughput in nodes per second. */
+static int qed_bench_multi(void){
+    const unsigned num_graphs = 50000, repeats = 5;
+    struct QED_Dependency **const ptrs = malloc(num_graphs * 50 * sizeof(void*));
+    struct QED_Dependency *const deps =
+        calloc(num_graphs * 50, sizeof(struct QED_Dependency));
+    struct QED_Dependency **const edges = malloc(num_graphs * 50 * 3 * sizeof(void*));
+    struct QED_GraphInput *const inputs =
+        malloc(num_graphs * sizeof(struct QED_GraphInput));
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(0);
+    struct QED_MultiSchedule schedule;
+    struct QED_BatchOptions options;
+    uint32_t state = 7;
+    unsigned long num_nodes = 0, num_edges = 0;
+    unsigned g, i, e, r;
+    double start, each_time, multi_time, pool_time;
+    
+    if(ptrs == NULL || deps == NULL || edges == NULL || inputs == NULL ||
+        pool == NULL)
+        return EXIT_FAILURE;
+    
+    /* Graphs of 5 to 50 nodes, each depending on up to three earlier nodes
+     * of the same graph. */
+    for(g = 0; g < num_graphs; g++){
+        const unsigned size = 5 + (qed_bench_random(&state) % 46);
+        inputs[g].deps = ptrs + num_nodes;
+        inputs[g].num_deps = size;
+        for(i = 0; i < size; i++){
+            struct QED_Dependency *const dep = deps + num_nodes + i;
+            ptrs[num_nodes + i] = dep;
+            dep->dependencies = edges + num_edges;
+            dep->num_dependencies = (i == 0) ? 0 : (qed_bench_random(&state) % 4);
+            for(e = 0; e < dep->num_dependencies; e++)
+                edges[num_edges++] = dep - 1 - (qed_bench_random(&state) % i);
+        }
+        num_nodes += size;
+    }
+    
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_eLookahead;
+    options.max_batch_size = 8;
+    
+    start = qed_bench_now();
+    for(r = 0; r < repeats; r++){
+        for(g = 0; g < num_graphs; g++){
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            if(!QED_CalculateBatchesWithOptions(&batches, &num_batches,
+                inputs[g].deps, inputs[g].num_deps, &options))
+                return EXIT_FAILURE;
+            QED_FreeBatches(batches);
+        }
+    }
+    each_time = (qed_bench_now() - start) / repeats;
+    
+    QED_InitMultiSchedule(&schedule);
+    start = qed_bench_now();
+    for(r = 0; r < repeats; r++){
+        if(!QED_CalculateMultiSchedule(&schedule, inputs, num_graphs, &options))
+            return EXIT_FAILURE;
+    }
+    multi_time = (qed_bench_now() - start) / repeats;
+    
+    options.pool = pool;
+    start = qed_bench_now();
+    for(r = 0; r < repeats; r++){
+        if(!QED_CalculateMultiSchedule(&schedule, inputs, num_graphs, &options))
+            return EXIT_FAILURE;
+    }
+    pool_time = (qed_bench_now() - start) / repeats;
+    
+    printf("%u graphs, %lu nodes\n", num_graphs, num_nodes);
+    printf("%24s %14s %14s\n", "", "ms", "Mnodes/s");
+    printf("%24s %14.3f %14.2f\n", "one call per graph", each_time * 1e3,
+        num_nodes / each_time / 1e6);
+    printf("%24s %14.3f %14.2f\n", "one call", multi_time * 1e3,
+        num_nodes / multi_time / 1e6);
+    printf("%21s %2u %14.3f %14.2f\n", "one call, threads:",
+        QED_ThreadPoolSize(pool), pool_time * 1e3, num_nodes / pool_time / 1e6);
+    
+    QED_FreeMultiSchedule(&schedule);
+    QED_DestroyThreadPool(pool);
+    free(inputs);
+    free(edges);
+    free(deps);
+    free(ptrs);
+    return EXIT_SUCCESS;
+}
+
+/* Words in the block each source writes in the locality bench. */
+#define QED_BENCH_BLOCK_WORDS (16 * 1024)
+
+/* The block a source writes, or for a consumer, the block it reads. */
+struct qed_bench_block{
+    unsigned *data;
+    unsigned long sum;
+};
+
+static int qed_bench_fill(void *action_data, void *user_data){
+    struct qed_bench_block *const block = user_data;
+    unsigned i;
+    (void)action_data;
+    for(i = 0; i < QED_BENCH_BLOCK_WORDS; i++)
+        block->data[i] = i * 2654435761u;
+    return 0;
+}
+
+static int qed_bench_consume(void *action_data, void *user_data){
+    struct qed_bench_block *const block = user_data;
+    unsigned long sum = 0;
+    unsigned i;
+    (void)action_data;
+    for(i = 0; i < QED_BENCH_BLOCK_WORDS; i++)
+        sum += block->data[i];
+    block->sum = sum;
+    return 0;
+}
+
+/* Runs a pipeline where every source has eight consumers that read all of
+ * its block, and each consumer is followed by a chain of up to three empty
+ * nodes. The chains give the consumers different ranks, so the lookahead
+ * scheduler spreads the consumers of each source through the batch. Switches
+ * counts consumers that read a different block from the one run before. */
+static int qed_bench_locality(void){
+    static const struct{
+        const char *name;
+        enum QED_BatchAlgorithm algorithm;
+        bool locality, affinity;
+    } configs[] = {
+        {"greedy", QED_eGreedy, false, false},
+        {"lookahead", QED_eLookahead, false, false},
+        {"locality", QED_eLookahead, true, false},
+        {"affinity", QED_eLookahead, true, true}
+    };
+    const unsigned num_sources = 512, fanout = 8, repeats = 5,
+        num_consumers = num_sources * fanout,
+        max_nodes = num_sources + (num_consumers * 4);
+    struct QED_Dependency *const deps =
+        calloc(max_nodes, sizeof(struct QED_Dependency));
+    struct QED_Dependency **const ptrs = malloc(max_nodes * sizeof(void*));
+    struct QED_Dependency **const edges = malloc(max_nodes * sizeof(void*));
+    struct qed_bench_block *const blocks =
+        calloc(num_sources + num_consumers, sizeof(struct qed_bench_block));
+    unsigned *const data =
+        malloc((size_t)num_sources * QED_BENCH_BLOCK_WORDS * sizeof(unsigned));
+    unsigned *const sources = malloc(num_consumers * sizeof(unsigned));
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(0);
+    uint32_t state = 99;
+    unsigned n = 0, c, i, r;
+    
+    if(deps == NULL || ptrs == NULL || edges == NULL || blocks == NULL ||
+        data == NULL || sources == NULL || pool == NULL)
+        return EXIT_FAILURE;
+    
+    for(i = 0; i < num_sources; i++, n++){
+        blocks[i].data = data + ((size_t)i * QED_BENCH_BLOCK_WORDS);
+        deps[n].execute.func = qed_bench_fill;
+        deps[n].execute.user_data = blocks + i;
+    }
+    
+    /* Deal the consumers out to the sources in a random order. */
+    for(c = 0; c < num_consumers; c++)
+        sources[c] = c / fanout;
+    for(c = num_consumers - 1; c != 0; c--){
+        const unsigned j = qed_bench_random(&state) % (c + 1), t = sources[c];
+        sources[c] = sources[j];
+        sources[j] = t;
+    }
+    for(c = 0; c < num_consumers; c++){
+        const unsigned length = qed_bench_random(&state) % 4;
+        struct qed_bench_block *const block = blocks + num_sources + c;
+        block->data = blocks[sources[c]].data;
+        deps[n].execute.func = qed_bench_consume;
+        deps[n].execute.user_data = block;
+        edges[n] = deps + sources[c];
+        deps[n].dependencies = edges + n;
+        deps[n].num_dependencies = 1;
+        for(n++, i = 0; i < length; i++, n++){
+            edges[n] = deps + n - 1;
+            deps[n].dependencies = edges + n;
+            deps[n].num_dependencies = 1;
+        }
+    }
+    
+    /* The order of the nodes given to the scheduler says nothing either. */
+    for(i = 0; i < n; i++)
+        ptrs[i] = deps + i;
+    for(i = n - 1; i != 0; i--){
+        const unsigned j = qed_bench_random(&state) % (i + 1);
+        struct QED_Dependency *const t = ptrs[i];
+        ptrs[i] = ptrs[j];
+        ptrs[j] = t;
+    }
+    
+    printf("%u sources of %u KiB, %u consumers, %u nodes, %u threads\n",
+        num_sources, (unsigned)(QED_BENCH_BLOCK_WORDS * sizeof(unsigned) / 1024),
+        num_consumers, n, QED_ThreadPoolSize(pool));
+    printf("%12s %12s %12s\n", "order", "switches", "exec ms");
+    
+    for(c = 0; c < sizeof(configs) / sizeof(configs[0]); c++){
+        struct QED_BatchOptions batch_options;
+        struct QED_ExecuteOptions options;
+        struct QED_Batch **batches;
+        const unsigned *previous = NULL;
+        unsigned num_batches, b, switches = 0;
+        double best = 0.0;
+        
+        QED_InitBatchOptions(&batch_options);
+        batch_options.algorithm = configs[c].algorithm;
+        batch_options.locality = configs[c].locality;
+        if(!QED_CalculateBatchesWithOptions(&batches, &num_batches, ptrs, n,
+            &batch_options))
+            return EXIT_FAILURE;
+        
+        for(b = 0; b < num_batches; b++){
+            for(i = 0; i < batches[b]->num_dependencies; i++){
+                const struct QED_Dependency *const dep = batches[b]->dependencies[i];
+                if(dep->execute.func == qed_bench_consume){
+                    const struct qed_bench_block *const block =
+                        dep->execute.user_data;
+                    switches += (block->data != previous);
+                    previous = block->data;
+                }
+            }
+        }
+        
+        QED_InitExecuteOptions(&options);
+        options.affinity = configs[c].affinity;
+        for(r = 0; r < repeats; r++){
+            const double start = qed_bench_now();
+            QED_ExecuteBatches(pool, batches, num_batches, &options);
+            if(r == 0 || qed_bench_now() - start < best)
+                best = qed_bench_now() - start;
+        }
+        printf("%12s %12u %12.3f\n", configs[c].name, switches, best * 1e3);
+        QED_FreeBatches(batches);
+    }
+    
+    QED_DestroyThreadPool(pool);
+    free(sources);
+    free(data);
+    free(blocks);
+    free(edges);
+    free(ptrs);
+    free(deps);
+    return EXIT_SUCCESS;
+}
+
+/* Layers of this many nodes, so that every batch is split between workers. */
+#define QED_BENCH_PARALLEL_WIDTH 20000
+
+/* Graphs where each node depends on several of the nodes just before it,
+ * which makes most edges redundant. Reports the time to reduce each graph
+ * and to schedule it with QED_eGreedy before and after. */
+static int qed_bench_reduce(void){
+    static const unsigned sizes[] = { 10000, 100000, 1000000 };
+    unsigned s;
+    
+    printf("%10s %10s %10s %12s %14s %14s\n", "nodes", "edges", "removed",
+        "reduce ms", "schedule ms", "reduced ms");
+    
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        const unsigned n = sizes[s];
+        struct QED_GraphBuilder builder;
+        struct QED_BatchOptions options;
+        struct QED_Graph graph;
+        const unsigned *order, *offsets;
+        double start, reduce_time, times[2];
+        uint32_t state = 31;
+        unsigned num_batches, num_edges, num_removed, i, e, pass, r;
+        
+        QED_InitGraphBuilder(&builder);
+        if(!QED_ReserveGraphBuilder(&builder, n, n * 6))
+            return EXIT_FAILURE;
+        for(i = 0; i < n; i++){
+            const unsigned num_deps = (i == 0) ? 0 : (qed_bench_random(&state) % 7);
+            QED_BuilderAddNode(&builder, NULL, NULL);
+            for(e = 0; e < num_deps; e++){
+                const unsigned back = 1 + (qed_bench_random(&state) % 32);
+                if(!QED_BuilderAddEdge(&builder, i, (back > i) ? 0 : (i - back)))
+                    return EXIT_FAILURE;
+            }
+        }
+        if(!QED_BuildGraph(&builder, &graph))
+            return EXIT_FAILURE;
+        QED_FreeGraphBuilder(&builder);
+        num_edges = graph.num_edges;
+        
+        QED_InitBatchOptions(&options);
+        for(pass = 0; pass < 2; pass++){
+            if(pass == 1){
+                start = qed_bench_now();
+                if(!QED_ReduceGraph(&graph, NULL, &num_removed))
+                    return EXIT_FAILURE;
+                reduce_time = qed_bench_now() - start;
+            }
+            times[pass] = 1e30;
+            for(r = 0; r < 5; r++){
+                double t;
+                start = qed_bench_now();
+                if(!QED_ScheduleGraph(&graph, &options, &order, &offsets,
+                    &num_batches))
+                    return EXIT_FAILURE;
+                t = qed_bench_now() - start;
+                if(t < times[pass])
+                    times[pass] = t;
+            }
+        }
+        
+        printf("%10u %10u %10u %12.3f %14.3f %14.3f\n", n, num_edges,
+            num_removed, reduce_time * 1e3, times[0] * 1e3, times[1] * 1e3);
+        QED_FreeGraph(&graph);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Times the greedy scheduler on one to every processor, on a graph of wide
+ * layers where each node depends on three nodes of the previous layer. */
+static int qed_bench_parallel(void){
+    const unsigned n = qed_bench_max_nodes(), repeats = 5;
+    struct QED_ThreadPool *pool = QED_CreateThreadPool(0);
+    struct qed_bench_graph bench_graph;
+    struct QED_Graph graph;
+    unsigned *const order = malloc(((unsigned long)n + 1) * 4 * sizeof(unsigned)),
+        *const offsets = order + n + 1,
+        *const parallel_order = offsets + n + 1,
+        *const parallel_offsets = parallel_order + n + 1;
+    uint32_t state = 1;
+    unsigned max_threads, num_threads, num_batches, num_parallel_batches, i, r;
+    double start, serial_time;
+    
+    if(pool == NULL || order == NULL ||
+        !qed_bench_alloc_graph(&bench_graph, n, (unsigned long)n * 3))
+        return EXIT_FAILURE;
+    max_threads = QED_ThreadPoolSize(pool);
+    QED_DestroyThreadPool(pool);
+    
+    for(i = 0; i < n; i++){
+        qed_bench_begin_node(&bench_graph, i);
+        if(i >= QED_BENCH_PARALLEL_WIDTH){
+            const unsigned layer = i - (i % QED_BENCH_PARALLEL_WIDTH) -
+                QED_BENCH_PARALLEL_WIDTH;
+            unsigned e;
+            for(e = 0; e < 3; e++){
+                qed_bench_add_edge(&bench_graph, i,
+                    layer + (qed_bench_random(&state) % QED_BENCH_PARALLEL_WIDTH));
+            }
+        }
+    }
+    if(!QED_CompileGraph(&graph, bench_graph.ptrs, n))
+        return EXIT_FAILURE;
+    
+    start = qed_bench_now();
+    for(r = 0; r < repeats; r++){
+        if(!QED_ScheduleGreedy(&graph, 0, NULL, NULL, order, offsets,
+            &num_batches))
+            return EXIT_FAILURE;
+    }
+    serial_time = (qed_bench_now() - start) / repeats;
+    
+    printf("%10u nodes, %u batches\n", n, num_batches);
+    printf("%10s %14s %14s\n", "threads", "ms", "speedup");
+    printf("%10s %14.3f %14.2f\n", "serial", serial_time * 1e3, 1.0);
+    
+    for(num_threads = 1; ; num_threads *= 2){
+        double parallel_time;
+        if(num_threads > max_threads)
+            num_threads = max_threads;
+        if((pool = QED_CreateThreadPool(num_threads)) == NULL)
+            return EXIT_FAILURE;
+        
+        start = qed_bench_now();
+        for(r = 0; r < repeats; r++){
+            if(!QED_ScheduleGreedyParallel(pool, &graph, 0, NULL, NULL,
+                parallel_order, parallel_offsets, &num_parallel_batches))
+                return EXIT_FAILURE;
+        }
+        parallel_time = (qed_bench_now() - start) / repeats;
+        QED_DestroyThreadPool(pool);
+        
+        /* Only a schedule that is the same as the serial one counts. */
+        if(num_parallel_batches != num_batches ||
+            memcmp(parallel_order, order, n * sizeof(unsigned)) != 0 ||
+            memcmp(parallel_offsets, offsets,
+                (num_batches + 1) * sizeof(unsigned)) != 0)
+            return EXIT_FAILURE;
+        
+        printf("%10u %14.3f %14.2f\n", num_threads, parallel_time * 1e3,
+            serial_time / parallel_time);
+        if(num_threads == max_threads)
+            break;
+    }
+    
+    QED_FreeGraph(&graph);
+    qed_bench_free_suite_graph(&bench_graph);
+    free(order);
+    return EXIT_SUCCESS;
+}
+
+struct qed_bench{
+    const char *name;
+    int (*function)(void);
+};
+
+static const struct qed_bench qed_benches[] = {
+    {"hash", qed_bench_hash},
+    {"greedy", qed_bench_greedy},
+    {"lookahead", qed_bench_lookahead},
+    {"balanced", qed_bench_balanced},
+    {"compiled", qed_bench_compiled},
+    {"executor", qed_bench_executor},
+    {"packed", qed_bench_packed},
+    {"incremental", qed_bench_incremental},
+    {"cache", qed_bench_cache},
+    {"binary", qed_bench_binary},
+    {"parallel", qed_bench_parallel},
+    {"builder", qed_bench_builder},
+    {"multi", qed_bench_multi},
+    {"locality", qed_bench_locality},
+    {"reduce", qed_bench_reduce},
+    {"suite", qed_bench_suite}
+};
+
+#define QED_NUM_BENCHES (sizeof(qed_benches) / sizeof(qed_benches[0]))
+
+int main(int argc, char **argv){
+    unsigned i;
+    int result = EXIT_SUCCESS;
+    for(i = 0; i < QED_NUM_BENCHES; i++){
+        if(argc > 1){
+            int e;
+            for(e = 1; e < argc; e++){
+                if(strcmp(argv[e], qed_benches[i].name) == 0)
+                    break;
+            }
+            if(e == argc)
+                continue;
+        }
+        printf("========== %s ==========\n", qed_benches[i].name);
+        if(qed_benches[i].function() != EXIT_SUCCESS)
+            result = EXIT_FAILURE;
+    }
+    return result;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_binary.h"
+
+#include "qed_dependency.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define QED_BINARY_MAGIC "QEDSCHED"
+#define QED_BINARY_BYTE_ORDER 0x01020304u
+#define QED_BINARY_HAS_COSTS 1u
+
+enum qed_binary_section{
+    qed_binary_pred_offsets,
+    qed_binary_preds,
+    qed_binary_succ_offsets,
+    qed_binary_succs,
+    qed_binary_order,
+    qed_binary_offsets,
+    qed_binary_ids,
+    qed_binary_costs,
+    qed_binary_num_sections
+};
+
+struct qed_binary_header{
+    char magic[8];
+    unsigned version;
+    unsigned byte_order; /* QED_BINARY_BYTE_ORDER as it was written. */
+    unsigned word_size; /* sizeof(unsigned) */
+    unsigned flags;
+    unsigned num_nodes, num_edges, num_batches, num_scheduled;
+    unsigned long long file_size;
+    /* Where each array starts, from the start of the file. */
+    unsigned long long sections[qed_binary_num_sections];
+};
+
+/* Gets the size of each array in bytes. */
+static void qed_binary_sizes(const struct qed_binary_header *header,
+    unsigned long long *out_sizes){
+    
+    const unsigned long long nodes = header->num_nodes,
+        edges = header->num_edges, word = sizeof(unsigned);
+    out_sizes[qed_binary_pred_offsets] = (nodes + 1) * word;
+    out_sizes[qed_binary_preds] = edges * word;
+    out_sizes[qed_binary_succ_offsets] = (nodes + 1) * word;
+    out_sizes[qed_binary_succs] = edges * word;
+    out_sizes[qed_binary_order] = header->num_scheduled * word;
+    out_sizes[qed_binary_offsets] = ((unsigned long long)header->num_batches + 1) * word;
+    out_sizes[qed_binary_ids] = nodes * sizeof(unsigned long long);
+    out_sizes[qed_binary_costs] = (header->flags & QED_BINARY_HAS_COSTS) ?
+        (nodes * sizeof(unsigned long long)) : 0;
+}
+
+/* Writes an array and pads it to eight bytes. */
+static bool qed_binary_write(FILE *file,
+    const void *data,
+    unsigned long long size){
+    
+    static const char padding[8];
+    const size_t pad = (size_t)((8 - (size % 8)) % 8);
+    return (size == 0 || fwrite(data, (size_t)size, 1, file) == 1) &&
+        (pad == 0 || fwrite(padding, pad, 1, file) == 1);
+}
+
+/* Writes the ids or costs, which are widened to 64 bits. */
+static bool qed_binary_write_wide(FILE *file,
+    const struct QED_Graph *graph,
+    const unsigned long *costs){
+    
+    unsigned long long buffer[256];
+    unsigned i, n = 0;
+    for(i = 0; i < graph->num_nodes; i++){
+        buffer[n++] = (costs == NULL) ? graph->nodes[i]->id : costs[i];
+        if(n == 256 || i + 1 == graph->num_nodes){
+            if(fwrite(buffer, n * sizeof(unsigned long long), 1, file) != 1)
+                return false;
+            n = 0;
+        }
+    }
+    return true;
+}
+
+bool QED_SaveSchedule(const char *path,
+    const struct QED_Graph *graph,
+    const unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches,
+    const unsigned long *costs){
+    
+    struct qed_binary_header header;
+    unsigned long long sizes[qed_binary_num_sections], position;
+    FILE *file;
+    unsigned i;
+    bool ok;
+    
+    memset(&header, 0, sizeof(struct qed_binary_header));
+    memcpy(header.magic, QED_BINARY_MAGIC, 8);
+    header.version = QED_BINARY_VERSION;
+    header.byte_order = QED_BINARY_BYTE_ORDER;
+    header.word_size = sizeof(unsigned);
+    header.flags = (costs == NULL) ? 0 : QED_BINARY_HAS_COSTS;
+    header.num_nodes = graph->num_nodes;
+    header.num_edges = graph->num_edges;
+    header.num_batches = num_batches;
+    header.num_scheduled = offsets[num_batches];
+    
+    /* Lay the arrays out one after another. */
+    qed_binary_sizes(&header, sizes);
+    position = sizeof(struct qed_binary_header);
+    for(i = 0; i < qed_binary_num_sections; i++){
+        header.sections[i] = (i == qed_binary_costs && costs == NULL) ? 0 : position;
+        position += (sizes[i] + 7) & ~7ull;
+    }
+    header.file_size = position;
+    
+    if((file = fopen(path, "wb")) == NULL)
+        return false;
+    
+    ok = fwrite(&header, sizeof(struct qed_binary_header), 1, file) == 1 &&
+        qed_binary_write(file, graph->pred_offsets, sizes[qed_binary_pred_offsets]) &&
+        qed_binary_write(file, graph->preds, sizes[qed_binary_preds]) &&
+        qed_binary_write(file, graph->succ_offsets, sizes[qed_binary_succ_offsets]) &&
+        qed_binary_write(file, graph->succs, sizes[qed_binary_succs]) &&
+        qed_binary_write(file, order, sizes[qed_binary_order]) &&
+        qed_binary_write(file, offsets, sizes[qed_binary_offsets]) &&
+        qed_binary_write_wide(file, graph, NULL) &&
+        (costs == NULL || qed_binary_write_wide(file, graph, costs));
+    
+    return (fclose(file) == 0) && ok;
+}
+
+/* Checks the header, and that every array is inside the file. */
+static bool qed_binary_check(const struct qed_binary_header *header,
+    size_t size){
+    
+    unsigned long long sizes[qed_binary_num_sections];
+    unsigned i;
+    
+    if(size < sizeof(struct qed_binary_header) ||
+        memcmp(header->magic, QED_BINARY_MAGIC, 8) != 0 ||
+        header->version != QED_BINARY_VERSION ||
+        header->byte_order != QED_BINARY_BYTE_ORDER ||
+        header->word_size != sizeof(unsigned) ||
+        header->file_size != size ||
+        header->num_scheduled > header->num_nodes)
+        return false;
+    
+    qed_binary_sizes(header, sizes);
+    for(i = 0; i < qed_binary_num_sections; i++){
+        const unsigned long long start = header->sections[i];
+        if(i == qed_binary_costs && !(header->flags & QED_BINARY_HAS_COSTS))
+            continue;
+        if(start % 8 != 0 || start < sizeof(struct qed_binary_header) ||
+            start > size || sizes[i] > size - start)
+            return false;
+    }
+    return true;
+}
+
+bool QED_MapSchedule(struct QED_MappedSchedule *out_schedule, const char *path){
+    
+    const struct qed_binary_header *header;
+    struct stat info;
+    unsigned char *map;
+    int fd;
+    
+    memset(out_schedule, 0, sizeof(struct QED_MappedSchedule));
+    
+    if((fd = open(path, O_RDONLY)) < 0)
+        return false;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0){
+        close(fd);
+        return false;
+    }
+    
+    /* Private and writable, so that nothing written ever reaches the file. */
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+        fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+    
+    header = (const struct qed_binary_header*)map;
+    if(!qed_binary_check(header, (size_t)info.st_size)){
+        munmap(map, (size_t)info.st_size);
+        return false;
+    }
+    
+    out_schedule->map = map;
+    out_schedule->map_size = (size_t)info.st_size;
+    out_schedule->graph.num_nodes = header->num_nodes;
+    out_schedule->graph.num_edges = header->num_edges;
+    out_schedule->graph.pred_offsets =
+        (unsigned*)(map + header->sections[qed_binary_pred_offsets]);
+    out_schedule->graph.preds = (unsigned*)(map + header->sections[qed_binary_preds]);
+    out_schedule->graph.succ_offsets =
+        (unsigned*)(map + header->sections[qed_binary_succ_offsets]);
+    out_schedule->graph.succs = (unsigned*)(map + header->sections[qed_binary_succs]);
+    out_schedule->order = (const unsigned*)(map + header->sections[qed_binary_order]);
+    out_schedule->offsets =
+        (const unsigned*)(map + header->sections[qed_binary_offsets]);
+    out_schedule->num_batches = header->num_batches;
+    out_schedule->ids =
+        (const unsigned long long*)(map + header->sections[qed_binary_ids]);
+    if(header->flags & QED_BINARY_HAS_COSTS){
+        out_schedule->costs =
+            (const unsigned long long*)(map + header->sections[qed_binary_costs]);
+    }
+    return true;
+}
+
+void QED_UnmapSchedule(struct QED_MappedSchedule *schedule){
+    /* Only the graph's scratch and marks were allocated. */
+    free(schedule->graph.scratch);
+    free(schedule->graph.marks);
+    if(schedule->map != NULL)
+        munmap(schedule->map, schedule->map_size);
+    memset(schedule, 0, sizeof(struct QED_MappedSchedule));
+}
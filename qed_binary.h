@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_BINARY_H
+#define LIBQED_BINARY_H
+#pragma once
+
+#include "qed_graph.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A computed schedule and its graph, saved in a form that is used straight
+ * from a memory mapped file.
+ *
+ * The file is a fixed header followed by the arrays of the graph and the
+ * schedule, each aligned to eight bytes, exactly as they are in memory. So
+ * loading a file maps it and points into it, with nothing to parse and no
+ * allocation per node. The file holds:
+ *
+ * - The preds and succs of every node, in the same form as a QED_Graph.
+ * - The schedule, as the order and offsets from QED_ScheduleGraph.
+ * - The QED_Dependency::id of every node, so that a process which did not
+ *   compile the graph can find its own dep for each node.
+ * - Optionally, the cost of every node.
+ *
+ * Files are in the byte order and word size of the machine that saved them,
+ * and are refused by a machine where those differ.
+ */
+
+#define QED_BINARY_VERSION 1
+
+struct QED_MappedSchedule{
+    /** The graph, with its edges in the mapping. nodes is NULL, and must be
+     * set by the caller before the graph is executed. The graph must not be
+     * passed to QED_FreeGraph.
+     */
+    struct QED_Graph graph;
+    
+    /** Batch i is order[offsets[i]] to order[offsets[i+1]-1]. */
+    const unsigned *order;
+    const unsigned *offsets; /**< num_batches + 1 entries. */
+    unsigned num_batches;
+    
+    const unsigned long long *ids; /**< num_nodes entries. */
+    const unsigned long long *costs; /**< NULL if no costs were saved. */
+    
+    void *map;
+    size_t map_size;
+};
+
+/**
+ * @brief Saves a graph and a schedule of it.
+ *
+ * order, offsets and num_batches are as given by QED_ScheduleGraph.
+ *
+ * @param costs The cost of every node, such as from QED_ProfileCosts. May be
+ *   NULL.
+ * @return false if the file could not be written.
+ */
+bool QED_SaveSchedule(const char *path,
+    const struct QED_Graph *graph,
+    const unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches,
+    const unsigned long *costs);
+
+/**
+ * @brief Maps a file written by QED_SaveSchedule.
+ *
+ * The header and the bounds of every array are checked, but the contents of
+ * the arrays are trusted. The mapping is private, so the graph may be
+ * scheduled again without changing the file.
+ *
+ * @return false if the file could not be mapped or is not a schedule of this
+ *   version for this machine.
+ */
+bool QED_MapSchedule(struct QED_MappedSchedule *out_schedule, const char *path);
+
+/**
+ * @brief Unmaps a schedule, and frees any scratch memory of its graph.
+ */
+void QED_UnmapSchedule(struct QED_MappedSchedule *schedule);
+
+#endif /* LIBQED_BINARY_H */
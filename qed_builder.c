@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_builder.h"
+
+#include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void QED_InitGraphBuilder(struct QED_GraphBuilder *builder){
+    memset(builder, 0, sizeof(struct QED_GraphBuilder));
+}
+
+void QED_FreeGraphBuilder(struct QED_GraphBuilder *builder){
+    free(builder->callbacks);
+    free(builder->costs);
+    free(builder->ids);
+    free(builder->resources);
+    free(builder->edge_nodes);
+    free(builder->edge_deps);
+    QED_InitGraphBuilder(builder);
+}
+
+/* Gets the capacity to grow to, doubling from sixteen. */
+static unsigned qed_builder_capacity(unsigned capacity, unsigned needed){
+    if(capacity < 16)
+        capacity = 16;
+    while(capacity < needed)
+        capacity <<= 1;
+    return capacity;
+}
+
+static bool qed_builder_grow(void **array,
+    unsigned capacity,
+    size_t element_size){
+    
+    void *new_array;
+    QED_STATS_ALLOC(capacity * element_size);
+    if((new_array = realloc(*array, capacity * element_size)) == NULL)
+        return false;
+    array[0] = new_array;
+    return true;
+}
+
+bool QED_ReserveGraphBuilder(struct QED_GraphBuilder *builder,
+    unsigned num_nodes,
+    unsigned num_edges){
+    
+    /* The capacities are only raised once every array has grown. */
+    if(num_nodes > builder->nodes_capacity){
+        const unsigned capacity =
+            qed_builder_capacity(builder->nodes_capacity, num_nodes);
+        if(!qed_builder_grow((void**)&builder->callbacks, capacity,
+                sizeof(struct QED_Callback)) ||
+            !qed_builder_grow((void**)&builder->costs, capacity,
+                sizeof(unsigned long)) ||
+            !qed_builder_grow((void**)&builder->ids, capacity,
+                sizeof(unsigned long)) ||
+            !qed_builder_grow((void**)&builder->resources, capacity,
+                sizeof(unsigned)))
+            return false;
+        builder->nodes_capacity = capacity;
+    }
+    
+    if(num_edges > builder->edges_capacity){
+        const unsigned capacity =
+            qed_builder_capacity(builder->edges_capacity, num_edges);
+        if(!qed_builder_grow((void**)&builder->edge_nodes, capacity,
+                sizeof(unsigned)) ||
+            !qed_builder_grow((void**)&builder->edge_deps, capacity,
+                sizeof(unsigned)))
+            return false;
+        builder->edges_capacity = capacity;
+    }
+    return true;
+}
+
+unsigned QED_BuilderAddNode(struct QED_GraphBuilder *builder,
+    QED_CallbackFunction *func,
+    void *user_data){
+    
+    const unsigned node = builder->num_nodes;
+    if(node == QED_BUILDER_NO_NODE ||
+        !QED_ReserveGraphBuilder(builder, node + 1, builder->num_edges))
+        return QED_BUILDER_NO_NODE;
+    
+    builder->callbacks[node].func = func;
+    builder->callbacks[node].user_data = user_data;
+    builder->costs[node] = 0;
+    builder->ids[node] = 0;
+    builder->resources[node] = 0;
+    builder->num_nodes++;
+    return node;
+}
+
+bool QED_BuilderAddEdge(struct QED_GraphBuilder *builder,
+    unsigned node,
+    unsigned dependency){
+    
+    const unsigned edge = builder->num_edges;
+    if(node >= builder->num_nodes || dependency >= builder->num_nodes ||
+        !QED_ReserveGraphBuilder(builder, builder->num_nodes, edge + 1))
+        return false;
+    
+    builder->edge_nodes[edge] = node;
+    builder->edge_deps[edge] = dependency;
+    builder->num_edges++;
+    return true;
+}
+
+/* Turns counts shifted up by one into the start of each row. */
+static void qed_builder_prefix(unsigned *offsets, unsigned num_nodes){
+    unsigned i;
+    for(i = 0; i < num_nodes; i++)
+        offsets[i + 1] += offsets[i];
+}
+
+/* Moves each row cursor back to the start of its row, once every row has
+ * been filled. */
+static void qed_builder_rewind(unsigned *offsets, unsigned num_nodes){
+    unsigned i;
+    for(i = num_nodes; i != 0; i--)
+        offsets[i] = offsets[i - 1];
+    offsets[0] = 0;
+}
+
+bool QED_BuildGraph(const struct QED_GraphBuilder *builder,
+    struct QED_Graph *out_graph){
+    
+    const unsigned num_nodes = builder->num_nodes,
+        num_edges = builder->num_edges;
+    struct QED_Dependency *deps;
+    unsigned i, e;
+    
+    memset(out_graph, 0, sizeof(struct QED_Graph));
+    out_graph->num_nodes = out_graph->nodes_capacity = num_nodes;
+    out_graph->num_edges = out_graph->edges_capacity = num_edges;
+    
+    QED_STATS_ALLOC(((num_nodes + 1) * sizeof(unsigned) * 2) +
+        ((num_edges + 1) * (sizeof(unsigned) * 2 + sizeof(void*))) +
+        (num_nodes * (sizeof(void*) + sizeof(struct QED_Dependency))));
+    out_graph->pred_offsets = calloc(num_nodes + 1, sizeof(unsigned));
+    out_graph->preds = malloc((num_edges + 1) * sizeof(unsigned));
+    out_graph->succ_offsets = calloc(num_nodes + 1, sizeof(unsigned));
+    out_graph->succs = malloc((num_edges + 1) * sizeof(unsigned));
+    out_graph->nodes = malloc((num_nodes + 1) * sizeof(void*));
+    out_graph->built_deps = deps =
+        malloc((num_nodes + 1) * sizeof(struct QED_Dependency));
+    out_graph->built_edges = malloc((num_edges + 1) * sizeof(void*));
+    if(out_graph->pred_offsets == NULL || out_graph->preds == NULL ||
+        out_graph->succ_offsets == NULL || out_graph->succs == NULL ||
+        out_graph->nodes == NULL || deps == NULL ||
+        out_graph->built_edges == NULL){
+        QED_FreeGraph(out_graph);
+        return false;
+    }
+    
+    /* Sort the edges into rows by the node that depends on them, keeping the
+     * order they were added in within each row. */
+    for(e = 0; e < num_edges; e++)
+        out_graph->pred_offsets[builder->edge_nodes[e] + 1]++;
+    qed_builder_prefix(out_graph->pred_offsets, num_nodes);
+    for(e = 0; e < num_edges; e++){
+        out_graph->preds[out_graph->pred_offsets[builder->edge_nodes[e]]++] =
+            builder->edge_deps[e];
+    }
+    qed_builder_rewind(out_graph->pred_offsets, num_nodes);
+    
+    /* The successors are filled by visiting the nodes in order, as
+     * QED_CompileGraph does, so every successor list ends up sorted. */
+    for(e = 0; e < num_edges; e++)
+        out_graph->succ_offsets[builder->edge_deps[e] + 1]++;
+    qed_builder_prefix(out_graph->succ_offsets, num_nodes);
+    for(i = 0; i < num_nodes; i++){
+        for(e = out_graph->pred_offsets[i]; e < out_graph->pred_offsets[i + 1]; e++)
+            out_graph->succs[out_graph->succ_offsets[out_graph->preds[e]]++] = i;
+    }
+    qed_builder_rewind(out_graph->succ_offsets, num_nodes);
+    
+    /* The deps are for everything that still reads nodes, such as the
+     * executors and the resource limits. */
+    for(i = 0; i < num_nodes; i++){
+        struct QED_Dependency *const dep = deps + i;
+        dep->execute = builder->callbacks[i];
+        dep->dependencies = out_graph->built_edges + out_graph->pred_offsets[i];
+        dep->num_dependencies =
+            out_graph->pred_offsets[i + 1] - out_graph->pred_offsets[i];
+        dep->cost = builder->costs[i];
+        dep->id = builder->ids[i];
+        dep->resources = builder->resources[i];
+        out_graph->nodes[i] = dep;
+    }
+    for(e = 0; e < num_edges; e++)
+        out_graph->built_edges[e] = deps + out_graph->preds[e];
+    
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_BUILDER_H
+#define LIBQED_BUILDER_H
+#pragma once
+
+#include "qed_callback.h"
+
+#include <stdbool.h>
+
+struct QED_Graph;
+
+/* Builds a QED_Graph from dense integer ids instead of QED_Dependency
+ * pointers.
+ *
+ * Nodes are added in order and get the ids 0, 1, 2 and so on, which are also
+ * their indices in the built graph. Edges are given as pairs of ids. Every
+ * field of the nodes is kept in its own array, so nothing is allocated per
+ * node, and building the graph is a few passes over the arrays with no hash
+ * table.
+ *
+ * Since ids are indices, the order and offsets from QED_ScheduleGraph are
+ * already lists of ids, and the results of QED_ExecuteGraph are indexed by id.
+ */
+struct QED_GraphBuilder{
+    unsigned num_nodes, nodes_capacity;
+    unsigned num_edges, edges_capacity;
+    
+    /** One entry per node. The costs, ids and resources are zero when a node
+     * is added, and may be written directly. See QED_Dependency.
+     */
+    struct QED_Callback *callbacks;
+    unsigned long *costs;
+    unsigned long *ids;
+    unsigned *resources;
+    
+    /** Edge i makes edge_nodes[i] depend on edge_deps[i]. */
+    unsigned *edge_nodes;
+    unsigned *edge_deps;
+};
+
+#define QED_BUILDER_NO_NODE (~0u)
+
+void QED_InitGraphBuilder(struct QED_GraphBuilder *builder);
+
+void QED_FreeGraphBuilder(struct QED_GraphBuilder *builder);
+
+/**
+ * @brief Makes room for at least this many nodes and edges in total.
+ *
+ * @return false if an allocation failed.
+ */
+bool QED_ReserveGraphBuilder(struct QED_GraphBuilder *builder,
+    unsigned num_nodes,
+    unsigned num_edges);
+
+/**
+ * @brief Adds a node.
+ *
+ * @return The id of the node, or QED_BUILDER_NO_NODE if an allocation failed.
+ */
+unsigned QED_BuilderAddNode(struct QED_GraphBuilder *builder,
+    QED_CallbackFunction *func,
+    void *user_data);
+
+/**
+ * @brief Makes a node depend on another. Both must already have been added.
+ *
+ * The dependencies of each node keep the order they were added in.
+ *
+ * @return false if either id is not a node, or if an allocation failed.
+ */
+bool QED_BuilderAddEdge(struct QED_GraphBuilder *builder,
+    unsigned node,
+    unsigned dependency);
+
+/**
+ * @brief Builds the graph of every node and edge added so far.
+ *
+ * The graph has the same layout as one from QED_CompileGraph given every
+ * node as an input, in order. Its nodes point to deps owned by the graph,
+ * which are freed by QED_FreeGraph. The builder is not changed, and may be
+ * freed or added to afterwards.
+ *
+ * @return false if an allocation failed.
+ */
+bool QED_BuildGraph(const struct QED_GraphBuilder *builder,
+    struct QED_Graph *out_graph);
+
+#endif /* LIBQED_BUILDER_H */
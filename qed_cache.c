@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_cache.h"
+
+#include "qed_batch.h"
+#include "qed_graph.h"
+#include "qed_stats.h"
+#include "qed_tinyhash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The options that a cacheable schedule depends on. */
+struct qed_cache_key{
+    unsigned algorithm, max_batch_size, window;
+    unsigned long max_operations, max_microseconds;
+};
+
+struct qed_cache_entry{
+    unsigned long long fingerprint;
+    unsigned long long last_used;
+    struct qed_cache_key key;
+    unsigned num_nodes, num_edges, num_batches;
+    
+    /* The shape, to check hits against. These and the schedule are in one
+     * allocation, starting at pred_offsets. */
+    unsigned *pred_offsets, *preds;
+    unsigned *order, *offsets;
+};
+
+void QED_InitScheduleCache(struct QED_ScheduleCache *cache,
+    unsigned max_entries){
+    memset(cache, 0, sizeof(struct QED_ScheduleCache));
+    cache->max_entries = max_entries;
+}
+
+void QED_FreeScheduleCache(struct QED_ScheduleCache *cache){
+    unsigned i;
+    for(i = 0; i < cache->num_entries; i++)
+        free(cache->entries[i].pred_offsets);
+    free(cache->entries);
+    if(cache->index != NULL){
+        QED_FreeHashTable(cache->index, NULL);
+        free(cache->index);
+    }
+    QED_InitScheduleCache(cache, cache->max_entries);
+}
+
+/* Gets the key of the options, or returns false if the schedule depends on
+ * more than the shape of the graph. */
+static bool qed_cache_key(const struct QED_BatchOptions *options,
+    struct qed_cache_key *out_key){
+    
+    memset(out_key, 0, sizeof(struct qed_cache_key));
+    out_key->algorithm = options->algorithm;
+    out_key->max_batch_size = options->max_batch_size;
+    
+    switch(options->algorithm){
+        case QED_eGreedy:
+        case QED_eLookahead:
+            break;
+        case QED_eBalanced:
+            if(options->budget == NULL){
+                out_key->max_operations = QED_DEFAULT_BUDGET_OPERATIONS;
+                out_key->window = QED_DEFAULT_BUDGET_WINDOW;
+            }
+            else{
+                out_key->max_operations = options->budget->max_operations;
+                out_key->max_microseconds = options->budget->max_microseconds;
+                out_key->window = options->budget->window;
+            }
+            break;
+        default:
+            return false;
+    }
+    return options->resources == NULL;
+}
+
+static bool qed_cache_key_equal(const struct qed_cache_key *a,
+    const struct qed_cache_key *b){
+    return a->algorithm == b->algorithm &&
+        a->max_batch_size == b->max_batch_size &&
+        a->window == b->window &&
+        a->max_operations == b->max_operations &&
+        a->max_microseconds == b->max_microseconds;
+}
+
+unsigned long long QED_ScheduleFingerprint(const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options){
+    
+    const unsigned long long prime = 0x100000001B3ull;
+    struct qed_cache_key key;
+    unsigned long long hash;
+    
+    if(!qed_cache_key(options, &key))
+        return 0;
+    
+    hash = QED_GraphFingerprint(graph);
+    hash = (hash ^ key.algorithm) * prime;
+    hash = (hash ^ key.max_batch_size) * prime;
+    hash = (hash ^ key.window) * prime;
+    hash = (hash ^ key.max_operations) * prime;
+    hash = (hash ^ key.max_microseconds) * prime;
+    hash ^= hash >> 29;
+    return (hash == 0) ? 1 : hash;
+}
+
+/* Finds the entry for a fingerprint, if it is for the same shape and key. */
+static struct qed_cache_entry *qed_cache_find(struct QED_ScheduleCache *cache,
+    unsigned long long fingerprint,
+    const struct QED_Graph *graph,
+    const struct qed_cache_key *key){
+    
+    struct qed_cache_entry *entry;
+    qed_hashdata_t slot;
+    
+    if(cache->index == NULL ||
+        !QED_HashTableGet(cache->index, (qed_hashkey_t)fingerprint, &slot))
+        return NULL;
+    
+    entry = cache->entries + slot;
+    if(entry->fingerprint != fingerprint ||
+        entry->num_nodes != graph->num_nodes ||
+        entry->num_edges != graph->num_edges ||
+        !qed_cache_key_equal(&entry->key, key) ||
+        memcmp(entry->pred_offsets, graph->pred_offsets,
+            (graph->num_nodes + 1) * sizeof(unsigned)) != 0 ||
+        memcmp(entry->preds, graph->preds,
+            graph->num_edges * sizeof(unsigned)) != 0)
+        return NULL;
+    return entry;
+}
+
+bool QED_ScheduleCacheFind(struct QED_ScheduleCache *cache,
+    unsigned long long fingerprint,
+    const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    struct qed_cache_key key;
+    struct qed_cache_entry *entry;
+    
+    qed_cache_key(options, &key);
+    if((entry = qed_cache_find(cache, fingerprint, graph, &key)) == NULL){
+        cache->misses++;
+        QED_STATS_ADD(cache_misses, 1);
+        return false;
+    }
+    
+    cache->hits++;
+    QED_STATS_ADD(cache_hits, 1);
+    entry->last_used = ++cache->clock;
+    memcpy(out_order, entry->order,
+        entry->offsets[entry->num_batches] * sizeof(unsigned));
+    memcpy(out_offsets, entry->offsets,
+        (entry->num_batches + 1) * sizeof(unsigned));
+    out_num_batches[0] = entry->num_batches;
+    return true;
+}
+
+/* Gets an entry to replace. This is either unused or the least recently
+ * used, which is a scan of the entries. */
+static struct qed_cache_entry *qed_cache_victim(struct QED_ScheduleCache *cache){
+    
+    struct qed_cache_entry *victim;
+    qed_hashdata_t slot;
+    unsigned i;
+    
+    if(cache->num_entries < cache->max_entries)
+        return cache->entries + cache->num_entries++;
+    
+    victim = cache->entries;
+    for(i = 1; i < cache->num_entries; i++){
+        if(cache->entries[i].last_used < victim->last_used)
+            victim = cache->entries + i;
+    }
+    
+    /* Another entry may have taken the fingerprint since. */
+    if(QED_HashTableGet(cache->index, (qed_hashkey_t)victim->fingerprint, &slot) &&
+        slot == (qed_hashdata_t)(victim - cache->entries))
+        QED_HashTableRemove(cache->index, (qed_hashkey_t)victim->fingerprint, &slot);
+    free(victim->pred_offsets);
+    victim->pred_offsets = NULL;
+    return victim;
+}
+
+bool QED_ScheduleCacheAdd(struct QED_ScheduleCache *cache,
+    unsigned long long fingerprint,
+    const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    const unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches){
+    
+    const unsigned num_nodes = graph->num_nodes, num_edges = graph->num_edges;
+    struct qed_cache_entry *entry;
+    unsigned long size;
+    unsigned *memory;
+    qed_hashdata_t unused;
+    
+    if(cache->max_entries == 0)
+        return true;
+    
+    if(cache->entries == NULL){
+        QED_STATS_ALLOC(cache->max_entries * sizeof(struct qed_cache_entry));
+        cache->entries = calloc(cache->max_entries, sizeof(struct qed_cache_entry));
+        if(cache->entries == NULL)
+            return false;
+    }
+    if(cache->index == NULL &&
+        (cache->index = calloc(1, QED_HASH_TABLE_SIZE)) == NULL)
+        return false;
+    
+    size = ((unsigned long)num_nodes + 1) + num_edges + num_nodes +
+        ((unsigned long)num_batches + 1);
+    QED_STATS_ALLOC(size * sizeof(unsigned));
+    if((memory = malloc(size * sizeof(unsigned))) == NULL)
+        return false;
+    
+    entry = qed_cache_victim(cache);
+    entry->fingerprint = fingerprint;
+    entry->last_used = ++cache->clock;
+    qed_cache_key(options, &entry->key);
+    entry->num_nodes = num_nodes;
+    entry->num_edges = num_edges;
+    entry->num_batches = num_batches;
+    entry->pred_offsets = memory;
+    entry->preds = entry->pred_offsets + num_nodes + 1;
+    entry->order = entry->preds + num_edges;
+    entry->offsets = entry->order + num_nodes;
+    memcpy(entry->pred_offsets, graph->pred_offsets,
+        (num_nodes + 1) * sizeof(unsigned));
+    memcpy(entry->preds, graph->preds, num_edges * sizeof(unsigned));
+    memcpy(entry->order, order, offsets[num_batches] * sizeof(unsigned));
+    memcpy(entry->offsets, offsets, (num_batches + 1) * sizeof(unsigned));
+    
+    QED_HashTableInsert(cache->index, (qed_hashkey_t)fingerprint,
+        entry - cache->entries, &unused);
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_CACHE_H
+#define LIBQED_CACHE_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_BatchOptions;
+struct QED_Graph;
+struct QED_HashTable;
+
+struct qed_cache_entry;
+
+/* Schedules of graphs that have been seen before, by shape.
+ *
+ * Give a cache to QED_CalculateBatches and the other schedulers in the batch
+ * options. The schedule of each graph is stored by the graph's fingerprint
+ * (see QED_GraphFingerprint) and the options that affect it. A later graph
+ * with the same shape gets the stored schedule, with the nodes taken from the
+ * new graph, instead of being scheduled again.
+ *
+ * A hit is checked against the stored shape, so a collision of fingerprints
+ * can never give a wrong schedule. Finding and checking an entry both read
+ * the graph once, which is far less work than scheduling it.
+ *
+ * Schedules that depend on more than the shape are not cached. These are
+ * QED_ePacked, whose costs can change between calls, and any options with
+ * resource limits. With QED_eBalanced, a hit does not update the budget.
+ *
+ * Once max_entries schedules are stored, the least recently used one is
+ * replaced.
+ */
+struct QED_ScheduleCache{
+    struct QED_HashTable *index; /* Maps fingerprints to entries. */
+    struct qed_cache_entry *entries;
+    unsigned num_entries, max_entries;
+    /* Counts lookups, to find the least recently used entry. */
+    unsigned long long clock;
+    
+    /** Lookups that found a schedule, and that did not. */
+    unsigned long hits, misses;
+};
+
+void QED_InitScheduleCache(struct QED_ScheduleCache *cache,
+    unsigned max_entries);
+
+void QED_FreeScheduleCache(struct QED_ScheduleCache *cache);
+
+/**
+ * @brief Gets the key for the schedule of a graph.
+ *
+ * @return The fingerprint of the graph combined with the options, or zero if
+ *   the schedule cannot be cached.
+ */
+unsigned long long QED_ScheduleFingerprint(const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Looks up the schedule of a graph.
+ *
+ * On a hit, the order and offsets of the schedule are written the same way as
+ * QED_ScheduleGraph gives them. out_order and out_offsets must have room for
+ * graph->num_nodes + 1 entries.
+ *
+ * @return true on a hit.
+ */
+bool QED_ScheduleCacheFind(struct QED_ScheduleCache *cache,
+    unsigned long long fingerprint,
+    const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches);
+
+/**
+ * @brief Stores the schedule of a graph, replacing the least recently used
+ * entry if the cache is full.
+ *
+ * @return false if an allocation failed. The cache is still usable.
+ */
+bool QED_ScheduleCacheAdd(struct QED_ScheduleCache *cache,
+    unsigned long long fingerprint,
+    const struct QED_Graph *graph,
+    const struct QED_BatchOptions *options,
+    const unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches);
+
+#endif /* LIBQED_CACHE_H */
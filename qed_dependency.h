@@ -17,6 +17,16 @@ struct QED_Dependency {
     
     struct QED_Dependency **dependencies;
     unsigned num_dependencies;
+    
+    /* Estimated run time of execute, in any unit. Only used by QED_ePacked.
+     * Zero is treated as one. */
+    unsigned long cost;
+    
+    /* Identifies the dep between runs, to key a QED_Profile. Zero is none. */
+    unsigned long id;
+    
+    /* Bit i is set if the dep uses resource class i. See qed_resource.h. */
+    unsigned resources;
 };
 
 #endif /* LIBQED_DEPENDENCY_H */
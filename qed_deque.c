@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_deque.h"
+
+#include <stdlib.h>
+
+struct qed_deque_array{
+    struct qed_deque_array *next_retired;
+    long mask; /* Capacity minus one. Capacity is a power of two. */
+    atomic_uint values[1];
+};
+
+static struct qed_deque_array *qed_deque_array_create(long capacity){
+    struct qed_deque_array *const array = malloc(sizeof(struct qed_deque_array) +
+        (capacity - 1) * sizeof(atomic_uint));
+    if(array != NULL){
+        array->next_retired = NULL;
+        array->mask = capacity - 1;
+    }
+    return array;
+}
+
+bool QED_InitDeque(struct QED_Deque *deque, unsigned capacity){
+    long size = 16;
+    struct qed_deque_array *array;
+    while(size < (long)capacity)
+        size <<= 1;
+    
+    if((array = qed_deque_array_create(size)) == NULL)
+        return false;
+    
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, array);
+    deque->retired = NULL;
+    return true;
+}
+
+void QED_DestroyDeque(struct QED_Deque *deque){
+    struct qed_deque_array *array = deque->retired;
+    while(array != NULL){
+        struct qed_deque_array *const next = array->next_retired;
+        free(array);
+        array = next;
+    }
+    free(atomic_load_explicit(&deque->array, memory_order_relaxed));
+}
+
+bool QED_DequePush(struct QED_Deque *deque, unsigned value){
+    const long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed),
+        top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    struct qed_deque_array *array =
+        atomic_load_explicit(&deque->array, memory_order_relaxed);
+    
+    if(bottom - top > array->mask){
+        struct qed_deque_array *const grown =
+            qed_deque_array_create((array->mask + 1) << 1);
+        long i;
+        if(grown == NULL)
+            return false;
+        for(i = top; i < bottom; i++){
+            atomic_store_explicit(grown->values + (i & grown->mask),
+                atomic_load_explicit(array->values + (i & array->mask),
+                    memory_order_relaxed),
+                memory_order_relaxed);
+        }
+        array->next_retired = deque->retired;
+        deque->retired = array;
+        atomic_store_explicit(&deque->array, grown, memory_order_release);
+        array = grown;
+    }
+    
+    atomic_store_explicit(array->values + (bottom & array->mask), value,
+        memory_order_relaxed);
+    /* Publishes the value, and anything written before the push, to thieves. */
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+unsigned QED_DequeTake(struct QED_Deque *deque){
+    const long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    struct qed_deque_array *const array =
+        atomic_load_explicit(&deque->array, memory_order_relaxed);
+    long top;
+    unsigned value;
+    
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    
+    if(top > bottom){
+        /* Already empty. */
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return QED_DEQUE_EMPTY;
+    }
+    
+    value = atomic_load_explicit(array->values + (bottom & array->mask),
+        memory_order_relaxed);
+    
+    if(top == bottom){
+        /* This is the last value, so race any thieves for it. */
+        if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+            value = QED_DEQUE_EMPTY;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return value;
+}
+
+unsigned QED_DequeSteal(struct QED_Deque *deque){
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire), bottom;
+    
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    
+    if(top < bottom){
+        struct qed_deque_array *const array =
+            atomic_load_explicit(&deque->array, memory_order_acquire);
+        const unsigned value = atomic_load_explicit(
+            array->values + (top & array->mask), memory_order_relaxed);
+        if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+            return QED_DEQUE_ABORT;
+        return value;
+    }
+    return QED_DEQUE_EMPTY;
+}
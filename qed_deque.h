@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_DEQUE_H
+#define LIBQED_DEQUE_H
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/* A Chase-Lev work-stealing deque of node indices.
+ *
+ * Only the owning thread may push and take, which both work on the bottom of
+ * the deque. Any thread may steal from the top. The storage grows as needed,
+ * and old arrays are kept until the deque is destroyed since a thief may still
+ * be reading from them.
+ *
+ * See "Correct and Efficient Work-Stealing for Weak Memory Models", Le et al.
+ */
+struct QED_Deque{
+    atomic_long top, bottom;
+    _Atomic(struct qed_deque_array*) array;
+    struct qed_deque_array *retired;
+};
+
+#define QED_DEQUE_EMPTY (~0u)
+#define QED_DEQUE_ABORT (~1u)
+
+bool QED_InitDeque(struct QED_Deque *deque, unsigned capacity);
+
+void QED_DestroyDeque(struct QED_Deque *deque);
+
+/**
+ * @brief Pushes onto the bottom of the deque. Only called by the owner.
+ *
+ * @return false if the deque needed to grow and the allocation failed.
+ */
+bool QED_DequePush(struct QED_Deque *deque, unsigned value);
+
+/**
+ * @brief Takes from the bottom of the deque. Only called by the owner.
+ *
+ * @return The value, or QED_DEQUE_EMPTY.
+ */
+unsigned QED_DequeTake(struct QED_Deque *deque);
+
+/**
+ * @brief Steals from the top of the deque. May be called by any thread.
+ *
+ * @return The value, QED_DEQUE_EMPTY, or QED_DEQUE_ABORT if another thread
+ * won a race for the value.
+ */
+unsigned QED_DequeSteal(struct QED_Deque *deque);
+
+#endif /* LIBQED_DEQUE_H */
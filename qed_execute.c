@@ -0,0 +1,814 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_execute.h"
+
+#include "qed_batch.h"
+#include "qed_dependency.h"
+#include "qed_deque.h"
+#include "qed_graph.h"
+#include "qed_pool.h"
+#include "qed_profile.h"
+#include "qed_resource.h"
+#include "qed_stats.h"
+#include "qed_tinyhash.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The most deps a worker sets aside while their resources are in use. Past
+ * this the worker waits for room instead. */
+#define QED_EXECUTE_MAX_DEFERRED 32
+
+/* Ends a list of skipped nodes. */
+#define QED_EXECUTE_NO_NODE (~0u)
+
+void QED_InitExecuteOptions(struct QED_ExecuteOptions *options){
+    memset(options, 0, sizeof(struct QED_ExecuteOptions));
+}
+
+/* Waits until the resources of a dep are free. Whoever holds them is running
+ * a callback, and will release them when it returns. */
+static void qed_execute_acquire(const struct QED_ResourceLimits *resources,
+    atomic_uint *usage,
+    unsigned mask){
+    
+    while(!QED_AcquireResources(resources, usage, mask))
+        sched_yield();
+}
+
+static void qed_execute_init_usage(atomic_uint *usage){
+    unsigned i;
+    for(i = 0; i < QED_MAX_RESOURCE_CLASSES; i++)
+        atomic_init(usage + i, 0);
+}
+
+/* Worker times are kept in pairs of busy and total nanoseconds, and only
+ * added to the stats once the workers have stopped. */
+#ifdef QED_ENABLE_STATS
+
+#define QED_EXECUTE_BUSY(TIMES, WORKER) \
+    (((TIMES) == NULL) ? NULL : ((TIMES) + ((WORKER) * 2)))
+
+/* Runs the rest of the arguments, recording the time taken as the total for
+ * the worker. */
+#define QED_EXECUTE_WORKER(TIMES, WORKER, ...) do{ \
+        if((TIMES) != NULL){ \
+            const unsigned long long qed_execute_start = QED_StatsNow(); \
+            __VA_ARGS__; \
+            (TIMES)[((WORKER) * 2) + 1] += QED_StatsNow() - qed_execute_start; \
+        } \
+        else{ \
+            __VA_ARGS__; \
+        } \
+    }while(0)
+
+#else
+
+#define QED_EXECUTE_BUSY(TIMES, WORKER) NULL
+#define QED_EXECUTE_WORKER(TIMES, WORKER, ...) do{ __VA_ARGS__; }while(0)
+
+#endif
+
+static unsigned long long *qed_execute_alloc_times(
+    const struct QED_ExecuteOptions *options,
+    unsigned num_workers){
+    
+#ifdef QED_ENABLE_STATS
+    if(options != NULL && options->stats != NULL)
+        return calloc(num_workers * 2, sizeof(unsigned long long));
+#else
+    (void)options;
+    (void)num_workers;
+#endif
+    return NULL;
+}
+
+static void qed_execute_free_times(const struct QED_ExecuteOptions *options,
+    unsigned long long *times,
+    unsigned num_workers){
+    
+#ifdef QED_ENABLE_STATS
+    if(times != NULL){
+        struct QED_Stats *const stats = options->stats;
+        unsigned i;
+        for(i = 0; i < num_workers; i++){
+            const unsigned long long busy = times[i * 2],
+                total = times[(i * 2) + 1];
+            QED_StatsWorker(stats, i, busy, (total > busy) ? (total - busy) : 0);
+        }
+        if(stats->num_workers < num_workers)
+            stats->num_workers = num_workers;
+    }
+#else
+    (void)options;
+    (void)num_workers;
+#endif
+    free(times);
+}
+
+struct qed_execute_batches{
+    struct QED_ThreadPool *pool;
+    struct QED_Batch **batches;
+    unsigned num_batches;
+    void *action_data;
+    int *results;
+    unsigned long long *times;
+    unsigned long long *run_ns; /* Run time of each dep, for the profile. */
+    const struct QED_ResourceLimits *resources;
+    enum QED_ErrorMode error_mode;
+    
+    /* Status of each dep, by result index. This is the status option, or
+     * allocated here for QED_eSkipDependents. Otherwise it may be NULL. */
+    enum QED_Status *status;
+    bool own_status;
+    /* For QED_eSkipDependents, the result index of each dependency of each
+     * dep which is in the batches. */
+    unsigned *pred_offsets, *preds;
+    
+    /* Next unclaimed dep in each share of each batch. There is one share
+     * per worker with the affinity option, otherwise one per batch. */
+    atomic_uint *cursors;
+    unsigned num_shares;
+    atomic_bool failed;
+    
+    /* Running callbacks of each resource class. */
+    atomic_uint usage[QED_MAX_RESOURCE_CLASSES];
+};
+
+/* Runs the callback of a dep. If busy_ns is not NULL, the time spent in the
+ * callback is added to it, and if out_ns is not NULL it is stored there. */
+static int qed_execute_dependency(const struct QED_Dependency *dep,
+    void *action_data,
+    unsigned long long *busy_ns,
+    unsigned long long *out_ns){
+    
+    QED_CallbackFunction *const func = dep->execute.func;
+    if(func == NULL){
+        if(out_ns != NULL)
+            out_ns[0] = 0;
+        return 0;
+    }
+    
+    if(busy_ns != NULL || out_ns != NULL){
+        const unsigned long long start = QED_StatsNow();
+        const int result = func(action_data, dep->execute.user_data);
+        const unsigned long long time = QED_StatsNow() - start;
+        if(busy_ns != NULL)
+            busy_ns[0] += time;
+        if(out_ns != NULL)
+            out_ns[0] = time;
+        return result;
+    }
+    return func(action_data, dep->execute.user_data);
+}
+
+/* Allocates room to time every dep, if there is a profile to record them. */
+static unsigned long long *qed_execute_alloc_run_times(
+    const struct QED_ExecuteOptions *options,
+    unsigned num_deps){
+    
+    if(options == NULL || options->profile == NULL)
+        return NULL;
+    return malloc((num_deps + 1) * sizeof(unsigned long long));
+}
+
+/* Finds the result index of the dependencies of each dep that are in the
+ * batches, so that QED_eSkipDependents can check on them. */
+static bool qed_execute_batches_preds(struct qed_execute_batches *execute,
+    unsigned num_deps){
+    
+    struct QED_HashTable *const indices = calloc(1, QED_HASH_TABLE_SIZE);
+    unsigned b, i, e, index, num_preds = 0;
+    bool ok = false;
+    
+    if(indices == NULL)
+        return false;
+    
+    for(b = 0, index = 0; b < execute->num_batches; b++){
+        for(i = 0; i < execute->batches[b]->num_dependencies; i++){
+            qed_hashdata_t unused;
+            QED_HashTableInsert(indices,
+                (qed_hashkey_t)execute->batches[b]->dependencies[i], index++,
+                &unused);
+        }
+    }
+    
+    /* Count, and then fill in the indices. */
+    execute->pred_offsets = malloc((num_deps + 1) * sizeof(unsigned));
+    if(execute->pred_offsets == NULL)
+        goto preds_end;
+    for(b = 0, index = 0; b < execute->num_batches; b++){
+        for(i = 0; i < execute->batches[b]->num_dependencies; i++){
+            const struct QED_Dependency *const dep =
+                execute->batches[b]->dependencies[i];
+            qed_hashdata_t pred;
+            execute->pred_offsets[index++] = num_preds;
+            for(e = 0; e < dep->num_dependencies; e++){
+                if(QED_HashTableGet(indices, (qed_hashkey_t)dep->dependencies[e],
+                    &pred))
+                    num_preds++;
+            }
+        }
+    }
+    execute->pred_offsets[num_deps] = num_preds;
+    
+    execute->preds = malloc((num_preds + 1) * sizeof(unsigned));
+    if(execute->preds == NULL)
+        goto preds_end;
+    for(b = 0, num_preds = 0; b < execute->num_batches; b++){
+        for(i = 0; i < execute->batches[b]->num_dependencies; i++){
+            const struct QED_Dependency *const dep =
+                execute->batches[b]->dependencies[i];
+            qed_hashdata_t pred;
+            for(e = 0; e < dep->num_dependencies; e++){
+                if(QED_HashTableGet(indices, (qed_hashkey_t)dep->dependencies[e],
+                    &pred))
+                    execute->preds[num_preds++] = (unsigned)pred;
+            }
+        }
+    }
+    ok = true;
+    
+preds_end:
+    QED_FreeHashTable(indices, NULL);
+    free(indices);
+    return ok;
+}
+
+/* Checks whether a dep should finish without running, because of an earlier
+ * failure. If so, its status and result are set. */
+static bool qed_execute_batches_drop(struct qed_execute_batches *execute,
+    unsigned index){
+    
+    enum QED_Status status;
+    unsigned e;
+    
+    if(execute->error_mode == QED_eStopAll){
+        if(!atomic_load_explicit(&execute->failed, memory_order_relaxed))
+            return false;
+        status = QED_eCancelled;
+    }
+    else if(execute->error_mode == QED_eSkipDependents){
+        /* The dependencies are all in earlier batches, so they are done. */
+        for(e = execute->pred_offsets[index];
+            e < execute->pred_offsets[index + 1]; e++){
+            const enum QED_Status pred = execute->status[execute->preds[e]];
+            if(pred == QED_eFailed || pred == QED_eSkipped)
+                break;
+        }
+        if(e == execute->pred_offsets[index + 1])
+            return false;
+        status = QED_eSkipped;
+    }
+    else{
+        return false;
+    }
+    
+    if(execute->status != NULL)
+        execute->status[index] = status;
+    if(execute->results != NULL)
+        execute->results[index] = 0;
+    return true;
+}
+
+/* Runs dep i of batch b, which starts at result index base. If resources are
+ * limited, the dep's resources must already be held. */
+static void qed_execute_batches_run(struct qed_execute_batches *execute,
+    unsigned long long *busy_ns,
+    unsigned b,
+    unsigned base,
+    unsigned i){
+    
+    const struct QED_Dependency *const dep = execute->batches[b]->dependencies[i];
+    const int result = qed_execute_dependency(dep, execute->action_data, busy_ns,
+        (execute->run_ns == NULL) ? NULL : (execute->run_ns + base + i));
+    
+    if(execute->resources != NULL)
+        QED_ReleaseResources(execute->resources, execute->usage, dep->resources);
+    if(execute->results != NULL)
+        execute->results[base + i] = result;
+    if(execute->status != NULL)
+        execute->status[base + i] = (result == 0) ? QED_eOk : QED_eFailed;
+    if(result != 0)
+        atomic_store_explicit(&execute->failed, true, memory_order_relaxed);
+}
+
+/* Gets where a share of a batch starts. */
+static unsigned qed_execute_share(unsigned num_deps,
+    unsigned share,
+    unsigned num_shares){
+    return (unsigned)(((unsigned long long)num_deps * share) / num_shares);
+}
+
+static void qed_execute_batches_work(struct qed_execute_batches *execute,
+    unsigned worker){
+    
+    unsigned long long *const busy_ns = QED_EXECUTE_BUSY(execute->times, worker);
+    const struct QED_ResourceLimits *const resources = execute->resources;
+    const unsigned num_shares = execute->num_shares;
+    unsigned deferred[QED_EXECUTE_MAX_DEFERRED];
+    unsigned b, s, base = 0;
+    
+    for(b = 0; b < execute->num_batches; b++){
+        const struct QED_Batch *const batch = execute->batches[b];
+        atomic_uint *const cursors = execute->cursors + (b * num_shares);
+        unsigned num_deferred = 0;
+        
+        /* Starting from the worker's own share. */
+        for(s = 0; s < num_shares; s++){
+            const unsigned share = (worker + s) % num_shares,
+                end = qed_execute_share(batch->num_dependencies, share + 1,
+                    num_shares);
+            for(;;){
+                const unsigned i = atomic_fetch_add_explicit(cursors + share,
+                    1, memory_order_relaxed);
+                if(i >= end)
+                    break;
+                if(qed_execute_batches_drop(execute, base + i))
+                    continue;
+                
+                if(resources != NULL){
+                    const unsigned mask = batch->dependencies[i]->resources;
+                    if(!QED_AcquireResources(resources, execute->usage, mask)){
+                        if(num_deferred < QED_EXECUTE_MAX_DEFERRED){
+                            deferred[num_deferred++] = i;
+                            continue;
+                        }
+                        qed_execute_acquire(resources, execute->usage, mask);
+                    }
+                }
+                qed_execute_batches_run(execute, busy_ns, b, base, i);
+            }
+        }
+        
+        /* Nothing else in the batch is left to claim, so wait for room for
+         * the deps that were set aside. */
+        while(num_deferred != 0){
+            unsigned i, num_left = 0;
+            for(i = 0; i < num_deferred; i++){
+                const unsigned d = deferred[i];
+                if(qed_execute_batches_drop(execute, base + d))
+                    continue;
+                if(QED_AcquireResources(resources, execute->usage,
+                    batch->dependencies[d]->resources))
+                    qed_execute_batches_run(execute, busy_ns, b, base, d);
+                else
+                    deferred[num_left++] = d;
+            }
+            if(num_left == num_deferred)
+                sched_yield();
+            num_deferred = num_left;
+        }
+        base += batch->num_dependencies;
+        
+        QED_ThreadPoolBarrier(execute->pool);
+    }
+}
+
+static void qed_execute_batches_job(void *arg, unsigned worker){
+    struct qed_execute_batches *const execute = arg;
+    QED_EXECUTE_WORKER(execute->times, worker,
+        qed_execute_batches_work(execute, worker));
+}
+
+bool QED_ExecuteBatches(struct QED_ThreadPool *pool,
+    struct QED_Batch **batches,
+    unsigned num_batches,
+    const struct QED_ExecuteOptions *options){
+    
+    struct qed_execute_batches execute;
+    const unsigned num_workers = QED_ThreadPoolSize(pool);
+    unsigned i, num_deps = 0;
+    bool ok;
+    
+    execute.pool = pool;
+    execute.batches = batches;
+    execute.num_batches = num_batches;
+    execute.action_data = (options == NULL) ? NULL : options->action_data;
+    execute.results = (options == NULL) ? NULL : options->results;
+    execute.resources = (options == NULL) ? NULL : options->resources;
+    execute.error_mode = (options == NULL) ? QED_eContinueAll : options->error_mode;
+    execute.status = (options == NULL) ? NULL : options->status;
+    execute.own_status = false;
+    execute.pred_offsets = execute.preds = NULL;
+    qed_execute_init_usage(execute.usage);
+    for(i = 0; i < num_batches; i++)
+        num_deps += batches[i]->num_dependencies;
+    
+    /* Statuses are needed to skip dependents, and to leave deps that never
+     * ran out of the profile. */
+    if(execute.status == NULL && (execute.error_mode == QED_eSkipDependents ||
+        (options != NULL && options->profile != NULL))){
+        execute.status = malloc((num_deps + 1) * sizeof(enum QED_Status));
+        execute.own_status = true;
+        if(execute.status == NULL){
+            ok = false;
+            goto batches_end;
+        }
+    }
+    if(execute.error_mode == QED_eSkipDependents &&
+        !qed_execute_batches_preds(&execute, num_deps)){
+        ok = false;
+        goto batches_end;
+    }
+    
+    execute.num_shares = (options != NULL && options->affinity) ? num_workers : 1;
+    execute.cursors = malloc(((num_batches * execute.num_shares) + 1) *
+        sizeof(atomic_uint));
+    if(execute.cursors == NULL){
+        ok = false;
+        goto batches_end;
+    }
+    for(i = 0; i < num_batches * execute.num_shares; i++){
+        atomic_init(execute.cursors + i, qed_execute_share(
+            batches[i / execute.num_shares]->num_dependencies,
+            i % execute.num_shares, execute.num_shares));
+    }
+    atomic_init(&execute.failed, false);
+    execute.times = qed_execute_alloc_times(options, num_workers);
+    execute.run_ns = qed_execute_alloc_run_times(options, num_deps);
+    
+    QED_RunThreadPool(pool, qed_execute_batches_job, &execute);
+    
+    if(execute.run_ns != NULL){
+        unsigned b, base = 0;
+        for(b = 0; b < num_batches; b++){
+            for(i = 0; i < batches[b]->num_dependencies; i++){
+                const enum QED_Status status = execute.status[base + i];
+                if(status == QED_eOk || status == QED_eFailed){
+                    QED_ProfileRecord(options->profile,
+                        batches[b]->dependencies[i]->id,
+                        execute.run_ns[base + i]);
+                }
+            }
+            base += batches[b]->num_dependencies;
+        }
+        free(execute.run_ns);
+    }
+    
+    qed_execute_free_times(options, execute.times, num_workers);
+    free(execute.cursors);
+    ok = !atomic_load(&execute.failed);
+    
+batches_end:
+    if(execute.own_status)
+        free(execute.status);
+    free(execute.pred_offsets);
+    free(execute.preds);
+    return ok;
+}
+
+struct qed_execute_graph{
+    const struct QED_Graph *graph;
+    unsigned num_workers;
+    void *action_data;
+    int *results;
+    unsigned long long *times;
+    unsigned long long *run_ns; /* Run time of each node, for the profile. */
+    const struct QED_ResourceLimits *resources;
+    enum QED_ErrorMode error_mode;
+    
+    /* A QED_Status for each node, if there is a status option or
+     * QED_eSkipDependents is used. */
+    atomic_uchar *status;
+    /* Links the nodes a worker has skipped but not yet followed. Each node is
+     * only ever skipped by one worker. */
+    unsigned *skip_next;
+    
+    /* Number of unfinished dependencies of each node. */
+    atomic_uint *pending;
+    /* Number of nodes which have not finished. */
+    atomic_uint remaining;
+    /* Number of nodes which are queued or running. When this reaches zero
+     * there is nothing left that could make another node ready. */
+    atomic_uint active;
+    atomic_bool failed;
+    
+    /* Running callbacks of each resource class. */
+    atomic_uint usage[QED_MAX_RESOURCE_CLASSES];
+    
+    struct QED_Deque *deques;
+};
+
+/* Marks everything downstream of a failed node as skipped. Nothing downstream
+ * of it can have started, as the failed node only just finished. Marking stops
+ * at nodes which are already skipped, since everything after them is too. */
+static void qed_execute_graph_skip(struct qed_execute_graph *execute,
+    unsigned node){
+    
+    const struct QED_Graph *const graph = execute->graph;
+    unsigned stack = node, e;
+    execute->skip_next[node] = QED_EXECUTE_NO_NODE;
+    while(stack != QED_EXECUTE_NO_NODE){
+        const unsigned next = stack;
+        stack = execute->skip_next[next];
+        for(e = graph->succ_offsets[next]; e < graph->succ_offsets[next + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            if(atomic_exchange_explicit(execute->status + succ, QED_eSkipped,
+                memory_order_relaxed) != QED_eSkipped){
+                execute->skip_next[succ] = stack;
+                stack = succ;
+            }
+        }
+    }
+}
+
+/* Checks whether a node that is ready should finish without running, because
+ * of an earlier failure. */
+static bool qed_execute_graph_drop(struct qed_execute_graph *execute,
+    unsigned node){
+    
+    switch(execute->error_mode){
+        case QED_eSkipDependents:
+            return atomic_load_explicit(execute->status + node,
+                memory_order_relaxed) == QED_eSkipped;
+        case QED_eStopAll:
+            return atomic_load_explicit(&execute->failed, memory_order_relaxed);
+        default:
+            return false;
+    }
+}
+
+static void qed_execute_graph_start(struct qed_execute_graph *execute,
+    struct QED_Deque *deque,
+    unsigned long long *busy_ns,
+    unsigned node);
+
+/* Pushes any dependents a node makes ready, now that it has finished. */
+static void qed_execute_graph_finish(struct qed_execute_graph *execute,
+    struct QED_Deque *deque,
+    unsigned long long *busy_ns,
+    unsigned node,
+    int result){
+    
+    const struct QED_Graph *const graph = execute->graph;
+    unsigned e;
+    
+    if(execute->results != NULL)
+        execute->results[node] = result;
+    
+    for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+        const unsigned succ = graph->succs[e];
+        if(atomic_fetch_sub_explicit(execute->pending + succ, 1,
+            memory_order_acq_rel) == 1){
+            
+            atomic_fetch_add_explicit(&execute->active, 1, memory_order_relaxed);
+            if(!QED_DequePush(deque, succ)){
+                /* Just run it here rather than losing it. */
+                qed_execute_graph_start(execute, deque, busy_ns, succ);
+            }
+        }
+    }
+    
+    atomic_fetch_sub_explicit(&execute->remaining, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&execute->active, 1, memory_order_release);
+}
+
+/* Runs a node and pushes any dependents it makes ready. If resources are
+ * limited, the node's resources must already be held. */
+static void qed_execute_graph_node(struct qed_execute_graph *execute,
+    struct QED_Deque *deque,
+    unsigned long long *busy_ns,
+    unsigned node){
+    
+    const struct QED_Graph *const graph = execute->graph;
+    const int result = qed_execute_dependency(graph->nodes[node],
+        execute->action_data, busy_ns,
+        (execute->run_ns == NULL) ? NULL : (execute->run_ns + node));
+    
+    if(execute->resources != NULL){
+        QED_ReleaseResources(execute->resources, execute->usage,
+            graph->nodes[node]->resources);
+    }
+    if(execute->status != NULL){
+        atomic_store_explicit(execute->status + node,
+            (result == 0) ? QED_eOk : QED_eFailed, memory_order_relaxed);
+    }
+    if(result != 0){
+        atomic_store_explicit(&execute->failed, true, memory_order_relaxed);
+        /* Before any dependents can be made ready. */
+        if(execute->error_mode == QED_eSkipDependents)
+            qed_execute_graph_skip(execute, node);
+    }
+    
+    qed_execute_graph_finish(execute, deque, busy_ns, node, result);
+}
+
+/* Runs a node that is ready, waiting for its resources if need be. */
+static void qed_execute_graph_start(struct qed_execute_graph *execute,
+    struct QED_Deque *deque,
+    unsigned long long *busy_ns,
+    unsigned node){
+    
+    if(qed_execute_graph_drop(execute, node)){
+        qed_execute_graph_finish(execute, deque, busy_ns, node, 0);
+        return;
+    }
+    if(execute->resources != NULL){
+        qed_execute_acquire(execute->resources, execute->usage,
+            execute->graph->nodes[node]->resources);
+    }
+    qed_execute_graph_node(execute, deque, busy_ns, node);
+}
+
+/* Runs whichever of the set aside nodes now fit. Returns the number left. */
+static unsigned qed_execute_graph_deferred(struct qed_execute_graph *execute,
+    struct QED_Deque *deque,
+    unsigned long long *busy_ns,
+    unsigned *deferred,
+    unsigned num_deferred){
+    
+    struct QED_Dependency *const *const nodes = execute->graph->nodes;
+    unsigned i, num_left = 0;
+    for(i = 0; i < num_deferred; i++){
+        const unsigned node = deferred[i];
+        if(qed_execute_graph_drop(execute, node))
+            qed_execute_graph_finish(execute, deque, busy_ns, node, 0);
+        else if(QED_AcquireResources(execute->resources, execute->usage,
+            nodes[node]->resources))
+            qed_execute_graph_node(execute, deque, busy_ns, node);
+        else
+            deferred[num_left++] = node;
+    }
+    return num_left;
+}
+
+static void qed_execute_graph_work(struct qed_execute_graph *execute,
+    unsigned worker){
+    
+    unsigned long long *const busy_ns = QED_EXECUTE_BUSY(execute->times, worker);
+    struct QED_Deque *const deque = execute->deques + worker;
+    const struct QED_ResourceLimits *const resources = execute->resources;
+    const unsigned num_workers = execute->num_workers;
+    unsigned deferred[QED_EXECUTE_MAX_DEFERRED];
+    unsigned victim = worker, num_deferred = 0;
+    
+    for(;;){
+        unsigned node;
+        
+        if(num_deferred != 0){
+            num_deferred = qed_execute_graph_deferred(execute, deque, busy_ns,
+                deferred, num_deferred);
+        }
+        
+        node = QED_DequeTake(deque);
+        if(node == QED_DEQUE_EMPTY){
+            unsigned i;
+            for(i = 1; i < num_workers && node >= QED_DEQUE_ABORT; i++){
+                if(++victim == num_workers)
+                    victim = 0;
+                if(victim != worker)
+                    node = QED_DequeSteal(execute->deques + victim);
+            }
+        }
+        
+        if(node < QED_DEQUE_ABORT){
+            if(qed_execute_graph_drop(execute, node)){
+                qed_execute_graph_finish(execute, deque, busy_ns, node, 0);
+                continue;
+            }
+            
+            /* Nodes that do not fit yet are set aside, and the worker looks
+             * for something else to run. */
+            if(resources != NULL){
+                const unsigned mask = execute->graph->nodes[node]->resources;
+                if(!QED_AcquireResources(resources, execute->usage, mask)){
+                    if(num_deferred < QED_EXECUTE_MAX_DEFERRED){
+                        deferred[num_deferred++] = node;
+                        continue;
+                    }
+                    qed_execute_acquire(resources, execute->usage, mask);
+                }
+            }
+            qed_execute_graph_node(execute, deque, busy_ns, node);
+        }
+        else if(atomic_load_explicit(&execute->active,
+            memory_order_acquire) == 0){
+            return;
+        }
+        else{
+            sched_yield();
+        }
+    }
+}
+
+static void qed_execute_graph_job(void *arg, unsigned worker){
+    struct qed_execute_graph *const execute = arg;
+    QED_EXECUTE_WORKER(execute->times, worker,
+        qed_execute_graph_work(execute, worker));
+}
+
+bool QED_ExecuteGraph(struct QED_ThreadPool *pool,
+    const struct QED_Graph *graph,
+    const struct QED_ExecuteOptions *options){
+    
+    const unsigned num_nodes = graph->num_nodes,
+        num_workers = QED_ThreadPoolSize(pool);
+    struct qed_execute_graph execute;
+    unsigned i, num_deques = 0, next_deque = 0;
+    bool ok = false;
+    
+    execute.graph = graph;
+    execute.num_workers = num_workers;
+    execute.action_data = (options == NULL) ? NULL : options->action_data;
+    execute.results = (options == NULL) ? NULL : options->results;
+    execute.resources = (options == NULL) ? NULL : options->resources;
+    execute.error_mode = (options == NULL) ? QED_eContinueAll : options->error_mode;
+    qed_execute_init_usage(execute.usage);
+    atomic_init(&execute.remaining, num_nodes);
+    atomic_init(&execute.active, 0);
+    atomic_init(&execute.failed, false);
+    execute.times = NULL;
+    execute.run_ns = NULL;
+    execute.status = NULL;
+    execute.skip_next = NULL;
+    
+    execute.pending = malloc((num_nodes + 1) * sizeof(atomic_uint));
+    execute.deques = malloc(num_workers * sizeof(struct QED_Deque));
+    if(execute.pending == NULL || execute.deques == NULL)
+        goto execute_error;
+    
+    /* Statuses are also needed to leave nodes that never ran out of the
+     * profile. */
+    if(execute.error_mode == QED_eSkipDependents || (options != NULL &&
+        (options->status != NULL || options->profile != NULL))){
+        if((execute.status = malloc(num_nodes + 1)) == NULL)
+            goto execute_error;
+        for(i = 0; i < num_nodes; i++)
+            atomic_init(execute.status + i, QED_eCancelled);
+    }
+    if(execute.error_mode == QED_eSkipDependents &&
+        (execute.skip_next = malloc((num_nodes + 1) * sizeof(unsigned))) == NULL)
+        goto execute_error;
+    
+    for(; num_deques < num_workers; num_deques++){
+        if(!QED_InitDeque(execute.deques + num_deques,
+            num_nodes / num_workers))
+            goto execute_error;
+    }
+    
+    /* Deal the nodes with no dependencies out to the workers. This happens
+     * before the workers start, so pushing to deques we do not own is safe. */
+    for(i = 0; i < num_nodes; i++){
+        const unsigned num_preds = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        atomic_init(execute.pending + i, num_preds);
+        if(num_preds == 0){
+            atomic_fetch_add_explicit(&execute.active, 1, memory_order_relaxed);
+            if(!QED_DequePush(execute.deques + next_deque, i))
+                goto execute_error;
+            if(++next_deque == num_workers)
+                next_deque = 0;
+        }
+    }
+    
+    execute.times = qed_execute_alloc_times(options, num_workers);
+    execute.run_ns = qed_execute_alloc_run_times(options, num_nodes);
+    QED_RunThreadPool(pool, qed_execute_graph_job, &execute);
+    
+    /* Nodes that were skipped, cancelled, or in a cycle never ran, so they
+     * are not recorded. */
+    if(execute.run_ns != NULL){
+        for(i = 0; i < num_nodes; i++){
+            const unsigned status = atomic_load_explicit(execute.status + i,
+                memory_order_relaxed);
+            if(status == QED_eOk || status == QED_eFailed)
+                QED_ProfileRecord(options->profile, graph->nodes[i]->id,
+                    execute.run_ns[i]);
+        }
+    }
+    
+    /* Anything left over is part of a cycle, and was never started. */
+    for(i = 0; i < num_nodes && execute.results != NULL; i++){
+        if(atomic_load_explicit(execute.pending + i, memory_order_relaxed) != 0)
+            execute.results[i] = 0;
+    }
+    if(execute.status != NULL && options->status != NULL){
+        for(i = 0; i < num_nodes; i++){
+            options->status[i] = (enum QED_Status)atomic_load_explicit(
+                execute.status + i, memory_order_relaxed);
+        }
+    }
+    ok = atomic_load(&execute.remaining) == 0 && !atomic_load(&execute.failed);
+    
+execute_error:
+    free(execute.skip_next);
+    free(execute.status);
+    free(execute.run_ns);
+    qed_execute_free_times(options, execute.times, num_workers);
+    for(i = 0; i < num_deques; i++)
+        QED_DestroyDeque(execute.deques + i);
+    free(execute.deques);
+    free(execute.pending);
+    return ok;
+}
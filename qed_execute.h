@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_EXECUTE_H
+#define LIBQED_EXECUTE_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_ThreadPool;
+struct QED_Batch;
+struct QED_Graph;
+struct QED_Profile;
+struct QED_ResourceLimits;
+struct QED_Stats;
+
+/* What happens once a callback returns non-zero. */
+enum QED_ErrorMode {
+    /** Every callback runs regardless. */
+    QED_eContinueAll,
+    /** Nothing that depends on the failed dep, directly or indirectly, runs.
+     * Deps which do not depend on it keep running.
+     */
+    QED_eSkipDependents,
+    /** No more callbacks start. Those already running are allowed to finish.
+     */
+    QED_eStopAll
+};
+
+/* How each dep ended. */
+enum QED_Status {
+    /** The callback never started, because execution stopped or the dep is
+     * part of a cycle.
+     */
+    QED_eCancelled,
+    QED_eOk,
+    /** The callback returned non-zero. */
+    QED_eFailed,
+    /** Not run, because something it depends on failed or was skipped. */
+    QED_eSkipped
+};
+
+struct QED_ExecuteOptions{
+    /** Passed as the action_data of every callback. */
+    void *action_data;
+    /** If not NULL, receives the return value of every callback. Deps with
+     * no callback, or which did not run, get zero.
+     */
+    int *results;
+    /** If not NULL, receives the status of every dep, in the same order as
+     * the results.
+     */
+    enum QED_Status *status;
+    /** Defaults to QED_eContinueAll. */
+    enum QED_ErrorMode error_mode;
+    /** If not NULL, the busy and idle time of each worker is added to this.
+     * See qed_stats.h.
+     */
+    struct QED_Stats *stats;
+    /** If not NULL, the run time of every callback of a dep with an id is
+     * recorded in this once execution finishes. Deps that were skipped or
+     * cancelled never ran, so are not recorded. See qed_profile.h.
+     */
+    struct QED_Profile *profile;
+    /** If not NULL, no more callbacks of a resource class run at once than its
+     * limit. A worker that picks up a dep which does not fit sets it aside and
+     * runs other work until there is room. See qed_resource.h.
+     */
+    const struct QED_ResourceLimits *resources;
+    /** Used by QED_ExecuteBatches. If true, each batch is split into one
+     * share per worker, and each worker runs its own share before helping
+     * with the others. So a dep tends to run on the worker that ran the deps
+     * at the same place in earlier batches, which with the locality option of
+     * QED_BatchOptions is the worker that ran its input. QED_ExecuteGraph
+     * already runs deps on the worker that made them ready.
+     */
+    bool affinity;
+};
+
+void QED_InitExecuteOptions(struct QED_ExecuteOptions *options);
+
+/**
+ * @brief Runs the execute callback of every dependency, batch by batch.
+ *
+ * The callbacks in each batch are spread across the workers of the pool, and
+ * no callback in a batch starts until every callback in the previous batch
+ * has returned.
+ *
+ * The results are in the same order as the batches, so the result for
+ * batches[1]->dependencies[0] follows the results for all of batches[0].
+ *
+ * With QED_eSkipDependents, a dep is skipped when one of its dependencies in
+ * an earlier batch failed or was skipped. Dependencies that are not in any of
+ * the batches count as satisfied.
+ *
+ * options may be NULL.
+ *
+ * @return true if every callback returned zero.
+ */
+bool QED_ExecuteBatches(struct QED_ThreadPool *pool,
+    struct QED_Batch **batches,
+    unsigned num_batches,
+    const struct QED_ExecuteOptions *options);
+
+/**
+ * @brief Runs the execute callback of every node in a graph, without batches.
+ *
+ * Each node starts as soon as all of its dependencies have returned. Every
+ * worker has a work-stealing deque. When a node finishes, any dependents that
+ * it made ready are pushed onto the deque of the worker that ran it. Idle
+ * workers steal from the other deques.
+ *
+ * The results are indexed by node, so the result for graph->nodes[i] is
+ * results[i].
+ *
+ * With QED_eSkipDependents, a failure marks everything downstream of it as
+ * skipped straight away, while the rest of the graph is still running. Each
+ * node is marked at most once, so this costs no more than the nodes and edges
+ * that are skipped.
+ *
+ * options may be NULL.
+ *
+ * @return true if every callback returned zero.
+ */
+bool QED_ExecuteGraph(struct QED_ThreadPool *pool,
+    const struct QED_Graph *graph,
+    const struct QED_ExecuteOptions *options);
+
+#endif /* LIBQED_EXECUTE_H */
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_graph.h"
+
+#include "qed_dependency.h"
+#include "qed_stats.h"
+#include "qed_tinyhash.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Grows an array to hold at least `needed` elements. */
+static bool qed_graph_reserve(void **array,
+    unsigned *capacity,
+    unsigned needed,
+    size_t element_size){
+    
+    if(needed > *capacity){
+        unsigned new_capacity = (*capacity < 16) ? 16 : *capacity;
+        void *new_array;
+        while(new_capacity < needed)
+            new_capacity <<= 1;
+        QED_STATS_ALLOC(new_capacity * element_size);
+        if((new_array = realloc(*array, new_capacity * element_size)) == NULL)
+            return false;
+        array[0] = new_array;
+        capacity[0] = new_capacity;
+    }
+    return true;
+}
+
+/* Gets the index of a dependency, adding it to the graph if it is new. */
+static bool qed_graph_index(struct QED_Graph *graph,
+    struct QED_HashTable *indices,
+    unsigned *nodes_capacity,
+    struct QED_Dependency *dep,
+    unsigned *out_index){
+    
+    qed_hashdata_t index;
+    if(QED_HashTableGet(indices, (qed_hashkey_t)dep, &index)){
+        out_index[0] = (unsigned)index;
+        return true;
+    }
+    
+    if(!qed_graph_reserve((void**)&graph->nodes, nodes_capacity,
+        graph->num_nodes + 1, sizeof(void*)))
+        return false;
+    
+    index = graph->num_nodes++;
+    graph->nodes[index] = dep;
+    QED_HashTableInsert(indices, (qed_hashkey_t)dep, index, &index);
+    out_index[0] = graph->num_nodes - 1;
+    return true;
+}
+
+/* Grows an array that follows the capacity of another, if it changed or was
+ * never allocated. */
+static bool qed_graph_follow(void **array,
+    bool grow,
+    unsigned count,
+    size_t element_size){
+    
+    void *new_array;
+    if(!grow && array[0] != NULL)
+        return true;
+    QED_STATS_ALLOC(count * element_size);
+    if((new_array = realloc(*array, count * element_size)) == NULL)
+        return false;
+    array[0] = new_array;
+    return true;
+}
+
+/* Compiles into the arrays the graph already has. The indices are left in
+ * the table. */
+static bool qed_compile_graph(struct QED_Graph *graph,
+    struct QED_HashTable *indices,
+    struct QED_Dependency **deps,
+    unsigned num_deps){
+    
+    const unsigned old_nodes_capacity = graph->nodes_capacity,
+        old_edges_capacity = graph->edges_capacity;
+    unsigned i;
+    
+    graph->num_nodes = graph->num_edges = 0;
+    if(!QED_HashTableReserve(indices, num_deps))
+        return false;
+    
+    for(i = 0; i < num_deps; i++){
+        unsigned unused;
+        if(!qed_graph_index(graph, indices, &graph->nodes_capacity, deps[i],
+            &unused))
+            return false;
+    }
+    
+    /* Walk the graph breadth-first. Since nodes are visited in index order,
+     * the predecessor lists can be written out as we go. */
+    for(i = 0; i < graph->num_nodes; i++){
+        struct QED_Dependency *const dep = graph->nodes[i];
+        const unsigned start = graph->num_edges;
+        unsigned e;
+        
+        if(!qed_graph_reserve((void**)&graph->preds, &graph->edges_capacity,
+            start + dep->num_dependencies, sizeof(unsigned)))
+            return false;
+        
+        for(e = 0; e < dep->num_dependencies; e++){
+            unsigned index;
+            if(!qed_graph_index(graph, indices, &graph->nodes_capacity,
+                dep->dependencies[e], &index))
+                return false;
+            graph->preds[start + e] = index;
+        }
+        graph->num_edges += dep->num_dependencies;
+    }
+    
+    {
+        const unsigned num_nodes = graph->num_nodes;
+        const bool grow_nodes = graph->nodes_capacity != old_nodes_capacity,
+            grow_edges = graph->edges_capacity != old_edges_capacity;
+        unsigned edge = 0;
+        
+        if(!qed_graph_follow((void**)&graph->pred_offsets, grow_nodes,
+                graph->nodes_capacity + 1, sizeof(unsigned)) ||
+            !qed_graph_follow((void**)&graph->succ_offsets, grow_nodes,
+                graph->nodes_capacity + 1, sizeof(unsigned)) ||
+            !qed_graph_follow((void**)&graph->succs, grow_edges,
+                graph->edges_capacity + 1, sizeof(unsigned)))
+            return false;
+        memset(graph->succ_offsets, 0, (num_nodes + 1) * sizeof(unsigned));
+        
+        /* Count the successors of every node, shifted up by one so that the
+         * prefix sum leaves the start of each row in succ_offsets. */
+        for(i = 0; i < num_nodes; i++){
+            const unsigned num_preds = graph->nodes[i]->num_dependencies;
+            unsigned e;
+            graph->pred_offsets[i] = edge;
+            for(e = 0; e < num_preds; e++)
+                graph->succ_offsets[graph->preds[edge + e] + 1]++;
+            edge += num_preds;
+        }
+        graph->pred_offsets[num_nodes] = edge;
+        assert(edge == graph->num_edges);
+        
+        for(i = 0; i < num_nodes; i++)
+            graph->succ_offsets[i + 1] += graph->succ_offsets[i];
+        
+        /* Fill the rows, using the row starts as cursors. Nodes are visited in
+         * order, so every successor list ends up sorted. */
+        for(i = 0; i < num_nodes; i++){
+            unsigned e;
+            for(e = graph->pred_offsets[i]; e < graph->pred_offsets[i + 1]; e++)
+                graph->succs[graph->succ_offsets[graph->preds[e]]++] = i;
+        }
+        
+        /* Each cursor now points at the start of the next row. */
+        for(i = num_nodes; i != 0; i--)
+            graph->succ_offsets[i] = graph->succ_offsets[i - 1];
+        graph->succ_offsets[0] = 0;
+    }
+    
+    return true;
+}
+
+bool QED_CompileGraph(struct QED_Graph *out_graph,
+    struct QED_Dependency **deps,
+    unsigned num_deps){
+    
+    struct QED_HashTable *const indices = calloc(1, QED_HASH_TABLE_SIZE);
+    bool ok;
+    
+    memset(out_graph, 0, sizeof(struct QED_Graph));
+    ok = indices != NULL && qed_compile_graph(out_graph, indices, deps, num_deps);
+    
+    if(indices != NULL){
+        QED_FreeHashTable(indices, NULL);
+        free(indices);
+    }
+    if(!ok)
+        QED_FreeGraph(out_graph);
+    return ok;
+}
+
+bool QED_RecompileGraph(struct QED_Graph *graph,
+    struct QED_HashTable *indices,
+    struct QED_Dependency **deps,
+    unsigned num_deps){
+    
+    unsigned i;
+    
+    /* The marks are sized for the old graph, and the nodes will no longer
+     * point to any deps the graph built. */
+    free(graph->marks);
+    graph->marks = NULL;
+    graph->mark_generation = 0;
+    free(graph->built_deps);
+    free(graph->built_edges);
+    graph->built_deps = NULL;
+    graph->built_edges = NULL;
+    
+    if(!qed_compile_graph(graph, indices, deps, num_deps)){
+        QED_FreeHashTable(indices, NULL);
+        QED_FreeGraph(graph);
+        return false;
+    }
+    
+    /* Removing each node is cheaper than clearing a table that an earlier,
+     * larger graph may have grown. */
+    for(i = 0; i < graph->num_nodes; i++){
+        qed_hashdata_t unused;
+        QED_HashTableRemove(indices, (qed_hashkey_t)graph->nodes[i], &unused);
+    }
+    return true;
+}
+
+unsigned *QED_GraphScratch(struct QED_Graph *graph, unsigned long count){
+    if(count > graph->scratch_size){
+        unsigned *scratch;
+        QED_STATS_ALLOC(count * sizeof(unsigned));
+        if((scratch = malloc(count * sizeof(unsigned))) == NULL)
+            return NULL;
+        free(graph->scratch);
+        graph->scratch = scratch;
+        graph->scratch_size = count;
+    }
+    return graph->scratch;
+}
+
+unsigned *QED_GraphMarks(struct QED_Graph *graph, unsigned *out_generation){
+    
+    /* Start again from zero when the generation would wrap. */
+    if(graph->marks == NULL ||
+        graph->mark_generation > UINT_MAX - (QED_GRAPH_MARK_RANGE * 2)){
+        
+        if(graph->marks == NULL){
+            QED_STATS_ALLOC((graph->num_nodes + 1) * sizeof(unsigned));
+            graph->marks = calloc(graph->num_nodes + 1, sizeof(unsigned));
+            if(graph->marks == NULL)
+                return NULL;
+        }
+        else{
+            memset(graph->marks, 0, graph->num_nodes * sizeof(unsigned));
+        }
+        graph->mark_generation = 0;
+    }
+    
+    graph->mark_generation += QED_GRAPH_MARK_RANGE;
+    out_generation[0] = graph->mark_generation;
+    return graph->marks;
+}
+
+#define QED_GRAPH_FNV_OFFSET 0xCBF29CE484222325ull
+#define QED_GRAPH_FNV_PRIME 0x100000001B3ull
+
+/* FNV-1a over whole words, in four lanes so that the multiplies overlap. */
+static void qed_graph_hash_words(unsigned long long *lanes,
+    const unsigned *words,
+    unsigned long count){
+    
+    unsigned long i;
+    for(i = 0; i + 4 <= count; i += 4){
+        lanes[0] = (lanes[0] ^ words[i]) * QED_GRAPH_FNV_PRIME;
+        lanes[1] = (lanes[1] ^ words[i + 1]) * QED_GRAPH_FNV_PRIME;
+        lanes[2] = (lanes[2] ^ words[i + 2]) * QED_GRAPH_FNV_PRIME;
+        lanes[3] = (lanes[3] ^ words[i + 3]) * QED_GRAPH_FNV_PRIME;
+    }
+    for(; i < count; i++)
+        lanes[0] = (lanes[0] ^ words[i]) * QED_GRAPH_FNV_PRIME;
+}
+
+unsigned long long QED_GraphFingerprint(const struct QED_Graph *graph){
+    
+    unsigned long long lanes[4], hash;
+    unsigned i;
+    
+    for(i = 0; i < 4; i++)
+        lanes[i] = QED_GRAPH_FNV_OFFSET + i;
+    lanes[0] = (lanes[0] ^ graph->num_nodes) * QED_GRAPH_FNV_PRIME;
+    lanes[1] = (lanes[1] ^ graph->num_edges) * QED_GRAPH_FNV_PRIME;
+    
+    /* The preds and their offsets are the whole shape. The succs follow from
+     * them. */
+    qed_graph_hash_words(lanes, graph->pred_offsets, graph->num_nodes + 1);
+    qed_graph_hash_words(lanes, graph->preds, graph->num_edges);
+    
+    /* Fold the lanes together and mix the result, so every bit of the input
+     * affects every bit of the hash. */
+    hash = lanes[0];
+    for(i = 1; i < 4; i++)
+        hash = (hash ^ lanes[i]) * QED_GRAPH_FNV_PRIME;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return (hash == 0) ? 1 : hash;
+}
+
+unsigned long QED_GraphSuccessorCount(const struct QED_Graph *graph,
+    const unsigned *nodes,
+    unsigned num_nodes){
+    
+    unsigned long count = 0;
+    unsigned i;
+    for(i = 0; i < num_nodes; i++)
+        count += graph->succ_offsets[nodes[i] + 1] - graph->succ_offsets[nodes[i]];
+    return count;
+}
+
+void QED_FreeGraph(struct QED_Graph *graph){
+    free(graph->scratch);
+    free(graph->marks);
+    free(graph->nodes);
+    free(graph->pred_offsets);
+    free(graph->preds);
+    free(graph->succ_offsets);
+    free(graph->succs);
+    free(graph->built_deps);
+    free(graph->built_edges);
+    memset(graph, 0, sizeof(struct QED_Graph));
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_GRAPH_H
+#define LIBQED_GRAPH_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Dependency;
+struct QED_HashTable;
+
+/* A dependency graph flattened into dense indices.
+ *
+ * Every dependency reachable from the inputs gets an index in [0, num_nodes).
+ * Edges are stored in compressed sparse rows in both directions, so the
+ * predecessors of node i are preds[pred_offsets[i]] to
+ * preds[pred_offsets[i+1]-1], and likewise for successors.
+ *
+ * A graph is meant to be compiled once and then scheduled many times. The
+ * schedulers do not hash anything, and only allocate their output. Scratch
+ * memory is kept in the graph between calls, so only one thread at a time may
+ * schedule a particular graph.
+ */
+struct QED_Graph{
+    unsigned num_nodes;
+    unsigned num_edges;
+    
+    /* Maps indices back to the dependencies. */
+    struct QED_Dependency **nodes;
+    
+    unsigned *pred_offsets; /* num_nodes + 1 entries. */
+    unsigned *preds; /* num_edges entries. */
+    
+    unsigned *succ_offsets; /* num_nodes + 1 entries. */
+    unsigned *succs; /* num_edges entries. */
+    
+    /* See QED_GraphScratch. */
+    unsigned *scratch;
+    unsigned long scratch_size;
+    
+    /* See QED_GraphMarks. */
+    unsigned *marks;
+    unsigned mark_generation;
+    
+    /* The number of nodes and edges the arrays have room for, so that
+     * QED_RecompileGraph can reuse them. */
+    unsigned nodes_capacity, edges_capacity;
+    
+    /* Only set for graphs from QED_BuildGraph, which own the deps that nodes
+     * points to, and their dependency lists. See qed_builder.h. */
+    struct QED_Dependency *built_deps;
+    struct QED_Dependency **built_edges;
+};
+
+/* The number of mark values each call to QED_GraphMarks makes available. */
+#define QED_GRAPH_MARK_RANGE 16
+
+/**
+ * @brief Builds the indexed form of a dependency graph.
+ *
+ * The inputs are given the first indices, in order, and then every other
+ * dependency in breadth-first order. Duplicate inputs are ignored.
+ *
+ * @return false if an allocation failed.
+ */
+bool QED_CompileGraph(struct QED_Graph *out_graph,
+    struct QED_Dependency **deps,
+    unsigned num_deps);
+
+/**
+ * @brief Compiles a graph into the memory of a graph compiled before.
+ *
+ * This is the same as QED_CompileGraph, except that the arrays and scratch
+ * memory of the graph are reused, and only grow when a larger graph needs
+ * them. Together with reusing the hash table, compiling many small graphs one
+ * after another allocates nothing once the memory has grown to fit them.
+ *
+ * graph must be zeroed, or from QED_CompileGraph, QED_BuildGraph or an
+ * earlier call. indices must be an empty table of QED_HASH_TABLE_SIZE bytes,
+ * and is left empty.
+ *
+ * @return false if an allocation failed, in which case the graph is freed.
+ */
+bool QED_RecompileGraph(struct QED_Graph *graph,
+    struct QED_HashTable *indices,
+    struct QED_Dependency **deps,
+    unsigned num_deps);
+
+/**
+ * @brief Gets scratch memory owned by the graph.
+ *
+ * The memory is kept until the graph is freed, and only reallocated when a
+ * larger amount is requested. The contents are not preserved.
+ *
+ * @return At least count unsigneds, or NULL if the allocation failed.
+ */
+unsigned *QED_GraphScratch(struct QED_Graph *graph, unsigned long count);
+
+/**
+ * @brief Gets a mark for every node, kept by the graph between calls.
+ *
+ * Every mark is less than the returned generation, and the caller may set
+ * marks to anything from the generation to generation + QED_GRAPH_MARK_RANGE
+ * - 1. The generation is a multiple of QED_GRAPH_MARK_RANGE, so the low bits
+ * can be used as flags. This lets a search of part of the graph tell which
+ * nodes it has seen without clearing an array for the whole graph.
+ *
+ * @return The marks, or NULL if the allocation failed.
+ */
+unsigned *QED_GraphMarks(struct QED_Graph *graph, unsigned *out_generation);
+
+/**
+ * @brief Hashes the shape of a graph.
+ *
+ * The hash covers the number of nodes and the dependencies of each node, by
+ * index. Graphs compiled from deps with the same shape, given as inputs in
+ * the same order, have the same fingerprint. This reads each node and edge
+ * once, and does not depend on which deps the nodes are. It is never zero.
+ */
+unsigned long long QED_GraphFingerprint(const struct QED_Graph *graph);
+
+/**
+ * @brief Counts the dependents of a list of nodes.
+ */
+unsigned long QED_GraphSuccessorCount(const struct QED_Graph *graph,
+    const unsigned *nodes,
+    unsigned num_nodes);
+
+void QED_FreeGraph(struct QED_Graph *graph);
+
+#endif /* LIBQED_GRAPH_H */
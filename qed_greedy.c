@@ -10,9 +10,14 @@
 
 #include "qed_batch.h"
 #include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_pool.h"
+#include "qed_resource.h"
+#include "qed_stats.h"
 #include "qed_tinyhash.h"
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 
 struct qed_greedy_arg{
@@ -20,6 +25,7 @@ struct qed_greedy_arg{
     struct QED_HashTable *satisfied;
     struct QED_Dependency **dest;
     unsigned max_deps, found_deps;
+    unsigned long visited;
 };
 
 #ifndef NDEBUG
@@ -30,6 +36,7 @@ struct qed_greedy_arg{
 
 static int qed_greedy_iterator(int accum, void *arg, qed_hashkey_t key, qed_hashdata_t data){
     struct qed_greedy_arg *const dep_arg = (struct qed_greedy_arg*)arg;
+    dep_arg->visited++;
     if(data == 0){
         struct QED_Dependency *const dep = (struct QED_Dependency *)key;
         const unsigned generation = dep_arg->generation;
@@ -39,8 +46,9 @@ static int qed_greedy_iterator(int accum, void *arg, qed_hashkey_t key, qed_hash
         qed_hashdata_t built;
         
         for(i = 0; i < dep->num_dependencies; i++){
-            if(QED_HashTableGet(dep_arg->satisfied, dep->dependencies[i], &built) &&
-                built == 0 ||
+            if((QED_HashTableGet(dep_arg->satisfied,
+                (qed_hashkey_t)dep->dependencies[i], &built) &&
+                built == 0) ||
                 built >= generation){
                 
                 assert(built == generation || built == 0);
@@ -50,7 +58,8 @@ static int qed_greedy_iterator(int accum, void *arg, qed_hashkey_t key, qed_hash
         }
         
         {
-            const bool set = QED_HashTableSet(dep_arg->satisfied, dep, generation);
+            const bool set = QED_HashTableSet(dep_arg->satisfied,
+                (qed_hashkey_t)dep, generation);
             (void)set;
             assert(set);
         }
@@ -64,6 +73,366 @@ static int qed_greedy_iterator(int accum, void *arg, qed_hashkey_t key, qed_hash
     return accum;
 }
 
+/* Fills a batch from the ready queue between head and tail, keeping to the
+ * resource limits. Returns the end of the batch. The nodes that were passed
+ * over are moved to just after the batch, so they stay at the front of the
+ * queue. */
+static unsigned qed_greedy_fill(const struct QED_Graph *graph,
+    const struct QED_ResourceLimits *resources,
+    unsigned *queue,
+    unsigned head,
+    unsigned tail,
+    unsigned max_batch_size){
+    
+    unsigned usage[QED_MAX_RESOURCE_CLASSES], skipped[QED_RESOURCE_MAX_SKIPPED];
+    unsigned end = head, next = head, num_skipped = 0, i;
+    
+    QED_ClearResources(usage);
+    while(next != tail && end - head < max_batch_size &&
+        num_skipped < QED_RESOURCE_MAX_SKIPPED){
+        
+        const unsigned node = queue[next++];
+        if(QED_ReserveResources(resources, usage, graph->nodes[node]->resources))
+            queue[end++] = node;
+        else
+            skipped[num_skipped++] = node;
+    }
+    
+    for(i = 0; i < num_skipped; i++)
+        queue[end + i] = skipped[i];
+    return end;
+}
+
+bool QED_ScheduleGreedy(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned *const pending = (scratch != NULL) ? scratch :
+        malloc(QED_GREEDY_SCRATCH(num_nodes) * sizeof(unsigned));
+    unsigned head = 0, tail = 0, num_batches = 0, i;
+    
+    if(pending == NULL)
+        return false;
+    
+    if(max_batch_size == 0)
+        max_batch_size = num_nodes;
+    
+    /* The output doubles as the ready queue. Everything before head has been
+     * scheduled, and everything from head to tail is ready. */
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        if(pending[i] == 0)
+            out_order[tail++] = i;
+    }
+    
+    while(head != tail){
+        const unsigned end = (resources != NULL) ?
+            qed_greedy_fill(graph, resources, out_order, head, tail, max_batch_size) :
+            ((tail - head > max_batch_size) ? (head + max_batch_size) : tail);
+        
+        out_offsets[num_batches++] = head;
+        QED_STATS_BATCH((end - head) +
+            QED_GraphSuccessorCount(graph, out_order + head, end - head));
+        
+        /* Nodes that become ready here are queued after end, so they cannot
+         * join the batch that satisfied them. */
+        for(; head < end; head++){
+            const unsigned node = out_order[head];
+            unsigned e;
+            for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+                const unsigned succ = graph->succs[e];
+                assert(pending[succ] != 0);
+                if(--pending[succ] == 0)
+                    out_order[tail++] = succ;
+            }
+        }
+    }
+    out_offsets[num_batches] = head;
+    
+    if(scratch == NULL)
+        free(pending);
+    out_num_batches[0] = num_batches;
+    
+    /* Any nodes which were never queued are part of a cycle. */
+    return head == num_nodes;
+}
+
+/* Shared by the workers of QED_ScheduleGreedyParallel. Only worker zero
+ * writes the queue positions and the counts of batches, between barriers. */
+struct qed_greedy_parallel{
+    struct QED_ThreadPool *pool;
+    const struct QED_Graph *graph;
+    const struct QED_ResourceLimits *resources;
+    unsigned max_batch_size, num_workers;
+    
+    /* The serial queue position of the edge that made each node ready, which
+     * is the latest one that reached it. */
+    atomic_ullong *owners;
+    atomic_uint *pending;
+    /* What each worker found, then where it writes. */
+    unsigned *counts;
+    
+    unsigned *order, *offsets;
+    /* The batch to expand in parallel is head to end. */
+    unsigned head, end, tail, num_batches;
+    bool done;
+};
+
+/* Gets the part of begin to end that a worker handles. */
+static void qed_greedy_parallel_chunk(unsigned begin,
+    unsigned end,
+    unsigned worker,
+    unsigned num_workers,
+    unsigned *out_begin,
+    unsigned *out_end){
+    
+    const unsigned long long length = end - begin;
+    out_begin[0] = begin + (unsigned)((length * worker) / num_workers);
+    out_end[0] = begin + (unsigned)((length * (worker + 1)) / num_workers);
+}
+
+/* Turns the count of each worker into where it starts writing, from base.
+ * Returns the end of what is written. */
+static unsigned qed_greedy_parallel_prefix(unsigned *counts,
+    unsigned num_workers,
+    unsigned base){
+    
+    unsigned i;
+    for(i = 0; i < num_workers; i++){
+        const unsigned count = counts[i];
+        counts[i] = base;
+        base += count;
+    }
+    return base;
+}
+
+/* The key of an edge is the position of its source in the queue, then its
+ * place among the edges of the source. One thread would queue the dependents
+ * of a batch in the order of the key of the edge that made them ready. */
+static unsigned long long qed_greedy_parallel_key(const struct QED_Graph *graph,
+    unsigned position,
+    unsigned node,
+    unsigned edge){
+    return (((unsigned long long)position) << 32) |
+        (edge - graph->succ_offsets[node]);
+}
+
+/* Run by worker zero. Schedules batches alone until one is large enough to
+ * be split between the workers, or until the queue is empty. */
+static void qed_greedy_parallel_advance(struct qed_greedy_parallel *state){
+    
+    const struct QED_Graph *const graph = state->graph;
+    unsigned *const order = state->order;
+    unsigned head = state->head, tail = state->tail;
+    
+    while(head != tail){
+        const unsigned end = (state->resources != NULL) ?
+            qed_greedy_fill(graph, state->resources, order, head, tail,
+                state->max_batch_size) :
+            ((tail - head > state->max_batch_size) ?
+                (head + state->max_batch_size) : tail);
+        const unsigned long edges =
+            QED_GraphSuccessorCount(graph, order + head, end - head);
+        
+        state->offsets[state->num_batches++] = head;
+        QED_STATS_BATCH((end - head) + edges);
+        
+        if(edges >= QED_GREEDY_PARALLEL_MIN_EDGES){
+            state->head = head;
+            state->end = end;
+            state->tail = tail;
+            return;
+        }
+        
+        for(; head < end; head++){
+            const unsigned node = order[head];
+            unsigned e;
+            for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+                const unsigned succ = graph->succs[e];
+                /* No other worker is running, so this need not be atomic. */
+                const unsigned pending = atomic_load_explicit(state->pending + succ,
+                    memory_order_relaxed) - 1;
+                atomic_store_explicit(state->pending + succ, pending,
+                    memory_order_relaxed);
+                if(pending == 0)
+                    order[tail++] = succ;
+            }
+        }
+    }
+    state->head = head;
+    state->tail = tail;
+    state->done = true;
+}
+
+/* Counts the predecessors of every node, and queues the roots in order. */
+static void qed_greedy_parallel_start(struct qed_greedy_parallel *state,
+    unsigned worker){
+    
+    const struct QED_Graph *const graph = state->graph;
+    unsigned begin, end, i, count = 0;
+    
+    qed_greedy_parallel_chunk(0, graph->num_nodes, worker, state->num_workers,
+        &begin, &end);
+    for(i = begin; i < end; i++){
+        const unsigned num_preds = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        atomic_init(state->pending + i, num_preds);
+        atomic_init(state->owners + i, 0);
+        if(num_preds == 0)
+            count++;
+    }
+    state->counts[worker] = count;
+    QED_ThreadPoolBarrier(state->pool);
+    
+    if(worker == 0){
+        state->tail = qed_greedy_parallel_prefix(state->counts,
+            state->num_workers, 0);
+    }
+    QED_ThreadPoolBarrier(state->pool);
+    
+    count = state->counts[worker];
+    for(i = begin; i < end; i++){
+        if(graph->pred_offsets[i + 1] == graph->pred_offsets[i])
+            state->order[count++] = i;
+    }
+}
+
+/* Expands the batch from head to end on every worker. */
+static void qed_greedy_parallel_expand(struct qed_greedy_parallel *state,
+    unsigned worker){
+    
+    const struct QED_Graph *const graph = state->graph;
+    const unsigned *const order = state->order;
+    unsigned begin, end, i, e, count = 0;
+    
+    qed_greedy_parallel_chunk(state->head, state->end, worker,
+        state->num_workers, &begin, &end);
+    
+    /* Every dependent keeps the latest key that reached it. Since keys only
+     * grow, an owner left over from an earlier batch is always replaced. */
+    for(i = begin; i < end; i++){
+        const unsigned node = order[i];
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            const unsigned long long key =
+                qed_greedy_parallel_key(graph, i, node, e);
+            atomic_ullong *const owner = state->owners + succ;
+            unsigned long long current =
+                atomic_load_explicit(owner, memory_order_relaxed);
+            
+            while(current < key && !atomic_compare_exchange_weak_explicit(owner,
+                &current, key, memory_order_relaxed, memory_order_relaxed)){}
+            atomic_fetch_sub_explicit(state->pending + succ, 1,
+                memory_order_relaxed);
+        }
+    }
+    QED_ThreadPoolBarrier(state->pool);
+    
+    /* Each ready dependent is queued by the edge that owns it, so the workers
+     * queue them in the order of their keys. */
+    for(i = begin; i < end; i++){
+        const unsigned node = order[i];
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            if(atomic_load_explicit(state->pending + succ, memory_order_relaxed) == 0 &&
+                atomic_load_explicit(state->owners + succ, memory_order_relaxed) ==
+                    qed_greedy_parallel_key(graph, i, node, e))
+                count++;
+        }
+    }
+    state->counts[worker] = count;
+    QED_ThreadPoolBarrier(state->pool);
+    
+    if(worker == 0){
+        state->tail = qed_greedy_parallel_prefix(state->counts,
+            state->num_workers, state->tail);
+        state->head = state->end;
+    }
+    QED_ThreadPoolBarrier(state->pool);
+    
+    count = state->counts[worker];
+    for(i = begin; i < end; i++){
+        const unsigned node = order[i];
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            if(atomic_load_explicit(state->pending + succ, memory_order_relaxed) == 0 &&
+                atomic_load_explicit(state->owners + succ, memory_order_relaxed) ==
+                    qed_greedy_parallel_key(graph, i, node, e))
+                state->order[count++] = succ;
+        }
+    }
+}
+
+static void qed_greedy_parallel_job(void *arg, unsigned worker){
+    
+    struct qed_greedy_parallel *const state = (struct qed_greedy_parallel*)arg;
+    
+    qed_greedy_parallel_start(state, worker);
+    for(;;){
+        QED_ThreadPoolBarrier(state->pool);
+        if(worker == 0)
+            qed_greedy_parallel_advance(state);
+        QED_ThreadPoolBarrier(state->pool);
+        if(state->done)
+            return;
+        qed_greedy_parallel_expand(state, worker);
+    }
+}
+
+bool QED_ScheduleGreedyParallel(struct QED_ThreadPool *pool,
+    const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    const unsigned num_nodes = graph->num_nodes,
+        num_workers = QED_ThreadPoolSize(pool);
+    unsigned *memory;
+    struct qed_greedy_parallel state;
+    
+    if(num_workers == 1){
+        return QED_ScheduleGreedy(graph, max_batch_size, resources, scratch,
+            out_order, out_offsets, out_num_batches);
+    }
+    
+    memory = (scratch != NULL) ? scratch :
+        malloc(QED_GREEDY_PARALLEL_SCRATCH(num_nodes, num_workers) *
+            sizeof(unsigned));
+    if(memory == NULL)
+        return false;
+    
+    /* The owners go first, so they are aligned. */
+    state.pool = pool;
+    state.graph = graph;
+    state.resources = resources;
+    state.max_batch_size = (max_batch_size == 0) ? num_nodes : max_batch_size;
+    state.num_workers = num_workers;
+    state.owners = (atomic_ullong*)memory;
+    state.pending = (atomic_uint*)(memory + (((unsigned long)num_nodes + 1) * 2));
+    state.counts = (unsigned*)(state.pending + num_nodes + 1);
+    state.order = out_order;
+    state.offsets = out_offsets;
+    state.head = state.end = state.tail = state.num_batches = 0;
+    state.done = false;
+    
+    QED_RunThreadPool(pool, qed_greedy_parallel_job, &state);
+    out_offsets[state.num_batches] = state.head;
+    
+    if(scratch == NULL)
+        free(memory);
+    out_num_batches[0] = state.num_batches;
+    
+    /* Any nodes which were never queued are part of a cycle. */
+    return state.head == num_nodes;
+}
+
 bool QED_CalculateBatchesGreedy(struct QED_Batch **in_out_batches,
     unsigned *out_num_batches,
     struct QED_HashTable *satisfied,
@@ -82,10 +451,16 @@ bool QED_CalculateBatchesGreedy(struct QED_Batch **in_out_batches,
         in_out_batches[num_batches] = malloc(sizeof(struct QED_Batch));
         arg.dest = in_out_batches[num_batches]->dependencies = calloc(max_batch_size, sizeof(void*));
         arg.found_deps = 0;
+        arg.visited = 0;
         {
             const int num = QED_HashTableIterate(satisfied, 0, &arg, qed_greedy_iterator);
             
             if(num == 0){
+                /* Nothing more can be satisfied, so there is a cycle. */
+                do{
+                    free(in_out_batches[num_batches]->dependencies);
+                    free(in_out_batches[num_batches]);
+                }while(num_batches-- != 0);
                 return false;
             }
             else if(num < 0){
@@ -97,6 +472,7 @@ bool QED_CalculateBatchesGreedy(struct QED_Batch **in_out_batches,
                 in_out_batches[num_batches]->num_dependencies = num;
             }
         }
+        QED_STATS_BATCH(arg.visited);
         num_satisfied += in_out_batches[num_batches]->num_dependencies;
         num_batches++;
         assert(num_satisfied <= num_deps);
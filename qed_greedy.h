@@ -15,7 +15,83 @@
 struct QED_HashTable;
 struct QED_Dependency;
 struct QED_Batch;
+struct QED_Graph;
+struct QED_ResourceLimits;
+struct QED_ThreadPool;
 
+#define QED_GREEDY_SCRATCH(NUM_NODES) ((unsigned long)(NUM_NODES) + 1)
+
+/**
+ * @brief Calculates greedy batches in O(V+E).
+ *
+ * This is Kahn's algorithm with a FIFO ready queue. Each node keeps a count of
+ * unscheduled predecessors, and is queued when the count reaches zero. Each
+ * batch takes up to max_batch_size nodes from the front of the queue, so
+ * nodes left over from a full batch are always taken before nodes that became
+ * ready later. A max_batch_size of zero means batches are unlimited.
+ *
+ * If resources is not NULL, a node that would take a batch over the limit of
+ * one of its resource classes is left at the front of the queue for the next
+ * batch, and the nodes behind it are tried instead.
+ *
+ * The nodes are written to out_order in batch order, and batch i consists of
+ * out_order[out_offsets[i]] to out_order[out_offsets[i+1]-1]. Both arrays
+ * must have room for graph->num_nodes + 1 entries.
+ *
+ * scratch must have room for QED_GREEDY_SCRATCH(graph->num_nodes) entries, or
+ * be NULL to allocate it internally.
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_ScheduleGreedy(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches);
+
+/* Batches with fewer dependents than this are expanded by one thread, since
+ * waiting for the other workers would take longer. */
+#define QED_GREEDY_PARALLEL_MIN_EDGES 4096
+
+#define QED_GREEDY_PARALLEL_SCRATCH(NUM_NODES, NUM_WORKERS) \
+    ((((unsigned long)(NUM_NODES) + 1) * 3) + (NUM_WORKERS) + 1)
+
+/**
+ * @brief Calculates the same batches as QED_ScheduleGreedy, using every
+ * worker of a pool.
+ *
+ * The workers count the predecessors of every node together, and then go
+ * through the batches in order. A batch with at least
+ * QED_GREEDY_PARALLEL_MIN_EDGES dependents is split between the workers, which
+ * decrement the counts of its dependents atomically. The nodes this makes
+ * ready are queued in the order one thread would have queued them, so the
+ * result is identical. Smaller batches are done by worker zero alone.
+ *
+ * scratch must have room for QED_GREEDY_PARALLEL_SCRATCH(graph->num_nodes,
+ * QED_ThreadPoolSize(pool)) entries and be aligned to eight bytes, or be NULL
+ * to allocate it internally. The other arguments are as QED_ScheduleGreedy.
+ * This runs a job on the pool, so it cannot be called from inside one.
+ */
+bool QED_ScheduleGreedyParallel(struct QED_ThreadPool *pool,
+    const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches);
+
+/**
+ * @brief Calculates greedy batches by repeatedly iterating the table.
+ *
+ * This is the original greedy implementation, which is O(batches * (V+E)).
+ * It is kept to compare against QED_ScheduleGreedy.
+ *
+ * @return false if there is a cycle, in which case every batch it allocated
+ *   has been freed.
+ */
 bool QED_CalculateBatchesGreedy(struct QED_Batch **in_out_batches,
     unsigned *out_num_batches,
     struct QED_HashTable *satisfied,
@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_incremental.h"
+
+#include "qed_batch.h"
+#include "qed_graph.h"
+#include "qed_greedy.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QED_INCREMENTAL_MIN_CAPACITY 4
+
+struct qed_incremental_edges{
+    unsigned *nodes;
+    unsigned count, capacity;
+};
+
+struct qed_incremental_node{
+    struct QED_Dependency *dep; /* NULL if the node was removed. */
+    unsigned level; /* Index of the batch the node is in. */
+    unsigned slot; /* Index of the node in its batch. */
+    unsigned mark; /* Generation of the last search that reached the node. */
+    bool queued;
+    struct qed_incremental_edges preds, succs;
+};
+
+struct qed_incremental_level{
+    struct QED_Dependency **deps;
+    unsigned *nodes;
+    unsigned count, capacity;
+};
+
+/* Grows an array to hold at least count elements of size bytes. */
+static bool qed_incremental_reserve(void **array,
+    unsigned *capacity,
+    unsigned count,
+    size_t size){
+    
+    unsigned new_capacity = capacity[0];
+    void *grown;
+    
+    if(count <= new_capacity)
+        return true;
+    if(new_capacity < QED_INCREMENTAL_MIN_CAPACITY)
+        new_capacity = QED_INCREMENTAL_MIN_CAPACITY;
+    while(new_capacity < count)
+        new_capacity *= 2;
+    
+    if((grown = realloc(array[0], (size_t)new_capacity * size)) == NULL)
+        return false;
+    array[0] = grown;
+    capacity[0] = new_capacity;
+    return true;
+}
+
+static bool qed_incremental_edges_add(struct qed_incremental_edges *edges,
+    unsigned node){
+    
+    if(!qed_incremental_reserve((void**)&edges->nodes, &edges->capacity,
+        edges->count + 1, sizeof(unsigned)))
+        return false;
+    edges->nodes[edges->count++] = node;
+    return true;
+}
+
+static bool qed_incremental_edges_find(const struct qed_incremental_edges *edges,
+    unsigned node,
+    unsigned *out_index){
+    
+    unsigned i;
+    for(i = 0; i < edges->count; i++){
+        if(edges->nodes[i] == node){
+            out_index[0] = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool qed_incremental_edges_remove(struct qed_incremental_edges *edges,
+    unsigned node){
+    
+    unsigned i;
+    if(!qed_incremental_edges_find(edges, node, &i))
+        return false;
+    edges->nodes[i] = edges->nodes[--edges->count];
+    return true;
+}
+
+static bool qed_incremental_is_node(const struct QED_Incremental *inc,
+    unsigned node){
+    return node < inc->num_nodes && inc->nodes[node].dep != NULL;
+}
+
+/* Adds a node to the batch given by its level. */
+static bool qed_incremental_level_add(struct QED_Incremental *inc,
+    unsigned node){
+    
+    struct qed_incremental_node *const n = inc->nodes + node;
+    struct qed_incremental_level *level;
+    
+    if(n->level >= inc->levels_capacity){
+        const unsigned old_capacity = inc->levels_capacity;
+        if(!qed_incremental_reserve((void**)&inc->levels,
+            &inc->levels_capacity, n->level + 1,
+            sizeof(struct qed_incremental_level)))
+            return false;
+        memset(inc->levels + old_capacity, 0, (inc->levels_capacity -
+            old_capacity) * sizeof(struct qed_incremental_level));
+    }
+    
+    /* Both arrays always have the same capacity. */
+    level = inc->levels + n->level;
+    if(level->count == level->capacity){
+        unsigned capacity = level->capacity;
+        if(!qed_incremental_reserve((void**)&level->nodes, &capacity,
+            level->count + 1, sizeof(unsigned)) ||
+            !qed_incremental_reserve((void**)&level->deps, &level->capacity,
+            level->count + 1, sizeof(void*)))
+            return false;
+        assert(capacity == level->capacity);
+    }
+    
+    n->slot = level->count++;
+    level->nodes[n->slot] = node;
+    level->deps[n->slot] = n->dep;
+    if(n->level >= inc->num_levels)
+        inc->num_levels = n->level + 1;
+    return true;
+}
+
+static void qed_incremental_level_remove(struct QED_Incremental *inc,
+    unsigned node){
+    
+    const struct qed_incremental_node *const n = inc->nodes + node;
+    struct qed_incremental_level *const level = inc->levels + n->level;
+    const unsigned last = --level->count;
+    
+    if(n->slot != last){
+        const unsigned moved = level->nodes[last];
+        level->nodes[n->slot] = moved;
+        level->deps[n->slot] = level->deps[last];
+        inc->nodes[moved].slot = n->slot;
+    }
+    
+    /* Every batch has a node that the next batch depends on, so only batches
+     * at the end can become empty. */
+    while(inc->num_levels != 0 && inc->levels[inc->num_levels - 1].count == 0)
+        inc->num_levels--;
+}
+
+static unsigned qed_incremental_calculate_level(const struct QED_Incremental *inc,
+    unsigned node){
+    
+    const struct qed_incremental_edges *const preds = &inc->nodes[node].preds;
+    unsigned i, level = 0;
+    for(i = 0; i < preds->count; i++){
+        const unsigned pred_level = inc->nodes[preds->nodes[i]].level + 1;
+        if(pred_level > level)
+            level = pred_level;
+    }
+    return level;
+}
+
+/* The work heap keeps nodes in order of their batch, which is a topological
+ * order, so most nodes are only updated once per edit. */
+static bool qed_incremental_before(const struct QED_Incremental *inc,
+    unsigned a,
+    unsigned b){
+    return inc->nodes[a].level < inc->nodes[b].level;
+}
+
+static bool qed_incremental_queue(struct QED_Incremental *inc,
+    unsigned node){
+    
+    unsigned i;
+    if(inc->nodes[node].queued)
+        return true;
+    if(!qed_incremental_reserve((void**)&inc->work, &inc->work_capacity,
+        inc->work_count + 1, sizeof(unsigned)))
+        return false;
+    
+    inc->nodes[node].queued = true;
+    i = inc->work_count++;
+    while(i != 0){
+        const unsigned parent = (i - 1) >> 1;
+        if(!qed_incremental_before(inc, node, inc->work[parent]))
+            break;
+        inc->work[i] = inc->work[parent];
+        i = parent;
+    }
+    inc->work[i] = node;
+    return true;
+}
+
+static unsigned qed_incremental_dequeue(struct QED_Incremental *inc){
+    unsigned *const work = inc->work;
+    const unsigned top = work[0];
+    const unsigned last = work[--inc->work_count];
+    const unsigned count = inc->work_count;
+    unsigned i = 0;
+    
+    for(;;){
+        unsigned child = (i << 1) + 1;
+        if(child >= count)
+            break;
+        if(child + 1 < count &&
+            qed_incremental_before(inc, work[child + 1], work[child]))
+            child++;
+        if(!qed_incremental_before(inc, work[child], last))
+            break;
+        work[i] = work[child];
+        i = child;
+    }
+    if(count != 0)
+        work[i] = last;
+    inc->nodes[top].queued = false;
+    return top;
+}
+
+/* Moves every queued node to the batch its dependencies now put it in, and
+ * queues the dependents of any node that moved. */
+static bool qed_incremental_update(struct QED_Incremental *inc){
+    while(inc->work_count != 0){
+        const unsigned node = qed_incremental_dequeue(inc);
+        struct qed_incremental_node *const n = inc->nodes + node;
+        const unsigned level = qed_incremental_calculate_level(inc, node);
+        unsigned i;
+        
+        inc->visited++;
+        if(level == n->level)
+            continue;
+        
+        qed_incremental_level_remove(inc, node);
+        n->level = level;
+        if(!qed_incremental_level_add(inc, node))
+            return false;
+        
+        for(i = 0; i < n->succs.count; i++){
+            if(!qed_incremental_queue(inc, n->succs.nodes[i]))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Returns true if target can be reached from start by following dependents.
+ * Only nodes in batches up to the target's can lead to it, so the search stays
+ * within the part of the graph between the two. */
+static bool qed_incremental_reaches(struct QED_Incremental *inc,
+    unsigned start,
+    unsigned target,
+    bool *out_failed){
+    
+    const unsigned max_level = inc->nodes[target].level;
+    unsigned count = 0;
+    
+    out_failed[0] = false;
+    if(inc->nodes[start].level > max_level)
+        return false;
+    
+    inc->generation++;
+    inc->nodes[start].mark = inc->generation;
+    inc->work[count++] = start;
+    
+    while(count != 0){
+        const struct qed_incremental_node *const n =
+            inc->nodes + inc->work[--count];
+        unsigned i;
+        
+        inc->visited++;
+        for(i = 0; i < n->succs.count; i++){
+            const unsigned succ = n->succs.nodes[i];
+            struct qed_incremental_node *const s = inc->nodes + succ;
+            if(succ == target)
+                return true;
+            if(s->mark == inc->generation || s->level > max_level)
+                continue;
+            s->mark = inc->generation;
+            if(!qed_incremental_reserve((void**)&inc->work, &inc->work_capacity,
+                count + 1, sizeof(unsigned))){
+                out_failed[0] = true;
+                return false;
+            }
+            inc->work[count++] = succ;
+        }
+    }
+    return false;
+}
+
+/* Fails the schedule if ok is false, since it may be half updated. */
+static bool qed_incremental_check(struct QED_Incremental *inc, bool ok){
+    if(!ok){
+        inc->failed = true;
+        inc->work_count = 0;
+    }
+    return ok;
+}
+
+void QED_InitIncremental(struct QED_Incremental *incremental){
+    memset(incremental, 0, sizeof(struct QED_Incremental));
+}
+
+void QED_FreeIncremental(struct QED_Incremental *incremental){
+    unsigned i;
+    for(i = 0; i < incremental->num_nodes; i++){
+        free(incremental->nodes[i].preds.nodes);
+        free(incremental->nodes[i].succs.nodes);
+    }
+    for(i = 0; i < incremental->levels_capacity; i++){
+        free(incremental->levels[i].deps);
+        free(incremental->levels[i].nodes);
+    }
+    free(incremental->nodes);
+    free(incremental->free_nodes);
+    free(incremental->levels);
+    free(incremental->work);
+    QED_InitIncremental(incremental);
+}
+
+bool QED_IncrementalLoadGraph(struct QED_Incremental *incremental,
+    const struct QED_Graph *graph){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned *const order = malloc(((num_nodes + 1) * 2) * sizeof(unsigned));
+    unsigned *const offsets = order + num_nodes + 1;
+    unsigned num_batches, b, i;
+    bool ok;
+    
+    assert(incremental->num_nodes == 0);
+    if(order == NULL)
+        return false;
+    
+    /* The unlimited greedy batches are exactly the levels. */
+    ok = QED_ScheduleGreedy(graph, 0, NULL, NULL, order, offsets, &num_batches) &&
+        qed_incremental_reserve((void**)&incremental->nodes,
+            &incremental->nodes_capacity, num_nodes,
+            sizeof(struct qed_incremental_node));
+    
+    if(ok){
+        memset(incremental->nodes, 0,
+            num_nodes * sizeof(struct qed_incremental_node));
+        incremental->num_nodes = num_nodes;
+        for(i = 0; i < num_nodes; i++)
+            incremental->nodes[i].dep = graph->nodes[i];
+    }
+    
+    for(b = 0; ok && b < num_batches; b++){
+        for(i = offsets[b]; ok && i < offsets[b + 1]; i++){
+            const unsigned node = order[i];
+            struct qed_incremental_node *const n = incremental->nodes + node;
+            unsigned e;
+            n->level = b;
+            ok = qed_incremental_level_add(incremental, node);
+            for(e = graph->pred_offsets[node]; ok && e < graph->pred_offsets[node + 1]; e++)
+                ok = qed_incremental_edges_add(&n->preds, graph->preds[e]);
+            for(e = graph->succ_offsets[node]; ok && e < graph->succ_offsets[node + 1]; e++)
+                ok = qed_incremental_edges_add(&n->succs, graph->succs[e]);
+        }
+    }
+    
+    free(order);
+    return qed_incremental_check(incremental, ok);
+}
+
+unsigned QED_IncrementalAddNode(struct QED_Incremental *incremental,
+    struct QED_Dependency *dep){
+    
+    const bool reuse = (incremental->num_free != 0);
+    struct qed_incremental_node *n;
+    unsigned node;
+    
+    if(incremental->failed)
+        return QED_INCREMENTAL_NONE;
+    
+    if(reuse){
+        node = incremental->free_nodes[incremental->num_free - 1];
+    }
+    else{
+        if(!qed_incremental_reserve((void**)&incremental->nodes,
+            &incremental->nodes_capacity, incremental->num_nodes + 1,
+            sizeof(struct qed_incremental_node)))
+            return QED_INCREMENTAL_NONE;
+        node = incremental->num_nodes;
+        memset(incremental->nodes + node, 0, sizeof(struct qed_incremental_node));
+    }
+    
+    n = incremental->nodes + node;
+    n->dep = dep;
+    n->level = 0;
+    if(!qed_incremental_level_add(incremental, node)){
+        n->dep = NULL;
+        return QED_INCREMENTAL_NONE;
+    }
+    
+    if(reuse)
+        incremental->num_free--;
+    else
+        incremental->num_nodes++;
+    incremental->visited = 1;
+    return node;
+}
+
+bool QED_IncrementalRemoveNode(struct QED_Incremental *incremental,
+    unsigned node){
+    
+    struct qed_incremental_node *n;
+    unsigned i;
+    bool ok;
+    
+    if(incremental->failed || !qed_incremental_is_node(incremental, node))
+        return false;
+    
+    /* Make room to free the handle first, so that nothing can fail once the
+     * node is half removed. */
+    if(!qed_incremental_reserve((void**)&incremental->free_nodes,
+        &incremental->free_capacity, incremental->num_free + 1, sizeof(unsigned)))
+        return false;
+    
+    incremental->visited = 1;
+    n = incremental->nodes + node;
+    for(i = 0; i < n->preds.count; i++){
+        const bool removed = qed_incremental_edges_remove(
+            &incremental->nodes[n->preds.nodes[i]].succs, node);
+        (void)removed;
+        assert(removed);
+    }
+    
+    ok = true;
+    for(i = 0; i < n->succs.count; i++){
+        const unsigned succ = n->succs.nodes[i];
+        const bool removed = qed_incremental_edges_remove(
+            &incremental->nodes[succ].preds, node);
+        (void)removed;
+        assert(removed);
+        ok = ok && qed_incremental_queue(incremental, succ);
+    }
+    
+    qed_incremental_level_remove(incremental, node);
+    n->dep = NULL;
+    n->preds.count = n->succs.count = 0;
+    incremental->free_nodes[incremental->num_free++] = node;
+    
+    return qed_incremental_check(incremental, ok && qed_incremental_update(incremental));
+}
+
+bool QED_IncrementalAddEdge(struct QED_Incremental *incremental,
+    unsigned node,
+    unsigned dependency){
+    
+    struct qed_incremental_node *n, *d;
+    unsigned unused;
+    bool failed;
+    
+    if(incremental->failed || node == dependency ||
+        !qed_incremental_is_node(incremental, node) ||
+        !qed_incremental_is_node(incremental, dependency))
+        return false;
+    
+    n = incremental->nodes + node;
+    d = incremental->nodes + dependency;
+    incremental->visited = 0;
+    if(qed_incremental_edges_find(&n->preds, dependency, &unused))
+        return true;
+    
+    /* A cycle is only possible if node could already come before dependency. */
+    if(n->level <= d->level){
+        if(!qed_incremental_reserve((void**)&incremental->work,
+            &incremental->work_capacity, 1, sizeof(unsigned)))
+            return false;
+        if(qed_incremental_reaches(incremental, node, dependency, &failed) ||
+            failed)
+            return false;
+    }
+    
+    if(!qed_incremental_edges_add(&n->preds, dependency))
+        return false;
+    if(!qed_incremental_edges_add(&d->succs, node)){
+        n->preds.count--;
+        return false;
+    }
+    
+    return qed_incremental_check(incremental,
+        qed_incremental_queue(incremental, node) &&
+        qed_incremental_update(incremental));
+}
+
+bool QED_IncrementalRemoveEdge(struct QED_Incremental *incremental,
+    unsigned node,
+    unsigned dependency){
+    
+    if(incremental->failed ||
+        !qed_incremental_is_node(incremental, node) ||
+        !qed_incremental_is_node(incremental, dependency) ||
+        !qed_incremental_edges_remove(&incremental->nodes[node].preds, dependency))
+        return false;
+    
+    {
+        const bool removed = qed_incremental_edges_remove(
+            &incremental->nodes[dependency].succs, node);
+        (void)removed;
+        assert(removed);
+    }
+    
+    incremental->visited = 0;
+    return qed_incremental_check(incremental,
+        qed_incremental_queue(incremental, node) &&
+        qed_incremental_update(incremental));
+}
+
+unsigned QED_IncrementalNumBatches(const struct QED_Incremental *incremental){
+    return incremental->num_levels;
+}
+
+void QED_IncrementalBatch(const struct QED_Incremental *incremental,
+    unsigned i,
+    struct QED_Batch *out_batch){
+    
+    assert(i < incremental->num_levels);
+    out_batch->num_dependencies = incremental->levels[i].count;
+    out_batch->dependencies = incremental->levels[i].deps;
+}
+
+unsigned QED_IncrementalBatchOf(const struct QED_Incremental *incremental,
+    unsigned node){
+    
+    assert(qed_incremental_is_node(incremental, node));
+    return incremental->nodes[node].level;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_INCREMENTAL_H
+#define LIBQED_INCREMENTAL_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Batch;
+struct QED_Dependency;
+struct QED_Graph;
+
+struct qed_incremental_node;
+struct qed_incremental_level;
+
+/* A schedule that is kept up to date as the graph is edited.
+ *
+ * Nodes are referred to by the handle QED_IncrementalAddNode returns. The
+ * edges are held here, and the dependencies arrays of the deps are not used.
+ *
+ * Every node is in the batch after the last of its dependencies, which gives
+ * the same batches as QED_eGreedy with an unlimited max_batch_size. An edit
+ * only recalculates the batch of nodes downstream of it whose batch might
+ * change, and stops wherever a batch turns out not to. Limiting the size of
+ * batches is not supported, since a single edit could then move nodes
+ * anywhere in the graph.
+ *
+ * A zeroed QED_Incremental is empty.
+ */
+struct QED_Incremental{
+    struct qed_incremental_node *nodes;
+    unsigned num_nodes, nodes_capacity; /* Including removed nodes. */
+    
+    unsigned *free_nodes;
+    unsigned num_free, free_capacity;
+    
+    struct qed_incremental_level *levels;
+    unsigned num_levels, levels_capacity;
+    
+    /* Nodes waiting to be updated, as a heap ordered by batch. Also the stack
+     * for the cycle check. */
+    unsigned *work;
+    unsigned work_count, work_capacity;
+    
+    unsigned generation;
+    bool failed;
+    
+    /** Number of nodes the last edit visited. */
+    unsigned long visited;
+};
+
+#define QED_INCREMENTAL_NONE (~0u)
+
+void QED_InitIncremental(struct QED_Incremental *incremental);
+
+void QED_FreeIncremental(struct QED_Incremental *incremental);
+
+/**
+ * @brief Adds every node and edge of a compiled graph to an empty schedule.
+ *
+ * Node i of the graph gets the handle i. This takes O(V+E).
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_IncrementalLoadGraph(struct QED_Incremental *incremental,
+    const struct QED_Graph *graph);
+
+/**
+ * @brief Adds a node with no edges. It goes in the first batch.
+ *
+ * @return The handle of the node, or QED_INCREMENTAL_NONE if an allocation
+ *   failed. Handles of removed nodes are reused, the most recently removed
+ *   first.
+ */
+unsigned QED_IncrementalAddNode(struct QED_Incremental *incremental,
+    struct QED_Dependency *dep);
+
+/**
+ * @brief Removes a node and all of its edges.
+ */
+bool QED_IncrementalRemoveNode(struct QED_Incremental *incremental,
+    unsigned node);
+
+/**
+ * @brief Makes node depend on dependency.
+ *
+ * Adding an edge that already exists does nothing.
+ *
+ * @return false if the edge would make a cycle, either handle is not a node,
+ *   or an allocation failed. The schedule is unchanged unless an allocation
+ *   failed.
+ */
+bool QED_IncrementalAddEdge(struct QED_Incremental *incremental,
+    unsigned node,
+    unsigned dependency);
+
+/**
+ * @brief Removes the edge making node depend on dependency.
+ *
+ * @return false if there is no such edge.
+ */
+bool QED_IncrementalRemoveEdge(struct QED_Incremental *incremental,
+    unsigned node,
+    unsigned dependency);
+
+unsigned QED_IncrementalNumBatches(const struct QED_Incremental *incremental);
+
+/**
+ * @brief Gets batch i of the current schedule.
+ *
+ * The batch points into the schedule, and is only valid until the next edit.
+ * The order of the deps within a batch is not meaningful.
+ */
+void QED_IncrementalBatch(const struct QED_Incremental *incremental,
+    unsigned i,
+    struct QED_Batch *out_batch);
+
+/**
+ * @brief Gets the index of the batch a node is in.
+ */
+unsigned QED_IncrementalBatchOf(const struct QED_Incremental *incremental,
+    unsigned node);
+
+#endif /* LIBQED_INCREMENTAL_H */
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_iterator.h"
+
+#include "qed_dependency.h"
+#include "qed_lookahead.h"
+#include "qed_resource.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QED_ITERATOR_MIN_CAPACITY 64
+
+static struct QED_RankHeap qed_iterator_heap(const struct QED_BatchIterator *it){
+    struct QED_RankHeap heap;
+    heap.graph = it->graph;
+    heap.ranks = it->ranks;
+    heap.nodes = it->ready;
+    heap.count = it->ready_count;
+    return heap;
+}
+
+/* Adds a node to the ready set, growing it if needed. */
+static bool qed_iterator_push(struct QED_BatchIterator *it, unsigned node){
+    
+    if(it->ready_count == it->ready_capacity){
+        const unsigned capacity = it->ready_capacity * 2;
+        unsigned *const ready = realloc(it->ready, capacity * sizeof(unsigned));
+        if(ready == NULL)
+            return false;
+        
+        /* Unwrap the ring so that it is contiguous from the head again. */
+        if(!it->lookahead)
+            memcpy(ready + it->ready_capacity, ready, it->ready_head * sizeof(unsigned));
+        it->ready = ready;
+        it->ready_capacity = capacity;
+    }
+    
+    if(it->lookahead){
+        struct QED_RankHeap heap = qed_iterator_heap(it);
+        QED_RankHeapPush(&heap, node);
+    }
+    else{
+        unsigned tail = it->ready_head + it->ready_count;
+        if(tail >= it->ready_capacity)
+            tail -= it->ready_capacity;
+        it->ready[tail] = node;
+    }
+    it->ready_count++;
+    return true;
+}
+
+static unsigned qed_iterator_pop(struct QED_BatchIterator *it){
+    unsigned node;
+    assert(it->ready_count != 0);
+    
+    if(it->lookahead){
+        struct QED_RankHeap heap = qed_iterator_heap(it);
+        node = QED_RankHeapPop(&heap);
+    }
+    else{
+        node = it->ready[it->ready_head];
+        if(++it->ready_head == it->ready_capacity)
+            it->ready_head = 0;
+    }
+    it->ready_count--;
+    return node;
+}
+
+/* Returns nodes that were popped but passed over to the ready set, in the
+ * order they were popped. There is always room, since they were just popped. */
+static void qed_iterator_unpop(struct QED_BatchIterator *it,
+    const unsigned *nodes,
+    unsigned num_nodes){
+    
+    unsigned i;
+    if(it->lookahead){
+        struct QED_RankHeap heap = qed_iterator_heap(it);
+        for(i = 0; i < num_nodes; i++)
+            QED_RankHeapPush(&heap, nodes[i]);
+    }
+    else{
+        /* Put them back at the front of the ring. */
+        it->ready_head = (it->ready_head >= num_nodes) ?
+            (it->ready_head - num_nodes) :
+            (it->ready_head + it->ready_capacity - num_nodes);
+        for(i = 0; i < num_nodes; i++){
+            unsigned slot = it->ready_head + i;
+            if(slot >= it->ready_capacity)
+                slot -= it->ready_capacity;
+            it->ready[slot] = nodes[i];
+        }
+    }
+    it->ready_count += num_nodes;
+}
+
+static bool qed_iterator_reserve_batch(struct QED_BatchIterator *it,
+    unsigned size){
+    
+    unsigned capacity = it->batch_capacity;
+    unsigned *batch_nodes;
+    struct QED_Dependency **batch;
+    
+    if(size <= capacity)
+        return true;
+    
+    if(capacity == 0)
+        capacity = QED_ITERATOR_MIN_CAPACITY;
+    while(capacity < size)
+        capacity *= 2;
+    
+    if((batch_nodes = realloc(it->batch_nodes, capacity * sizeof(unsigned))) == NULL)
+        return false;
+    it->batch_nodes = batch_nodes;
+    if((batch = realloc(it->batch, capacity * sizeof(void*))) == NULL)
+        return false;
+    it->batch = batch;
+    it->batch_capacity = capacity;
+    return true;
+}
+
+/* Sets up everything after the graph. On failure the iterator is freed. */
+static bool qed_iterator_start(struct QED_BatchIterator *it,
+    const struct QED_BatchOptions *options){
+    
+    const struct QED_Graph *const graph = it->graph;
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned i;
+    
+    it->max_batch_size = options->max_batch_size;
+    it->resources = options->resources;
+    it->lookahead = (options->algorithm == QED_eLookahead);
+    it->ready_capacity = QED_ITERATOR_MIN_CAPACITY;
+    
+    it->pending = malloc((num_nodes + 1) * sizeof(unsigned));
+    it->ready = malloc(it->ready_capacity * sizeof(unsigned));
+    if(it->pending == NULL || it->ready == NULL)
+        goto fail;
+    
+    if(it->lookahead){
+        if((it->ranks = malloc((num_nodes + 1) * sizeof(unsigned))) == NULL ||
+            !QED_CalculateRanks(graph, NULL, it->ranks))
+            goto fail;
+    }
+    
+    for(i = 0; i < num_nodes; i++){
+        it->pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        if(it->pending[i] == 0 && !qed_iterator_push(it, i))
+            goto fail;
+    }
+    return true;
+    
+fail:
+    QED_BatchIteratorEnd(it);
+    it->failed = true;
+    return false;
+}
+
+bool QED_BatchIteratorBegin(struct QED_BatchIterator *iterator,
+    struct QED_Dependency **deps,
+    unsigned num_deps,
+    const struct QED_BatchOptions *options){
+    
+    memset(iterator, 0, sizeof(struct QED_BatchIterator));
+    if(!QED_CompileGraph(&iterator->own_graph, deps, num_deps)){
+        iterator->failed = true;
+        return false;
+    }
+    iterator->graph = &iterator->own_graph;
+    iterator->owns_graph = true;
+    return qed_iterator_start(iterator, options);
+}
+
+bool QED_BatchIteratorBeginGraph(struct QED_BatchIterator *iterator,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options){
+    
+    memset(iterator, 0, sizeof(struct QED_BatchIterator));
+    iterator->graph = graph;
+    return qed_iterator_start(iterator, options);
+}
+
+bool QED_BatchIteratorNext(struct QED_BatchIterator *iterator,
+    struct QED_Batch *out_batch){
+    
+    const struct QED_Graph *const graph = iterator->graph;
+    unsigned size, i;
+    
+    out_batch->num_dependencies = 0;
+    out_batch->dependencies = NULL;
+    
+    if(iterator->failed || graph == NULL)
+        return false;
+    
+    /* Release the dependents of the last batch. This is done here rather than
+     * when the batch is returned, so that nodes cannot join the batch that
+     * satisfied them. */
+    for(i = 0; i < iterator->batch_size; i++){
+        const unsigned node = iterator->batch_nodes[i];
+        unsigned e;
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            assert(iterator->pending[succ] != 0);
+            if(--iterator->pending[succ] == 0 && !qed_iterator_push(iterator, succ)){
+                iterator->failed = true;
+                return false;
+            }
+        }
+    }
+    iterator->batch_size = 0;
+    
+    if(iterator->ready_count == 0)
+        return false;
+    
+    size = iterator->ready_count;
+    if(iterator->max_batch_size != 0 && size > iterator->max_batch_size)
+        size = iterator->max_batch_size;
+    if(!qed_iterator_reserve_batch(iterator, size)){
+        iterator->failed = true;
+        return false;
+    }
+    
+    if(iterator->resources == NULL){
+        for(i = 0; i < size; i++){
+            const unsigned node = qed_iterator_pop(iterator);
+            iterator->batch_nodes[i] = node;
+            iterator->batch[i] = graph->nodes[node];
+        }
+    }
+    else{
+        unsigned usage[QED_MAX_RESOURCE_CLASSES], skipped[QED_RESOURCE_MAX_SKIPPED];
+        unsigned limit = size, num_skipped = 0;
+        
+        QED_ClearResources(usage);
+        for(size = 0; size < limit && iterator->ready_count != 0 &&
+            num_skipped < QED_RESOURCE_MAX_SKIPPED;){
+            
+            const unsigned node = qed_iterator_pop(iterator);
+            if(QED_ReserveResources(iterator->resources, usage,
+                graph->nodes[node]->resources)){
+                iterator->batch_nodes[size] = node;
+                iterator->batch[size++] = graph->nodes[node];
+            }
+            else{
+                skipped[num_skipped++] = node;
+            }
+        }
+        qed_iterator_unpop(iterator, skipped, num_skipped);
+    }
+    iterator->batch_size = size;
+    iterator->num_scheduled += size;
+    
+    out_batch->num_dependencies = size;
+    out_batch->dependencies = iterator->batch;
+    return true;
+}
+
+bool QED_BatchIteratorEnd(struct QED_BatchIterator *iterator){
+    
+    const bool ok = !iterator->failed && iterator->graph != NULL &&
+        iterator->num_scheduled == iterator->graph->num_nodes;
+    
+    free(iterator->pending);
+    free(iterator->ranks);
+    free(iterator->ready);
+    free(iterator->batch_nodes);
+    free(iterator->batch);
+    if(iterator->owns_graph)
+        QED_FreeGraph(&iterator->own_graph);
+    memset(iterator, 0, sizeof(struct QED_BatchIterator));
+    return ok;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_ITERATOR_H
+#define LIBQED_ITERATOR_H
+#pragma once
+
+#include "qed_batch.h"
+#include "qed_graph.h"
+
+#include <stdbool.h>
+
+struct QED_Dependency;
+
+/* Produces batches one at a time.
+ *
+ * Each call to QED_BatchIteratorNext only does the work for one batch, so the
+ * first batch can be executed while the rest of the graph is still being
+ * scheduled. Apart from the graph itself, memory use is one counter per node
+ * plus the set of ready nodes, and the full schedule is never stored.
+ *
+ * QED_eLookahead gives the same batches as QED_CalculateBatches, at the cost
+ * of ranking every node in QED_BatchIteratorBegin. Every other algorithm gives
+ * the QED_eGreedy batches, which need no work up front.
+ *
+ * Resource limits in the options are kept to in the same way as by
+ * QED_CalculateBatches, and must stay valid until QED_BatchIteratorEnd.
+ */
+struct QED_BatchIterator{
+    struct QED_Graph *graph;
+    struct QED_Graph own_graph;
+    bool owns_graph;
+    
+    unsigned max_batch_size;
+    const struct QED_ResourceLimits *resources;
+    bool lookahead;
+    bool failed;
+    
+    unsigned *pending; /* Unscheduled dependencies of each node. */
+    unsigned *ranks; /* Only used for QED_eLookahead. */
+    
+    /* Ready nodes. This is a ring for QED_eGreedy and a heap otherwise. */
+    unsigned *ready;
+    unsigned ready_head, ready_count, ready_capacity;
+    
+    /* The last batch returned, which is released by the next call. */
+    unsigned *batch_nodes;
+    struct QED_Dependency **batch;
+    unsigned batch_size, batch_capacity;
+    
+    unsigned num_scheduled;
+};
+
+/**
+ * @brief Starts iterating the batches for a set of dependencies.
+ *
+ * The dependencies are compiled into a graph owned by the iterator.
+ *
+ * @return false if an allocation failed, or if ranking found a cycle.
+ */
+bool QED_BatchIteratorBegin(struct QED_BatchIterator *iterator,
+    struct QED_Dependency **deps,
+    unsigned num_deps,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Starts iterating the batches for a compiled graph.
+ *
+ * The graph must not be modified or freed until QED_BatchIteratorEnd.
+ */
+bool QED_BatchIteratorBeginGraph(struct QED_BatchIterator *iterator,
+    struct QED_Graph *graph,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Gets the next batch.
+ *
+ * The dependencies of out_batch point into the iterator, and are only valid
+ * until the next call.
+ *
+ * @return false once every batch has been returned, or on failure.
+ */
+bool QED_BatchIteratorNext(struct QED_BatchIterator *iterator,
+    struct QED_Batch *out_batch);
+
+/**
+ * @brief Frees the iterator.
+ *
+ * @return true if every node was scheduled. This is false if the graph has a
+ *   cycle, an allocation failed, or iteration was stopped early.
+ */
+bool QED_BatchIteratorEnd(struct QED_BatchIterator *iterator);
+
+#endif /* LIBQED_ITERATOR_H */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_locality.h"
+
+#include "qed_dependency.h"
+#include "qed_graph.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct qed_locality_entry{
+    unsigned long long user_data;
+    /* One more than the position of the node's input, or zero if it has no
+     * dependencies. */
+    unsigned input;
+    unsigned node;
+};
+
+static int qed_locality_compare(const void *a, const void *b){
+    const struct qed_locality_entry *const x = a, *const y = b;
+    if(x->input != y->input)
+        return (x->input < y->input) ? -1 : 1;
+    if(x->user_data != y->user_data)
+        return (x->user_data < y->user_data) ? -1 : 1;
+    return (x->node < y->node) ? -1 : (x->node > y->node);
+}
+
+bool QED_OrderForLocality(const struct QED_Graph *graph,
+    unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches,
+    unsigned *scratch){
+    
+    const unsigned long stride = (unsigned long)graph->num_nodes + 1;
+    unsigned *const memory = (scratch != NULL) ? scratch :
+        malloc(QED_LOCALITY_SCRATCH(graph->num_nodes) * sizeof(unsigned));
+    
+    /* The entries go first so that they stay aligned. */
+    struct qed_locality_entry *const entries = (struct qed_locality_entry*)memory;
+    unsigned *const positions = memory + (stride * 4);
+    unsigned b, i, e;
+    
+    if(memory == NULL)
+        return false;
+    
+    /* Every dependency is in an earlier batch, so its position is already
+     * final by the time its dependents are sorted. */
+    for(b = 0; b < num_batches; b++){
+        const unsigned start = offsets[b], count = offsets[b + 1] - start;
+        for(i = 0; i < count; i++){
+            const unsigned node = order[start + i];
+            struct qed_locality_entry *const entry = entries + i;
+            entry->input = 0;
+            for(e = graph->pred_offsets[node]; e < graph->pred_offsets[node + 1]; e++){
+                const unsigned input = positions[graph->preds[e]] + 1;
+                if(input > entry->input)
+                    entry->input = input;
+            }
+            /* A mapped graph has no deps. */
+            entry->user_data = (graph->nodes == NULL) ? 0 :
+                (uintptr_t)graph->nodes[node]->execute.user_data;
+            entry->node = node;
+        }
+        
+        if(count > 1)
+            qsort(entries, count, sizeof(struct qed_locality_entry),
+                qed_locality_compare);
+        for(i = 0; i < count; i++){
+            order[start + i] = entries[i].node;
+            positions[entries[i].node] = start + i;
+        }
+    }
+    
+    if(scratch == NULL)
+        free(memory);
+    return true;
+}
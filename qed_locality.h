@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_LOCALITY_H
+#define LIBQED_LOCALITY_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Graph;
+
+#define QED_LOCALITY_SCRATCH(NUM_NODES) (((unsigned long)(NUM_NODES) + 1) * 5)
+
+/**
+ * @brief Reorders the nodes within each batch of a schedule so that nodes
+ * which share an input are next to each other.
+ *
+ * The input of a node is whichever of its dependencies is latest in the
+ * schedule, which is the one most likely to still be in cache. Nodes are
+ * sorted by the position of their input, then by their user data, then by
+ * index. So the consumers of each node are together, in the same order as
+ * the nodes they consume, and nodes with no dependencies are grouped by their
+ * user data. The batches themselves are not changed.
+ *
+ * A worker which takes the same share of each batch, as QED_ExecuteBatches
+ * does with the affinity option, then tends to run a node's consumers itself.
+ *
+ * scratch must have room for QED_LOCALITY_SCRATCH(graph->num_nodes) entries
+ * and be aligned for unsigned long long, or be NULL to allocate it internally.
+ *
+ * @return false if an allocation failed, in which case the order is not
+ *   changed.
+ */
+bool QED_OrderForLocality(const struct QED_Graph *graph,
+    unsigned *order,
+    const unsigned *offsets,
+    unsigned num_batches,
+    unsigned *scratch);
+
+#endif /* LIBQED_LOCALITY_H */
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_lookahead.h"
+
+#include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_resource.h"
+#include "qed_stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+bool QED_CalculateRanks(const struct QED_Graph *graph,
+    unsigned *scratch,
+    unsigned *out_ranks){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned *const pending = (scratch != NULL) ? scratch :
+        malloc(QED_RANKS_SCRATCH(num_nodes) * sizeof(unsigned));
+    unsigned *const queue = pending + num_nodes + 1;
+    unsigned head = 0, tail = 0, i;
+    
+    if(pending == NULL)
+        return false;
+    
+    /* Kahn's algorithm run backwards, starting at the nodes nothing depends
+     * on. A node is only visited once all its dependents have a rank. */
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->succ_offsets[i + 1] - graph->succ_offsets[i];
+        if(pending[i] == 0)
+            queue[tail++] = i;
+    }
+    
+    while(head != tail){
+        const unsigned node = queue[head++];
+        unsigned e, rank = 0;
+        
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ_rank = out_ranks[graph->succs[e]];
+            if(succ_rank > rank)
+                rank = succ_rank;
+        }
+        out_ranks[node] = rank + 1;
+        
+        for(e = graph->pred_offsets[node]; e < graph->pred_offsets[node + 1]; e++){
+            const unsigned pred = graph->preds[e];
+            assert(pending[pred] != 0);
+            if(--pending[pred] == 0)
+                queue[tail++] = pred;
+        }
+    }
+    
+    if(scratch == NULL)
+        free(pending);
+    return head == num_nodes;
+}
+
+/* Returns true if a should be scheduled before b. */
+static bool qed_lookahead_before(const struct QED_RankHeap *heap,
+    unsigned a,
+    unsigned b){
+    
+    const unsigned *const succ_offsets = heap->graph->succ_offsets;
+    
+    if(heap->ranks[a] != heap->ranks[b])
+        return heap->ranks[a] > heap->ranks[b];
+    
+    {
+        const unsigned num_a = succ_offsets[a + 1] - succ_offsets[a],
+            num_b = succ_offsets[b + 1] - succ_offsets[b];
+        if(num_a != num_b)
+            return num_a > num_b;
+    }
+    
+    return a < b;
+}
+
+void QED_RankHeapPush(struct QED_RankHeap *heap, unsigned node){
+    unsigned i = heap->count++;
+    while(i != 0){
+        const unsigned parent = (i - 1) >> 1;
+        if(!qed_lookahead_before(heap, node, heap->nodes[parent]))
+            break;
+        heap->nodes[i] = heap->nodes[parent];
+        i = parent;
+    }
+    heap->nodes[i] = node;
+}
+
+unsigned QED_RankHeapPop(struct QED_RankHeap *heap){
+    const unsigned top = heap->nodes[0];
+    const unsigned last = heap->nodes[--heap->count];
+    const unsigned count = heap->count;
+    unsigned i = 0;
+    
+    for(;;){
+        unsigned child = (i << 1) + 1;
+        if(child >= count)
+            break;
+        if(child + 1 < count &&
+            qed_lookahead_before(heap, heap->nodes[child + 1], heap->nodes[child]))
+            child++;
+        if(!qed_lookahead_before(heap, heap->nodes[child], last))
+            break;
+        heap->nodes[i] = heap->nodes[child];
+        i = child;
+    }
+    if(count != 0)
+        heap->nodes[i] = last;
+    return top;
+}
+
+bool QED_ScheduleLookahead(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned *const memory = (scratch != NULL) ? scratch :
+        malloc(QED_LOOKAHEAD_SCRATCH(num_nodes) * sizeof(unsigned));
+    unsigned *const ranks = memory,
+        *const pending = memory + num_nodes + 1;
+    struct QED_RankHeap heap;
+    unsigned num_scheduled = 0, num_batches = 0, i;
+    bool ok;
+    
+    if(memory == NULL)
+        return false;
+    
+    /* The pending counts and the heap are used as scratch for the ranks. */
+    QED_STATS_TIME(rank_ns, ok = QED_CalculateRanks(graph, pending, ranks));
+    if(!ok){
+        if(scratch == NULL)
+            free(memory);
+        return false;
+    }
+    
+    if(max_batch_size == 0)
+        max_batch_size = num_nodes;
+    
+    heap.graph = graph;
+    heap.ranks = ranks;
+    heap.nodes = pending + num_nodes + 1;
+    heap.count = 0;
+    
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        if(pending[i] == 0)
+            QED_RankHeapPush(&heap, i);
+    }
+    
+    while(heap.count != 0){
+        const unsigned start = num_scheduled;
+        unsigned usage[QED_MAX_RESOURCE_CLASSES], skipped[QED_RESOURCE_MAX_SKIPPED];
+        unsigned num_skipped = 0;
+        
+        out_offsets[num_batches++] = start;
+        if(resources == NULL){
+            while(heap.count != 0 && num_scheduled - start < max_batch_size)
+                out_order[num_scheduled++] = QED_RankHeapPop(&heap);
+        }
+        else{
+            QED_ClearResources(usage);
+            while(heap.count != 0 && num_scheduled - start < max_batch_size &&
+                num_skipped < QED_RESOURCE_MAX_SKIPPED){
+                
+                const unsigned node = QED_RankHeapPop(&heap);
+                if(QED_ReserveResources(resources, usage,
+                    graph->nodes[node]->resources))
+                    out_order[num_scheduled++] = node;
+                else
+                    skipped[num_skipped++] = node;
+            }
+            for(i = 0; i < num_skipped; i++)
+                QED_RankHeapPush(&heap, skipped[i]);
+        }
+        QED_STATS_BATCH((num_scheduled - start) + num_skipped +
+            QED_GraphSuccessorCount(graph, out_order + start, num_scheduled - start));
+        
+        /* Only queue newly ready nodes once the batch is complete. */
+        for(i = start; i < num_scheduled; i++){
+            const unsigned node = out_order[i];
+            unsigned e;
+            for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+                const unsigned succ = graph->succs[e];
+                assert(pending[succ] != 0);
+                if(--pending[succ] == 0)
+                    QED_RankHeapPush(&heap, succ);
+            }
+        }
+    }
+    out_offsets[num_batches] = num_scheduled;
+    
+    if(scratch == NULL)
+        free(memory);
+    out_num_batches[0] = num_batches;
+    assert(num_scheduled == num_nodes);
+    return true;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_LOOKAHEAD_H
+#define LIBQED_LOOKAHEAD_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Graph;
+struct QED_ResourceLimits;
+
+#define QED_RANKS_SCRATCH(NUM_NODES) (((unsigned long)(NUM_NODES) + 1) * 2)
+#define QED_LOOKAHEAD_SCRATCH(NUM_NODES) (((unsigned long)(NUM_NODES) + 1) * 3)
+
+/**
+ * @brief Calculates the rank of every node in a graph.
+ *
+ * The rank of a node is the number of nodes on the longest path from it to a
+ * node with no dependents, including itself. This is the least number of
+ * batches needed to run the node and everything that depends on it, so at
+ * least rank - 1 batches must follow the batch the node is scheduled in.
+ *
+ * out_ranks must have room for graph->num_nodes entries. scratch must have
+ * room for QED_RANKS_SCRATCH(graph->num_nodes) entries, or be NULL to allocate
+ * it internally.
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_CalculateRanks(const struct QED_Graph *graph,
+    unsigned *scratch,
+    unsigned *out_ranks);
+
+/**
+ * @brief Calculates batches, preferring nodes on the critical path.
+ *
+ * This is a list scheduler in the style of HLFET. When there are more ready
+ * nodes than fit in a batch, the nodes with the highest rank are taken first,
+ * then the nodes with the most dependents, and then the lowest index.
+ *
+ * If resources is not NULL, nodes that would take a batch over a resource
+ * limit are passed over for the next highest ranked nodes, and are first in
+ * line for the following batch.
+ *
+ * The output is the same as for QED_ScheduleGreedy. It takes O(V log V + E).
+ *
+ * scratch must have room for QED_LOOKAHEAD_SCRATCH(graph->num_nodes) entries,
+ * or be NULL to allocate it internally.
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_ScheduleLookahead(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches);
+
+/* A max-heap of node indices, in the order that QED_ScheduleLookahead takes
+ * them. nodes must have room for every node that will be pushed. */
+struct QED_RankHeap{
+    const struct QED_Graph *graph;
+    const unsigned *ranks;
+    unsigned *nodes;
+    unsigned count;
+};
+
+void QED_RankHeapPush(struct QED_RankHeap *heap, unsigned node);
+
+/* The heap must not be empty. */
+unsigned QED_RankHeapPop(struct QED_RankHeap *heap);
+
+#endif /* LIBQED_LOOKAHEAD_H */
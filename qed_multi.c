@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_multi.h"
+
+#include "qed_batch.h"
+#include "qed_graph.h"
+#include "qed_pool.h"
+#include "qed_reduce.h"
+#include "qed_stats.h"
+#include "qed_tinyhash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Marks a graph with a cycle in qed_multi_worker::graph_batches. */
+#define QED_MULTI_CYCLE (~0u)
+
+struct qed_multi_worker{
+    struct QED_Graph graph;
+    struct QED_HashTable *indices;
+    
+    /* The graphs from first_graph to end_graph are this worker's. */
+    unsigned first_graph, end_graph;
+    bool ok;
+    
+    /* The schedules of the worker's graphs, one after another. offsets holds
+     * the start of each batch in nodes, and graph_batches the number of
+     * batches of each graph. */
+    struct QED_Dependency **nodes;
+    unsigned *offsets;
+    unsigned *graph_batches;
+    unsigned num_nodes, num_batches;
+    unsigned nodes_capacity, batches_capacity, graphs_capacity;
+};
+
+struct qed_multi_job{
+    struct qed_multi_worker *workers;
+    const struct QED_GraphInput *graphs;
+    const struct QED_BatchOptions *options;
+};
+
+void QED_InitMultiSchedule(struct QED_MultiSchedule *schedule){
+    memset(schedule, 0, sizeof(struct QED_MultiSchedule));
+}
+
+void QED_FreeMultiSchedule(struct QED_MultiSchedule *schedule){
+    unsigned i;
+    for(i = 0; i < schedule->num_workers; i++){
+        struct qed_multi_worker *const worker = schedule->workers + i;
+        QED_FreeGraph(&worker->graph);
+        if(worker->indices != NULL){
+            QED_FreeHashTable(worker->indices, NULL);
+            free(worker->indices);
+        }
+        free(worker->nodes);
+        free(worker->offsets);
+        free(worker->graph_batches);
+    }
+    free(schedule->workers);
+    free(schedule->buffer);
+    QED_InitMultiSchedule(schedule);
+}
+
+/* Grows an array to hold at least `needed` elements. */
+static bool qed_multi_reserve(void **array,
+    unsigned *capacity,
+    unsigned needed,
+    size_t element_size){
+    
+    if(needed > *capacity){
+        unsigned new_capacity = (*capacity < 16) ? 16 : *capacity;
+        void *new_array;
+        while(new_capacity < needed)
+            new_capacity <<= 1;
+        QED_STATS_ALLOC(new_capacity * element_size);
+        if((new_array = realloc(*array, new_capacity * element_size)) == NULL)
+            return false;
+        array[0] = new_array;
+        capacity[0] = new_capacity;
+    }
+    return true;
+}
+
+/* Schedules one graph and appends the result to the worker's output. */
+static bool qed_multi_schedule_graph(struct qed_multi_worker *worker,
+    const struct QED_GraphInput *input,
+    const struct QED_BatchOptions *options,
+    unsigned *out_num_batches){
+    
+    const unsigned *order, *offsets;
+    unsigned num_batches, i;
+    
+    if(!QED_RecompileGraph(&worker->graph, worker->indices, input->deps,
+        input->num_deps))
+        return false;
+    if(options->reduce && !QED_ReduceGraph(&worker->graph, options->stats, NULL))
+        return false;
+    
+    if(!QED_ScheduleGraph(&worker->graph, options, &order, &offsets,
+        &num_batches)){
+        out_num_batches[0] = QED_MULTI_CYCLE;
+        return true;
+    }
+    
+    if(!qed_multi_reserve((void**)&worker->nodes, &worker->nodes_capacity,
+            worker->num_nodes + offsets[num_batches], sizeof(void*)) ||
+        !qed_multi_reserve((void**)&worker->offsets, &worker->batches_capacity,
+            worker->num_batches + num_batches, sizeof(unsigned)))
+        return false;
+    
+    for(i = 0; i < offsets[num_batches]; i++)
+        worker->nodes[worker->num_nodes + i] = worker->graph.nodes[order[i]];
+    for(i = 0; i < num_batches; i++)
+        worker->offsets[worker->num_batches + i] = worker->num_nodes + offsets[i];
+    worker->num_nodes += offsets[num_batches];
+    worker->num_batches += num_batches;
+    out_num_batches[0] = num_batches;
+    return true;
+}
+
+static bool qed_multi_run(struct qed_multi_worker *worker,
+    const struct QED_GraphInput *graphs,
+    const struct QED_BatchOptions *options){
+    
+    unsigned g;
+    
+    worker->num_nodes = worker->num_batches = 0;
+    if(!qed_multi_reserve((void**)&worker->graph_batches,
+        &worker->graphs_capacity, worker->end_graph - worker->first_graph,
+        sizeof(unsigned)))
+        return false;
+    if(worker->indices == NULL &&
+        (worker->indices = calloc(1, QED_HASH_TABLE_SIZE)) == NULL)
+        return false;
+    
+    for(g = worker->first_graph; g < worker->end_graph; g++){
+        if(!qed_multi_schedule_graph(worker, graphs + g, options,
+            worker->graph_batches + (g - worker->first_graph)))
+            return false;
+    }
+    return true;
+}
+
+static void qed_multi_job(void *arg, unsigned worker){
+    
+    const struct qed_multi_job *const job = (struct qed_multi_job*)arg;
+    struct QED_BatchOptions options = job->options[0];
+    struct QED_BatchBudget budget;
+    
+    /* Each graph is scheduled on one thread, so the pool is not used again.
+     * Everything the workers would share is left to worker zero. */
+    options.pool = NULL;
+    if(worker != 0){
+        options.stats = NULL;
+        options.cache = NULL;
+        if(options.budget != NULL){
+            budget = options.budget[0];
+            options.budget = &budget;
+        }
+    }
+    job->workers[worker].ok =
+        qed_multi_run(job->workers + worker, job->graphs, &options);
+}
+
+/* Copies the output of every worker into the buffer, in the order of the
+ * graphs. Returns false if the buffer could not be allocated. */
+static bool qed_multi_gather(struct QED_MultiSchedule *schedule,
+    unsigned num_graphs,
+    unsigned num_workers){
+    
+    unsigned num_nodes = 0, num_batches = 0, graph_batch = 0, w, i;
+    size_t size;
+    
+    for(w = 0; w < num_workers; w++){
+        num_nodes += schedule->workers[w].num_nodes;
+        num_batches += schedule->workers[w].num_batches;
+    }
+    
+    /* The pointers go first so they are aligned. */
+    size = (num_nodes * sizeof(void*)) +
+        (((size_t)num_batches + 1 + num_graphs + 1) * sizeof(unsigned)) +
+        (num_graphs * sizeof(bool));
+    if(schedule->buffer_size < size){
+        void *const buffer = malloc(size);
+        QED_STATS_ALLOC(size);
+        if(buffer == NULL)
+            return false;
+        free(schedule->buffer);
+        schedule->buffer = buffer;
+        schedule->buffer_size = size;
+    }
+    schedule->nodes = schedule->buffer;
+    schedule->offsets = (unsigned*)(schedule->nodes + num_nodes);
+    schedule->graph_offsets = schedule->offsets + num_batches + 1;
+    schedule->scheduled = (bool*)(schedule->graph_offsets + num_graphs + 1);
+    
+    num_nodes = num_batches = 0;
+    for(w = 0; w < num_workers; w++){
+        const struct qed_multi_worker *const worker = schedule->workers + w;
+        if(worker->num_nodes != 0){
+            memcpy(schedule->nodes + num_nodes, worker->nodes,
+                worker->num_nodes * sizeof(void*));
+        }
+        for(i = 0; i < worker->num_batches; i++)
+            schedule->offsets[num_batches + i] = num_nodes + worker->offsets[i];
+        for(i = worker->first_graph; i < worker->end_graph; i++){
+            const unsigned count = worker->graph_batches[i - worker->first_graph];
+            schedule->graph_offsets[i] = graph_batch;
+            schedule->scheduled[i] = (count != QED_MULTI_CYCLE);
+            if(count != QED_MULTI_CYCLE)
+                graph_batch += count;
+        }
+        num_nodes += worker->num_nodes;
+        num_batches += worker->num_batches;
+    }
+    schedule->offsets[num_batches] = num_nodes;
+    schedule->graph_offsets[num_graphs] = num_batches;
+    
+    schedule->num_graphs = num_graphs;
+    schedule->num_batches = num_batches;
+    schedule->num_nodes = num_nodes;
+    return true;
+}
+
+static bool qed_calculate_multi_schedule(struct QED_MultiSchedule *schedule,
+    const struct QED_GraphInput *graphs,
+    unsigned num_graphs,
+    const struct QED_BatchOptions *options){
+    
+    const unsigned num_workers = (options->pool == NULL) ? 1 :
+        QED_ThreadPoolSize(options->pool);
+    struct qed_multi_job job;
+    unsigned w, g;
+    
+    schedule->num_graphs = schedule->num_batches = schedule->num_nodes = 0;
+    
+    if(schedule->num_workers < num_workers){
+        struct qed_multi_worker *const workers = realloc(schedule->workers,
+            num_workers * sizeof(struct qed_multi_worker));
+        QED_STATS_ALLOC(num_workers * sizeof(struct qed_multi_worker));
+        if(workers == NULL)
+            return false;
+        memset(workers + schedule->num_workers, 0,
+            (num_workers - schedule->num_workers) * sizeof(struct qed_multi_worker));
+        schedule->workers = workers;
+        schedule->num_workers = num_workers;
+    }
+    
+    /* Each worker takes a run of whole graphs, so gathering the runs in order
+     * gives the same result for any number of workers. */
+    for(w = 0; w < num_workers; w++){
+        struct qed_multi_worker *const worker = schedule->workers + w;
+        worker->first_graph =
+            (unsigned)(((unsigned long long)num_graphs * w) / num_workers);
+        worker->end_graph =
+            (unsigned)(((unsigned long long)num_graphs * (w + 1)) / num_workers);
+    }
+    
+    job.workers = schedule->workers;
+    job.graphs = graphs;
+    job.options = options;
+    if(options->pool == NULL)
+        qed_multi_job(&job, 0);
+    else
+        QED_RunThreadPool(options->pool, qed_multi_job, &job);
+    
+    for(w = 0; w < num_workers; w++){
+        if(!schedule->workers[w].ok)
+            return false;
+    }
+    if(!qed_multi_gather(schedule, num_graphs, num_workers))
+        return false;
+    
+    for(g = 0; g < num_graphs; g++){
+        if(!schedule->scheduled[g])
+            return false;
+    }
+    return true;
+}
+
+bool QED_CalculateMultiSchedule(struct QED_MultiSchedule *schedule,
+    const struct QED_GraphInput *graphs,
+    unsigned num_graphs,
+    const struct QED_BatchOptions *options){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_calculate_multi_schedule(schedule, graphs, num_graphs, options));
+}
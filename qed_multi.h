@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_MULTI_H
+#define LIBQED_MULTI_H
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct QED_BatchOptions;
+struct QED_Dependency;
+
+struct qed_multi_worker;
+
+/* One of the graphs for QED_CalculateMultiSchedule, given as the deps that
+ * would be passed to QED_CalculateBatches. */
+struct QED_GraphInput{
+    struct QED_Dependency **deps;
+    unsigned num_deps;
+};
+
+/* The schedules of many independent graphs, from one call.
+ *
+ * This is for scheduling large numbers of small graphs, where the cost of
+ * each call to QED_CalculateBatches is mostly setting up and allocating. The
+ * graphs are compiled and scheduled one after another in memory that is kept
+ * between graphs and between calls, and all of the results go in one buffer.
+ * Once the memory has grown to fit, a call does not allocate.
+ *
+ * Graph g has the batches graph_offsets[g] to graph_offsets[g+1]-1, and batch
+ * b is nodes[offsets[b]] to nodes[offsets[b+1]-1]. So the batches of every
+ * graph are in the same arrays, one graph after another.
+ */
+struct QED_MultiSchedule{
+    unsigned num_graphs, num_batches, num_nodes;
+    struct QED_Dependency **nodes; /**< num_nodes entries. */
+    unsigned *offsets; /**< num_batches + 1 entries. */
+    unsigned *graph_offsets; /**< num_graphs + 1 entries. */
+    /** False for a graph with a cycle, which is given no batches. */
+    bool *scheduled;
+    
+    void *buffer;
+    size_t buffer_size;
+    /* A graph, hash table and output for each worker, kept between calls. */
+    struct qed_multi_worker *workers;
+    unsigned num_workers;
+};
+
+void QED_InitMultiSchedule(struct QED_MultiSchedule *schedule);
+
+/**
+ * @brief Schedules many independent graphs.
+ *
+ * Each graph is scheduled with the options, and gets the same batches as from
+ * QED_CalculateBatchesWithOptions. Any previous contents of the schedule are
+ * replaced.
+ *
+ * If the options have a pool, the graphs are split between its workers, each
+ * of which schedules whole graphs. The result is the same. Only worker zero
+ * records stats and uses the cache, and the other workers use copies of the
+ * budget.
+ *
+ * @return false if an allocation failed or any of the graphs has a cycle. The
+ *   other graphs are still scheduled if there was a cycle.
+ */
+bool QED_CalculateMultiSchedule(struct QED_MultiSchedule *schedule,
+    const struct QED_GraphInput *graphs,
+    unsigned num_graphs,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Frees the buffer and all memory kept between calls.
+ */
+void QED_FreeMultiSchedule(struct QED_MultiSchedule *schedule);
+
+#endif /* LIBQED_MULTI_H */
@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_online.h"
+
+#include "qed_dependency.h"
+#include "qed_deque.h"
+#include "qed_pool.h"
+#include "qed_tinyhash.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Nodes are kept in chunks which are never moved, so a node can be reached by
+ * its index without a lock while other nodes are being added. */
+#define QED_ONLINE_CHUNK_BITS 12
+#define QED_ONLINE_CHUNK_SIZE (1u << QED_ONLINE_CHUNK_BITS)
+#define QED_ONLINE_MAX_CHUNKS (1u << 14)
+
+/* Number of parts the table of submitted deps is split into. */
+#define QED_ONLINE_SHARDS 64
+
+/* Ends the stack of ready nodes. */
+#define QED_ONLINE_NO_NODE (~0u)
+
+/* Waits on a node until it finishes. Each node has one for each of its
+ * dependencies, pushed onto the list of that dependency. */
+struct qed_online_waiter{
+    struct qed_online_waiter *next;
+    unsigned node;
+};
+
+/* Replaces the list of waiters of a node once it has finished. */
+static struct qed_online_waiter qed_online_done;
+#define QED_ONLINE_DONE (&qed_online_done)
+
+struct qed_online_node{
+    struct QED_Dependency *dep;
+    /* Nodes to notify when this finishes, or QED_ONLINE_DONE once it has. */
+    _Atomic(struct qed_online_waiter*) waiters;
+    struct qed_online_waiter *edges;
+    /* Number of unfinished dependencies, plus one which the submitter holds
+     * until it has pushed every waiter. */
+    atomic_uint pending;
+    /* Set when a dependency failed or was skipped. */
+    atomic_bool tainted;
+    atomic_uchar status;
+    int result;
+    /* Links the stack of nodes that were ready when submitted. */
+    unsigned next_ready;
+};
+
+struct qed_online_shard{
+    pthread_mutex_t mutex;
+    struct QED_HashTable *indices;
+};
+
+struct QED_OnlineScheduler{
+    _Atomic(struct qed_online_node*) *chunks;
+    atomic_uint num_nodes;
+    struct qed_online_shard shards[QED_ONLINE_SHARDS];
+    
+    /* Top of the stack of nodes that were ready when submitted. */
+    atomic_uint ready;
+    /* Number of submitted nodes which have not finished. */
+    atomic_uint remaining;
+    atomic_bool closed, failed;
+    
+    /* Idle workers wait on cond, and count themselves in sleepers first. */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    atomic_uint sleepers;
+    
+    /* Only used while running. */
+    struct QED_Deque *deques;
+    unsigned num_workers;
+    void *action_data;
+    enum QED_ErrorMode error_mode;
+};
+
+static struct qed_online_node *qed_online_node(
+    struct QED_OnlineScheduler *online,
+    unsigned index){
+    
+    return atomic_load_explicit(online->chunks + (index >> QED_ONLINE_CHUNK_BITS),
+        memory_order_acquire) + (index & (QED_ONLINE_CHUNK_SIZE - 1));
+}
+
+static struct qed_online_shard *qed_online_shard(
+    struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep){
+    
+    const uintptr_t key = (uintptr_t)dep;
+    return online->shards + (((key >> 4) ^ (key >> 10)) % QED_ONLINE_SHARDS);
+}
+
+struct QED_OnlineScheduler *QED_CreateOnlineScheduler(void){
+    struct QED_OnlineScheduler *const online =
+        calloc(1, sizeof(struct QED_OnlineScheduler));
+    unsigned i;
+    
+    if(online == NULL)
+        return NULL;
+    if((online->chunks = calloc(QED_ONLINE_MAX_CHUNKS,
+        sizeof(_Atomic(struct qed_online_node*)))) == NULL){
+        free(online);
+        return NULL;
+    }
+    for(i = 0; i < QED_ONLINE_MAX_CHUNKS; i++)
+        atomic_init(online->chunks + i, NULL);
+    
+    for(i = 0; i < QED_ONLINE_SHARDS; i++){
+        pthread_mutex_init(&online->shards[i].mutex, NULL);
+        if((online->shards[i].indices = calloc(1, QED_HASH_TABLE_SIZE)) == NULL){
+            QED_DestroyOnlineScheduler(online);
+            return NULL;
+        }
+    }
+    
+    atomic_init(&online->num_nodes, 0);
+    atomic_init(&online->ready, QED_ONLINE_NO_NODE);
+    atomic_init(&online->remaining, 0);
+    atomic_init(&online->closed, false);
+    atomic_init(&online->failed, false);
+    atomic_init(&online->sleepers, 0);
+    pthread_mutex_init(&online->mutex, NULL);
+    pthread_cond_init(&online->cond, NULL);
+    return online;
+}
+
+void QED_DestroyOnlineScheduler(struct QED_OnlineScheduler *online){
+    unsigned i, n;
+    
+    for(i = 0; i < QED_ONLINE_MAX_CHUNKS; i++){
+        struct qed_online_node *const chunk =
+            atomic_load_explicit(online->chunks + i, memory_order_relaxed);
+        if(chunk != NULL){
+            for(n = 0; n < QED_ONLINE_CHUNK_SIZE; n++)
+                free(chunk[n].edges);
+            free(chunk);
+        }
+    }
+    free(online->chunks);
+    
+    /* Creating may have stopped part way through the shards. */
+    for(i = 0; i < QED_ONLINE_SHARDS; i++){
+        pthread_mutex_destroy(&online->shards[i].mutex);
+        if(online->shards[i].indices == NULL)
+            break;
+        QED_FreeHashTable(online->shards[i].indices, NULL);
+        free(online->shards[i].indices);
+    }
+    if(i == QED_ONLINE_SHARDS){
+        pthread_mutex_destroy(&online->mutex);
+        pthread_cond_destroy(&online->cond);
+    }
+    free(online);
+}
+
+/* Wakes idle workers, if there are any. The caller has just made work
+ * visible, and idle workers count themselves before looking for work one last
+ * time, so the fence means at least one side sees the other. */
+static void qed_online_wake(struct QED_OnlineScheduler *online, bool all){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load(&online->sleepers) != 0){
+        pthread_mutex_lock(&online->mutex);
+        if(all)
+            pthread_cond_broadcast(&online->cond);
+        else
+            pthread_cond_signal(&online->cond);
+        pthread_mutex_unlock(&online->mutex);
+    }
+}
+
+/* Counts a node as finished, and wakes the workers if it was the last. */
+static void qed_online_finished(struct QED_OnlineScheduler *online){
+    if(atomic_fetch_sub(&online->remaining, 1) == 1)
+        qed_online_wake(online, true);
+}
+
+/* Claims the index of a new node, allocating its chunk if need be. */
+static unsigned qed_online_new_node(struct QED_OnlineScheduler *online){
+    const unsigned index = atomic_fetch_add_explicit(&online->num_nodes, 1,
+        memory_order_relaxed);
+    _Atomic(struct qed_online_node*) *chunk;
+    struct qed_online_node *expected = NULL, *nodes;
+    
+    if(index >= QED_ONLINE_MAX_CHUNKS * QED_ONLINE_CHUNK_SIZE)
+        return QED_ONLINE_NO_NODE;
+    
+    /* Anyone may allocate the chunk, and whoever loses the race frees theirs. */
+    chunk = online->chunks + (index >> QED_ONLINE_CHUNK_BITS);
+    if(atomic_load_explicit(chunk, memory_order_acquire) == NULL){
+        if((nodes = calloc(QED_ONLINE_CHUNK_SIZE,
+            sizeof(struct qed_online_node))) == NULL)
+            return QED_ONLINE_NO_NODE;
+        if(!atomic_compare_exchange_strong_explicit(chunk, &expected, nodes,
+            memory_order_acq_rel, memory_order_acquire))
+            free(nodes);
+    }
+    return index;
+}
+
+static bool qed_online_find(struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep,
+    unsigned *out_index){
+    
+    struct qed_online_shard *const shard = qed_online_shard(online, dep);
+    qed_hashdata_t index;
+    bool found;
+    
+    pthread_mutex_lock(&shard->mutex);
+    found = QED_HashTableGet(shard->indices, (qed_hashkey_t)dep, &index);
+    pthread_mutex_unlock(&shard->mutex);
+    if(found)
+        out_index[0] = (unsigned)index;
+    return found;
+}
+
+/* Adds a node to the table. Returns false if the dep is already there, or the
+ * table could not grow. */
+static bool qed_online_insert(struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep,
+    unsigned index){
+    
+    struct qed_online_shard *const shard = qed_online_shard(online, dep);
+    qed_hashdata_t old;
+    bool ok;
+    
+    pthread_mutex_lock(&shard->mutex);
+    ok = !QED_HashTableGet(shard->indices, (qed_hashkey_t)dep, &old) &&
+        QED_HashTableReserve(shard->indices,
+            QED_HashTableCount(shard->indices) + 1);
+    if(ok)
+        QED_HashTableInsert(shard->indices, (qed_hashkey_t)dep, index, &old);
+    pthread_mutex_unlock(&shard->mutex);
+    return ok;
+}
+
+/* Pushes a waiter onto the list of a dependency. Returns false if the
+ * dependency has already finished, in which case there is nothing to wait
+ * for. */
+static bool qed_online_wait(struct qed_online_node *node,
+    struct qed_online_node *dependency,
+    struct qed_online_waiter *waiter){
+    
+    struct qed_online_waiter *head =
+        atomic_load_explicit(&dependency->waiters, memory_order_acquire);
+    do{
+        if(head == QED_ONLINE_DONE){
+            const unsigned status = atomic_load_explicit(&dependency->status,
+                memory_order_relaxed);
+            if(status == QED_eFailed || status == QED_eSkipped)
+                atomic_store_explicit(&node->tainted, true, memory_order_relaxed);
+            return false;
+        }
+        waiter->next = head;
+    }while(!atomic_compare_exchange_weak_explicit(&dependency->waiters, &head,
+        waiter, memory_order_release, memory_order_acquire));
+    return true;
+}
+
+/* Pushes a node that was ready when submitted, for any worker to take. */
+static void qed_online_push_ready(struct QED_OnlineScheduler *online,
+    unsigned index){
+    
+    struct qed_online_node *const node = qed_online_node(online, index);
+    unsigned head = atomic_load_explicit(&online->ready, memory_order_relaxed);
+    do{
+        node->next_ready = head;
+    }while(!atomic_compare_exchange_weak_explicit(&online->ready, &head, index,
+        memory_order_release, memory_order_relaxed));
+    qed_online_wake(online, false);
+}
+
+bool QED_SubmitDependency(struct QED_OnlineScheduler *online,
+    struct QED_Dependency *dep){
+    
+    const unsigned num_deps = dep->num_dependencies;
+    struct qed_online_waiter *edges = NULL;
+    struct qed_online_node *node;
+    unsigned index, i;
+    
+    if(num_deps != 0 &&
+        (edges = malloc(num_deps * sizeof(struct qed_online_waiter))) == NULL)
+        return false;
+    
+    /* Counted before checking whether it is closed, so that the workers cannot
+     * see nothing remaining and stop while this is being added. */
+    atomic_fetch_add(&online->remaining, 1);
+    if(atomic_load(&online->closed) ||
+        (index = qed_online_new_node(online)) == QED_ONLINE_NO_NODE){
+        free(edges);
+        qed_online_finished(online);
+        return false;
+    }
+    
+    node = qed_online_node(online, index);
+    node->dep = dep;
+    node->edges = edges;
+    node->result = 0;
+    atomic_init(&node->waiters, NULL);
+    atomic_init(&node->pending, num_deps + 1);
+    atomic_init(&node->tainted, false);
+    atomic_init(&node->status, QED_eCancelled);
+    
+    for(i = 0; i < num_deps; i++){
+        unsigned dependency;
+        edges[i].node = index;
+        if(!qed_online_find(online, dep->dependencies[i], &dependency) ||
+            !qed_online_wait(node, qed_online_node(online, dependency), edges + i))
+            atomic_fetch_sub_explicit(&node->pending, 1, memory_order_relaxed);
+    }
+    
+    /* The node can only be found once its waiters are pushed, so a dep which
+     * depends on itself does not wait forever. If it was submitted twice, the
+     * submitter's count is never dropped and the node never runs. */
+    if(!qed_online_insert(online, dep, index)){
+        qed_online_finished(online);
+        return false;
+    }
+    
+    if(atomic_fetch_sub_explicit(&node->pending, 1, memory_order_acq_rel) == 1)
+        qed_online_push_ready(online, index);
+    return true;
+}
+
+void QED_CloseOnlineScheduler(struct QED_OnlineScheduler *online){
+    atomic_store(&online->closed, true);
+    pthread_mutex_lock(&online->mutex);
+    pthread_cond_broadcast(&online->cond);
+    pthread_mutex_unlock(&online->mutex);
+}
+
+static void qed_online_run(struct QED_OnlineScheduler *online,
+    struct QED_Deque *deque,
+    unsigned index);
+
+/* Notifies the waiters of a node that has finished, and pushes any it made
+ * ready onto the worker's deque. */
+static void qed_online_finish(struct QED_OnlineScheduler *online,
+    struct QED_Deque *deque,
+    struct qed_online_node *node,
+    int result,
+    enum QED_Status status){
+    
+    const bool taint = (status == QED_eFailed || status == QED_eSkipped);
+    struct qed_online_waiter *waiter;
+    bool pushed = false;
+    
+    node->result = result;
+    atomic_store_explicit(&node->status, status, memory_order_release);
+    
+    /* Anything that tries to wait on the node after this sees it is done. */
+    waiter = atomic_exchange_explicit(&node->waiters, QED_ONLINE_DONE,
+        memory_order_acq_rel);
+    while(waiter != NULL){
+        struct qed_online_waiter *const next = waiter->next;
+        struct qed_online_node *const dependent =
+            qed_online_node(online, waiter->node);
+        if(taint)
+            atomic_store_explicit(&dependent->tainted, true, memory_order_relaxed);
+        if(atomic_fetch_sub_explicit(&dependent->pending, 1,
+            memory_order_acq_rel) == 1){
+            
+            if(QED_DequePush(deque, waiter->node))
+                pushed = true;
+            else
+                qed_online_run(online, deque, waiter->node);
+        }
+        waiter = next;
+    }
+    
+    if(pushed)
+        qed_online_wake(online, false);
+    qed_online_finished(online);
+}
+
+/* Runs a node which is ready, unless an earlier failure means it should not
+ * run. */
+static void qed_online_run(struct QED_OnlineScheduler *online,
+    struct QED_Deque *deque,
+    unsigned index){
+    
+    struct qed_online_node *const node = qed_online_node(online, index);
+    const struct QED_Dependency *const dep = node->dep;
+    int result;
+    
+    if(online->error_mode == QED_eSkipDependents &&
+        atomic_load_explicit(&node->tainted, memory_order_relaxed)){
+        qed_online_finish(online, deque, node, 0, QED_eSkipped);
+        return;
+    }
+    if(online->error_mode == QED_eStopAll &&
+        atomic_load_explicit(&online->failed, memory_order_relaxed)){
+        qed_online_finish(online, deque, node, 0, QED_eCancelled);
+        return;
+    }
+    
+    result = (dep->execute.func == NULL) ? 0 :
+        dep->execute.func(online->action_data, dep->execute.user_data);
+    if(result != 0)
+        atomic_store_explicit(&online->failed, true, memory_order_relaxed);
+    qed_online_finish(online, deque, node, result,
+        (result == 0) ? QED_eOk : QED_eFailed);
+}
+
+/* Moves the nodes that were ready when submitted onto the worker's deque, and
+ * takes one of them. */
+static unsigned qed_online_take_ready(struct QED_OnlineScheduler *online,
+    struct QED_Deque *deque){
+    
+    unsigned index, num_pushed = 0;
+    if(atomic_load_explicit(&online->ready, memory_order_relaxed) ==
+        QED_ONLINE_NO_NODE)
+        return QED_DEQUE_EMPTY;
+    
+    /* Taking the whole stack at once leaves nothing for another worker to
+     * pop at the same time. */
+    index = atomic_exchange_explicit(&online->ready, QED_ONLINE_NO_NODE,
+        memory_order_acquire);
+    while(index != QED_ONLINE_NO_NODE){
+        const unsigned next = qed_online_node(online, index)->next_ready;
+        if(QED_DequePush(deque, index))
+            num_pushed++;
+        else
+            qed_online_run(online, deque, index);
+        index = next;
+    }
+    
+    if(num_pushed > 1)
+        qed_online_wake(online, true);
+    return QED_DequeTake(deque);
+}
+
+static unsigned qed_online_steal(struct QED_OnlineScheduler *online,
+    unsigned worker,
+    unsigned *victim){
+    
+    const unsigned num_workers = online->num_workers;
+    unsigned index = QED_DEQUE_EMPTY, i;
+    for(i = 1; i < num_workers && index >= QED_DEQUE_ABORT; i++){
+        if(++victim[0] == num_workers)
+            victim[0] = 0;
+        if(victim[0] != worker)
+            index = QED_DequeSteal(online->deques + victim[0]);
+    }
+    return index;
+}
+
+/* Waits for more work. Returns false once the scheduler is closed and every
+ * node has finished. A node may be stolen while getting ready to wait, and is
+ * placed in out_index, which is otherwise QED_DEQUE_EMPTY. */
+static bool qed_online_sleep(struct QED_OnlineScheduler *online,
+    unsigned worker,
+    unsigned *victim,
+    unsigned *out_index){
+    
+    bool stop;
+    
+    pthread_mutex_lock(&online->mutex);
+    atomic_fetch_add(&online->sleepers, 1);
+    
+    out_index[0] = qed_online_steal(online, worker, victim);
+    stop = atomic_load(&online->closed) && atomic_load(&online->remaining) == 0;
+    if(!stop && out_index[0] >= QED_DEQUE_ABORT &&
+        atomic_load(&online->ready) == QED_ONLINE_NO_NODE)
+        pthread_cond_wait(&online->cond, &online->mutex);
+    
+    atomic_fetch_sub(&online->sleepers, 1);
+    pthread_mutex_unlock(&online->mutex);
+    return !stop;
+}
+
+static void qed_online_job(void *arg, unsigned worker){
+    struct QED_OnlineScheduler *const online = arg;
+    struct QED_Deque *const deque = online->deques + worker;
+    unsigned victim = worker;
+    
+    for(;;){
+        unsigned index = QED_DequeTake(deque);
+        if(index == QED_DEQUE_EMPTY)
+            index = qed_online_take_ready(online, deque);
+        if(index == QED_DEQUE_EMPTY)
+            index = qed_online_steal(online, worker, &victim);
+        if(index >= QED_DEQUE_ABORT &&
+            !qed_online_sleep(online, worker, &victim, &index))
+            return;
+        if(index < QED_DEQUE_ABORT)
+            qed_online_run(online, deque, index);
+    }
+}
+
+bool QED_RunOnlineScheduler(struct QED_OnlineScheduler *online,
+    struct QED_ThreadPool *pool,
+    const struct QED_ExecuteOptions *options){
+    
+    const unsigned num_workers = QED_ThreadPoolSize(pool);
+    unsigned num_deques = 0;
+    bool ok = false;
+    
+    online->num_workers = num_workers;
+    online->action_data = (options == NULL) ? NULL : options->action_data;
+    online->error_mode = (options == NULL) ? QED_eContinueAll : options->error_mode;
+    
+    if((online->deques = malloc(num_workers * sizeof(struct QED_Deque))) == NULL)
+        return false;
+    for(; num_deques < num_workers; num_deques++){
+        if(!QED_InitDeque(online->deques + num_deques, 64))
+            goto online_end;
+    }
+    
+    QED_RunThreadPool(pool, qed_online_job, online);
+    ok = !atomic_load(&online->failed);
+
+online_end:
+    while(num_deques != 0)
+        QED_DestroyDeque(online->deques + --num_deques);
+    free(online->deques);
+    online->deques = NULL;
+    return ok;
+}
+
+enum QED_Status QED_OnlineStatus(struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep){
+    
+    unsigned index;
+    if(!qed_online_find(online, dep, &index))
+        return QED_eCancelled;
+    return (enum QED_Status)atomic_load_explicit(
+        &qed_online_node(online, index)->status, memory_order_acquire);
+}
+
+int QED_OnlineResult(struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep){
+    
+    unsigned index;
+    struct qed_online_node *node;
+    if(!qed_online_find(online, dep, &index))
+        return 0;
+    node = qed_online_node(online, index);
+    if(atomic_load_explicit(&node->status, memory_order_acquire) == QED_eCancelled)
+        return 0;
+    return node->result;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_ONLINE_H
+#define LIBQED_ONLINE_H
+#pragma once
+
+#include "qed_execute.h"
+
+#include <stdbool.h>
+
+struct QED_Dependency;
+struct QED_ThreadPool;
+
+/* Runs deps which are submitted while earlier ones are still running.
+ *
+ * Instead of a complete graph, deps are submitted one at a time from any
+ * thread, including from inside callbacks. A dep may depend on deps that have
+ * not started, are running, or have already finished. Nothing is scheduled
+ * ahead of time: each submitted dep waits on the deps it depends on, and is
+ * run by QED_RunOnlineScheduler as soon as the last of them finishes.
+ *
+ * Submitting takes no lock that every producer shares. The submitted deps are
+ * found through a table split into shards, each with its own lock, and the
+ * deps that wait on each dep are kept in a lock-free list.
+ *
+ * The dependencies of a dep are looked up when it is submitted, so they must
+ * have been submitted first. A dependency that was never submitted counts as
+ * satisfied, which also means there can be no cycles.
+ */
+struct QED_OnlineScheduler;
+
+/**
+ * @brief Creates an online scheduler.
+ *
+ * @return The scheduler, or NULL if an allocation failed.
+ */
+struct QED_OnlineScheduler *QED_CreateOnlineScheduler(void);
+
+/**
+ * @brief Submits a dep. May be called from any thread.
+ *
+ * The dep and its dependencies must stay valid, and must not be changed, until
+ * the scheduler is destroyed.
+ *
+ * @return false if the dep was already submitted, the scheduler is closed, or
+ *   an allocation failed. The dep will not run.
+ */
+bool QED_SubmitDependency(struct QED_OnlineScheduler *online,
+    struct QED_Dependency *dep);
+
+/**
+ * @brief Stops accepting deps. May be called from any thread.
+ *
+ * Every dep submitted before this still runs, and QED_RunOnlineScheduler
+ * returns once they have all finished.
+ */
+void QED_CloseOnlineScheduler(struct QED_OnlineScheduler *online);
+
+/**
+ * @brief Runs submitted deps on the pool until the scheduler is closed and
+ * every dep has finished.
+ *
+ * When a dep finishes, any dependents that it made ready are pushed onto the
+ * work-stealing deque of the worker that ran it, as in QED_ExecuteGraph. Deps
+ * that were ready when submitted are collected by whichever worker looks for
+ * them next. Workers with nothing to do sleep until more is submitted.
+ *
+ * Only the action_data and error_mode of the options are used, and options may
+ * be NULL. The result and status of each dep are from QED_OnlineResult and
+ * QED_OnlineStatus. Only one thread may run the scheduler at a time, and it
+ * cannot be run again once it has returned.
+ *
+ * @return false if any callback returned non-zero, or if an allocation failed
+ *   before anything ran.
+ */
+bool QED_RunOnlineScheduler(struct QED_OnlineScheduler *online,
+    struct QED_ThreadPool *pool,
+    const struct QED_ExecuteOptions *options);
+
+/**
+ * @brief Gets how a submitted dep ended. May be called from any thread.
+ *
+ * @return QED_eCancelled if the dep was not submitted or has not finished.
+ */
+enum QED_Status QED_OnlineStatus(struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep);
+
+/**
+ * @brief Gets the return value of the callback of a dep which has finished.
+ *
+ * @return zero if the dep did not run.
+ */
+int QED_OnlineResult(struct QED_OnlineScheduler *online,
+    const struct QED_Dependency *dep);
+
+/**
+ * @brief Frees the scheduler. Must not be called while it is running.
+ */
+void QED_DestroyOnlineScheduler(struct QED_OnlineScheduler *online);
+
+#endif /* LIBQED_ONLINE_H */
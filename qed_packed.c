@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_packed.h"
+
+#include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_lookahead.h"
+#include "qed_resource.h"
+#include "qed_stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+unsigned long QED_DependencyCost(const struct QED_Dependency *dep){
+    return (dep->cost == 0) ? 1 : dep->cost;
+}
+
+bool QED_CalculateCostRanks(const struct QED_Graph *graph,
+    const unsigned long long *costs,
+    unsigned *scratch,
+    unsigned long long *out_ranks){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned *const pending = (scratch != NULL) ? scratch :
+        malloc(QED_RANKS_SCRATCH(num_nodes) * sizeof(unsigned));
+    unsigned *const queue = pending + num_nodes + 1;
+    unsigned head = 0, tail = 0, i;
+    
+    if(pending == NULL)
+        return false;
+    
+    /* The same backwards Kahn's algorithm as QED_CalculateRanks. */
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->succ_offsets[i + 1] - graph->succ_offsets[i];
+        if(pending[i] == 0)
+            queue[tail++] = i;
+    }
+    
+    while(head != tail){
+        const unsigned node = queue[head++];
+        unsigned long long rank = 0;
+        unsigned e;
+        
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned long long succ_rank = out_ranks[graph->succs[e]];
+            if(succ_rank > rank)
+                rank = succ_rank;
+        }
+        out_ranks[node] = rank + costs[node];
+        
+        for(e = graph->pred_offsets[node]; e < graph->pred_offsets[node + 1]; e++){
+            const unsigned pred = graph->preds[e];
+            assert(pending[pred] != 0);
+            if(--pending[pred] == 0)
+                queue[tail++] = pred;
+        }
+    }
+    
+    if(scratch == NULL)
+        free(pending);
+    return head == num_nodes;
+}
+
+struct qed_packed_heap{
+    const unsigned long long *ranks;
+    const unsigned long long *costs;
+    unsigned *nodes;
+    unsigned count;
+};
+
+/* Returns true if a should be scheduled before b. */
+static bool qed_packed_before(const struct qed_packed_heap *heap,
+    unsigned a,
+    unsigned b){
+    
+    if(heap->ranks[a] != heap->ranks[b])
+        return heap->ranks[a] > heap->ranks[b];
+    if(heap->costs[a] != heap->costs[b])
+        return heap->costs[a] > heap->costs[b];
+    return a < b;
+}
+
+static void qed_packed_push(struct qed_packed_heap *heap, unsigned node){
+    unsigned i = heap->count++;
+    while(i != 0){
+        const unsigned parent = (i - 1) >> 1;
+        if(!qed_packed_before(heap, node, heap->nodes[parent]))
+            break;
+        heap->nodes[i] = heap->nodes[parent];
+        i = parent;
+    }
+    heap->nodes[i] = node;
+}
+
+static unsigned qed_packed_pop(struct qed_packed_heap *heap){
+    const unsigned top = heap->nodes[0];
+    const unsigned last = heap->nodes[--heap->count];
+    const unsigned count = heap->count;
+    unsigned i = 0;
+    
+    for(;;){
+        unsigned child = (i << 1) + 1;
+        if(child >= count)
+            break;
+        if(child + 1 < count &&
+            qed_packed_before(heap, heap->nodes[child + 1], heap->nodes[child]))
+            child++;
+        if(!qed_packed_before(heap, heap->nodes[child], last))
+            break;
+        heap->nodes[i] = heap->nodes[child];
+        i = child;
+    }
+    if(count != 0)
+        heap->nodes[i] = last;
+    return top;
+}
+
+/* Returns the least loaded worker. */
+static unsigned qed_packed_worker(const unsigned long long *loads,
+    unsigned num_workers){
+    
+    unsigned i, best = 0;
+    for(i = 1; i < num_workers; i++){
+        if(loads[i] < loads[best])
+            best = i;
+    }
+    return best;
+}
+
+bool QED_SchedulePacked(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned long max_batch_cost,
+    unsigned num_workers,
+    const unsigned long *costs,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    const unsigned long stride = (unsigned long)num_nodes + 1;
+    unsigned *const memory = (scratch != NULL) ? scratch :
+        malloc(QED_PACKED_SCRATCH(num_nodes, num_workers) * sizeof(unsigned));
+    
+    /* The 64-bit arrays go first so that they stay aligned. */
+    unsigned long long *const ranks = (unsigned long long*)memory,
+        *const node_costs = ranks + stride,
+        *const loads = node_costs + stride;
+    unsigned *const pending = (unsigned*)(loads + num_workers + 1),
+        *const skipped = pending + stride;
+    struct qed_packed_heap heap;
+    unsigned num_scheduled = 0, num_batches = 0, i;
+    
+    if(memory == NULL)
+        return false;
+    
+    for(i = 0; i < num_nodes; i++){
+        node_costs[i] = (costs == NULL) ? QED_DependencyCost(graph->nodes[i]) :
+            ((costs[i] == 0) ? 1 : costs[i]);
+    }
+    
+    /* The pending counts and the heap are used as scratch for the ranks. */
+    if(!QED_CalculateCostRanks(graph, node_costs, pending, ranks)){
+        if(scratch == NULL)
+            free(memory);
+        return false;
+    }
+    
+    if(max_batch_size == 0)
+        max_batch_size = num_nodes;
+    
+    heap.ranks = ranks;
+    heap.costs = node_costs;
+    heap.nodes = skipped + stride;
+    heap.count = 0;
+    
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        if(pending[i] == 0)
+            qed_packed_push(&heap, i);
+    }
+    
+    while(heap.count != 0){
+        const unsigned start = num_scheduled;
+        unsigned long long total = 0, makespan = 0;
+        unsigned usage[QED_MAX_RESOURCE_CLASSES];
+        unsigned num_skipped = 0;
+        
+        for(i = 0; i < num_workers; i++)
+            loads[i] = 0;
+        if(resources != NULL)
+            QED_ClearResources(usage);
+        
+        out_offsets[num_batches++] = start;
+        while(heap.count != 0 && num_scheduled - start < max_batch_size &&
+            num_skipped < QED_PACKED_MAX_SKIPPED){
+            
+            const unsigned node = qed_packed_pop(&heap);
+            const unsigned long long cost = node_costs[node];
+            const unsigned worker = (num_workers == 0) ? 0 :
+                qed_packed_worker(loads, num_workers);
+            
+            if(num_scheduled != start){
+                if((max_batch_cost != 0 && total + cost > max_batch_cost) ||
+                    (num_workers != 0 && loads[worker] + cost > makespan) ||
+                    (resources != NULL && !QED_ReserveResources(resources,
+                    usage, graph->nodes[node]->resources))){
+                    skipped[num_skipped++] = node;
+                    continue;
+                }
+            }
+            else{
+                /* Nothing can finish before the first node, so the other
+                 * workers are filled up to its cost. */
+                makespan = cost;
+                if(resources != NULL)
+                    QED_ReserveResources(resources, usage,
+                        graph->nodes[node]->resources);
+            }
+            
+            if(num_workers != 0)
+                loads[worker] += cost;
+            total += cost;
+            out_order[num_scheduled++] = node;
+            
+            /* Stop early once nothing else could fit. */
+            if((max_batch_cost != 0 && total >= max_batch_cost) ||
+                (num_workers != 0 &&
+                loads[qed_packed_worker(loads, num_workers)] >= makespan))
+                break;
+        }
+        
+        QED_STATS_BATCH((num_scheduled - start) + num_skipped +
+            QED_GraphSuccessorCount(graph, out_order + start, num_scheduled - start));
+        
+        for(i = 0; i < num_skipped; i++)
+            qed_packed_push(&heap, skipped[i]);
+        
+        /* Only queue newly ready nodes once the batch is complete. */
+        for(i = start; i < num_scheduled; i++){
+            const unsigned node = out_order[i];
+            unsigned e;
+            for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+                const unsigned succ = graph->succs[e];
+                assert(pending[succ] != 0);
+                if(--pending[succ] == 0)
+                    qed_packed_push(&heap, succ);
+            }
+        }
+    }
+    out_offsets[num_batches] = num_scheduled;
+    
+    if(scratch == NULL)
+        free(memory);
+    out_num_batches[0] = num_batches;
+    assert(num_scheduled == num_nodes);
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_PACKED_H
+#define LIBQED_PACKED_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Dependency;
+struct QED_Graph;
+struct QED_ResourceLimits;
+
+#define QED_PACKED_SCRATCH(NUM_NODES, NUM_WORKERS) \
+    ((((unsigned long)(NUM_NODES) + 1) * 7) + (((unsigned long)(NUM_WORKERS) + 1) * 2))
+
+/* The most ready nodes that are passed over while filling one batch. This
+ * keeps each batch from scanning every ready node when little fits. */
+#define QED_PACKED_MAX_SKIPPED 64
+
+/**
+ * @brief Gets the cost of a dependency, treating zero as one.
+ */
+unsigned long QED_DependencyCost(const struct QED_Dependency *dep);
+
+/**
+ * @brief Calculates the cost of the longest path from every node to a sink.
+ *
+ * This is the same as QED_CalculateRanks, except that each node counts as its
+ * cost rather than as one.
+ *
+ * scratch must have room for QED_RANKS_SCRATCH(graph->num_nodes) entries,
+ * or be NULL to allocate it internally.
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_CalculateCostRanks(const struct QED_Graph *graph,
+    const unsigned long long *costs,
+    unsigned *scratch,
+    unsigned long long *out_ranks);
+
+/**
+ * @brief Calculates batches packed by cost.
+ *
+ * Ready nodes are taken in order of their cost-weighted rank, then their
+ * cost. Among independent nodes this is longest processing time first.
+ *
+ * A node is passed over for the current batch if it would take the total
+ * cost of the batch over max_batch_cost, or if num_workers is not zero and
+ * the node would not fit on any worker without running longer than the first
+ * node in the batch. Workers are assigned LPT-style, each node going to the
+ * least loaded one. The first node of a batch is always taken. Zero disables
+ * each limit, and max_batch_size still applies. A node is also passed over
+ * if resources is not NULL and it would take the batch over a resource limit.
+ *
+ * costs has one entry per node, or is NULL to use the cost of each dependency.
+ *
+ * scratch must have room for QED_PACKED_SCRATCH(graph->num_nodes, num_workers)
+ * entries and be aligned for unsigned long long, or be NULL to allocate it
+ * internally.
+ *
+ * @return false if the graph has a cycle or an allocation failed.
+ */
+bool QED_SchedulePacked(const struct QED_Graph *graph,
+    unsigned max_batch_size,
+    const struct QED_ResourceLimits *resources,
+    unsigned long max_batch_cost,
+    unsigned num_workers,
+    const unsigned long *costs,
+    unsigned *scratch,
+    unsigned *out_order,
+    unsigned *out_offsets,
+    unsigned *out_num_batches);
+
+#endif /* LIBQED_PACKED_H */
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_partial.h"
+
+#include "qed_batch.h"
+#include "qed_graph.h"
+#include "qed_stats.h"
+#include "qed_tinyhash.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Flags in the graph marks. */
+#define QED_PARTIAL_DOWN 1 /* Downstream of a dirty node. */
+#define QED_PARTIAL_UP 2 /* Upstream of a target. */
+#define QED_PARTIAL_SELECTED 4
+
+/* Flags in the table of dirty deps and targets. */
+#define QED_PARTIAL_DIRTY_DEP 1
+#define QED_PARTIAL_TARGET_DEP 2
+
+/* A breadth-first search along either the preds or the succs. */
+struct qed_partial_search{
+    const unsigned *offsets, *edges;
+    unsigned *queue;
+    unsigned head, tail;
+    unsigned flag;
+    /* If not zero, only nodes that already have this flag are visited. */
+    unsigned within;
+};
+
+static bool qed_partial_has(const unsigned *marks,
+    unsigned generation,
+    unsigned node,
+    unsigned flag){
+    return marks[node] >= generation && (marks[node] & flag) != 0;
+}
+
+/* Flags and queues a node if the search has not seen it and may visit it. */
+static void qed_partial_visit(struct qed_partial_search *search,
+    unsigned *marks,
+    unsigned generation,
+    unsigned node){
+    
+    if(qed_partial_has(marks, generation, node, search->flag) ||
+        (search->within != 0 &&
+        !qed_partial_has(marks, generation, node, search->within)))
+        return;
+    
+    marks[node] = ((marks[node] < generation) ? generation : marks[node]) |
+        search->flag;
+    search->queue[search->tail++] = node;
+}
+
+static void qed_partial_start(struct qed_partial_search *search,
+    unsigned *marks,
+    unsigned generation,
+    const unsigned *nodes,
+    unsigned num_nodes){
+    
+    unsigned i;
+    search->head = search->tail = 0;
+    for(i = 0; i < num_nodes; i++)
+        qed_partial_visit(search, marks, generation, nodes[i]);
+}
+
+/* Visits the next node in the queue. */
+static void qed_partial_step(struct qed_partial_search *search,
+    unsigned *marks,
+    unsigned generation){
+    
+    const unsigned node = search->queue[search->head++];
+    unsigned e;
+    for(e = search->offsets[node]; e < search->offsets[node + 1]; e++)
+        qed_partial_visit(search, marks, generation, search->edges[e]);
+}
+
+static void qed_partial_search(const struct QED_Graph *graph,
+    struct qed_partial_search *search,
+    bool downstream,
+    unsigned flag,
+    unsigned within,
+    unsigned *queue){
+    
+    search->offsets = downstream ? graph->succ_offsets : graph->pred_offsets;
+    search->edges = downstream ? graph->succs : graph->preds;
+    search->queue = queue;
+    search->flag = flag;
+    search->within = within;
+}
+
+/* Selects the nodes, leaving them flagged as selected in the marks. */
+static bool qed_partial_select(struct QED_Graph *graph,
+    const unsigned *targets,
+    unsigned num_targets,
+    const unsigned *dirty,
+    unsigned num_dirty,
+    unsigned *out_nodes,
+    unsigned *out_num_nodes,
+    unsigned *out_generation){
+    
+    const unsigned stride = graph->num_nodes + 1;
+    unsigned *const queues = QED_GraphScratch(graph, (unsigned long)stride * 2);
+    unsigned generation;
+    unsigned *const marks = QED_GraphMarks(graph, &generation);
+    struct qed_partial_search down, up, select;
+    
+    out_num_nodes[0] = 0;
+    if(queues == NULL || marks == NULL)
+        return false;
+    
+    qed_partial_search(graph, &down, true, QED_PARTIAL_DOWN, 0, queues);
+    qed_partial_search(graph, &up, false, QED_PARTIAL_UP, 0, queues + stride);
+    qed_partial_start(&down, marks, generation, dirty, num_dirty);
+    qed_partial_start(&up, marks, generation, targets, num_targets);
+    
+    /* Take turns until one side is complete. */
+    while(down.head != down.tail && up.head != up.tail){
+        qed_partial_step(&down, marks, generation);
+        qed_partial_step(&up, marks, generation);
+    }
+    QED_STATS_ADD(nodes_visited, down.head + up.head);
+    
+    /* Then search from the other side, but only inside the complete set. */
+    if(down.head == down.tail){
+        qed_partial_search(graph, &select, false, QED_PARTIAL_SELECTED,
+            QED_PARTIAL_DOWN, out_nodes);
+        qed_partial_start(&select, marks, generation, targets, num_targets);
+    }
+    else{
+        qed_partial_search(graph, &select, true, QED_PARTIAL_SELECTED,
+            QED_PARTIAL_UP, out_nodes);
+        qed_partial_start(&select, marks, generation, dirty, num_dirty);
+    }
+    while(select.head != select.tail)
+        qed_partial_step(&select, marks, generation);
+    QED_STATS_ADD(nodes_visited, select.head);
+    
+    out_num_nodes[0] = select.tail;
+    out_generation[0] = generation;
+    return true;
+}
+
+bool QED_SelectGraph(struct QED_Graph *graph,
+    const unsigned *targets,
+    unsigned num_targets,
+    const unsigned *dirty,
+    unsigned num_dirty,
+    unsigned *out_nodes,
+    unsigned *out_num_nodes){
+    
+    unsigned generation;
+    return qed_partial_select(graph, targets, num_targets, dirty, num_dirty,
+        out_nodes, out_num_nodes, &generation);
+}
+
+/* Builds the graph of just the selected nodes, and the edges between them.
+ * map must have room for an entry for every node of the graph. */
+static bool qed_partial_subgraph(struct QED_Graph *out_graph,
+    const struct QED_Graph *graph,
+    const unsigned *nodes,
+    unsigned num_nodes,
+    const unsigned *marks,
+    unsigned generation,
+    unsigned *map){
+    
+    unsigned i, e, num_edges = 0, edge;
+    
+    memset(out_graph, 0, sizeof(struct QED_Graph));
+    
+    for(i = 0; i < num_nodes; i++){
+        const unsigned node = nodes[i];
+        map[node] = i;
+        for(e = graph->pred_offsets[node]; e < graph->pred_offsets[node + 1]; e++){
+            if(qed_partial_has(marks, generation, graph->preds[e],
+                QED_PARTIAL_SELECTED))
+                num_edges++;
+        }
+    }
+    
+    QED_STATS_ALLOC(((num_nodes + 1) * (sizeof(void*) + (sizeof(unsigned) * 2))) +
+        ((num_edges + 1) * sizeof(unsigned) * 2));
+    out_graph->num_nodes = num_nodes;
+    out_graph->num_edges = num_edges;
+    out_graph->nodes = malloc((num_nodes + 1) * sizeof(void*));
+    out_graph->pred_offsets = malloc((num_nodes + 1) * sizeof(unsigned));
+    out_graph->preds = malloc((num_edges + 1) * sizeof(unsigned));
+    out_graph->succ_offsets = malloc((num_nodes + 1) * sizeof(unsigned));
+    out_graph->succs = malloc((num_edges + 1) * sizeof(unsigned));
+    if(out_graph->nodes == NULL || out_graph->pred_offsets == NULL ||
+        out_graph->preds == NULL || out_graph->succ_offsets == NULL ||
+        out_graph->succs == NULL){
+        QED_FreeGraph(out_graph);
+        return false;
+    }
+    
+    for(i = 0, edge = 0; i < num_nodes; i++){
+        const unsigned node = nodes[i];
+        out_graph->nodes[i] = graph->nodes[node];
+        out_graph->pred_offsets[i] = edge;
+        for(e = graph->pred_offsets[node]; e < graph->pred_offsets[node + 1]; e++){
+            const unsigned pred = graph->preds[e];
+            if(qed_partial_has(marks, generation, pred, QED_PARTIAL_SELECTED))
+                out_graph->preds[edge++] = map[pred];
+        }
+    }
+    out_graph->pred_offsets[num_nodes] = edge;
+    
+    for(i = 0, edge = 0; i < num_nodes; i++){
+        const unsigned node = nodes[i];
+        out_graph->succ_offsets[i] = edge;
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            if(qed_partial_has(marks, generation, succ, QED_PARTIAL_SELECTED))
+                out_graph->succs[edge++] = map[succ];
+        }
+    }
+    out_graph->succ_offsets[num_nodes] = edge;
+    assert(edge == num_edges);
+    return true;
+}
+
+static bool qed_partial_batches_from_graph(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Graph *graph,
+    const unsigned *targets,
+    unsigned num_targets,
+    const unsigned *dirty,
+    unsigned num_dirty,
+    const struct QED_BatchOptions *options){
+    
+    unsigned *const nodes = malloc((graph->num_nodes + 1) * sizeof(unsigned));
+    struct QED_BatchOptions sub_options = *options;
+    struct QED_Graph subgraph;
+    unsigned num_nodes, generation;
+    bool ok;
+    
+    out_batches[0] = NULL;
+    out_num_batches[0] = 0;
+    QED_STATS_ALLOC((graph->num_nodes + 1) * sizeof(unsigned));
+    if(nodes == NULL)
+        return false;
+    
+    /* The selection is done with the scratch, so it can hold the map. */
+    QED_STATS_TIME(closure_ns, ok = qed_partial_select(graph, targets,
+        num_targets, dirty, num_dirty, nodes, &num_nodes, &generation) &&
+        qed_partial_subgraph(&subgraph, graph, nodes, num_nodes, graph->marks,
+            generation, graph->scratch));
+    free(nodes);
+    if(!ok)
+        return false;
+    
+    if(sub_options.algorithm == QED_eGreedyIterate)
+        sub_options.algorithm = QED_eGreedy;
+    ok = QED_CalculateBatchesFromGraph(out_batches, out_num_batches, &subgraph,
+        &sub_options);
+    QED_FreeGraph(&subgraph);
+    return ok;
+}
+
+bool QED_CalculatePartialBatchesFromGraph(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Graph *graph,
+    const unsigned *targets,
+    unsigned num_targets,
+    const unsigned *dirty,
+    unsigned num_dirty,
+    const struct QED_BatchOptions *options){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_partial_batches_from_graph(out_batches, out_num_batches, graph,
+            targets, num_targets, dirty, num_dirty, options));
+}
+
+static bool qed_partial_batches(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **targets,
+    unsigned num_targets,
+    struct QED_Dependency **dirty,
+    unsigned num_dirty,
+    const struct QED_BatchOptions *options){
+    
+    struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+    unsigned *indices = NULL, num_target_indices = 0, num_dirty_indices = 0, i;
+    struct QED_Graph graph;
+    bool ok = false;
+    
+    memset(&graph, 0, sizeof(struct QED_Graph));
+    out_batches[0] = NULL;
+    out_num_batches[0] = 0;
+    if(table == NULL)
+        return false;
+    
+    /* Note which deps are dirty and which are targets. */
+    for(i = 0; i < num_dirty; i++){
+        qed_hashdata_t unused;
+        QED_HashTableInsert(table, (qed_hashkey_t)dirty[i],
+            QED_PARTIAL_DIRTY_DEP, &unused);
+    }
+    for(i = 0; i < num_targets; i++){
+        qed_hashdata_t flags = 0;
+        QED_HashTableGet(table, (qed_hashkey_t)targets[i], &flags);
+        QED_HashTableInsert(table, (qed_hashkey_t)targets[i],
+            flags | QED_PARTIAL_TARGET_DEP, &flags);
+    }
+    
+    QED_STATS_TIME(closure_ns, ok = QED_CompileGraph(&graph, targets, num_targets));
+    if(!ok)
+        goto partial_end;
+    
+    /* Targets go in the first half of the indices and dirty nodes in the
+     * second, as a dep can be both. */
+    ok = false;
+    QED_STATS_ALLOC((graph.num_nodes * 2 + 1) * sizeof(unsigned));
+    if((indices = malloc((graph.num_nodes * 2 + 1) * sizeof(unsigned))) == NULL)
+        goto partial_end;
+    for(i = 0; i < graph.num_nodes; i++){
+        qed_hashdata_t flags;
+        if(QED_HashTableGet(table, (qed_hashkey_t)graph.nodes[i], &flags)){
+            if(flags & QED_PARTIAL_TARGET_DEP)
+                indices[num_target_indices++] = i;
+            if(flags & QED_PARTIAL_DIRTY_DEP)
+                indices[graph.num_nodes + num_dirty_indices++] = i;
+        }
+    }
+    
+    ok = qed_partial_batches_from_graph(out_batches, out_num_batches, &graph,
+        indices, num_target_indices,
+        indices + graph.num_nodes, num_dirty_indices, options);
+    
+partial_end:
+    free(indices);
+    QED_FreeGraph(&graph);
+    QED_FreeHashTable(table, NULL);
+    free(table);
+    return ok;
+}
+
+bool QED_CalculatePartialBatches(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **targets,
+    unsigned num_targets,
+    struct QED_Dependency **dirty,
+    unsigned num_dirty,
+    const struct QED_BatchOptions *options){
+    QED_STATS_RETURN(options->stats, bool,
+        qed_partial_batches(out_batches, out_num_batches, targets, num_targets,
+            dirty, num_dirty, options));
+}
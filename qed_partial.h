@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_PARTIAL_H
+#define LIBQED_PARTIAL_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Batch;
+struct QED_BatchOptions;
+struct QED_Dependency;
+struct QED_Graph;
+
+/* Scheduling only what needs to run again, as a build system does.
+ *
+ * Given the targets that are wanted and the nodes that are dirty, the nodes to
+ * run are those downstream of a dirty node (or dirty themselves) and upstream
+ * of a target (or targets themselves). Dependencies outside of this set are
+ * either clean or not needed, so they are treated as already satisfied.
+ */
+
+/**
+ * @brief Finds the nodes of a graph that are affected and needed.
+ *
+ * The nodes downstream of the dirty nodes and the nodes upstream of the
+ * targets are searched for together, a node at a time from each, until one
+ * of the searches finishes. The other set is then only searched within the
+ * one that was found. The time taken is proportional to the smaller of the
+ * two sets, plus the nodes that are selected, and not to the whole graph.
+ *
+ * out_nodes must have room for graph->num_nodes entries, and receives the
+ * selected nodes in no particular order. This uses the graph's scratch
+ * memory and marks.
+ *
+ * @return false if an allocation failed.
+ */
+bool QED_SelectGraph(struct QED_Graph *graph,
+    const unsigned *targets,
+    unsigned num_targets,
+    const unsigned *dirty,
+    unsigned num_dirty,
+    unsigned *out_nodes,
+    unsigned *out_num_nodes);
+
+/**
+ * @brief Calculates batches for the affected nodes needed by the targets.
+ *
+ * Apart from which nodes are scheduled, this is the same as
+ * QED_CalculateBatchesFromGraph. QED_eGreedyIterate is treated as
+ * QED_eGreedy, since it would follow the dependencies that were pruned.
+ */
+bool QED_CalculatePartialBatchesFromGraph(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Graph *graph,
+    const unsigned *targets,
+    unsigned num_targets,
+    const unsigned *dirty,
+    unsigned num_dirty,
+    const struct QED_BatchOptions *options);
+
+/**
+ * @brief Calculates batches for the affected deps needed by the targets.
+ *
+ * Without a compiled graph the dependents of the dirty deps are not known, so
+ * this walks everything the targets depend on. Dirty deps that the targets do
+ * not depend on are ignored. To schedule the same graph repeatedly, compile it
+ * once and use QED_CalculatePartialBatchesFromGraph instead.
+ */
+bool QED_CalculatePartialBatches(struct QED_Batch ***out_batches,
+    unsigned *out_num_batches,
+    struct QED_Dependency **targets,
+    unsigned num_targets,
+    struct QED_Dependency **dirty,
+    unsigned num_dirty,
+    const struct QED_BatchOptions *options);
+
+#endif /* LIBQED_PARTIAL_H */
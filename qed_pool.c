@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct qed_pool_worker{
+    struct QED_ThreadPool *pool;
+    unsigned index;
+    pthread_t thread;
+};
+
+struct QED_ThreadPool{
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond, done_cond, barrier_cond;
+    
+    QED_ThreadPoolJob *job;
+    void *arg;
+    
+    /* Incremented for every job, which is how workers see a new one. */
+    unsigned long generation;
+    unsigned num_running;
+    bool quit;
+    
+    unsigned barrier_count;
+    unsigned long barrier_generation;
+    
+    unsigned num_threads;
+    struct qed_pool_worker *workers;
+};
+
+static void *qed_pool_worker_main(void *arg){
+    struct qed_pool_worker *const worker = arg;
+    struct QED_ThreadPool *const pool = worker->pool;
+    unsigned long generation = 0;
+    
+    pthread_mutex_lock(&pool->mutex);
+    for(;;){
+        while(pool->generation == generation && !pool->quit)
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        if(pool->quit)
+            break;
+        generation = pool->generation;
+        
+        {
+            QED_ThreadPoolJob *const job = pool->job;
+            void *const job_arg = pool->arg;
+            pthread_mutex_unlock(&pool->mutex);
+            job(job_arg, worker->index);
+            pthread_mutex_lock(&pool->mutex);
+        }
+        
+        if(--pool->num_running == 0)
+            pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+struct QED_ThreadPool *QED_CreateThreadPool(unsigned num_threads){
+    struct QED_ThreadPool *const pool = calloc(1, sizeof(struct QED_ThreadPool));
+    unsigned i;
+    
+    if(pool == NULL)
+        return NULL;
+    
+    if(num_threads == 0){
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (online > 0) ? (unsigned)online : 1;
+    }
+    
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pthread_cond_init(&pool->barrier_cond, NULL);
+    pool->num_threads = num_threads;
+    
+    /* Worker zero is whichever thread runs the job. */
+    pool->workers = calloc(num_threads, sizeof(struct qed_pool_worker));
+    if(pool->workers == NULL){
+        free(pool);
+        return NULL;
+    }
+    
+    for(i = 1; i < num_threads; i++){
+        struct qed_pool_worker *const worker = pool->workers + i;
+        worker->pool = pool;
+        worker->index = i;
+        if(pthread_create(&worker->thread, NULL, qed_pool_worker_main, worker) != 0){
+            pool->num_threads = i;
+            QED_DestroyThreadPool(pool);
+            return NULL;
+        }
+    }
+    
+    return pool;
+}
+
+unsigned QED_ThreadPoolSize(const struct QED_ThreadPool *pool){
+    return pool->num_threads;
+}
+
+void QED_RunThreadPool(struct QED_ThreadPool *pool,
+    QED_ThreadPoolJob *job,
+    void *arg){
+    
+    if(pool->num_threads > 1){
+        pthread_mutex_lock(&pool->mutex);
+        assert(pool->num_running == 0);
+        pool->job = job;
+        pool->arg = arg;
+        pool->num_running = pool->num_threads - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start_cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    
+    job(arg, 0);
+    
+    if(pool->num_threads > 1){
+        pthread_mutex_lock(&pool->mutex);
+        while(pool->num_running != 0)
+            pthread_cond_wait(&pool->done_cond, &pool->mutex);
+        pool->job = NULL;
+        pool->arg = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void QED_ThreadPoolBarrier(struct QED_ThreadPool *pool){
+    if(pool->num_threads > 1){
+        pthread_mutex_lock(&pool->mutex);
+        if(++pool->barrier_count == pool->num_threads){
+            pool->barrier_count = 0;
+            pool->barrier_generation++;
+            pthread_cond_broadcast(&pool->barrier_cond);
+        }
+        else{
+            const unsigned long generation = pool->barrier_generation;
+            while(pool->barrier_generation == generation)
+                pthread_cond_wait(&pool->barrier_cond, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void QED_DestroyThreadPool(struct QED_ThreadPool *pool){
+    unsigned i;
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    
+    for(i = 1; i < pool->num_threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->barrier_cond);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_POOL_H
+#define LIBQED_POOL_H
+#pragma once
+
+#include <stdbool.h>
+
+/* A fixed set of worker threads which run jobs together.
+ *
+ * The thread which calls QED_RunThreadPool takes part as worker zero, so a
+ * pool of size N starts N-1 threads. A pool of size one runs everything on the
+ * calling thread.
+ */
+struct QED_ThreadPool;
+
+/* Called once on every worker. worker is in [0, QED_ThreadPoolSize). */
+typedef void QED_ThreadPoolJob(void *arg, unsigned worker);
+
+/**
+ * @brief Starts a thread pool.
+ *
+ * A num_threads of zero uses one thread per online processor.
+ *
+ * @return The pool, or NULL if the threads could not be started.
+ */
+struct QED_ThreadPool *QED_CreateThreadPool(unsigned num_threads);
+
+unsigned QED_ThreadPoolSize(const struct QED_ThreadPool *pool);
+
+/**
+ * @brief Runs a job on every worker, and waits for all of them to return.
+ *
+ * Only one job can run on a pool at a time.
+ */
+void QED_RunThreadPool(struct QED_ThreadPool *pool,
+    QED_ThreadPoolJob *job,
+    void *arg);
+
+/**
+ * @brief Waits until every worker in the current job has reached the barrier.
+ *
+ * Must be called by every worker, or none of them, from inside a job.
+ */
+void QED_ThreadPoolBarrier(struct QED_ThreadPool *pool);
+
+/**
+ * @brief Stops the threads and frees the pool. Must not be called while a job
+ * is running.
+ */
+void QED_DestroyThreadPool(struct QED_ThreadPool *pool);
+
+#endif /* LIBQED_POOL_H */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_profile.h"
+
+#include "qed_dependency.h"
+#include "qed_graph.h"
+#include "qed_packed.h"
+#include "qed_tinyhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QED_PROFILE_HEADER "qed-profile 1"
+
+void QED_InitProfile(struct QED_Profile *profile){
+    memset(profile, 0, sizeof(struct QED_Profile));
+}
+
+void QED_FreeProfile(struct QED_Profile *profile){
+    if(profile->index != NULL){
+        QED_FreeHashTable(profile->index, NULL);
+        free(profile->index);
+    }
+    free(profile->entries);
+    QED_InitProfile(profile);
+}
+
+/* Gets the entry for an id, adding an empty one if it is new. */
+static struct QED_ProfileEntry *qed_profile_entry(struct QED_Profile *profile,
+    unsigned long id){
+    
+    qed_hashdata_t index;
+    
+    if(profile->index == NULL &&
+        (profile->index = calloc(1, QED_HASH_TABLE_SIZE)) == NULL)
+        return NULL;
+    
+    if(QED_HashTableGet(profile->index, (qed_hashkey_t)id, &index))
+        return profile->entries + index;
+    
+    if(profile->num_entries == profile->capacity){
+        const unsigned capacity = (profile->capacity == 0) ? 64 :
+            (profile->capacity * 2);
+        struct QED_ProfileEntry *const entries = realloc(profile->entries,
+            capacity * sizeof(struct QED_ProfileEntry));
+        if(entries == NULL)
+            return NULL;
+        profile->entries = entries;
+        profile->capacity = capacity;
+    }
+    
+    index = profile->num_entries++;
+    QED_HashTableInsert(profile->index, (qed_hashkey_t)id, index, &index);
+    memset(profile->entries + index, 0, sizeof(struct QED_ProfileEntry));
+    profile->entries[index].id = id;
+    return profile->entries + index;
+}
+
+bool QED_ProfileRecord(struct QED_Profile *profile,
+    unsigned long id,
+    unsigned long long ns){
+    
+    struct QED_ProfileEntry *entry;
+    
+    if(id == 0 || (entry = qed_profile_entry(profile, id)) == NULL)
+        return false;
+    
+    /* Plain average until there are enough samples, then a moving one. */
+    if(entry->samples < QED_PROFILE_WEIGHT){
+        entry->mean_ns = ((entry->mean_ns * entry->samples) + ns) /
+            (entry->samples + 1);
+    }
+    else{
+        entry->mean_ns = ((entry->mean_ns * (QED_PROFILE_WEIGHT - 1)) + ns) /
+            QED_PROFILE_WEIGHT;
+    }
+    entry->samples++;
+    return true;
+}
+
+const struct QED_ProfileEntry *QED_ProfileFind(const struct QED_Profile *profile,
+    unsigned long id){
+    
+    qed_hashdata_t index;
+    
+    if(id == 0 || profile->index == NULL ||
+        !QED_HashTableGet(profile->index, (qed_hashkey_t)id, &index))
+        return NULL;
+    return profile->entries + index;
+}
+
+unsigned long QED_ProfileCost(const struct QED_Profile *profile,
+    const struct QED_Dependency *dep){
+    
+    const struct QED_ProfileEntry *const entry =
+        (profile == NULL) ? NULL : QED_ProfileFind(profile, dep->id);
+    
+    if(entry == NULL)
+        return QED_DependencyCost(dep);
+    return (entry->mean_ns < 1000) ? 1 : (unsigned long)(entry->mean_ns / 1000);
+}
+
+void QED_ProfileCosts(const struct QED_Profile *profile,
+    const struct QED_Graph *graph,
+    unsigned long *out_costs){
+    
+    unsigned i;
+    for(i = 0; i < graph->num_nodes; i++)
+        out_costs[i] = QED_ProfileCost(profile, graph->nodes[i]);
+}
+
+bool QED_SaveProfile(const struct QED_Profile *profile, const char *path){
+    FILE *const file = fopen(path, "w");
+    unsigned i;
+    bool ok;
+    
+    if(file == NULL)
+        return false;
+    
+    ok = fprintf(file, "%s %u\n", QED_PROFILE_HEADER, profile->num_entries) > 0;
+    for(i = 0; ok && i < profile->num_entries; i++){
+        const struct QED_ProfileEntry *const entry = profile->entries + i;
+        ok = fprintf(file, "%lu %llu %lu\n", entry->id, entry->mean_ns,
+            entry->samples) > 0;
+    }
+    
+    return (fclose(file) == 0) && ok;
+}
+
+bool QED_LoadProfile(struct QED_Profile *profile, const char *path){
+    FILE *const file = fopen(path, "r");
+    unsigned num_entries, i;
+    bool ok;
+    
+    if(file == NULL)
+        return false;
+    
+    ok = fscanf(file, QED_PROFILE_HEADER " %u", &num_entries) == 1;
+    for(i = 0; ok && i < num_entries; i++){
+        unsigned long id, samples;
+        unsigned long long mean_ns;
+        struct QED_ProfileEntry *entry;
+        
+        if(fscanf(file, "%lu %llu %lu", &id, &mean_ns, &samples) != 3 ||
+            id == 0 || (entry = qed_profile_entry(profile, id)) == NULL){
+            ok = false;
+        }
+        else{
+            entry->mean_ns = mean_ns;
+            entry->samples = samples;
+        }
+    }
+    
+    fclose(file);
+    return ok;
+}
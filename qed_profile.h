@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_PROFILE_H
+#define LIBQED_PROFILE_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Dependency;
+struct QED_Graph;
+struct QED_HashTable;
+
+struct QED_ProfileEntry{
+    unsigned long id;
+    /** Moving average of the run time, in nanoseconds. */
+    unsigned long long mean_ns;
+    unsigned long samples;
+};
+
+/* Measured run times of dependencies, keyed by QED_Dependency::id.
+ *
+ * Give a profile to QED_ExecuteGraph or QED_ExecuteBatches to record the run
+ * time of every callback, and to QED_CalculateBatches with QED_ePacked to use
+ * those times as costs. Deps with an id of zero are never profiled.
+ *
+ * A zeroed profile is empty.
+ */
+struct QED_Profile{
+    struct QED_HashTable *index; /* Maps ids to entries. */
+    struct QED_ProfileEntry *entries;
+    unsigned num_entries;
+    unsigned capacity;
+};
+
+/* How many of the newest samples the average mostly reflects. Older runs fade
+ * out, so the profile follows changes in the callbacks. */
+#define QED_PROFILE_WEIGHT 4
+
+/* The number of unsigneds of scratch needed for the costs of a graph. */
+#define QED_PROFILE_COSTS_SCRATCH(NUM_NODES) \
+    (((((unsigned long)(NUM_NODES) + 1) * sizeof(unsigned long) + \
+    sizeof(unsigned long long) - 1) / sizeof(unsigned long long)) * \
+    (sizeof(unsigned long long) / sizeof(unsigned)))
+
+void QED_InitProfile(struct QED_Profile *profile);
+
+void QED_FreeProfile(struct QED_Profile *profile);
+
+/**
+ * @brief Adds a measured run time for a dependency id.
+ *
+ * @return false if the id is zero or an allocation failed.
+ */
+bool QED_ProfileRecord(struct QED_Profile *profile,
+    unsigned long id,
+    unsigned long long ns);
+
+/**
+ * @brief Finds the entry for an id.
+ *
+ * @return NULL if the id has never been recorded.
+ */
+const struct QED_ProfileEntry *QED_ProfileFind(const struct QED_Profile *profile,
+    unsigned long id);
+
+/**
+ * @brief Gets the cost of a dependency for scheduling.
+ *
+ * This is the mean run time in microseconds, at least one, for profiled deps
+ * and QED_DependencyCost otherwise. Unprofiled costs should be estimated in
+ * microseconds to mix well with measured ones.
+ */
+unsigned long QED_ProfileCost(const struct QED_Profile *profile,
+    const struct QED_Dependency *dep);
+
+/**
+ * @brief Gets the cost of every node in a graph.
+ *
+ * out_costs must have room for graph->num_nodes entries.
+ */
+void QED_ProfileCosts(const struct QED_Profile *profile,
+    const struct QED_Graph *graph,
+    unsigned long *out_costs);
+
+/**
+ * @brief Writes a profile to a file.
+ *
+ * The file is plain text, with a header line followed by one line per entry of
+ * the id, the mean in nanoseconds and the number of samples.
+ */
+bool QED_SaveProfile(const struct QED_Profile *profile, const char *path);
+
+/**
+ * @brief Reads a profile written by QED_SaveProfile.
+ *
+ * The entries replace any existing entries with the same ids.
+ *
+ * @return false if the file could not be read or is not a profile.
+ */
+bool QED_LoadProfile(struct QED_Profile *profile, const char *path);
+
+#endif /* LIBQED_PROFILE_H */
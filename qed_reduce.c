@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_reduce.h"
+
+#include "qed_graph.h"
+#include "qed_stats.h"
+
+#include <limits.h>
+#include <string.h>
+
+/* Written over the preds that are removed until the rows are compacted. */
+#define QED_REDUCE_REMOVED UINT_MAX
+
+/* Each node has a bit for each of this many positions before it in the
+ * sequence, set when the node there is one of its ancestors. */
+#define QED_REDUCE_WINDOW 64
+
+/* Finds the topological order that the nodes are reduced in, which is chosen
+ * to keep the edges short so that they fit in the windows. Of the ready
+ * nodes, the one with the lowest index goes first, or the highest if more
+ * edges go from higher indices to lower. So indices that are already in
+ * topological order are kept, and the nodes with no dependencies are not all
+ * put at the start.
+ *
+ * @return false if the graph has a cycle.
+ */
+static bool qed_reduce_sequence(const struct QED_Graph *graph,
+    unsigned *sequence,
+    unsigned *ranks,
+    unsigned *heap,
+    unsigned *pending){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned long num_forward = 0, num_backward = 0;
+    unsigned i, e, flip = 0, count = 0, num_ordered = 0;
+    
+    for(i = 0; i < num_nodes; i++){
+        for(e = graph->pred_offsets[i]; e < graph->pred_offsets[i + 1]; e++){
+            num_forward += graph->preds[e] < i;
+            num_backward += graph->preds[e] > i;
+        }
+    }
+    
+    /* Indices that are in order already need no sorting. */
+    if(num_forward == graph->num_edges || num_backward == graph->num_edges){
+        for(i = 0; i < num_nodes; i++){
+            const unsigned node = (num_forward == graph->num_edges) ? i :
+                (num_nodes - 1 - i);
+            sequence[i] = node;
+            ranks[node] = i;
+        }
+        return true;
+    }
+    
+    /* The heap holds keys, which are the indices with every bit flipped to
+     * take the highest first. The keys of the nodes that are ready to begin
+     * with are added in order, which is a heap already, or the reverse of
+     * one. */
+    if(num_forward < num_backward)
+        flip = UINT_MAX;
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        if(pending[i] == 0)
+            heap[count++] = i ^ flip;
+    }
+    if(flip != 0){
+        for(i = 0; i < count / 2; i++){
+            const unsigned key = heap[i];
+            heap[i] = heap[count - 1 - i];
+            heap[count - 1 - i] = key;
+        }
+    }
+    
+    while(count != 0){
+        const unsigned node = heap[0] ^ flip, last = heap[--count];
+        unsigned hole = 0;
+        
+        /* Sift the last key down from the top. */
+        for(;;){
+            unsigned child = (hole * 2) + 1;
+            if(child >= count)
+                break;
+            if(child + 1 < count && heap[child + 1] < heap[child])
+                child++;
+            if(last <= heap[child])
+                break;
+            heap[hole] = heap[child];
+            hole = child;
+        }
+        heap[hole] = last;
+        
+        ranks[node] = num_ordered;
+        sequence[num_ordered++] = node;
+        
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e], key = succ ^ flip;
+            if(--pending[succ] != 0)
+                continue;
+            for(hole = count++; hole != 0 && heap[(hole - 1) / 2] > key;
+                hole = (hole - 1) / 2)
+                heap[hole] = heap[(hole - 1) / 2];
+            heap[hole] = key;
+        }
+    }
+    
+    return num_ordered == num_nodes;
+}
+
+/* Labels the nodes for searching for the dependencies that are too far back
+ * for the windows. This finds a depth-first topological order, the position
+ * of each node in it, the depth of each node, and the last position of any
+ * descendant of each node. */
+static void qed_reduce_label(const struct QED_Graph *graph,
+    unsigned *order,
+    unsigned *positions,
+    unsigned *levels,
+    unsigned *highs,
+    unsigned *pending){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned i, e, num_ready = 0, num_ordered = 0;
+    
+    /* The ready nodes are kept on a stack at the end of the order. Taking the
+     * newest first goes deep before wide, which keeps the descendants of a
+     * node close together, so the intervals are tighter. */
+    for(i = 0; i < num_nodes; i++){
+        pending[i] = graph->pred_offsets[i + 1] - graph->pred_offsets[i];
+        levels[i] = 0;
+        if(pending[i] == 0)
+            order[num_nodes - ++num_ready] = i;
+    }
+    
+    while(num_ready != 0){
+        const unsigned node = order[num_nodes - num_ready--];
+        positions[node] = num_ordered;
+        order[num_ordered++] = node;
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            const unsigned succ = graph->succs[e];
+            if(levels[succ] < levels[node] + 1)
+                levels[succ] = levels[node] + 1;
+            if(--pending[succ] == 0)
+                order[num_nodes - ++num_ready] = succ;
+        }
+    }
+    
+    for(i = num_nodes; i != 0; i--){
+        const unsigned node = order[i - 1];
+        highs[node] = i - 1;
+        for(e = graph->succ_offsets[node]; e < graph->succ_offsets[node + 1]; e++){
+            if(highs[node] < highs[graph->succs[e]])
+                highs[node] = highs[graph->succs[e]];
+        }
+    }
+}
+
+/* Compacts the rows of preds, dropping the removed ones, and builds the
+ * successors again from them in the same way as QED_CompileGraph. */
+static void qed_reduce_compact(struct QED_Graph *graph){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    unsigned i, e, start = 0, edge = 0;
+    
+    for(i = 0; i < num_nodes; i++){
+        const unsigned end = graph->pred_offsets[i + 1];
+        graph->pred_offsets[i] = edge;
+        for(e = start; e < end; e++){
+            if(graph->preds[e] != QED_REDUCE_REMOVED)
+                graph->preds[edge++] = graph->preds[e];
+        }
+        start = end;
+    }
+    graph->pred_offsets[num_nodes] = edge;
+    graph->num_edges = edge;
+    
+    memset(graph->succ_offsets, 0, (num_nodes + 1) * sizeof(unsigned));
+    for(e = 0; e < edge; e++)
+        graph->succ_offsets[graph->preds[e] + 1]++;
+    for(i = 0; i < num_nodes; i++)
+        graph->succ_offsets[i + 1] += graph->succ_offsets[i];
+    for(i = 0; i < num_nodes; i++){
+        for(e = graph->pred_offsets[i]; e < graph->pred_offsets[i + 1]; e++)
+            graph->succs[graph->succ_offsets[graph->preds[e]]++] = i;
+    }
+    for(i = num_nodes; i != 0; i--)
+        graph->succ_offsets[i] = graph->succ_offsets[i - 1];
+    graph->succ_offsets[0] = 0;
+}
+
+static bool qed_reduce_graph(struct QED_Graph *graph,
+    unsigned *out_num_removed){
+    
+    const unsigned num_nodes = graph->num_nodes;
+    const unsigned long stride = (unsigned long)num_nodes + 1;
+    unsigned *const scratch = QED_GraphScratch(graph, stride * 11);
+    /* The windows go first so that they stay aligned. */
+    unsigned long long *const windows = (unsigned long long*)scratch;
+    unsigned *const sequence = scratch + (stride * 2),
+        *const ranks = scratch + (stride * 3),
+        *const order = scratch + (stride * 4),
+        *const positions = scratch + (stride * 5),
+        *const levels = scratch + (stride * 6),
+        *const highs = scratch + (stride * 7),
+        *const stack = scratch + (stride * 8),
+        /* Set to the node's index plus one while it is a dependency of that
+         * node which has not been found to be redundant. */
+        *const targets = scratch + (stride * 9),
+        /* Set to the node's index plus one once it is on the stack. */
+        *const visited = scratch + (stride * 10);
+    unsigned i, e, num_removed = 0;
+    
+    if(scratch == NULL)
+        return false;
+    
+    if(!qed_reduce_sequence(graph, sequence, ranks, stack, visited)){
+        /* There is no reduction of a graph with a cycle. */
+        if(out_num_removed != NULL)
+            out_num_removed[0] = 0;
+        return true;
+    }
+    
+    /* Only label the graph if there is anything to search for. */
+    for(i = 0; i < num_nodes; i++){
+        for(e = graph->pred_offsets[i]; e < graph->pred_offsets[i + 1]; e++){
+            if(ranks[i] - ranks[graph->preds[e]] > QED_REDUCE_WINDOW)
+                break;
+        }
+        if(e != graph->pred_offsets[i + 1]){
+            qed_reduce_label(graph, order, positions, levels, highs, visited);
+            break;
+        }
+    }
+    memset(targets, 0, num_nodes * sizeof(unsigned));
+    memset(visited, 0, num_nodes * sizeof(unsigned));
+    
+    for(i = 0; i < num_nodes; i++){
+        const unsigned node = sequence[i], stamp = node + 1,
+            start = graph->pred_offsets[node], end = graph->pred_offsets[node + 1];
+        unsigned long long window = 0, implied = 0;
+        unsigned num_near = 0, num_far = 0, num_found = 0, num_stack = 0,
+            min_level = UINT_MAX, min_position = UINT_MAX, max_high = 0;
+        
+        /* Every path between two nodes stays between them in the sequence,
+         * so the window of a dependency is exact for the positions it shares
+         * with this node's window, and only the near dependencies have
+         * ancestors in it. */
+        for(e = start; e < end; e++){
+            const unsigned pred = graph->preds[e], distance = i - ranks[pred];
+            if(targets[pred] == stamp)
+                continue;
+            targets[pred] = stamp;
+            if(distance <= QED_REDUCE_WINDOW){
+                window |= 1ull << (distance - 1);
+                if(distance < QED_REDUCE_WINDOW)
+                    implied |= windows[pred] << distance;
+                num_near++;
+            }
+            else{
+                num_far++;
+                if(min_level > levels[pred])
+                    min_level = levels[pred];
+                if(min_position > positions[pred])
+                    min_position = positions[pred];
+                if(max_high < highs[pred])
+                    max_high = highs[pred];
+            }
+        }
+        windows[node] = window | implied;
+        
+        if(end - start < 2)
+            continue;
+        
+        /* A near dependency is redundant if it is an ancestor of another. */
+        if((window & implied) != 0){
+            for(e = start; e < end; e++){
+                const unsigned pred = graph->preds[e], distance = i - ranks[pred];
+                if(distance <= QED_REDUCE_WINDOW &&
+                    (implied & (1ull << (distance - 1))) != 0)
+                    targets[pred] = 0;
+            }
+        }
+        
+        /* The far dependencies are searched for up from all of the others. A
+         * far dependency and all of its ancestors have levels and positions at
+         * least as low as its own, and intervals inside its own, so nothing
+         * outside all of these bounds leads to one. The last dependency in the
+         * sequence cannot be reached from the others, so if that is a far one
+         * the search is over once the rest have been found. */
+        if(num_near == 0)
+            num_far--;
+        for(e = start; e < end && num_found < num_far; e++){
+            const unsigned pred = graph->preds[e];
+            if(visited[pred] == stamp)
+                continue;
+            visited[pred] = stamp;
+            stack[num_stack++] = pred;
+            
+            while(num_stack != 0 && num_found < num_far){
+                const unsigned ancestor = stack[--num_stack];
+                unsigned a;
+                for(a = graph->pred_offsets[ancestor];
+                    a < graph->pred_offsets[ancestor + 1]; a++){
+                    
+                    const unsigned next = graph->preds[a];
+                    if(next == QED_REDUCE_REMOVED)
+                        continue;
+                    if(targets[next] == stamp){
+                        targets[next] = 0;
+                        num_found += (i - ranks[next] > QED_REDUCE_WINDOW);
+                    }
+                    if(visited[next] != stamp &&
+                        levels[next] >= min_level &&
+                        positions[next] >= min_position &&
+                        highs[next] <= max_high){
+                        
+                        visited[next] = stamp;
+                        stack[num_stack++] = next;
+                    }
+                }
+            }
+        }
+        
+        /* Keep the first copy of each dependency that was not found. */
+        for(e = start; e < end; e++){
+            const unsigned pred = graph->preds[e];
+            if(targets[pred] == stamp){
+                targets[pred] = 0;
+            }
+            else{
+                graph->preds[e] = QED_REDUCE_REMOVED;
+                num_removed++;
+            }
+        }
+    }
+    
+    if(num_removed != 0)
+        qed_reduce_compact(graph);
+    
+    QED_STATS_ADD(edges_removed, num_removed);
+    if(out_num_removed != NULL)
+        out_num_removed[0] = num_removed;
+    return true;
+}
+
+static bool qed_reduce_graph_timed(struct QED_Graph *graph,
+    unsigned *out_num_removed){
+    
+    bool ok;
+    QED_STATS_TIME(reduce_ns, ok = qed_reduce_graph(graph, out_num_removed));
+    return ok;
+}
+
+bool QED_ReduceGraph(struct QED_Graph *graph,
+    struct QED_Stats *stats,
+    unsigned *out_num_removed){
+    (void)stats;
+    QED_STATS_RETURN(stats, bool,
+        qed_reduce_graph_timed(graph, out_num_removed));
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_REDUCE_H
+#define LIBQED_REDUCE_H
+#pragma once
+
+#include <stdbool.h>
+
+struct QED_Graph;
+struct QED_Stats;
+
+/**
+ * @brief Removes the edges of a graph which are implied by other edges.
+ *
+ * An edge from A to C is redundant if there is another path from A to C, such
+ * as through A to B to C. Duplicate edges are redundant too. What is left is
+ * the transitive reduction of the graph, which has the same reachability. Every
+ * node becomes ready at the same point as before, so QED_eGreedy gives the
+ * same batches, with or without the locality option, and QED_ExecuteGraph
+ * still runs each dep after its dependencies. Both then have fewer edges to
+ * follow. The schedulers that rank deps break ties by the number of direct
+ * dependents, which no longer counts redundant edges, so they may order ties
+ * differently.
+ *
+ * Only the edges of the graph are changed. The dependency lists of the deps
+ * are not, and neither are the node indices, so the graph can still be used
+ * with anything that was built from it. A graph with a cycle is left as it is.
+ *
+ * Nodes are visited in a topological order that keeps edges short, which is
+ * index order if that is topological already. Each node keeps a bitset of
+ * which of the 64 nodes before it are its ancestors, built from the bitsets of
+ * its dependencies, and a dependency that falls in the bitset of another is
+ * redundant. Only dependencies further back than that are searched for, by
+ * walking up from the other dependencies. Each search is cut short at nodes
+ * which cannot reach any of them, which is decided from the depth of each
+ * node and an interval of depth-first positions that contains all of its
+ * descendants.
+ *
+ * Uses the graph's scratch memory. The time taken and number of edges removed
+ * are added to stats, which may be NULL.
+ *
+ * @param out_num_removed Set to the number of edges removed. May be NULL.
+ *
+ * @return false if an allocation failed, in which case the graph is not
+ *   changed.
+ */
+bool QED_ReduceGraph(struct QED_Graph *graph,
+    struct QED_Stats *stats,
+    unsigned *out_num_removed);
+
+#endif /* LIBQED_REDUCE_H */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "qed_resource.h"
+
+#include <string.h>
+
+/* Returns the classes in mask which have a limit. */
+static unsigned qed_resource_limited(const struct QED_ResourceLimits *resources,
+    unsigned mask){
+    
+    const unsigned num_classes = (resources->num_classes > QED_MAX_RESOURCE_CLASSES) ?
+        QED_MAX_RESOURCE_CLASSES : resources->num_classes;
+    unsigned i, limited = 0;
+    
+    if(num_classes < QED_MAX_RESOURCE_CLASSES)
+        mask &= (1u << num_classes) - 1;
+    
+    for(i = 0; mask != 0; i++, mask >>= 1){
+        if((mask & 1) && resources->limits[i] != 0)
+            limited |= 1u << i;
+    }
+    return limited;
+}
+
+void QED_ClearResources(unsigned *usage){
+    memset(usage, 0, QED_MAX_RESOURCE_CLASSES * sizeof(unsigned));
+}
+
+bool QED_ReserveResources(const struct QED_ResourceLimits *resources,
+    unsigned *usage,
+    unsigned mask){
+    
+    const unsigned limited = qed_resource_limited(resources, mask);
+    unsigned i, bits;
+    
+    for(i = 0, bits = limited; bits != 0; i++, bits >>= 1){
+        if((bits & 1) && usage[i] >= resources->limits[i])
+            return false;
+    }
+    for(i = 0, bits = limited; bits != 0; i++, bits >>= 1){
+        if(bits & 1)
+            usage[i]++;
+    }
+    return true;
+}
+
+bool QED_AcquireResources(const struct QED_ResourceLimits *resources,
+    atomic_uint *usage,
+    unsigned mask){
+    
+    const unsigned limited = qed_resource_limited(resources, mask);
+    unsigned i, bits;
+    
+    /* Take each class in turn, and give back what was taken if one is full.
+     * Nothing ever waits while holding a class, so this cannot deadlock. */
+    for(i = 0, bits = limited; bits != 0; i++, bits >>= 1){
+        unsigned count;
+        if(!(bits & 1))
+            continue;
+        
+        count = atomic_load_explicit(usage + i, memory_order_relaxed);
+        do{
+            if(count >= resources->limits[i]){
+                QED_ReleaseResources(resources, usage,
+                    limited & ((1u << i) - 1));
+                return false;
+            }
+        }while(!atomic_compare_exchange_weak_explicit(usage + i, &count,
+            count + 1, memory_order_acquire, memory_order_relaxed));
+    }
+    return true;
+}
+
+void QED_ReleaseResources(const struct QED_ResourceLimits *resources,
+    atomic_uint *usage,
+    unsigned mask){
+    
+    unsigned i, bits;
+    for(i = 0, bits = qed_resource_limited(resources, mask); bits != 0;
+        i++, bits >>= 1){
+        if(bits & 1)
+            atomic_fetch_sub_explicit(usage + i, 1, memory_order_release);
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_RESOURCE_H
+#define LIBQED_RESOURCE_H
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/* Caps how many deps of each resource class may share a batch or run at once.
+ *
+ * A dep declares the classes it uses as a bitmask in QED_Dependency::resources,
+ * and uses one unit of each of them. Given to QED_CalculateBatches, a limit
+ * applies to each batch. Given to QED_ExecuteGraph or QED_ExecuteBatches, it
+ * applies to the callbacks running at any moment.
+ *
+ * Classes past num_classes, and classes with a limit of zero, are unlimited.
+ */
+struct QED_ResourceLimits{
+    const unsigned *limits;
+    unsigned num_classes;
+};
+
+#define QED_MAX_RESOURCE_CLASSES 32
+
+/* The most ready nodes that are passed over while filling one batch, as for
+ * QED_PACKED_MAX_SKIPPED. */
+#define QED_RESOURCE_MAX_SKIPPED 64
+
+/**
+ * @brief Zeroes the usage of every class.
+ *
+ * usage must have room for QED_MAX_RESOURCE_CLASSES entries.
+ */
+void QED_ClearResources(unsigned *usage);
+
+/**
+ * @brief Adds a dep's classes to the usage if none would go over its limit.
+ *
+ * @return false, leaving the usage unchanged, if the dep does not fit.
+ */
+bool QED_ReserveResources(const struct QED_ResourceLimits *resources,
+    unsigned *usage,
+    unsigned mask);
+
+/**
+ * @brief The same as QED_ReserveResources, for usage shared between threads.
+ */
+bool QED_AcquireResources(const struct QED_ResourceLimits *resources,
+    atomic_uint *usage,
+    unsigned mask);
+
+/**
+ * @brief Releases what QED_AcquireResources took.
+ */
+void QED_ReleaseResources(const struct QED_ResourceLimits *resources,
+    atomic_uint *usage,
+    unsigned mask);
+
+#endif /* LIBQED_RESOURCE_H */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qed_stats.h"
+
+#include <string.h>
+#include <time.h>
+
+void QED_InitStats(struct QED_Stats *stats){
+    memset(stats, 0, sizeof(struct QED_Stats));
+}
+
+bool QED_StatsEnabled(void){
+#ifdef QED_ENABLE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned long long QED_StatsNow(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ((unsigned long long)t.tv_sec * 1000000000ull) +
+        (unsigned long long)t.tv_nsec;
+}
+
+#ifdef QED_ENABLE_STATS
+
+_Thread_local struct QED_Stats *QED_CurrentStats = NULL;
+
+/* Only called once the workers have stopped. */
+void QED_StatsWorker(struct QED_Stats *stats,
+    unsigned worker,
+    unsigned long long busy_ns,
+    unsigned long long idle_ns){
+    
+    if(worker >= QED_STATS_MAX_WORKERS)
+        worker = QED_STATS_MAX_WORKERS - 1;
+    stats->worker_busy_ns[worker] += busy_ns;
+    stats->worker_idle_ns[worker] += idle_ns;
+}
+
+#endif
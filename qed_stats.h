@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2017, Martin McDonough. All Rights Reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBQED_STATS_H
+#define LIBQED_STATS_H
+#pragma once
+
+#include <stdbool.h>
+
+/* Workers past this many are counted together in the last slot. */
+#define QED_STATS_MAX_WORKERS 64
+
+/* Counters filled in by scheduling and execution.
+ *
+ * Stats are only collected when libqed is built with QED_ENABLE_STATS defined.
+ * Otherwise all of the instrumentation compiles away, and a QED_Stats passed
+ * in the options is left untouched. Counters are added to, so one QED_Stats
+ * can accumulate several calls.
+ */
+struct QED_Stats{
+    /* Scheduling time in nanoseconds, by phase. */
+    unsigned long long closure_ns; /**< Finding and indexing every dep. */
+    unsigned long long reduce_ns; /**< Removing redundant edges. */
+    unsigned long long rank_ns; /**< Ranking for QED_eLookahead. */
+    unsigned long long schedule_ns; /**< Batching, including rank_ns. */
+    unsigned long long output_ns; /**< Creating the QED_Batch arrays. */
+    
+    unsigned long hash_lookups;
+    unsigned long hash_probes; /**< Slots examined by all lookups. */
+    unsigned long hash_collisions; /**< Lookups that examined several slots. */
+    unsigned long hash_max_probe; /**< Slots examined by the longest lookup. */
+    unsigned long hash_resizes;
+    unsigned long iterate_passes; /**< Calls to QED_HashTableIterate. */
+    
+    /* Lookups in a QED_ScheduleCache. See qed_cache.h. */
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    
+    /* Edges removed by QED_ReduceGraph. See qed_reduce.h. */
+    unsigned long edges_removed;
+    
+    unsigned long num_batches;
+    unsigned long nodes_visited; /**< Nodes and edges examined. */
+    unsigned long max_nodes_visited; /**< Most nodes examined for a batch. */
+    
+    unsigned long allocations;
+    unsigned long bytes_allocated;
+    
+    /* Execution time in nanoseconds, for each worker. Busy time is spent in
+     * callbacks, and idle time is spent waiting for work. */
+    unsigned num_workers;
+    unsigned long long worker_busy_ns[QED_STATS_MAX_WORKERS];
+    unsigned long long worker_idle_ns[QED_STATS_MAX_WORKERS];
+};
+
+void QED_InitStats(struct QED_Stats *stats);
+
+/**
+ * @brief Checks if libqed was built with QED_ENABLE_STATS.
+ */
+bool QED_StatsEnabled(void);
+
+/**
+ * @brief Gets a monotonic time in nanoseconds.
+ */
+unsigned long long QED_StatsNow(void);
+
+/* Everything below is used inside libqed to collect the stats. */
+
+#ifdef QED_ENABLE_STATS
+
+/* The stats for the call in progress on this thread, or NULL. Set by the
+ * public entry points through QED_STATS_RETURN. */
+extern _Thread_local struct QED_Stats *QED_CurrentStats;
+
+/* Adds the time for one worker. Only called after the workers have stopped,
+ * so that each slot has one writer. */
+void QED_StatsWorker(struct QED_Stats *stats,
+    unsigned worker,
+    unsigned long long busy_ns,
+    unsigned long long idle_ns);
+
+/* Returns the value of CALL, with QED_CurrentStats set to STATS during it. */
+#define QED_STATS_RETURN(STATS, TYPE, ...) do{ \
+        struct QED_Stats *const qed_stats_saved = QED_CurrentStats; \
+        TYPE qed_stats_result; \
+        QED_CurrentStats = (STATS); \
+        qed_stats_result = __VA_ARGS__; \
+        QED_CurrentStats = qed_stats_saved; \
+        return qed_stats_result; \
+    }while(0)
+
+/* Runs STATEMENT, adding the time it took to FIELD. */
+#define QED_STATS_TIME(FIELD, ...) do{ \
+        struct QED_Stats *const qed_stats = QED_CurrentStats; \
+        if(qed_stats != NULL){ \
+            const unsigned long long qed_stats_start = QED_StatsNow(); \
+            __VA_ARGS__; \
+            qed_stats->FIELD += QED_StatsNow() - qed_stats_start; \
+        } \
+        else{ \
+            __VA_ARGS__; \
+        } \
+    }while(0)
+
+#define QED_STATS_ADD(FIELD, N) do{ \
+        if(QED_CurrentStats != NULL) \
+            QED_CurrentStats->FIELD += (N); \
+    }while(0)
+
+#define QED_STATS_MAX(FIELD, N) do{ \
+        if(QED_CurrentStats != NULL && QED_CurrentStats->FIELD < (N)) \
+            QED_CurrentStats->FIELD = (N); \
+    }while(0)
+
+#define QED_STATS_ALLOC(BYTES) do{ \
+        QED_STATS_ADD(allocations, 1); \
+        QED_STATS_ADD(bytes_allocated, (BYTES)); \
+    }while(0)
+
+/* Records one hash table lookup which examined PROBES slots. */
+#define QED_STATS_LOOKUP(PROBES) do{ \
+        QED_STATS_ADD(hash_lookups, 1); \
+        QED_STATS_ADD(hash_probes, (PROBES)); \
+        QED_STATS_ADD(hash_collisions, (PROBES) > 1); \
+        QED_STATS_MAX(hash_max_probe, (PROBES)); \
+    }while(0)
+
+/* Records one batch, which took VISITED nodes and edges to find. VISITED is
+ * only evaluated once, as it is often counted just for this. */
+#define QED_STATS_BATCH(VISITED) do{ \
+        const unsigned long qed_stats_visited = (VISITED); \
+        QED_STATS_ADD(num_batches, 1); \
+        QED_STATS_ADD(nodes_visited, qed_stats_visited); \
+        QED_STATS_MAX(max_nodes_visited, qed_stats_visited); \
+    }while(0)
+
+#else
+
+#define QED_STATS_RETURN(STATS, TYPE, ...) return __VA_ARGS__
+#define QED_STATS_TIME(FIELD, ...) do{ __VA_ARGS__; }while(0)
+#define QED_STATS_ADD(FIELD, N) ((void)0)
+#define QED_STATS_MAX(FIELD, N) ((void)0)
+#define QED_STATS_ALLOC(BYTES) ((void)0)
+#define QED_STATS_LOOKUP(PROBES) ((void)0)
+#define QED_STATS_BATCH(VISITED) ((void)0)
+
+#endif
+
+#endif /* LIBQED_STATS_H */
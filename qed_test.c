@@ -7,14 +7,35 @@
  */
 
 #include "qed_batch.h"
+#include "qed_binary.h"
+#include "qed_builder.h"
+#include "qed_cache.h"
 #include "qed_dependency.h"
+#include "qed_deque.h"
+#include "qed_execute.h"
+#include "qed_graph.h"
+#include "qed_greedy.h"
+#include "qed_incremental.h"
+#include "qed_iterator.h"
+#include "qed_multi.h"
+#include "qed_online.h"
+#include "qed_partial.h"
+#include "qed_pool.h"
+#include "qed_profile.h"
+#include "qed_reduce.h"
+#include "qed_resource.h"
+#include "qed_stats.h"
 #include "qed_test.h"
+#include "qed_tinyhash.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define QED_NUM_TESTS 6
+#define QED_NUM_TESTS 56
 
 static int QED_TestZeroDependencies(){
     
@@ -200,13 +221,3424 @@ static int QED_TestThreeInvertedTreeDependencies(){
     return 1;
 }
 
+/* Builds a random DAG where each node depends on some earlier nodes. */
+static struct QED_Dependency *qed_test_random_graph(unsigned num_nodes,
+    unsigned max_deps,
+    unsigned seed){
+    
+    struct QED_Dependency *const deps =
+        calloc(num_nodes, sizeof(struct QED_Dependency));
+    unsigned i;
+    for(i = 0; i < num_nodes; i++){
+        unsigned e;
+        seed = seed * 1103515245u + 12345u;
+        deps[i].num_dependencies = (i == 0) ? 0 : ((seed >> 16) % (max_deps + 1));
+        deps[i].dependencies =
+            malloc((deps[i].num_dependencies + 1) * sizeof(void*));
+        for(e = 0; e < deps[i].num_dependencies; e++){
+            seed = seed * 1103515245u + 12345u;
+            deps[i].dependencies[e] = deps + ((seed >> 16) % i);
+        }
+    }
+    return deps;
+}
+
+static void qed_test_free_random_graph(struct QED_Dependency *deps,
+    unsigned num_nodes){
+    unsigned i;
+    for(i = 0; i < num_nodes; i++)
+        free(deps[i].dependencies);
+    free(deps);
+}
+
+/* Checks that every node is scheduled once, after all of its dependencies,
+ * in a batch no bigger than max_batch_size. */
+static int qed_test_check_batches(struct QED_Batch **batches,
+    unsigned num_batches,
+    unsigned num_nodes,
+    unsigned max_batch_size){
+    
+    struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+    unsigned i, num_scheduled = 0;
+    for(i = 0; i < num_batches; i++){
+        unsigned e;
+        QED_ASSERT_INT_EQ(batches[i]->num_dependencies != 0, 1);
+        QED_ASSERT_INT_EQ(batches[i]->num_dependencies <= max_batch_size, 1);
+        for(e = 0; e < batches[i]->num_dependencies; e++){
+            qed_hashdata_t unused;
+            QED_ASSERT_INT_EQ(QED_HashTableInsert(table,
+                (qed_hashkey_t)batches[i]->dependencies[e], i + 1, &unused), 0);
+        }
+        num_scheduled += batches[i]->num_dependencies;
+    }
+    QED_ASSERT_INT_EQ(num_scheduled, num_nodes);
+    
+    for(i = 0; i < num_batches; i++){
+        unsigned e;
+        for(e = 0; e < batches[i]->num_dependencies; e++){
+            const struct QED_Dependency *const dep = batches[i]->dependencies[e];
+            unsigned d;
+            for(d = 0; d < dep->num_dependencies; d++){
+                qed_hashdata_t batch = 0;
+                QED_EXPECT_TRUE(QED_HashTableGet(table,
+                    (qed_hashkey_t)dep->dependencies[d], &batch));
+                QED_ASSERT_INT_EQ(batch <= i, 1);
+            }
+        }
+    }
+    
+    QED_FreeHashTable(table, NULL);
+    free(table);
+    return 1;
+}
+
+/* Only the end of a chain is passed in, so every other node has to be found
+ * through the dependencies. */
+static int QED_TestChainClosure(){
+    
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    
+    struct QED_Dependency deps[16], *deps_ptr[16];
+    for(i = 0; i < 16; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].num_dependencies = (i == 0) ? 0 : 1;
+        deps[i].dependencies = (i == 0) ? NULL : (deps_ptr + i - 1);
+    }
+    
+    QED_EXPECT_TRUE(QED_CalculateBatches(&batches, &num_batches, deps_ptr + 15, 1, 8, QED_eGreedy));
+    
+    QED_ASSERT_INT_EQ(num_batches, 16);
+    for(i = 0; i < 16; i++){
+        QED_ASSERT_INT_EQ(batches[i]->num_dependencies, 1);
+        QED_EXPECT_TRUE((batches[i]->dependencies[0] == deps + i));
+    }
+    
+    return 1;
+}
+
+/* The linear greedy scheduler must give valid batches. When no batch is
+ * limited by max_batch_size there is only one greedy schedule, so it must be
+ * the same as the one from the original iterating scheduler. */
+static int QED_TestGreedyMatchesIterate(){
+    
+    static const unsigned max_batch_sizes[] = { 1, 3, 16, 1000 };
+    struct QED_Dependency *const deps = qed_test_random_graph(500, 4, 1);
+    struct QED_Dependency *deps_ptr[500];
+    unsigned i;
+    
+    for(i = 0; i < 500; i++)
+        deps_ptr[i] = deps + i;
+    
+    for(i = 0; i < sizeof(max_batch_sizes) / sizeof(max_batch_sizes[0]); i++){
+        const unsigned max_batch_size = max_batch_sizes[i];
+        struct QED_Batch **greedy, **iterate;
+        unsigned num_greedy, num_iterate;
+        
+        QED_ASSERT_INT_EQ(QED_CalculateBatches(&greedy, &num_greedy,
+            deps_ptr, 500, max_batch_size, QED_eGreedy), 1);
+        QED_ASSERT_INT_EQ(QED_CalculateBatches(&iterate, &num_iterate,
+            deps_ptr, 500, max_batch_size, QED_eGreedyIterate), 1);
+        
+        if(!qed_test_check_batches(greedy, num_greedy, 500, max_batch_size))
+            return 0;
+        if(!qed_test_check_batches(iterate, num_iterate, 500, max_batch_size))
+            return 0;
+        
+        if(max_batch_size == 1)
+            QED_EXPECT_INT_EQ(num_greedy, 500);
+    }
+    
+    /* The default max_batch_size of zero is unlimited for both. */
+    {
+        struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+        struct QED_Batch **greedy, **iterate;
+        struct QED_BatchOptions options;
+        unsigned num_greedy, num_iterate, e;
+        
+        QED_InitBatchOptions(&options);
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&greedy, &num_greedy,
+            deps_ptr, 500, &options), 1);
+        options.algorithm = QED_eGreedyIterate;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&iterate,
+            &num_iterate, deps_ptr, 500, &options), 1);
+        if(!qed_test_check_batches(iterate, num_iterate, 500, 500))
+            return 0;
+        QED_ASSERT_INT_EQ(num_greedy, num_iterate);
+        
+        for(i = 0; i < num_greedy; i++){
+            QED_ASSERT_INT_EQ(greedy[i]->num_dependencies,
+                iterate[i]->num_dependencies);
+            for(e = 0; e < greedy[i]->num_dependencies; e++){
+                qed_hashdata_t unused;
+                QED_HashTableInsert(table,
+                    (qed_hashkey_t)greedy[i]->dependencies[e], i, &unused);
+            }
+        }
+        for(i = 0; i < num_iterate; i++){
+            for(e = 0; e < iterate[i]->num_dependencies; e++){
+                qed_hashdata_t batch = ~(qed_hashdata_t)0;
+                QED_HashTableGet(table,
+                    (qed_hashkey_t)iterate[i]->dependencies[e], &batch);
+                QED_ASSERT_INT_EQ(batch, i);
+            }
+        }
+        
+        QED_FreeHashTable(table, NULL);
+        free(table);
+    }
+    
+    qed_test_free_random_graph(deps, 500);
+    return 1;
+}
+
+/* Six independent deps listed before a chain of four. Greedy takes the
+ * independent deps first and needs seven batches of two, but the chain can be
+ * started right away to finish in five. */
+static int QED_TestLookaheadCriticalPath(){
+    
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    
+    struct QED_Dependency deps[10], *deps_ptr[10];
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 10; i++)
+        deps_ptr[i] = deps + i;
+    for(i = 7; i < 10; i++){
+        deps[i].num_dependencies = 1;
+        deps[i].dependencies = deps_ptr + i - 1;
+    }
+    
+    QED_EXPECT_TRUE(QED_CalculateBatches(&batches, &num_batches, deps_ptr, 10, 2, QED_eGreedy));
+    QED_EXPECT_INT_EQ(num_batches, 7);
+    
+    QED_EXPECT_TRUE(QED_CalculateBatches(&batches, &num_batches, deps_ptr, 10, 2, QED_eLookahead));
+    QED_ASSERT_INT_EQ(num_batches, 5);
+    for(i = 0; i < 5; i++)
+        QED_ASSERT_INT_EQ(batches[i]->num_dependencies, 2);
+    
+    /* Once the rest of the chain has the same rank as the independent deps,
+     * it no longer has to come first. */
+    for(i = 0; i < 3; i++)
+        QED_EXPECT_TRUE((batches[i]->dependencies[0] == deps + 6 + i));
+    
+    return 1;
+}
+
+static int QED_TestLookaheadRandom(){
+    
+    static const unsigned max_batch_sizes[] = { 1, 2, 5, 1000 };
+    struct QED_Dependency *const deps = qed_test_random_graph(500, 3, 7);
+    struct QED_Dependency *deps_ptr[500];
+    unsigned i;
+    
+    for(i = 0; i < 500; i++)
+        deps_ptr[i] = deps + i;
+    
+    for(i = 0; i < sizeof(max_batch_sizes) / sizeof(max_batch_sizes[0]); i++){
+        struct QED_Batch **greedy, **lookahead;
+        unsigned num_greedy, num_lookahead;
+        
+        QED_ASSERT_INT_EQ(QED_CalculateBatches(&greedy, &num_greedy,
+            deps_ptr, 500, max_batch_sizes[i], QED_eGreedy), 1);
+        QED_ASSERT_INT_EQ(QED_CalculateBatches(&lookahead, &num_lookahead,
+            deps_ptr, 500, max_batch_sizes[i], QED_eLookahead), 1);
+        
+        if(!qed_test_check_batches(lookahead, num_lookahead, 500, max_batch_sizes[i]))
+            return 0;
+        QED_EXPECT_TRUE(num_lookahead <= num_greedy);
+    }
+    
+    qed_test_free_random_graph(deps, 500);
+    return 1;
+}
+
+static int QED_TestBalancedBudget(){
+    
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    struct QED_BatchOptions options;
+    struct QED_BatchBudget budget;
+    
+    /* The same graph as QED_TestLookaheadCriticalPath. */
+    struct QED_Dependency deps[10], *deps_ptr[10];
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 10; i++)
+        deps_ptr[i] = deps + i;
+    for(i = 7; i < 10; i++){
+        deps[i].num_dependencies = 1;
+        deps[i].dependencies = deps_ptr + i - 1;
+    }
+    
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 2;
+    options.algorithm = QED_eBalanced;
+    options.budget = &budget;
+    
+    /* With no limits this is the same as lookahead. */
+    memset(&budget, 0, sizeof(budget));
+    QED_EXPECT_TRUE(QED_CalculateBatchesWithOptions(&batches, &num_batches, deps_ptr, 10, &options));
+    QED_EXPECT_INT_EQ(num_batches, 5);
+    QED_EXPECT_FALSE(budget.exhausted);
+    QED_EXPECT_TRUE(budget.used_operations != 0);
+    
+    /* With almost no budget it falls back to greedy. */
+    memset(&budget, 0, sizeof(budget));
+    budget.max_operations = 1;
+    QED_EXPECT_TRUE(QED_CalculateBatchesWithOptions(&batches, &num_batches, deps_ptr, 10, &options));
+    QED_EXPECT_INT_EQ(num_batches, 7);
+    QED_EXPECT_TRUE(budget.exhausted);
+    QED_EXPECT_INT_EQ(budget.used_operations, 1);
+    
+    /* A window of two is enough to see that the chain comes first. */
+    memset(&budget, 0, sizeof(budget));
+    budget.window = 2;
+    QED_EXPECT_TRUE(QED_CalculateBatchesWithOptions(&batches, &num_batches, deps_ptr, 10, &options));
+    QED_EXPECT_INT_EQ(num_batches, 5);
+    
+    return 1;
+}
+
+static int QED_TestBalancedRandom(){
+    
+    static const unsigned long max_operations[] = { 1, 100, 1000, 0 };
+    struct QED_Dependency *const deps = qed_test_random_graph(500, 3, 11);
+    struct QED_Dependency *deps_ptr[500];
+    struct QED_BatchOptions options;
+    struct QED_BatchBudget budget;
+    unsigned i;
+    
+    for(i = 0; i < 500; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 4;
+    options.algorithm = QED_eBalanced;
+    options.budget = &budget;
+    
+    for(i = 0; i < sizeof(max_operations) / sizeof(max_operations[0]); i++){
+        struct QED_Batch **batches;
+        unsigned num_batches;
+        
+        memset(&budget, 0, sizeof(budget));
+        budget.max_operations = max_operations[i];
+        budget.window = 8;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches,
+            &num_batches, deps_ptr, 500, &options), 1);
+        if(!qed_test_check_batches(batches, num_batches, 500, 4))
+            return 0;
+        if(max_operations[i] != 0)
+            QED_EXPECT_TRUE(budget.used_operations <= max_operations[i]);
+    }
+    
+    qed_test_free_random_graph(deps, 500);
+    return 1;
+}
+
+/* A budget that is used again must still have its time limit checked, even
+ * though it holds the operations counted by the last call. */
+static int QED_TestBalancedBudgetReuse(){
+    
+    struct QED_Dependency *const deps = qed_test_random_graph(20000, 3, 5);
+    struct QED_Dependency **const deps_ptr =
+        malloc(20000 * sizeof(struct QED_Dependency*));
+    struct QED_BatchOptions options;
+    struct QED_BatchBudget budget;
+    struct QED_Batch **batches;
+    unsigned long used_operations;
+    unsigned num_batches, i;
+    
+    for(i = 0; i < 20000; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 2;
+    options.algorithm = QED_eBalanced;
+    options.budget = &budget;
+    
+    memset(&budget, 0, sizeof(budget));
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 20000, &options), 1);
+    QED_FreeBatches(batches);
+    QED_EXPECT_FALSE(budget.exhausted);
+    used_operations = budget.used_operations;
+    QED_ASSERT_INT_EQ(used_operations > 10000, 1);
+    
+    /* The clock is checked every thousand or so operations, so the limit
+     * stops the search long before the count from the last call. */
+    budget.max_microseconds = 1;
+    for(i = 0; i < 2; i++){
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches,
+            &num_batches, deps_ptr, 20000, &options), 1);
+        if(!qed_test_check_batches(batches, num_batches, 20000, 2))
+            return 0;
+        QED_FreeBatches(batches);
+        QED_EXPECT_TRUE(budget.exhausted);
+        QED_ASSERT_INT_EQ(budget.used_operations < used_operations / 2, 1);
+    }
+    
+    free(deps_ptr);
+    qed_test_free_random_graph(deps, 20000);
+    return 1;
+}
+
+/* A cycle below a ready dep must be found while ranking it, as it is by the
+ * other schedulers. */
+static int QED_TestBalancedCycle(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy,
+        QED_eLookahead,
+        QED_ePacked,
+        QED_eBalanced,
+        QED_eGreedyIterate
+    };
+    struct QED_Dependency deps[4], *deps_ptr[4], *two_deps[2], *three_deps[1];
+    struct QED_BatchOptions options;
+    struct QED_BatchBudget budget;
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    
+    /* Two depends on zero and three, and three depends on two. */
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 4; i++)
+        deps_ptr[i] = deps + i;
+    two_deps[0] = deps + 0;
+    two_deps[1] = deps + 3;
+    three_deps[0] = deps + 2;
+    deps[2].num_dependencies = 2;
+    deps[2].dependencies = two_deps;
+    deps[3].num_dependencies = 1;
+    deps[3].dependencies = three_deps;
+    
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 1;
+    options.budget = &budget;
+    for(i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++){
+        memset(&budget, 0, sizeof(budget));
+        options.algorithm = algorithms[i];
+        QED_EXPECT_FALSE(QED_CalculateBatchesWithOptions(&batches,
+            &num_batches, deps_ptr, 4, &options));
+    }
+    return 1;
+}
+
+/* Stamps each dep with the order it ran in. The action data is the counter.
+ * Fails the deps whose stamp is a multiple of `fail_every`. */
+struct qed_test_stamp{
+    atomic_uint counter;
+    unsigned fail_every;
+};
+
+static int qed_test_stamp_callback(void *action_data, void *user_data){
+    struct qed_test_stamp *const stamp = action_data;
+    const unsigned order =
+        atomic_fetch_add(&stamp->counter, 1) + 1;
+    ((unsigned*)user_data)[0] = order;
+    return (stamp->fail_every != 0 && order % stamp->fail_every == 0) ? 1 : 0;
+}
+
+/* Creates a random graph where every dep stamps an entry of `stamps`. */
+static struct QED_Dependency *qed_test_stamped_graph(unsigned num_nodes,
+    unsigned seed,
+    unsigned *stamps){
+    
+    struct QED_Dependency *const deps = qed_test_random_graph(num_nodes, 3, seed);
+    unsigned i;
+    for(i = 0; i < num_nodes; i++){
+        deps[i].execute.func = qed_test_stamp_callback;
+        deps[i].execute.user_data = stamps + i;
+        stamps[i] = 0;
+    }
+    return deps;
+}
+
+/* Checks that every dep ran, and ran after its dependencies. */
+static int qed_test_check_stamps(const struct QED_Dependency *deps,
+    unsigned num_nodes,
+    const unsigned *stamps){
+    
+    unsigned i;
+    for(i = 0; i < num_nodes; i++){
+        unsigned e;
+        QED_ASSERT_INT_EQ(stamps[i] != 0, 1);
+        for(e = 0; e < deps[i].num_dependencies; e++){
+            const unsigned d = deps[i].dependencies[e] - deps;
+            QED_ASSERT_INT_EQ(stamps[d] < stamps[i], 1);
+        }
+    }
+    return 1;
+}
+
+static int QED_TestExecuteBatches(){
+    
+    static const unsigned num_threads[] = { 1, 2, 4 };
+    unsigned stamps[300], t;
+    int results[300];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(300, 3, stamps);
+    struct QED_Dependency *deps_ptr[300];
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    
+    for(i = 0; i < 300; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_ASSERT_INT_EQ(QED_CalculateBatches(&batches, &num_batches,
+        deps_ptr, 300, 8, QED_eGreedy), 1);
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        struct qed_test_stamp stamp;
+        struct QED_ExecuteOptions options;
+        unsigned run;
+        
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        QED_ASSERT_INT_EQ(QED_ThreadPoolSize(pool), num_threads[t]);
+        
+        /* The same pool is reused for several runs. */
+        for(run = 0; run < 3; run++){
+            atomic_init(&stamp.counter, 0);
+            stamp.fail_every = 0;
+            QED_InitExecuteOptions(&options);
+            options.action_data = &stamp;
+            options.results = results;
+            for(i = 0; i < 300; i++)
+                stamps[i] = 0;
+            
+            QED_EXPECT_TRUE(QED_ExecuteBatches(pool, batches, num_batches, &options));
+            QED_EXPECT_INT_EQ(atomic_load(&stamp.counter), 300);
+            if(!qed_test_check_stamps(deps, 300, stamps))
+                return 0;
+        }
+        
+        /* Every seventh callback fails. */
+        atomic_init(&stamp.counter, 0);
+        stamp.fail_every = 7;
+        QED_EXPECT_FALSE(QED_ExecuteBatches(pool, batches, num_batches, &options));
+        {
+            unsigned num_failed = 0;
+            for(i = 0; i < 300; i++)
+                num_failed += (results[i] != 0);
+            QED_EXPECT_INT_EQ(num_failed, 300 / 7);
+        }
+        
+        QED_DestroyThreadPool(pool);
+    }
+    
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+struct qed_test_barrier{
+    struct QED_ThreadPool *pool;
+    atomic_uint arrived;
+    atomic_uint errors;
+};
+
+static void qed_test_barrier_job(void *arg, unsigned worker){
+    struct qed_test_barrier *const barrier = arg;
+    const unsigned size = QED_ThreadPoolSize(barrier->pool);
+    unsigned round;
+    (void)worker;
+    for(round = 1; round <= 50; round++){
+        atomic_fetch_add(&barrier->arrived, 1);
+        QED_ThreadPoolBarrier(barrier->pool);
+        if(atomic_load(&barrier->arrived) < round * size)
+            atomic_fetch_add(&barrier->errors, 1);
+        QED_ThreadPoolBarrier(barrier->pool);
+    }
+}
+
+static int QED_TestThreadPoolBarrier(){
+    struct qed_test_barrier barrier;
+    barrier.pool = QED_CreateThreadPool(4);
+    QED_ASSERT_INT_EQ(barrier.pool != NULL, 1);
+    atomic_init(&barrier.arrived, 0);
+    atomic_init(&barrier.errors, 0);
+    
+    QED_RunThreadPool(barrier.pool, qed_test_barrier_job, &barrier);
+    QED_EXPECT_INT_EQ(atomic_load(&barrier.arrived), 200);
+    QED_EXPECT_INT_EQ(atomic_load(&barrier.errors), 0);
+    
+    QED_DestroyThreadPool(barrier.pool);
+    return 1;
+}
+
+/* A compiled graph can be scheduled many times, and gives the same batches as
+ * scheduling the dependencies directly. */
+static int QED_TestScheduleCompiledGraph(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy, QED_eLookahead, QED_eBalanced, QED_eGreedyIterate
+    };
+    struct QED_Dependency *const deps = qed_test_random_graph(400, 3, 13);
+    struct QED_Dependency *deps_ptr[400];
+    struct QED_BatchOptions options;
+    struct QED_Graph graph;
+    unsigned *scratch = NULL, i, round;
+    
+    for(i = 0; i < 400; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 400), 1);
+    QED_ASSERT_INT_EQ(graph.num_nodes, 400);
+    
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 6;
+    
+    for(round = 0; round < 2; round++){
+        for(i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++){
+            struct QED_Batch **from_graph, **direct;
+            unsigned num_from_graph, num_direct, e;
+            
+            options.algorithm = algorithms[i];
+            QED_ASSERT_INT_EQ(QED_CalculateBatchesFromGraph(&from_graph,
+                &num_from_graph, &graph, &options), 1);
+            if(!qed_test_check_batches(from_graph, num_from_graph, 400, 6))
+                return 0;
+            
+            if(algorithms[i] == QED_eGreedyIterate)
+                continue;
+            
+            QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&direct,
+                &num_direct, deps_ptr, 400, &options), 1);
+            QED_ASSERT_INT_EQ(num_from_graph, num_direct);
+            for(e = 0; e < num_direct; e++){
+                QED_ASSERT_INT_EQ(from_graph[e]->num_dependencies,
+                    direct[e]->num_dependencies);
+                QED_EXPECT_INT_EQ(memcmp(from_graph[e]->dependencies,
+                    direct[e]->dependencies,
+                    direct[e]->num_dependencies * sizeof(void*)), 0);
+            }
+        }
+        
+        /* The scratch memory is only allocated once. */
+        if(round == 0)
+            scratch = graph.scratch;
+        else
+            QED_EXPECT_TRUE(scratch == graph.scratch);
+    }
+    
+    QED_FreeGraph(&graph);
+    qed_test_free_random_graph(deps, 400);
+    return 1;
+}
+
+static int QED_TestDeque(){
+    struct QED_Deque deque;
+    unsigned i;
+    
+    QED_ASSERT_INT_EQ(QED_InitDeque(&deque, 4), 1);
+    QED_EXPECT_INT_EQ(QED_DequeTake(&deque), QED_DEQUE_EMPTY);
+    QED_EXPECT_INT_EQ(QED_DequeSteal(&deque), QED_DEQUE_EMPTY);
+    
+    /* Enough to grow the deque a few times. */
+    for(i = 0; i < 100; i++)
+        QED_ASSERT_INT_EQ(QED_DequePush(&deque, i), 1);
+    
+    /* The owner takes from the bottom, thieves steal from the top. */
+    QED_EXPECT_INT_EQ(QED_DequeTake(&deque), 99);
+    QED_EXPECT_INT_EQ(QED_DequeSteal(&deque), 0);
+    QED_EXPECT_INT_EQ(QED_DequeSteal(&deque), 1);
+    QED_EXPECT_INT_EQ(QED_DequeTake(&deque), 98);
+    
+    for(i = 2; i < 98; i++)
+        QED_EXPECT_INT_EQ(QED_DequeSteal(&deque), i);
+    QED_EXPECT_INT_EQ(QED_DequeTake(&deque), QED_DEQUE_EMPTY);
+    QED_EXPECT_INT_EQ(QED_DequeSteal(&deque), QED_DEQUE_EMPTY);
+    
+    QED_DestroyDeque(&deque);
+    return 1;
+}
+
+static int QED_TestExecuteGraph(){
+    
+    static const unsigned num_threads[] = { 1, 2, 4 };
+    unsigned stamps[300], t;
+    int results[300];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(300, 5, stamps);
+    struct QED_Dependency *deps_ptr[300];
+    struct QED_Graph graph;
+    unsigned i;
+    
+    for(i = 0; i < 300; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 300), 1);
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        struct qed_test_stamp stamp;
+        struct QED_ExecuteOptions options;
+        
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        
+        atomic_init(&stamp.counter, 0);
+        stamp.fail_every = 0;
+        QED_InitExecuteOptions(&options);
+        options.action_data = &stamp;
+        options.results = results;
+        
+        QED_EXPECT_TRUE(QED_ExecuteGraph(pool, &graph, &options));
+        QED_EXPECT_INT_EQ(atomic_load(&stamp.counter), 300);
+        if(!qed_test_check_stamps(deps, 300, stamps))
+            return 0;
+        
+        atomic_init(&stamp.counter, 0);
+        stamp.fail_every = 10;
+        QED_EXPECT_FALSE(QED_ExecuteGraph(pool, &graph, &options));
+        for(i = 0; i < 300; i++){
+            /* Results are indexed by node. */
+            const unsigned node = graph.nodes[i] - deps;
+            QED_EXPECT_INT_EQ(results[i] != 0, stamps[node] % 10 == 0);
+        }
+        
+        QED_DestroyThreadPool(pool);
+    }
+    
+    QED_FreeGraph(&graph);
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+/* A cycle must not hang the dataflow executor. */
+static int QED_TestExecuteGraphCycle(){
+    
+    unsigned stamps[3];
+    struct qed_test_stamp stamp;
+    struct QED_ExecuteOptions options;
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    struct QED_Dependency deps[3], *deps_ptr[3];
+    struct QED_Graph graph;
+    unsigned i;
+    
+    for(i = 0; i < 3; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].execute.func = qed_test_stamp_callback;
+        deps[i].execute.user_data = stamps + i;
+        stamps[i] = 0;
+    }
+    deps[0].num_dependencies = 1;
+    deps[0].dependencies = deps_ptr + 1;
+    deps[1].num_dependencies = 1;
+    deps[1].dependencies = deps_ptr;
+    deps[2].num_dependencies = 0;
+    deps[2].dependencies = NULL;
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 3), 1);
+    
+    atomic_init(&stamp.counter, 0);
+    stamp.fail_every = 0;
+    QED_InitExecuteOptions(&options);
+    options.action_data = &stamp;
+    
+    QED_EXPECT_FALSE(QED_ExecuteGraph(pool, &graph, &options));
+    QED_EXPECT_INT_EQ(stamps[0], 0);
+    QED_EXPECT_INT_EQ(stamps[1], 0);
+    QED_EXPECT_INT_EQ(stamps[2], 1);
+    
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    return 1;
+}
+
+/* Fails if the flag that user_data points to is set, and counts the calls in
+ * the atomic_uint action_data points to. */
+static int qed_test_fail_callback(void *action_data, void *user_data){
+    atomic_fetch_add((atomic_uint*)action_data, 1);
+    return ((const bool*)user_data)[0] ? 1 : 0;
+}
+
+/* Checks the statuses from an error mode. status and fails are by dep, and
+ * tainted is true for deps downstream of a failure. */
+static int qed_test_check_status(enum QED_ErrorMode mode,
+    const enum QED_Status *status,
+    const bool *fails,
+    const bool *tainted,
+    unsigned num_calls){
+    
+    unsigned i, num_run = 0, num_failed = 0;
+    for(i = 0; i < 300; i++){
+        num_run += (status[i] == QED_eOk || status[i] == QED_eFailed);
+        num_failed += (status[i] == QED_eFailed);
+        switch(mode){
+            case QED_eContinueAll:
+                QED_ASSERT_INT_EQ(status[i], fails[i] ? QED_eFailed : QED_eOk);
+                break;
+            case QED_eSkipDependents:
+                if(tainted[i])
+                    QED_ASSERT_INT_EQ(status[i], QED_eSkipped);
+                else
+                    QED_ASSERT_INT_EQ(status[i], fails[i] ? QED_eFailed : QED_eOk);
+                break;
+            case QED_eStopAll:
+                QED_ASSERT_INT_EQ((status[i] != QED_eSkipped), 1);
+                if(status[i] != QED_eCancelled)
+                    QED_ASSERT_INT_EQ(status[i], fails[i] ? QED_eFailed : QED_eOk);
+                break;
+        }
+    }
+    QED_ASSERT_INT_EQ(num_run, num_calls);
+    QED_ASSERT_INT_EQ((num_failed != 0), 1);
+    return 1;
+}
+
+static int QED_TestExecuteErrorModes(){
+    
+    static const enum QED_ErrorMode modes[] = {
+        QED_eContinueAll, QED_eSkipDependents, QED_eStopAll
+    };
+    static const unsigned num_threads[] = { 1, 4 };
+    struct QED_Dependency *const deps = qed_test_random_graph(300, 3, 23);
+    struct QED_Dependency *deps_ptr[300];
+    bool fails[300], tainted[300];
+    enum QED_Status status[300], by_dep[300];
+    int results[300];
+    struct QED_Batch **batches;
+    struct QED_Graph graph;
+    unsigned num_batches, i, e, t, m, num_tainted = 0;
+    
+    /* Every dependency is an earlier dep, so one pass finds the tainted. */
+    for(i = 0; i < 300; i++){
+        deps_ptr[i] = deps + i;
+        fails[i] = (i % 37) == 5;
+        tainted[i] = false;
+        for(e = 0; e < deps[i].num_dependencies; e++){
+            const unsigned d = deps[i].dependencies[e] - deps;
+            tainted[i] = tainted[i] || fails[d] || tainted[d];
+        }
+        num_tainted += tainted[i];
+        deps[i].execute.func = qed_test_fail_callback;
+        deps[i].execute.user_data = fails + i;
+    }
+    QED_ASSERT_INT_EQ((num_tainted != 0 && num_tainted < 300), 1);
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 300), 1);
+    QED_ASSERT_INT_EQ(QED_CalculateBatches(&batches, &num_batches,
+        deps_ptr, 300, 8, QED_eLookahead), 1);
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        
+        for(m = 0; m < sizeof(modes) / sizeof(modes[0]); m++){
+            struct QED_ExecuteOptions options;
+            atomic_uint calls;
+            unsigned b, base;
+            
+            QED_InitExecuteOptions(&options);
+            options.action_data = &calls;
+            options.results = results;
+            options.status = status;
+            options.error_mode = modes[m];
+            
+            /* The graph has every dep as an input, so node i is deps[i]. */
+            atomic_init(&calls, 0);
+            QED_EXPECT_FALSE(QED_ExecuteGraph(pool, &graph, &options));
+            if(!qed_test_check_status(modes[m], status, fails, tainted,
+                atomic_load(&calls)))
+                return 0;
+            for(i = 0; i < 300; i++)
+                QED_ASSERT_INT_EQ(results[i], (status[i] == QED_eFailed));
+            
+            atomic_init(&calls, 0);
+            QED_EXPECT_FALSE(QED_ExecuteBatches(pool, batches, num_batches,
+                &options));
+            for(b = 0, base = 0; b < num_batches; b++){
+                for(i = 0; i < batches[b]->num_dependencies; i++){
+                    const unsigned d = batches[b]->dependencies[i] - deps;
+                    by_dep[d] = status[base + i];
+                    QED_ASSERT_INT_EQ(results[base + i],
+                        (status[base + i] == QED_eFailed));
+                }
+                base += batches[b]->num_dependencies;
+            }
+            if(!qed_test_check_status(modes[m], by_dep, fails, tainted,
+                atomic_load(&calls)))
+                return 0;
+            
+            /* A single worker starts nothing after the first failure. */
+            if(modes[m] == QED_eStopAll && num_threads[t] == 1){
+                unsigned num_failed = 0;
+                for(i = 0; i < 300; i++)
+                    num_failed += (by_dep[i] == QED_eFailed);
+                QED_EXPECT_INT_EQ(num_failed, 1);
+            }
+        }
+        
+        QED_DestroyThreadPool(pool);
+    }
+    
+    QED_FreeBatches(batches);
+    QED_FreeGraph(&graph);
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+/* Skipping must not hang on a cycle downstream of a failure, and nodes in a
+ * cycle are cancelled. */
+static int QED_TestExecuteSkipCycle(){
+    
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    struct QED_Dependency deps[5], *deps_ptr[5];
+    struct QED_ExecuteOptions options;
+    enum QED_Status status[5];
+    bool fails[5] = { true, false, false, false, false };
+    struct QED_Graph graph;
+    atomic_uint calls;
+    unsigned i;
+    
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 5; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].execute.func = qed_test_fail_callback;
+        deps[i].execute.user_data = fails + i;
+    }
+    /* 1 and 2 depend on each other and on 0, which fails. 3 and 4 form a
+     * cycle of their own. */
+    deps[1].num_dependencies = 2;
+    deps[1].dependencies = malloc(2 * sizeof(void*));
+    deps[1].dependencies[0] = deps;
+    deps[1].dependencies[1] = deps + 2;
+    deps[2].num_dependencies = 1;
+    deps[2].dependencies = deps_ptr + 1;
+    deps[3].num_dependencies = 1;
+    deps[3].dependencies = deps_ptr + 4;
+    deps[4].num_dependencies = 1;
+    deps[4].dependencies = deps_ptr + 3;
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 5), 1);
+    
+    atomic_init(&calls, 0);
+    QED_InitExecuteOptions(&options);
+    options.action_data = &calls;
+    options.status = status;
+    options.error_mode = QED_eSkipDependents;
+    
+    QED_EXPECT_FALSE(QED_ExecuteGraph(pool, &graph, &options));
+    QED_EXPECT_INT_EQ(atomic_load(&calls), 1);
+    QED_EXPECT_INT_EQ(status[0], QED_eFailed);
+    QED_EXPECT_INT_EQ(status[1], QED_eSkipped);
+    QED_EXPECT_INT_EQ(status[2], QED_eSkipped);
+    QED_EXPECT_INT_EQ(status[3], QED_eCancelled);
+    QED_EXPECT_INT_EQ(status[4], QED_eCancelled);
+    
+    free(deps[1].dependencies);
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    return 1;
+}
+
+static int QED_TestHashTableGrowth(){
+    
+    struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+    qed_hashdata_t data;
+    unsigned i;
+    
+    /* Enough keys to force several resizes. Key zero is also valid. */
+    for(i = 0; i < 10000; i++){
+        QED_EXPECT_FALSE(QED_HashTableInsert(table, i * 16, i + 1, &data));
+    }
+    QED_ASSERT_INT_EQ(QED_HashTableCount(table), 10000);
+    
+    for(i = 0; i < 10000; i++){
+        data = 0;
+        QED_EXPECT_TRUE(QED_HashTableGet(table, i * 16, &data));
+        QED_ASSERT_INT_EQ(data, i + 1);
+    }
+    
+    QED_EXPECT_FALSE(QED_HashTableGet(table, 8, &data));
+    QED_EXPECT_FALSE(QED_HashTableSet(table, 8, 1));
+    
+    QED_EXPECT_TRUE(QED_HashTableInsert(table, 16, 7, &data));
+    QED_EXPECT_INT_EQ(data, 2);
+    QED_EXPECT_TRUE(QED_HashTableSet(table, 16, 8));
+    QED_EXPECT_TRUE(QED_HashTableGet(table, 16, &data));
+    QED_EXPECT_INT_EQ(data, 8);
+    
+    QED_FreeHashTable(table, NULL);
+    QED_EXPECT_INT_EQ(QED_HashTableCount(table), 0);
+    QED_EXPECT_FALSE(QED_HashTableGet(table, 16, &data));
+    free(table);
+    return 1;
+}
+
+static int QED_TestHashTableRemove(){
+    
+    struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+    qed_hashdata_t data;
+    unsigned i;
+    
+    for(i = 0; i < 5000; i++)
+        QED_HashTableInsert(table, i * 8, i, &data);
+    
+    /* Remove every other key, which moves entries around inside probe runs. */
+    for(i = 0; i < 5000; i += 2){
+        data = ~(qed_hashdata_t)0;
+        QED_EXPECT_TRUE(QED_HashTableRemove(table, i * 8, &data));
+        QED_ASSERT_INT_EQ(data, i);
+    }
+    QED_EXPECT_FALSE(QED_HashTableRemove(table, 0, &data));
+    QED_ASSERT_INT_EQ(QED_HashTableCount(table), 2500);
+    
+    for(i = 0; i < 5000; i++){
+        const bool present = QED_HashTableGet(table, i * 8, &data);
+        QED_ASSERT_INT_EQ(present, i & 1);
+        if(present){
+            QED_ASSERT_INT_EQ(data, i);
+        }
+    }
+    
+    QED_FreeHashTable(table, NULL);
+    free(table);
+    return 1;
+}
+
+/* The batches and their dependency arrays must all be one block, in order,
+ * so that QED_FreeBatches only has to free the batch array. */
+static int QED_TestSingleAllocationBatches(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy,
+        QED_eLookahead,
+        QED_eGreedyIterate
+    };
+    struct QED_Dependency *const deps = qed_test_random_graph(300, 3, 11);
+    struct QED_Dependency *deps_ptr[300];
+    unsigned i;
+    
+    for(i = 0; i < 300; i++)
+        deps_ptr[i] = deps + i;
+    
+    for(i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++){
+        struct QED_Batch **batches;
+        unsigned num_batches, b;
+        const char *start, *end;
+        
+        QED_ASSERT_INT_EQ(QED_CalculateBatches(&batches, &num_batches,
+            deps_ptr, 300, 4, algorithms[i]), 1);
+        if(!qed_test_check_batches(batches, num_batches, 300, 4))
+            return 0;
+        
+        start = (const char*)batches;
+        end = (const char*)(batches[0]->dependencies + 300);
+        for(b = 0; b < num_batches; b++){
+            const char *const batch = (const char*)batches[b];
+            const char *const batch_deps = (const char*)batches[b]->dependencies;
+            QED_EXPECT_TRUE((batch > start && batch < end));
+            QED_EXPECT_TRUE((batch_deps > start && batch_deps < end));
+            if(b != 0){
+                QED_EXPECT_TRUE((batches[b]->dependencies ==
+                    batches[b - 1]->dependencies + batches[b - 1]->num_dependencies));
+            }
+        }
+        
+        QED_FreeBatches(batches);
+    }
+    
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+static int QED_TestScheduleBuffer(){
+    
+    struct QED_Dependency *const deps = qed_test_random_graph(200, 3, 5);
+    struct QED_Dependency *deps_ptr[200];
+    struct QED_Graph graph;
+    struct QED_BatchOptions options;
+    struct QED_Schedule schedule;
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    void *const buffer = malloc(QED_SCHEDULE_BUFFER_SIZE(200));
+    
+    for(i = 0; i < 200; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 200), 1);
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 3;
+    options.algorithm = QED_eLookahead;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesFromGraph(&batches, &num_batches,
+        &graph, &options), 1);
+    
+    /* A buffer from the caller is used as-is. */
+    QED_InitSchedule(&schedule, buffer, QED_SCHEDULE_BUFFER_SIZE(200));
+    for(i = 0; i < 2; i++){
+        unsigned b;
+        QED_ASSERT_INT_EQ(QED_CalculateSchedule(&schedule, &graph, &options), 1);
+        QED_EXPECT_FALSE(schedule.owns_buffer);
+        QED_EXPECT_TRUE((schedule.nodes == buffer));
+        QED_ASSERT_INT_EQ(schedule.num_nodes, 200);
+        QED_ASSERT_INT_EQ(schedule.num_batches, num_batches);
+        for(b = 0; b < num_batches; b++){
+            QED_ASSERT_INT_EQ(schedule.offsets[b + 1] - schedule.offsets[b],
+                batches[b]->num_dependencies);
+            QED_EXPECT_TRUE((schedule.nodes[schedule.offsets[b]] ==
+                batches[b]->dependencies[0]));
+        }
+    }
+    QED_FreeSchedule(&schedule);
+    
+    /* A buffer that is too small is replaced, and the new one is kept. */
+    QED_InitSchedule(&schedule, buffer, sizeof(void*));
+    QED_ASSERT_INT_EQ(QED_CalculateSchedule(&schedule, &graph, &options), 1);
+    QED_EXPECT_TRUE(schedule.owns_buffer);
+    QED_EXPECT_TRUE((schedule.buffer != buffer));
+    QED_ASSERT_INT_EQ(schedule.num_batches, num_batches);
+    QED_FreeSchedule(&schedule);
+    
+    QED_FreeBatches(batches);
+    QED_FreeGraph(&graph);
+    free(buffer);
+    qed_test_free_random_graph(deps, 200);
+    return 1;
+}
+
+/* The iterator has to give exactly the same batches as scheduling all at
+ * once, for both orders that it supports. */
+static int QED_TestBatchIterator(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy,
+        QED_eLookahead
+    };
+    static const unsigned max_batch_sizes[] = { 0, 1, 7 };
+    struct QED_Dependency *const deps = qed_test_random_graph(1000, 3, 17);
+    struct QED_Dependency *deps_ptr[1000];
+    unsigned i, a, m;
+    
+    for(i = 0; i < 1000; i++)
+        deps_ptr[i] = deps + i;
+    
+    for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+        for(m = 0; m < sizeof(max_batch_sizes) / sizeof(max_batch_sizes[0]); m++){
+            struct QED_BatchOptions options;
+            struct QED_BatchIterator iterator;
+            struct QED_Batch **batches, batch;
+            unsigned num_batches, b = 0;
+            
+            QED_InitBatchOptions(&options);
+            options.algorithm = algorithms[a];
+            options.max_batch_size = max_batch_sizes[m];
+            QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches,
+                &num_batches, deps_ptr, 1000, &options), 1);
+            
+            QED_ASSERT_INT_EQ(QED_BatchIteratorBegin(&iterator, deps_ptr, 1000,
+                &options), 1);
+            while(QED_BatchIteratorNext(&iterator, &batch)){
+                QED_ASSERT_INT_EQ(b < num_batches, 1);
+                QED_ASSERT_INT_EQ(batch.num_dependencies,
+                    batches[b]->num_dependencies);
+                for(i = 0; i < batch.num_dependencies; i++){
+                    QED_EXPECT_TRUE((batch.dependencies[i] ==
+                        batches[b]->dependencies[i]));
+                }
+                b++;
+            }
+            QED_EXPECT_INT_EQ(b, num_batches);
+            QED_EXPECT_TRUE(QED_BatchIteratorEnd(&iterator));
+            QED_FreeBatches(batches);
+        }
+    }
+    
+    qed_test_free_random_graph(deps, 1000);
+    return 1;
+}
+
+static int QED_TestBatchIteratorCycle(){
+    
+    struct QED_Dependency deps[3], *deps_ptr[3];
+    struct QED_BatchOptions options;
+    struct QED_BatchIterator iterator;
+    struct QED_Batch batch;
+    unsigned i;
+    
+    /* Zero is free, and one and two depend on each other. */
+    for(i = 0; i < 3; i++)
+        deps_ptr[i] = deps + i;
+    deps[0].num_dependencies = 0;
+    deps[0].dependencies = NULL;
+    deps[1].num_dependencies = 1;
+    deps[1].dependencies = deps_ptr + 2;
+    deps[2].num_dependencies = 1;
+    deps[2].dependencies = deps_ptr + 1;
+    
+    QED_InitBatchOptions(&options);
+    QED_ASSERT_INT_EQ(QED_BatchIteratorBegin(&iterator, deps_ptr, 3, &options), 1);
+    QED_ASSERT_INT_EQ(QED_BatchIteratorNext(&iterator, &batch), 1);
+    QED_EXPECT_INT_EQ(batch.num_dependencies, 1);
+    QED_EXPECT_TRUE((batch.dependencies[0] == deps + 0));
+    QED_EXPECT_FALSE(QED_BatchIteratorNext(&iterator, &batch));
+    QED_EXPECT_FALSE(QED_BatchIteratorEnd(&iterator));
+    
+    /* Ranking finds the cycle straight away. */
+    options.algorithm = QED_eLookahead;
+    QED_EXPECT_FALSE(QED_BatchIteratorBegin(&iterator, deps_ptr, 3, &options));
+    QED_EXPECT_FALSE(QED_BatchIteratorNext(&iterator, &batch));
+    QED_EXPECT_FALSE(QED_BatchIteratorEnd(&iterator));
+    return 1;
+}
+
+/* Without QED_ENABLE_STATS the stats must be left alone. */
+static int QED_TestStats(){
+    
+    unsigned stamps[200];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(200, 9, stamps);
+    struct QED_Dependency *deps_ptr[200];
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    struct QED_BatchOptions options;
+    struct QED_ExecuteOptions execute_options;
+    struct QED_Stats stats, empty;
+    struct QED_Batch **batches;
+    struct QED_Graph graph;
+    struct qed_test_stamp stamp;
+    unsigned num_batches, i;
+    
+    for(i = 0; i < 200; i++)
+        deps_ptr[i] = deps + i;
+    
+    QED_InitStats(&stats);
+    QED_InitStats(&empty);
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 4;
+    options.algorithm = QED_eLookahead;
+    options.stats = &stats;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 200, &options), 1);
+    
+    if(!QED_StatsEnabled()){
+        QED_EXPECT_TRUE((memcmp(&stats, &empty, sizeof(stats)) == 0));
+    }
+    else{
+        QED_EXPECT_INT_EQ(stats.num_batches, num_batches);
+        QED_EXPECT_TRUE(stats.nodes_visited >= 200);
+        QED_EXPECT_TRUE(stats.max_nodes_visited <= stats.nodes_visited);
+        QED_EXPECT_TRUE(stats.hash_lookups >= 200);
+        QED_EXPECT_TRUE(stats.hash_probes >= stats.hash_lookups);
+        QED_EXPECT_TRUE(stats.allocations != 0);
+        QED_EXPECT_TRUE(stats.bytes_allocated != 0);
+        QED_EXPECT_TRUE(stats.schedule_ns >= stats.rank_ns);
+        QED_EXPECT_INT_EQ(stats.iterate_passes, 0);
+    }
+    QED_FreeBatches(batches);
+    
+    /* The original algorithm makes one pass of the table per batch. */
+    QED_InitStats(&stats);
+    options.algorithm = QED_eGreedyIterate;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 200, &options), 1);
+    if(QED_StatsEnabled()){
+        QED_EXPECT_INT_EQ(stats.num_batches, num_batches);
+        QED_EXPECT_INT_EQ(stats.iterate_passes, num_batches);
+    }
+    
+    /* Nothing is collected when no stats are given. */
+    QED_InitStats(&stats);
+    options.stats = NULL;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 200), 1);
+    QED_EXPECT_TRUE((memcmp(&stats, &empty, sizeof(stats)) == 0));
+    
+    atomic_init(&stamp.counter, 0);
+    stamp.fail_every = 0;
+    QED_InitExecuteOptions(&execute_options);
+    execute_options.action_data = &stamp;
+    execute_options.stats = &stats;
+    QED_EXPECT_TRUE(QED_ExecuteGraph(pool, &graph, &execute_options));
+    QED_EXPECT_TRUE(QED_ExecuteBatches(pool, batches, num_batches, &execute_options));
+    if(QED_StatsEnabled()){
+        QED_EXPECT_INT_EQ(stats.num_workers, 2);
+        QED_EXPECT_TRUE(stats.worker_busy_ns[0] + stats.worker_busy_ns[1] != 0);
+    }
+    else{
+        QED_EXPECT_TRUE((memcmp(&stats, &empty, sizeof(stats)) == 0));
+    }
+    
+    QED_FreeBatches(batches);
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    qed_test_free_random_graph(deps, 200);
+    return 1;
+}
+
+static int QED_TestPackedWorkers(){
+    
+    struct QED_Dependency deps[9], *deps_ptr[9];
+    struct QED_BatchOptions options;
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    
+    /* One long dep and eight short ones, all independent. */
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 9; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].cost = (i == 0) ? 100 : 25;
+    }
+    
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_ePacked;
+    
+    /* Three workers can run all of the short deps beside the long one. */
+    options.num_workers = 4;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 9, &options), 1);
+    QED_ASSERT_INT_EQ(num_batches, 1);
+    QED_EXPECT_TRUE((batches[0]->dependencies[0] == deps + 0));
+    QED_FreeBatches(batches);
+    
+    /* With two workers only four short deps fit beside the long one, and
+     * then two at a time. */
+    options.num_workers = 2;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 9, &options), 1);
+    QED_ASSERT_INT_EQ(num_batches, 3);
+    QED_EXPECT_INT_EQ(batches[0]->num_dependencies, 5);
+    QED_EXPECT_TRUE((batches[0]->dependencies[0] == deps + 0));
+    QED_EXPECT_INT_EQ(batches[1]->num_dependencies, 2);
+    QED_EXPECT_INT_EQ(batches[2]->num_dependencies, 2);
+    QED_FreeBatches(batches);
+    
+    /* A cost limit splits the short deps, and the long dep goes alone. */
+    options.num_workers = 0;
+    options.max_batch_cost = 60;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 9, &options), 1);
+    QED_ASSERT_INT_EQ(num_batches, 5);
+    QED_EXPECT_INT_EQ(batches[0]->num_dependencies, 1);
+    for(i = 1; i < 5; i++)
+        QED_EXPECT_INT_EQ(batches[i]->num_dependencies, 2);
+    QED_FreeBatches(batches);
+    
+    return 1;
+}
+
+/* A chain of cheap deps should start before an expensive independent dep
+ * when the chain costs more in total. */
+static int QED_TestPackedCriticalPath(){
+    
+    struct QED_Dependency *const deps = qed_test_random_graph(400, 3, 21);
+    struct QED_Dependency *deps_ptr[400], chain[4], *chain_ptr[5];
+    struct QED_BatchOptions options;
+    struct QED_Batch **batches;
+    unsigned num_batches, i;
+    
+    memset(chain, 0, sizeof(chain));
+    for(i = 0; i < 4; i++){
+        chain_ptr[i] = chain + i;
+        chain[i].cost = 10;
+        if(i != 0){
+            chain[i].num_dependencies = 1;
+            chain[i].dependencies = chain_ptr + i - 1;
+        }
+    }
+    chain[0].cost = 1;
+    
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_ePacked;
+    options.max_batch_size = 1;
+    
+    /* The chain costs 31 in total, and the random deps cost 1 each except for
+     * a single one costing 20. */
+    deps[0].cost = 20;
+    chain_ptr[4] = deps + 0;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        chain_ptr + 3, 2, &options), 1);
+    QED_ASSERT_INT_EQ(num_batches, 5);
+    QED_EXPECT_TRUE((batches[0]->dependencies[0] == chain + 0));
+    QED_FreeBatches(batches);
+    
+    /* Any limits still give a valid schedule. */
+    for(i = 0; i < 400; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].cost = (i * 7919) % 50;
+    }
+    options.max_batch_size = 8;
+    options.max_batch_cost = 100;
+    options.num_workers = 3;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 400, &options), 1);
+    if(!qed_test_check_batches(batches, num_batches, 400, 8))
+        return 0;
+    QED_FreeBatches(batches);
+    
+    qed_test_free_random_graph(deps, 400);
+    return 1;
+}
+
+static int QED_TestProfile(){
+    
+    static const char path[] = "qed_test_profile.txt";
+    struct QED_Profile profile, loaded;
+    const struct QED_ProfileEntry *entry;
+    struct QED_Dependency dep;
+    unsigned i;
+    
+    QED_InitProfile(&profile);
+    QED_EXPECT_FALSE(QED_ProfileRecord(&profile, 0, 100));
+    QED_EXPECT_TRUE((QED_ProfileFind(&profile, 1) == NULL));
+    
+    /* A plain average to start with. */
+    QED_EXPECT_TRUE(QED_ProfileRecord(&profile, 1, 1000));
+    QED_EXPECT_TRUE(QED_ProfileRecord(&profile, 1, 3000));
+    QED_ASSERT_INT_EQ((entry = QED_ProfileFind(&profile, 1)) != NULL, 1);
+    QED_EXPECT_INT_EQ(entry->mean_ns, 2000);
+    QED_EXPECT_INT_EQ(entry->samples, 2);
+    
+    /* Then old samples fade out. */
+    for(i = 0; i < 100; i++)
+        QED_ProfileRecord(&profile, 1, 50000);
+    entry = QED_ProfileFind(&profile, 1);
+    QED_EXPECT_TRUE(entry->mean_ns > 49000 && entry->mean_ns <= 50000);
+    
+    for(i = 2; i < 500; i++)
+        QED_ProfileRecord(&profile, i, i * 1000);
+    
+    /* Measured costs are in microseconds, and anything else uses the cost
+     * from the dep. */
+    memset(&dep, 0, sizeof(dep));
+    dep.id = 300;
+    dep.cost = 7;
+    QED_EXPECT_INT_EQ(QED_ProfileCost(&profile, &dep), 300);
+    dep.id = 1000;
+    QED_EXPECT_INT_EQ(QED_ProfileCost(&profile, &dep), 7);
+    
+    QED_ASSERT_INT_EQ(QED_SaveProfile(&profile, path), 1);
+    QED_InitProfile(&loaded);
+    QED_ASSERT_INT_EQ(QED_LoadProfile(&loaded, path), 1);
+    remove(path);
+    QED_ASSERT_INT_EQ(loaded.num_entries, profile.num_entries);
+    for(i = 0; i < profile.num_entries; i++){
+        const struct QED_ProfileEntry *const a = profile.entries + i,
+            *const b = QED_ProfileFind(&loaded, a->id);
+        QED_ASSERT_INT_EQ(b != NULL, 1);
+        QED_EXPECT_INT_EQ(a->mean_ns, b->mean_ns);
+        QED_EXPECT_INT_EQ(a->samples, b->samples);
+    }
+    
+    QED_EXPECT_FALSE(QED_LoadProfile(&loaded, "qed_test_no_such_profile.txt"));
+    
+    QED_FreeProfile(&loaded);
+    QED_FreeProfile(&profile);
+    return 1;
+}
+
+/* Executing with a profile records every dep, and then the profile decides
+ * what QED_ePacked does first. */
+static int QED_TestProfileExecute(){
+    
+    unsigned stamps[100];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(100, 13, stamps);
+    struct QED_Dependency *deps_ptr[100], pair[2], *pair_ptr[2];
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    struct QED_ExecuteOptions execute_options;
+    struct QED_BatchOptions options;
+    struct QED_Profile profile;
+    struct QED_Batch **batches;
+    struct QED_Graph graph;
+    struct qed_test_stamp stamp;
+    unsigned num_batches, i;
+    
+    for(i = 0; i < 100; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].id = i + 1;
+    }
+    /* Deps without ids are not recorded. */
+    deps[50].id = 0;
+    
+    QED_InitProfile(&profile);
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 100), 1);
+    atomic_init(&stamp.counter, 0);
+    stamp.fail_every = 0;
+    QED_InitExecuteOptions(&execute_options);
+    execute_options.action_data = &stamp;
+    execute_options.profile = &profile;
+    QED_EXPECT_TRUE(QED_ExecuteGraph(pool, &graph, &execute_options));
+    QED_EXPECT_INT_EQ(profile.num_entries, 99);
+    
+    QED_ASSERT_INT_EQ(QED_CalculateBatches(&batches, &num_batches, deps_ptr,
+        100, 8, QED_eGreedy), 1);
+    QED_EXPECT_TRUE(QED_ExecuteBatches(pool, batches, num_batches, &execute_options));
+    for(i = 0; i < 100; i++){
+        const struct QED_ProfileEntry *const entry = QED_ProfileFind(&profile, i + 1);
+        QED_EXPECT_INT_EQ((entry == NULL), (i == 50));
+        if(entry != NULL){
+            QED_EXPECT_INT_EQ(entry->samples, 2);
+        }
+    }
+    QED_FreeBatches(batches);
+    QED_FreeProfile(&profile);
+    
+    /* The second dep looks cheaper, but was measured as much slower. */
+    memset(pair, 0, sizeof(pair));
+    for(i = 0; i < 2; i++){
+        pair_ptr[i] = pair + i;
+        pair[i].id = i + 1;
+        pair[i].cost = 2 - i;
+    }
+    QED_InitProfile(&profile);
+    QED_ProfileRecord(&profile, 2, 5000000);
+    
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_ePacked;
+    options.max_batch_size = 1;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        pair_ptr, 2, &options), 1);
+    QED_EXPECT_TRUE((batches[0]->dependencies[0] == pair + 0));
+    QED_FreeBatches(batches);
+    
+    options.profile = &profile;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        pair_ptr, 2, &options), 1);
+    QED_EXPECT_TRUE((batches[0]->dependencies[0] == pair + 1));
+    QED_FreeBatches(batches);
+    
+    QED_FreeProfile(&profile);
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    qed_test_free_random_graph(deps, 100);
+    return 1;
+}
+
+/* Deps that were skipped or cancelled never ran, so their profile entries are
+ * left alone. */
+static int QED_TestProfileSkipped(){
+    
+    static const enum QED_ErrorMode modes[] = {
+        QED_eSkipDependents, QED_eStopAll
+    };
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    struct QED_Dependency deps[2], *deps_ptr[2];
+    bool fails[2] = { true, false };
+    struct QED_ExecuteOptions options;
+    const struct QED_ProfileEntry *entry;
+    struct QED_Profile profile;
+    struct QED_Batch **batches;
+    struct QED_Graph graph;
+    atomic_uint calls;
+    unsigned num_batches, i, m;
+    
+    /* One depends on zero, which fails. */
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 2; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].id = i + 1;
+        deps[i].execute.func = qed_test_fail_callback;
+        deps[i].execute.user_data = fails + i;
+    }
+    deps[1].num_dependencies = 1;
+    deps[1].dependencies = deps_ptr;
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 2), 1);
+    QED_ASSERT_INT_EQ(QED_CalculateBatches(&batches, &num_batches, deps_ptr,
+        2, 0, QED_eGreedy), 1);
+    QED_ASSERT_INT_EQ(num_batches, 2);
+    
+    for(m = 0; m < sizeof(modes) / sizeof(modes[0]); m++){
+        QED_InitProfile(&profile);
+        QED_ASSERT_INT_EQ(QED_ProfileRecord(&profile, 2, 1000), 1);
+        
+        atomic_init(&calls, 0);
+        QED_InitExecuteOptions(&options);
+        options.action_data = &calls;
+        options.error_mode = modes[m];
+        options.profile = &profile;
+        QED_EXPECT_FALSE(QED_ExecuteGraph(pool, &graph, &options));
+        QED_EXPECT_FALSE(QED_ExecuteBatches(pool, batches, num_batches, &options));
+        QED_EXPECT_INT_EQ(atomic_load(&calls), 2);
+        
+        /* The failed dep did run. */
+        entry = QED_ProfileFind(&profile, 1);
+        QED_ASSERT_INT_EQ((entry != NULL), 1);
+        QED_EXPECT_INT_EQ(entry->samples, 2);
+        entry = QED_ProfileFind(&profile, 2);
+        QED_ASSERT_INT_EQ((entry != NULL), 1);
+        QED_EXPECT_INT_EQ(entry->samples, 1);
+        QED_EXPECT_INT_EQ(entry->mean_ns, 1000);
+        QED_FreeProfile(&profile);
+    }
+    
+    QED_FreeBatches(batches);
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    return 1;
+}
+
+/* Checks that no batch has more deps of a class than its limit. */
+static int qed_test_check_resources(struct QED_Batch **batches,
+    unsigned num_batches,
+    const struct QED_ResourceLimits *resources){
+    
+    unsigned i;
+    for(i = 0; i < num_batches; i++){
+        unsigned usage[QED_MAX_RESOURCE_CLASSES], e, c;
+        memset(usage, 0, sizeof(usage));
+        for(e = 0; e < batches[i]->num_dependencies; e++){
+            for(c = 0; c < resources->num_classes; c++){
+                if(batches[i]->dependencies[e]->resources & (1u << c))
+                    usage[c]++;
+            }
+        }
+        for(c = 0; c < resources->num_classes; c++){
+            if(resources->limits[c] != 0){
+                QED_ASSERT_INT_EQ(usage[c] <= resources->limits[c], 1);
+            }
+        }
+    }
+    return 1;
+}
+
+static int QED_TestResourceBatches(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy,
+        QED_eLookahead,
+        QED_eBalanced,
+        QED_ePacked
+    };
+    static const unsigned max_batch_sizes[] = { 0, 8 };
+    static const unsigned limits[] = { 3, 0, 2 };
+    struct QED_Dependency *const deps = qed_test_random_graph(1000, 3, 29);
+    struct QED_Dependency *deps_ptr[1000], flat[20], *flat_ptr[20];
+    struct QED_ResourceLimits resources;
+    struct QED_BatchOptions options;
+    struct QED_Batch **batches;
+    unsigned num_batches, i, a, m;
+    
+    resources.limits = limits;
+    resources.num_classes = 3;
+    for(i = 0; i < 1000; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].resources = ((i % 3 == 0) ? 1u : 0u) | ((i % 5 == 0) ? 2u : 0u) |
+            ((i % 7 == 0) ? 4u : 0u);
+    }
+    
+    for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+        for(m = 0; m < sizeof(max_batch_sizes) / sizeof(max_batch_sizes[0]); m++){
+            const unsigned max_batch_size =
+                (max_batch_sizes[m] == 0) ? 1000 : max_batch_sizes[m];
+            QED_InitBatchOptions(&options);
+            options.algorithm = algorithms[a];
+            options.max_batch_size = max_batch_sizes[m];
+            options.resources = &resources;
+            QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches,
+                &num_batches, deps_ptr, 1000, &options), 1);
+            QED_ASSERT_INT_EQ(qed_test_check_batches(batches, num_batches,
+                1000, max_batch_size), 1);
+            QED_ASSERT_INT_EQ(qed_test_check_resources(batches, num_batches,
+                &resources), 1);
+            
+            /* The iterator gives the same batches. */
+            if(algorithms[a] == QED_eGreedy || algorithms[a] == QED_eLookahead){
+                struct QED_BatchIterator iterator;
+                struct QED_Batch batch;
+                unsigned b = 0;
+                QED_ASSERT_INT_EQ(QED_BatchIteratorBegin(&iterator, deps_ptr,
+                    1000, &options), 1);
+                while(QED_BatchIteratorNext(&iterator, &batch)){
+                    QED_ASSERT_INT_EQ(b < num_batches, 1);
+                    QED_ASSERT_INT_EQ(batch.num_dependencies,
+                        batches[b]->num_dependencies);
+                    for(i = 0; i < batch.num_dependencies; i++){
+                        QED_EXPECT_TRUE((batch.dependencies[i] ==
+                            batches[b]->dependencies[i]));
+                    }
+                    b++;
+                }
+                QED_EXPECT_INT_EQ(b, num_batches);
+                QED_EXPECT_TRUE(QED_BatchIteratorEnd(&iterator));
+            }
+            QED_FreeBatches(batches);
+        }
+    }
+    
+    /* Ten limited deps come first, and the slots they cannot use go to the
+     * unlimited deps behind them. */
+    memset(flat, 0, sizeof(flat));
+    for(i = 0; i < 20; i++){
+        flat_ptr[i] = flat + i;
+        flat[i].resources = (i < 10) ? 1u : 0u;
+    }
+    for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+        unsigned num_limited = 0;
+        QED_InitBatchOptions(&options);
+        options.algorithm = algorithms[a];
+        options.max_batch_size = 8;
+        options.resources = &resources;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches,
+            &num_batches, flat_ptr, 20, &options), 1);
+        QED_EXPECT_INT_EQ(batches[0]->num_dependencies, 8);
+        for(i = 0; i < batches[0]->num_dependencies; i++)
+            num_limited += batches[0]->dependencies[i]->resources;
+        QED_EXPECT_INT_EQ(num_limited, 3);
+        QED_EXPECT_INT_EQ(num_batches, 4);
+        QED_FreeBatches(batches);
+    }
+    
+    qed_test_free_random_graph(deps, 1000);
+    return 1;
+}
+
+/* Tracks how many limited callbacks are running at once. */
+struct qed_test_running{
+    atomic_uint running, most, count;
+};
+
+static int qed_test_running_callback(void *action_data, void *user_data){
+    struct qed_test_running *const running = action_data;
+    atomic_fetch_add(&running->count, 1);
+    if(user_data != NULL){
+        const unsigned now = atomic_fetch_add(&running->running, 1) + 1;
+        unsigned most = atomic_load(&running->most), i;
+        while(now > most && !atomic_compare_exchange_weak(&running->most,
+            &most, now)){}
+        for(i = 0; i < 16; i++)
+            sched_yield();
+        atomic_fetch_sub(&running->running, 1);
+    }
+    return 0;
+}
+
+static int QED_TestResourceExecute(){
+    
+    static const unsigned limits[] = { 2 };
+    struct QED_Dependency deps[64], *deps_ptr[64];
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(4);
+    struct QED_ResourceLimits resources;
+    struct QED_ExecuteOptions execute_options;
+    struct qed_test_running running;
+    struct QED_Batch **batches;
+    struct QED_Graph graph;
+    unsigned num_batches, i;
+    
+    memset(deps, 0, sizeof(deps));
+    for(i = 0; i < 64; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].execute.func = qed_test_running_callback;
+        if(i % 2 == 0){
+            deps[i].execute.user_data = deps + i;
+            deps[i].resources = 1;
+        }
+    }
+    resources.limits = limits;
+    resources.num_classes = 1;
+    
+    QED_InitExecuteOptions(&execute_options);
+    execute_options.action_data = &running;
+    execute_options.resources = &resources;
+    
+    /* One batch of everything, so only the executor is limiting. */
+    QED_ASSERT_INT_EQ(QED_CalculateBatches(&batches, &num_batches, deps_ptr,
+        64, 0, QED_eGreedy), 1);
+    QED_ASSERT_INT_EQ(num_batches, 1);
+    atomic_init(&running.running, 0);
+    atomic_init(&running.most, 0);
+    atomic_init(&running.count, 0);
+    QED_EXPECT_TRUE(QED_ExecuteBatches(pool, batches, num_batches,
+        &execute_options));
+    QED_EXPECT_INT_EQ(atomic_load(&running.count), 64);
+    QED_EXPECT_TRUE(atomic_load(&running.most) <= 2);
+    QED_FreeBatches(batches);
+    
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 64), 1);
+    atomic_init(&running.running, 0);
+    atomic_init(&running.most, 0);
+    atomic_init(&running.count, 0);
+    QED_EXPECT_TRUE(QED_ExecuteGraph(pool, &graph, &execute_options));
+    QED_EXPECT_INT_EQ(atomic_load(&running.count), 64);
+    QED_EXPECT_TRUE(atomic_load(&running.most) <= 2);
+    QED_FreeGraph(&graph);
+    
+    QED_DestroyThreadPool(pool);
+    return 1;
+}
+
+#define QED_TEST_INCREMENTAL_NODES 200
+
+/* Checks every node is in the batch after its last dependency, and that the
+ * batches hold exactly the live nodes. */
+static int qed_test_check_incremental(const struct QED_Incremental *incremental,
+    const unsigned char (*edges)[QED_TEST_INCREMENTAL_NODES],
+    const bool *live,
+    struct QED_Dependency *deps){
+    
+    unsigned levels[QED_TEST_INCREMENTAL_NODES], i, j, num_live = 0, num_batched = 0;
+    unsigned num_batches = 0;
+    bool changed = true;
+    
+    /* The nodes are not in topological order, so iterate to a fixed point. */
+    memset(levels, 0, sizeof(levels));
+    while(changed){
+        changed = false;
+        for(i = 0; i < QED_TEST_INCREMENTAL_NODES; i++){
+            for(j = 0; live[i] && j < QED_TEST_INCREMENTAL_NODES; j++){
+                if(edges[i][j] && levels[j] + 1 > levels[i]){
+                    levels[i] = levels[j] + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+    
+    for(i = 0; i < QED_TEST_INCREMENTAL_NODES; i++){
+        if(!live[i])
+            continue;
+        num_live++;
+        QED_ASSERT_INT_EQ(QED_IncrementalBatchOf(incremental, i), levels[i]);
+        if(levels[i] + 1 > num_batches)
+            num_batches = levels[i] + 1;
+    }
+    QED_ASSERT_INT_EQ(QED_IncrementalNumBatches(incremental), num_batches);
+    
+    for(i = 0; i < num_batches; i++){
+        struct QED_Batch batch;
+        QED_IncrementalBatch(incremental, i, &batch);
+        QED_ASSERT_INT_EQ(batch.num_dependencies != 0, 1);
+        for(j = 0; j < batch.num_dependencies; j++){
+            const unsigned node = batch.dependencies[j] - deps;
+            QED_ASSERT_INT_EQ(live[node], 1);
+            QED_ASSERT_INT_EQ(levels[node], i);
+        }
+        num_batched += batch.num_dependencies;
+    }
+    QED_ASSERT_INT_EQ(num_batched, num_live);
+    return 1;
+}
+
+static int QED_TestIncremental(){
+    
+    static unsigned char edges[QED_TEST_INCREMENTAL_NODES][QED_TEST_INCREMENTAL_NODES];
+    struct QED_Dependency *const deps =
+        qed_test_random_graph(QED_TEST_INCREMENTAL_NODES, 3, 41);
+    struct QED_Dependency *deps_ptr[QED_TEST_INCREMENTAL_NODES];
+    bool live[QED_TEST_INCREMENTAL_NODES];
+    unsigned removed[QED_TEST_INCREMENTAL_NODES], num_removed = 0;
+    struct QED_Incremental incremental;
+    struct QED_Graph graph;
+    unsigned seed = 7, step, i, e;
+    
+    memset(edges, 0, sizeof(edges));
+    for(i = 0; i < QED_TEST_INCREMENTAL_NODES; i++){
+        deps_ptr[i] = deps + i;
+        live[i] = true;
+        for(e = 0; e < deps[i].num_dependencies; e++)
+            edges[i][deps[i].dependencies[e] - deps] = 1;
+    }
+    
+    /* Every node is an input, so node i has the handle i. */
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr,
+        QED_TEST_INCREMENTAL_NODES), 1);
+    QED_InitIncremental(&incremental);
+    QED_ASSERT_INT_EQ(QED_IncrementalLoadGraph(&incremental, &graph), 1);
+    QED_FreeGraph(&graph);
+    QED_ASSERT_INT_EQ(qed_test_check_incremental(&incremental,
+        (const unsigned char (*)[QED_TEST_INCREMENTAL_NODES])edges, live, deps), 1);
+    
+    for(step = 0; step < 2000; step++){
+        unsigned a, b;
+        seed = seed * 1103515245u + 12345u;
+        a = (seed >> 8) % QED_TEST_INCREMENTAL_NODES;
+        seed = seed * 1103515245u + 12345u;
+        b = (seed >> 8) % QED_TEST_INCREMENTAL_NODES;
+        
+        switch(step % 8){
+            case 0:
+                /* Remove a node, or put back one that was removed. */
+                if(live[a]){
+                    QED_ASSERT_INT_EQ(QED_IncrementalRemoveNode(&incremental, a), 1);
+                    live[a] = false;
+                    removed[num_removed++] = a;
+                    for(i = 0; i < QED_TEST_INCREMENTAL_NODES; i++)
+                        edges[a][i] = edges[i][a] = 0;
+                }
+                else{
+                    /* The last handle freed is the first reused. */
+                    const unsigned node = removed[--num_removed];
+                    QED_ASSERT_INT_EQ(QED_IncrementalAddNode(&incremental,
+                        deps + node), node);
+                    live[node] = true;
+                }
+                break;
+            case 1:
+            case 2:
+            case 3:
+                if(edges[a][b]){
+                    QED_ASSERT_INT_EQ(QED_IncrementalRemoveEdge(&incremental,
+                        a, b), 1);
+                    edges[a][b] = 0;
+                }
+                else{
+                    QED_EXPECT_FALSE(QED_IncrementalRemoveEdge(&incremental, a, b));
+                }
+                break;
+            default:
+                if(QED_IncrementalAddEdge(&incremental, a, b)){
+                    QED_ASSERT_INT_EQ(live[a] && live[b] && a != b, 1);
+                    edges[a][b] = 1;
+                }
+                else if(live[a] && live[b] && a != b){
+                    /* The only other reason to refuse is a cycle. */
+                    QED_ASSERT_INT_EQ(edges[a][b], 0);
+                    QED_ASSERT_INT_EQ(QED_IncrementalBatchOf(&incremental, a) <=
+                        QED_IncrementalBatchOf(&incremental, b), 1);
+                }
+        }
+        
+        if(step % 50 == 49){
+            QED_ASSERT_INT_EQ(qed_test_check_incremental(&incremental,
+                (const unsigned char (*)[QED_TEST_INCREMENTAL_NODES])edges,
+                live, deps), 1);
+        }
+    }
+    
+    QED_FreeIncremental(&incremental);
+    qed_test_free_random_graph(deps, QED_TEST_INCREMENTAL_NODES);
+    return 1;
+}
+
+/* Edits near the end of a long chain only visit the end of the chain. */
+static int QED_TestIncrementalLocal(){
+    
+    struct QED_Dependency *const deps = calloc(10001, sizeof(struct QED_Dependency));
+    struct QED_Dependency *deps_ptr[1];
+    struct QED_Incremental incremental;
+    struct QED_Graph graph;
+    unsigned i, extra;
+    
+    for(i = 1; i < 10000; i++){
+        deps[i].dependencies = malloc(sizeof(void*));
+        deps[i].dependencies[0] = deps + i - 1;
+        deps[i].num_dependencies = 1;
+    }
+    
+    /* Only the end of the chain is an input, so handles count back from it. */
+    deps_ptr[0] = deps + 9999;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 1), 1);
+    QED_InitIncremental(&incremental);
+    QED_ASSERT_INT_EQ(QED_IncrementalLoadGraph(&incremental, &graph), 1);
+    QED_FreeGraph(&graph);
+    QED_ASSERT_INT_EQ(QED_IncrementalNumBatches(&incremental), 10000);
+    QED_EXPECT_INT_EQ(QED_IncrementalBatchOf(&incremental, 0), 9999);
+    
+    /* A new node at the end. */
+    extra = QED_IncrementalAddNode(&incremental, deps + 10000);
+    QED_ASSERT_INT_EQ(extra, 10000);
+    QED_ASSERT_INT_EQ(QED_IncrementalAddEdge(&incremental, extra, 0), 1);
+    QED_EXPECT_TRUE(incremental.visited <= 2);
+    QED_EXPECT_INT_EQ(QED_IncrementalNumBatches(&incremental), 10001);
+    
+    /* Cutting the chain near its end only moves what follows the cut. */
+    QED_ASSERT_INT_EQ(QED_IncrementalRemoveEdge(&incremental, 2, 3), 1);
+    QED_EXPECT_TRUE(incremental.visited <= 4);
+    QED_EXPECT_INT_EQ(QED_IncrementalBatchOf(&incremental, extra), 3);
+    QED_EXPECT_INT_EQ(QED_IncrementalNumBatches(&incremental), 9997);
+    
+    /* The start of the chain cannot depend on its end. */
+    QED_EXPECT_FALSE(QED_IncrementalAddEdge(&incremental, 9999, 3));
+    QED_EXPECT_FALSE(QED_IncrementalAddEdge(&incremental, 3, 3));
+    QED_ASSERT_INT_EQ(QED_IncrementalAddEdge(&incremental, 2, 3), 1);
+    QED_EXPECT_INT_EQ(QED_IncrementalNumBatches(&incremental), 10001);
+    
+    QED_FreeIncremental(&incremental);
+    for(i = 0; i < 10001; i++)
+        free(deps[i].dependencies);
+    free(deps);
+    return 1;
+}
+
+/* Checks the partial batches hold exactly the selected deps, each after any
+ * dependency that was also selected. */
+static int qed_test_check_partial(struct QED_Batch **batches,
+    unsigned num_batches,
+    struct QED_Dependency *deps,
+    const bool *selected,
+    unsigned num_selected){
+    
+    unsigned batch_of[400], i, j, e, num_batched = 0;
+    for(i = 0; i < 400; i++)
+        batch_of[i] = ~0u;
+    for(i = 0; i < num_batches; i++){
+        for(j = 0; j < batches[i]->num_dependencies; j++){
+            const unsigned node = batches[i]->dependencies[j] - deps;
+            QED_ASSERT_INT_EQ(selected[node], 1);
+            QED_ASSERT_INT_EQ(batch_of[node], ~0u);
+            batch_of[node] = i;
+            num_batched++;
+        }
+    }
+    QED_ASSERT_INT_EQ(num_batched, num_selected);
+    for(i = 0; i < 400; i++){
+        for(e = 0; selected[i] && e < deps[i].num_dependencies; e++){
+            const unsigned dep = deps[i].dependencies[e] - deps;
+            if(selected[dep])
+                QED_ASSERT_INT_EQ((batch_of[dep] < batch_of[i]), 1);
+        }
+    }
+    return 1;
+}
+
+static int QED_TestPartial(){
+    
+    struct QED_Dependency *const deps = qed_test_random_graph(400, 3, 17);
+    struct QED_Dependency *deps_ptr[400], *target_deps[8], *dirty_deps[8];
+    unsigned targets[8], dirty[8], nodes[400];
+    struct QED_BatchOptions options;
+    struct QED_Graph graph;
+    unsigned seed = 5, round, i, e;
+    
+    for(i = 0; i < 400; i++)
+        deps_ptr[i] = deps + i;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 400), 1);
+    QED_InitBatchOptions(&options);
+    options.max_batch_size = 4;
+    
+    for(round = 0; round < 40; round++){
+        const unsigned num_targets = 1 + round % 3, num_dirty = round % 8;
+        bool down[400], up[400], selected[400];
+        unsigned num_selected = 0, num_nodes;
+        struct QED_Batch **batches;
+        unsigned num_batches;
+        
+        for(i = 0; i < 8; i++){
+            seed = seed * 1103515245u + 12345u;
+            targets[i] = 200 + (seed >> 8) % 200;
+            seed = seed * 1103515245u + 12345u;
+            dirty[i] = (seed >> 8) % 400;
+            target_deps[i] = deps + targets[i];
+            dirty_deps[i] = deps + dirty[i];
+        }
+        /* Some rounds mark targets as dirty too. */
+        for(i = 0; round % 4 == 3 && i < num_targets && i < num_dirty; i++){
+            dirty[i] = targets[i];
+            dirty_deps[i] = target_deps[i];
+        }
+        
+        /* Every dependency is an earlier node, so one pass each way works. */
+        memset(down, 0, sizeof(down));
+        memset(up, 0, sizeof(up));
+        for(i = 0; i < num_dirty; i++)
+            down[dirty[i]] = true;
+        for(i = 0; i < num_targets; i++)
+            up[targets[i]] = true;
+        for(i = 0; i < 400; i++){
+            for(e = 0; e < deps[i].num_dependencies; e++)
+                down[i] = down[i] || down[deps[i].dependencies[e] - deps];
+        }
+        for(i = 400; i-- != 0;){
+            for(e = 0; up[i] && e < deps[i].num_dependencies; e++)
+                up[deps[i].dependencies[e] - deps] = true;
+        }
+        for(i = 0; i < 400; i++){
+            selected[i] = down[i] && up[i];
+            num_selected += selected[i];
+        }
+        
+        QED_ASSERT_INT_EQ(QED_SelectGraph(&graph, targets, num_targets,
+            dirty, num_dirty, nodes, &num_nodes), 1);
+        QED_ASSERT_INT_EQ(num_nodes, num_selected);
+        for(i = 0; i < num_nodes; i++)
+            QED_ASSERT_INT_EQ(selected[nodes[i]], 1);
+        
+        options.algorithm = (round & 1) ? QED_eLookahead : QED_eGreedyIterate;
+        QED_ASSERT_INT_EQ(QED_CalculatePartialBatchesFromGraph(&batches,
+            &num_batches, &graph, targets, num_targets, dirty, num_dirty,
+            &options), 1);
+        if(!qed_test_check_partial(batches, num_batches, deps, selected,
+            num_selected))
+            return 0;
+        QED_FreeBatches(batches);
+        
+        QED_ASSERT_INT_EQ(QED_CalculatePartialBatches(&batches, &num_batches,
+            target_deps, num_targets, dirty_deps, num_dirty, &options), 1);
+        if(!qed_test_check_partial(batches, num_batches, deps, selected,
+            num_selected))
+            return 0;
+        QED_FreeBatches(batches);
+    }
+    QED_FreeGraph(&graph);
+    
+    /* Two independent deps which are both targets and dirty are both
+     * scheduled, even though the targets and dirty deps outnumber them. */
+    {
+        struct QED_Dependency pair[2], *pair_ptr[2];
+        struct QED_Batch **batches;
+        unsigned num_batches;
+        
+        memset(pair, 0, sizeof(pair));
+        pair_ptr[0] = pair + 0;
+        pair_ptr[1] = pair + 1;
+        options.algorithm = QED_eGreedy;
+        options.max_batch_size = 0;
+        QED_ASSERT_INT_EQ(QED_CalculatePartialBatches(&batches, &num_batches,
+            pair_ptr, 2, pair_ptr, 2, &options), 1);
+        QED_ASSERT_INT_EQ(num_batches, 1);
+        QED_EXPECT_INT_EQ(batches[0]->num_dependencies, 2);
+        QED_EXPECT_TRUE((batches[0]->dependencies[0] !=
+            batches[0]->dependencies[1]));
+        QED_FreeBatches(batches);
+    }
+    
+    qed_test_free_random_graph(deps, 400);
+    return 1;
+}
+
+/* A small edit at the end of a long chain only selects the end. */
+static int QED_TestPartialLocal(){
+    
+    struct QED_Dependency *const deps = calloc(10000, sizeof(struct QED_Dependency));
+    struct QED_Dependency *deps_ptr[1];
+    struct QED_BatchOptions options;
+    struct QED_Graph graph;
+    struct QED_Batch **batches;
+    unsigned nodes[10000], num_nodes, num_batches, i, target, dirty;
+    
+    for(i = 1; i < 10000; i++){
+        deps[i].dependencies = malloc(sizeof(void*));
+        deps[i].dependencies[0] = deps + i - 1;
+        deps[i].num_dependencies = 1;
+    }
+    
+    /* The end of the chain is node 0 of the graph, and the start is 9999. */
+    deps_ptr[0] = deps + 9999;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 1), 1);
+    QED_InitBatchOptions(&options);
+    
+    target = 0;
+    dirty = 3;
+    QED_ASSERT_INT_EQ(QED_SelectGraph(&graph, &target, 1, &dirty, 1, nodes,
+        &num_nodes), 1);
+    QED_EXPECT_INT_EQ(num_nodes, 4);
+    
+    /* The same from the other side, with the target near the start. */
+    target = 9996;
+    dirty = 9999;
+    QED_ASSERT_INT_EQ(QED_SelectGraph(&graph, &target, 1, &dirty, 1, nodes,
+        &num_nodes), 1);
+    QED_EXPECT_INT_EQ(num_nodes, 4);
+    
+    QED_ASSERT_INT_EQ(QED_CalculatePartialBatchesFromGraph(&batches,
+        &num_batches, &graph, &target, 1, &dirty, 1, &options), 1);
+    QED_ASSERT_INT_EQ(num_batches, 4);
+    for(i = 0; i < 4; i++){
+        QED_ASSERT_INT_EQ(batches[i]->num_dependencies, 1);
+        QED_EXPECT_TRUE(batches[i]->dependencies[0] == deps + i);
+    }
+    QED_FreeBatches(batches);
+    
+    /* Nothing dirty means nothing to do. */
+    QED_ASSERT_INT_EQ(QED_CalculatePartialBatchesFromGraph(&batches,
+        &num_batches, &graph, &target, 1, NULL, 0, &options), 1);
+    QED_EXPECT_INT_EQ(num_batches, 0);
+    QED_FreeBatches(batches);
+    
+    QED_FreeGraph(&graph);
+    for(i = 0; i < 10000; i++)
+        free(deps[i].dependencies);
+    free(deps);
+    return 1;
+}
+
+/* Checks that two sets of batches are the same, for deps at the same index of
+ * two copies of a graph. */
+static int qed_test_same_batches(struct QED_Batch **a,
+    unsigned num_a,
+    const struct QED_Dependency *deps_a,
+    struct QED_Batch **b,
+    unsigned num_b,
+    const struct QED_Dependency *deps_b){
+    
+    unsigned i, j;
+    QED_ASSERT_INT_EQ(num_a, num_b);
+    for(i = 0; i < num_a; i++){
+        QED_ASSERT_INT_EQ(a[i]->num_dependencies, b[i]->num_dependencies);
+        for(j = 0; j < a[i]->num_dependencies; j++){
+            QED_ASSERT_INT_EQ((a[i]->dependencies[j] - deps_a),
+                (b[i]->dependencies[j] - deps_b));
+        }
+    }
+    return 1;
+}
+
+static int QED_TestScheduleCache(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy, QED_eLookahead, QED_eBalanced
+    };
+    /* The same shape twice, and a different one. */
+    struct QED_Dependency *const deps_a = qed_test_random_graph(300, 3, 29),
+        *const deps_b = qed_test_random_graph(300, 3, 29),
+        *const deps_c = qed_test_random_graph(300, 3, 31);
+    struct QED_Dependency *ptrs_a[300], *ptrs_b[300], *ptrs_c[300];
+    struct QED_ScheduleCache cache;
+    struct QED_BatchOptions options;
+    struct QED_Stats stats;
+    struct QED_Batch **batches_a, **batches_b;
+    unsigned num_a, num_b, i;
+    
+    for(i = 0; i < 300; i++){
+        ptrs_a[i] = deps_a + i;
+        ptrs_b[i] = deps_b + i;
+        ptrs_c[i] = deps_c + i;
+    }
+    
+    QED_InitScheduleCache(&cache, 8);
+    QED_InitStats(&stats);
+    QED_InitBatchOptions(&options);
+    options.cache = &cache;
+    options.stats = &stats;
+    options.max_batch_size = 5;
+    
+    for(i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++){
+        const unsigned long hits = cache.hits, misses = cache.misses;
+        options.algorithm = algorithms[i];
+        
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches_a, &num_a,
+            ptrs_a, 300, &options), 1);
+        QED_EXPECT_INT_EQ(cache.misses, misses + 1);
+        
+        /* The other copy hits, and gets the same batches of its own deps. */
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches_b, &num_b,
+            ptrs_b, 300, &options), 1);
+        QED_EXPECT_INT_EQ(cache.hits, hits + 1);
+        if(!qed_test_same_batches(batches_a, num_a, deps_a, batches_b, num_b,
+            deps_b))
+            return 0;
+        QED_FreeBatches(batches_b);
+        
+        /* A different shape or batch size is a miss. */
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches_b, &num_b,
+            ptrs_c, 300, &options), 1);
+        QED_FreeBatches(batches_b);
+        options.max_batch_size = 6;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches_b, &num_b,
+            ptrs_b, 300, &options), 1);
+        QED_FreeBatches(batches_b);
+        options.max_batch_size = 5;
+        QED_EXPECT_INT_EQ(cache.hits, hits + 1);
+        QED_EXPECT_INT_EQ(cache.misses, misses + 3);
+        
+        QED_FreeBatches(batches_a);
+    }
+    
+    /* Packed schedules depend on the costs, so they are never looked up. */
+    {
+        const unsigned long misses = cache.misses;
+        options.algorithm = QED_ePacked;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches_a, &num_a,
+            ptrs_a, 300, &options), 1);
+        QED_FreeBatches(batches_a);
+        QED_EXPECT_INT_EQ(cache.misses, misses);
+    }
+    
+    QED_EXPECT_INT_EQ(cache.num_entries, 8);
+    if(QED_StatsEnabled()){
+        QED_EXPECT_INT_EQ(stats.cache_hits, cache.hits);
+        QED_EXPECT_INT_EQ(stats.cache_misses, cache.misses);
+    }
+    
+    QED_FreeScheduleCache(&cache);
+    qed_test_free_random_graph(deps_a, 300);
+    qed_test_free_random_graph(deps_b, 300);
+    qed_test_free_random_graph(deps_c, 300);
+    return 1;
+}
+
+/* The least recently used schedule is the one replaced. */
+static int QED_TestScheduleCacheEviction(){
+    
+    struct QED_Dependency *deps[3];
+    struct QED_Graph graphs[3];
+    struct QED_ScheduleCache cache;
+    struct QED_BatchOptions options;
+    unsigned i;
+    
+    for(i = 0; i < 3; i++){
+        struct QED_Dependency *ptrs[100];
+        unsigned j;
+        deps[i] = qed_test_random_graph(100, 2, 100 + i);
+        for(j = 0; j < 100; j++)
+            ptrs[j] = deps[i] + j;
+        QED_ASSERT_INT_EQ(QED_CompileGraph(graphs + i, ptrs, 100), 1);
+        QED_EXPECT_TRUE((i == 0 || QED_GraphFingerprint(graphs + i) !=
+            QED_GraphFingerprint(graphs + i - 1)));
+    }
+    
+    QED_InitScheduleCache(&cache, 2);
+    QED_InitBatchOptions(&options);
+    options.cache = &cache;
+    options.max_batch_size = 4;
+    
+    {
+        /* Schedule A, B, A, C, A, B. C replaces B, and then B replaces C. */
+        static const unsigned sequence[] = { 0, 1, 0, 2, 0, 1 };
+        static const bool hit[] = { false, false, true, false, true, false };
+        for(i = 0; i < 6; i++){
+            const unsigned long hits = cache.hits;
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            QED_ASSERT_INT_EQ(QED_CalculateBatchesFromGraph(&batches,
+                &num_batches, graphs + sequence[i], &options), 1);
+            QED_FreeBatches(batches);
+            QED_EXPECT_INT_EQ(cache.hits, hits + hit[i]);
+            QED_EXPECT_INT_EQ(cache.num_entries, (i == 0) ? 1 : 2);
+        }
+    }
+    
+    QED_FreeScheduleCache(&cache);
+    for(i = 0; i < 3; i++){
+        QED_FreeGraph(graphs + i);
+        qed_test_free_random_graph(deps[i], 100);
+    }
+    return 1;
+}
+
+static int QED_TestMappedSchedule(){
+    
+    static const char path[] = "qed_test_schedule.bin";
+    unsigned stamps[300];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(300, 37, stamps);
+    struct QED_Dependency *deps_ptr[300], *nodes[300];
+    unsigned long costs[300];
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(3);
+    struct QED_MappedSchedule mapped;
+    struct QED_BatchOptions options;
+    struct QED_ExecuteOptions execute_options;
+    struct qed_test_stamp stamp;
+    struct QED_Graph graph;
+    const unsigned *order, *offsets;
+    unsigned num_batches, i;
+    
+    QED_ASSERT_INT_EQ(pool != NULL, 1);
+    for(i = 0; i < 300; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].id = 1000 + i;
+        costs[i] = i * 3;
+    }
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 300), 1);
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_eLookahead;
+    options.max_batch_size = 7;
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 1);
+    QED_ASSERT_INT_EQ(QED_SaveSchedule(path, &graph, order, offsets,
+        num_batches, costs), 1);
+    
+    QED_ASSERT_INT_EQ(QED_MapSchedule(&mapped, path), 1);
+    QED_ASSERT_INT_EQ(mapped.graph.num_nodes, 300);
+    QED_ASSERT_INT_EQ(mapped.graph.num_edges, graph.num_edges);
+    QED_ASSERT_INT_EQ(mapped.num_batches, num_batches);
+    QED_EXPECT_INT_EQ(memcmp(mapped.graph.preds, graph.preds,
+        graph.num_edges * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(mapped.graph.succ_offsets, graph.succ_offsets,
+        301 * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(mapped.offsets, offsets,
+        (num_batches + 1) * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(mapped.order, order, 300 * sizeof(unsigned)), 0);
+    QED_ASSERT_INT_EQ(mapped.costs != NULL, 1);
+    for(i = 0; i < 300; i++){
+        QED_EXPECT_INT_EQ(mapped.costs[i], costs[i]);
+        QED_EXPECT_INT_EQ(mapped.ids[i], graph.nodes[i]->id);
+    }
+    QED_FreeGraph(&graph);
+    
+    /* Find the deps by id, as another process would, and run the graph. */
+    for(i = 0; i < 300; i++)
+        nodes[i] = deps + (mapped.ids[i] - 1000);
+    mapped.graph.nodes = nodes;
+    atomic_init(&stamp.counter, 0);
+    stamp.fail_every = 0;
+    QED_InitExecuteOptions(&execute_options);
+    execute_options.action_data = &stamp;
+    QED_EXPECT_TRUE(QED_ExecuteGraph(pool, &mapped.graph, &execute_options));
+    if(!qed_test_check_stamps(deps, 300, stamps))
+        return 0;
+    
+    /* The mapped graph can be scheduled like any other. */
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&mapped.graph, &options, &order,
+        &offsets, &num_batches), 1);
+    QED_EXPECT_INT_EQ(num_batches, mapped.num_batches);
+    QED_UnmapSchedule(&mapped);
+    
+    /* Without costs. */
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 300), 1);
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 1);
+    QED_ASSERT_INT_EQ(QED_SaveSchedule(path, &graph, order, offsets,
+        num_batches, NULL), 1);
+    QED_ASSERT_INT_EQ(QED_MapSchedule(&mapped, path), 1);
+    QED_EXPECT_TRUE(mapped.costs == NULL);
+    QED_UnmapSchedule(&mapped);
+    remove(path);
+    
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+/* Files that are cut short or are not schedules are refused. */
+static int QED_TestMappedScheduleInvalid(){
+    
+    static const char path[] = "qed_test_invalid.bin";
+    struct QED_Dependency *const deps = qed_test_random_graph(50, 2, 3);
+    struct QED_Dependency *deps_ptr[50];
+    struct QED_MappedSchedule mapped;
+    struct QED_BatchOptions options;
+    struct QED_Graph graph;
+    const unsigned *order, *offsets;
+    unsigned num_batches, i;
+    unsigned char *data;
+    long size;
+    FILE *file;
+    
+    for(i = 0; i < 50; i++)
+        deps_ptr[i] = deps + i;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 50), 1);
+    QED_InitBatchOptions(&options);
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 1);
+    QED_ASSERT_INT_EQ(QED_SaveSchedule(path, &graph, order, offsets,
+        num_batches, NULL), 1);
+    QED_FreeGraph(&graph);
+    
+    QED_ASSERT_INT_EQ((file = fopen(path, "rb")) != NULL, 1);
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = malloc(size);
+    QED_ASSERT_INT_EQ(fread(data, size, 1, file), 1);
+    fclose(file);
+    
+    /* Truncated. */
+    QED_ASSERT_INT_EQ((file = fopen(path, "wb")) != NULL, 1);
+    fwrite(data, size - 8, 1, file);
+    fclose(file);
+    QED_EXPECT_FALSE(QED_MapSchedule(&mapped, path));
+    
+    /* A later version. */
+    data[8]++;
+    QED_ASSERT_INT_EQ((file = fopen(path, "wb")) != NULL, 1);
+    fwrite(data, size, 1, file);
+    fclose(file);
+    QED_EXPECT_FALSE(QED_MapSchedule(&mapped, path));
+    
+    /* Something else entirely. */
+    QED_ASSERT_INT_EQ((file = fopen(path, "wb")) != NULL, 1);
+    fputs("not a schedule", file);
+    fclose(file);
+    QED_EXPECT_FALSE(QED_MapSchedule(&mapped, path));
+    
+    remove(path);
+    QED_EXPECT_FALSE(QED_MapSchedule(&mapped, path));
+    
+    free(data);
+    qed_test_free_random_graph(deps, 50);
+    return 1;
+}
+
+/* Builds a DAG in layers, where each node depends on a few nodes of the two
+ * layers before it. The batches are wide enough to be expanded in parallel. */
+static struct QED_Dependency *qed_test_layered_graph(unsigned num_layers,
+    unsigned width,
+    unsigned seed){
+    
+    const unsigned num_nodes = num_layers * width;
+    struct QED_Dependency *const deps =
+        calloc(num_nodes, sizeof(struct QED_Dependency));
+    unsigned i;
+    for(i = 0; i < num_nodes; i++){
+        const unsigned layer_start = i - (i % width),
+            first = (layer_start < width * 2) ? 0 : (layer_start - (width * 2));
+        unsigned e;
+        seed = seed * 1103515245u + 12345u;
+        deps[i].num_dependencies = (layer_start == 0) ? 0 : ((seed >> 16) % 7);
+        deps[i].dependencies =
+            malloc((deps[i].num_dependencies + 1) * sizeof(void*));
+        for(e = 0; e < deps[i].num_dependencies; e++){
+            seed = seed * 1103515245u + 12345u;
+            deps[i].dependencies[e] =
+                deps + first + ((seed >> 16) % (layer_start - first));
+        }
+        deps[i].resources = ((i % 3 == 0) ? 1u : 0u) | ((i % 7 == 0) ? 2u : 0u);
+    }
+    return deps;
+}
+
+/* The parallel greedy scheduler gives exactly the serial schedule, for any
+ * number of workers. */
+static int QED_TestGreedyParallel(){
+    
+    static const unsigned num_threads[] = { 1, 2, 4 };
+    static const unsigned max_batch_sizes[] = { 0, 700, 5000 };
+    static const unsigned limits[] = { 900, 0 };
+    struct QED_Dependency *const deps = qed_test_layered_graph(12, 2000, 41);
+    struct QED_Dependency **const deps_ptr =
+        malloc(24000 * sizeof(struct QED_Dependency*));
+    unsigned *const order = malloc(24001 * 4 * sizeof(unsigned)),
+        *const offsets = order + 24001,
+        *const parallel_order = offsets + 24001,
+        *const parallel_offsets = parallel_order + 24001;
+    struct QED_ResourceLimits resources;
+    struct QED_BatchOptions options;
+    struct QED_Graph graph;
+    const unsigned *graph_order, *graph_offsets;
+    unsigned num_batches, num_parallel_batches, i, t, m, r;
+    
+    resources.limits = limits;
+    resources.num_classes = 2;
+    for(i = 0; i < 24000; i++)
+        deps_ptr[i] = deps + i;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 24000), 1);
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        for(m = 0; m < sizeof(max_batch_sizes) / sizeof(max_batch_sizes[0]); m++){
+            for(r = 0; r < 2; r++){
+                const struct QED_ResourceLimits *const limited =
+                    (r == 0) ? NULL : &resources;
+                QED_ASSERT_INT_EQ(QED_ScheduleGreedy(&graph, max_batch_sizes[m],
+                    limited, NULL, order, offsets, &num_batches), 1);
+                QED_ASSERT_INT_EQ(QED_ScheduleGreedyParallel(pool, &graph,
+                    max_batch_sizes[m], limited, NULL, parallel_order,
+                    parallel_offsets, &num_parallel_batches), 1);
+                QED_ASSERT_INT_EQ(num_parallel_batches, num_batches);
+                QED_EXPECT_INT_EQ(memcmp(parallel_offsets, offsets,
+                    (num_batches + 1) * sizeof(unsigned)), 0);
+                QED_EXPECT_INT_EQ(memcmp(parallel_order, order,
+                    24000 * sizeof(unsigned)), 0);
+            }
+        }
+        
+        /* The same through the batch options. */
+        QED_InitBatchOptions(&options);
+        options.max_batch_size = 700;
+        options.pool = pool;
+        QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &graph_order,
+            &graph_offsets, &num_parallel_batches), 1);
+        QED_ASSERT_INT_EQ(QED_ScheduleGreedy(&graph, 700, NULL, NULL, order,
+            offsets, &num_batches), 1);
+        QED_ASSERT_INT_EQ(num_parallel_batches, num_batches);
+        QED_EXPECT_INT_EQ(memcmp(graph_order, order, 24000 * sizeof(unsigned)), 0);
+        QED_DestroyThreadPool(pool);
+    }
+    
+    QED_FreeGraph(&graph);
+    free(order);
+    free(deps_ptr);
+    qed_test_free_random_graph(deps, 24000);
+    return 1;
+}
+
+/* A cycle stops the parallel scheduler at the same place as the serial one. */
+static int QED_TestGreedyParallelCycle(){
+    
+    struct QED_Dependency *const deps = qed_test_layered_graph(6, 2000, 43);
+    struct QED_Dependency **const deps_ptr =
+        malloc(12000 * sizeof(struct QED_Dependency*));
+    unsigned *const order = malloc(12001 * 4 * sizeof(unsigned)),
+        *const offsets = order + 12001,
+        *const parallel_order = offsets + 12001,
+        *const parallel_offsets = parallel_order + 12001;
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(4);
+    struct QED_Graph graph;
+    unsigned num_batches, num_parallel_batches, i;
+    
+    QED_ASSERT_INT_EQ(pool != NULL, 1);
+    
+    /* Two nodes of the third layer depend on each other. */
+    deps[4000].dependencies[0] = deps + 4001;
+    deps[4001].dependencies[0] = deps + 4000;
+    deps[4000].num_dependencies = deps[4001].num_dependencies = 1;
+    for(i = 0; i < 12000; i++)
+        deps_ptr[i] = deps + i;
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 12000), 1);
+    
+    QED_ASSERT_INT_EQ(QED_ScheduleGreedy(&graph, 0, NULL, NULL, order, offsets,
+        &num_batches), 0);
+    QED_ASSERT_INT_EQ(QED_ScheduleGreedyParallel(pool, &graph, 0, NULL, NULL,
+        parallel_order, parallel_offsets, &num_parallel_batches), 0);
+    QED_ASSERT_INT_EQ(num_parallel_batches, num_batches);
+    QED_ASSERT_INT_EQ(parallel_offsets[num_batches] < 12000, 1);
+    QED_EXPECT_INT_EQ(memcmp(parallel_offsets, offsets,
+        (num_batches + 1) * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(parallel_order, order,
+        offsets[num_batches] * sizeof(unsigned)), 0);
+    
+    QED_FreeGraph(&graph);
+    QED_DestroyThreadPool(pool);
+    free(order);
+    free(deps_ptr);
+    qed_test_free_random_graph(deps, 12000);
+    return 1;
+}
+
+/* A graph built from ids is laid out the same as one compiled from the same
+ * deps, and runs the same. */
+static int QED_TestGraphBuilder(){
+    
+    unsigned stamps[300];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(300, 47, stamps);
+    struct QED_Dependency *deps_ptr[300];
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(3);
+    struct QED_GraphBuilder builder;
+    struct QED_BatchOptions options;
+    struct QED_ExecuteOptions execute_options;
+    struct qed_test_stamp stamp;
+    struct QED_Graph graph, built;
+    const unsigned *order, *offsets, *built_order, *built_offsets;
+    unsigned num_batches, num_built_batches, i, e;
+    
+    QED_ASSERT_INT_EQ(pool != NULL, 1);
+    QED_InitGraphBuilder(&builder);
+    for(i = 0; i < 300; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].id = 500 + i;
+        deps[i].resources = i % 4;
+        QED_ASSERT_INT_EQ(QED_BuilderAddNode(&builder, deps[i].execute.func,
+            deps[i].execute.user_data), i);
+        builder.ids[i] = deps[i].id;
+        builder.resources[i] = deps[i].resources;
+    }
+    for(i = 0; i < 300; i++){
+        for(e = 0; e < deps[i].num_dependencies; e++){
+            QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, i,
+                deps[i].dependencies[e] - deps), 1);
+        }
+    }
+    QED_ASSERT_INT_EQ(QED_BuildGraph(&builder, &built), 1);
+    QED_FreeGraphBuilder(&builder);
+    QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 300), 1);
+    
+    QED_ASSERT_INT_EQ(built.num_nodes, 300);
+    QED_ASSERT_INT_EQ(built.num_edges, graph.num_edges);
+    QED_EXPECT_INT_EQ(memcmp(built.pred_offsets, graph.pred_offsets,
+        301 * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(built.preds, graph.preds,
+        graph.num_edges * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(built.succ_offsets, graph.succ_offsets,
+        301 * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(memcmp(built.succs, graph.succs,
+        graph.num_edges * sizeof(unsigned)), 0);
+    QED_EXPECT_INT_EQ(QED_GraphFingerprint(&built), QED_GraphFingerprint(&graph));
+    for(i = 0; i < 300; i++){
+        const struct QED_Dependency *const node = built.nodes[i];
+        QED_EXPECT_TRUE((node->execute.user_data == stamps + i));
+        QED_EXPECT_INT_EQ(node->id, 500 + i);
+        QED_EXPECT_INT_EQ(node->resources, i % 4);
+        QED_ASSERT_INT_EQ(node->num_dependencies, deps[i].num_dependencies);
+        for(e = 0; e < node->num_dependencies; e++){
+            QED_EXPECT_INT_EQ((node->dependencies[e] - built.built_deps),
+                (deps[i].dependencies[e] - deps));
+        }
+    }
+    
+    /* Both schedule the same, as lists of ids. */
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_eLookahead;
+    options.max_batch_size = 8;
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 1);
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&built, &options, &built_order,
+        &built_offsets, &num_built_batches), 1);
+    QED_ASSERT_INT_EQ(num_built_batches, num_batches);
+    QED_EXPECT_INT_EQ(memcmp(built_order, order, 300 * sizeof(unsigned)), 0);
+    
+    atomic_init(&stamp.counter, 0);
+    stamp.fail_every = 0;
+    QED_InitExecuteOptions(&execute_options);
+    execute_options.action_data = &stamp;
+    QED_ASSERT_INT_EQ(QED_ExecuteGraph(pool, &built, &execute_options), 1);
+    QED_ASSERT_INT_EQ(qed_test_check_stamps(deps, 300, stamps), 1);
+    
+    QED_FreeGraph(&graph);
+    QED_FreeGraph(&built);
+    QED_DestroyThreadPool(pool);
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+/* Edges to nodes that do not exist are refused, and a builder with no nodes
+ * builds an empty graph. */
+static int QED_TestGraphBuilderEdges(){
+    
+    struct QED_GraphBuilder builder;
+    struct QED_BatchOptions options;
+    struct QED_Graph graph;
+    const unsigned *order, *offsets;
+    unsigned num_batches;
+    
+    QED_InitGraphBuilder(&builder);
+    QED_InitBatchOptions(&options);
+    QED_ASSERT_INT_EQ(QED_BuildGraph(&builder, &graph), 1);
+    QED_ASSERT_INT_EQ(graph.num_nodes, 0);
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 1);
+    QED_ASSERT_INT_EQ(num_batches, 0);
+    QED_FreeGraph(&graph);
+    
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 0, 0), 0);
+    QED_ASSERT_INT_EQ(QED_BuilderAddNode(&builder, NULL, NULL), 0);
+    QED_ASSERT_INT_EQ(QED_BuilderAddNode(&builder, NULL, NULL), 1);
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 1, 2), 0);
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 2, 1), 0);
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 1, 0), 1);
+    QED_ASSERT_INT_EQ(builder.num_edges, 1);
+    
+    QED_ASSERT_INT_EQ(QED_BuildGraph(&builder, &graph), 1);
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 1);
+    QED_ASSERT_INT_EQ(num_batches, 2);
+    QED_ASSERT_INT_EQ(order[0], 0);
+    QED_ASSERT_INT_EQ(order[1], 1);
+    QED_FreeGraph(&graph);
+    
+    /* A node that depends on itself is a cycle. */
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 0, 0), 1);
+    QED_ASSERT_INT_EQ(QED_BuildGraph(&builder, &graph), 1);
+    QED_ASSERT_INT_EQ(QED_ScheduleGraph(&graph, &options, &order, &offsets,
+        &num_batches), 0);
+    QED_FreeGraph(&graph);
+    QED_FreeGraphBuilder(&builder);
+    return 1;
+}
+
+/* Checks that the batches of graph g of a multi schedule are the same as from
+ * scheduling the graph by itself. */
+static int qed_test_check_multi(const struct QED_MultiSchedule *schedule,
+    unsigned g,
+    const struct QED_GraphInput *input,
+    const struct QED_BatchOptions *options){
+    
+    struct QED_Batch **batches;
+    unsigned num_batches, b, i;
+    
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        input->deps, input->num_deps, options), 1);
+    QED_ASSERT_INT_EQ(schedule->scheduled[g], 1);
+    QED_ASSERT_INT_EQ(schedule->graph_offsets[g + 1] - schedule->graph_offsets[g],
+        num_batches);
+    for(b = 0; b < num_batches; b++){
+        const unsigned batch = schedule->graph_offsets[g] + b;
+        QED_ASSERT_INT_EQ(schedule->offsets[batch + 1] - schedule->offsets[batch],
+            batches[b]->num_dependencies);
+        for(i = 0; i < batches[b]->num_dependencies; i++){
+            QED_EXPECT_TRUE((schedule->nodes[schedule->offsets[batch] + i] ==
+                batches[b]->dependencies[i]));
+        }
+    }
+    QED_FreeBatches(batches);
+    return 1;
+}
+
+/* Many small graphs in one call get the same batches as each on its own,
+ * with and without a pool, and when the memory is reused. */
+static int QED_TestMultiSchedule(){
+    
+    static const unsigned num_threads[] = { 0, 1, 3 };
+    struct QED_Dependency *deps[200];
+    struct QED_Dependency **deps_ptr[200];
+    struct QED_GraphInput inputs[200];
+    struct QED_MultiSchedule schedule;
+    struct QED_BatchOptions options;
+    unsigned g, i, t, r;
+    
+    for(g = 0; g < 200; g++){
+        const unsigned num_nodes = 5 + ((g * 7) % 46);
+        deps[g] = qed_test_random_graph(num_nodes, 3, g + 1);
+        deps_ptr[g] = malloc(num_nodes * sizeof(void*));
+        for(i = 0; i < num_nodes; i++)
+            deps_ptr[g][i] = deps[g] + i;
+        
+        /* Some graphs only give their last node, so the rest is found by
+         * the closure. */
+        inputs[g].deps = (g % 3 == 0) ? (deps_ptr[g] + num_nodes - 1) : deps_ptr[g];
+        inputs[g].num_deps = (g % 3 == 0) ? 1 : num_nodes;
+    }
+    
+    QED_InitMultiSchedule(&schedule);
+    QED_InitBatchOptions(&options);
+    options.algorithm = QED_eLookahead;
+    options.max_batch_size = 4;
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = (num_threads[t] == 0) ? NULL :
+            QED_CreateThreadPool(num_threads[t]);
+        options.pool = pool;
+        for(r = 0; r < 2; r++){
+            const unsigned num_graphs = (r == 0) ? 200 : 50;
+            QED_ASSERT_INT_EQ(QED_CalculateMultiSchedule(&schedule, inputs,
+                num_graphs, &options), 1);
+            QED_ASSERT_INT_EQ(schedule.num_graphs, num_graphs);
+            QED_ASSERT_INT_EQ(schedule.graph_offsets[num_graphs],
+                schedule.num_batches);
+            QED_ASSERT_INT_EQ(schedule.offsets[schedule.num_batches],
+                schedule.num_nodes);
+            options.pool = NULL;
+            for(g = 0; g < num_graphs; g++){
+                QED_ASSERT_INT_EQ(qed_test_check_multi(&schedule, g, inputs + g,
+                    &options), 1);
+            }
+            options.pool = pool;
+        }
+        if(pool != NULL)
+            QED_DestroyThreadPool(pool);
+    }
+    QED_FreeMultiSchedule(&schedule);
+    
+    for(g = 0; g < 200; g++){
+        free(deps_ptr[g]);
+        qed_test_free_random_graph(deps[g], 5 + ((g * 7) % 46));
+    }
+    return 1;
+}
+
+/* A graph with a cycle gets no batches, and does not stop the others. */
+static int QED_TestMultiScheduleCycle(){
+    
+    struct QED_Dependency *const deps = qed_test_random_graph(30, 2, 9);
+    struct QED_Dependency cycle[2], *cycle_deps[2], *deps_ptr[30];
+    struct QED_GraphInput inputs[3];
+    struct QED_MultiSchedule schedule;
+    struct QED_BatchOptions options;
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    unsigned i, p;
+    
+    QED_ASSERT_INT_EQ(pool != NULL, 1);
+    memset(cycle, 0, sizeof(cycle));
+    cycle_deps[0] = cycle + 1;
+    cycle_deps[1] = cycle + 0;
+    cycle[0].dependencies = cycle_deps;
+    cycle[0].num_dependencies = 1;
+    cycle[1].dependencies = cycle_deps + 1;
+    cycle[1].num_dependencies = 1;
+    for(i = 0; i < 30; i++)
+        deps_ptr[i] = deps + i;
+    
+    inputs[0].deps = deps_ptr;
+    inputs[0].num_deps = 10;
+    inputs[1].deps = cycle_deps;
+    inputs[1].num_deps = 1;
+    inputs[2].deps = deps_ptr + 10;
+    inputs[2].num_deps = 20;
+    
+    QED_InitMultiSchedule(&schedule);
+    QED_InitBatchOptions(&options);
+    for(p = 0; p < 2; p++){
+        options.pool = (p == 0) ? NULL : pool;
+        QED_ASSERT_INT_EQ(QED_CalculateMultiSchedule(&schedule, inputs, 3,
+            &options), 0);
+        QED_ASSERT_INT_EQ(schedule.num_graphs, 3);
+        QED_ASSERT_INT_EQ(schedule.scheduled[1], 0);
+        QED_ASSERT_INT_EQ(schedule.graph_offsets[1], schedule.graph_offsets[2]);
+        options.pool = NULL;
+        QED_ASSERT_INT_EQ(qed_test_check_multi(&schedule, 0, inputs, &options), 1);
+        QED_ASSERT_INT_EQ(qed_test_check_multi(&schedule, 2, inputs + 2,
+            &options), 1);
+    }
+    
+    QED_FreeMultiSchedule(&schedule);
+    QED_DestroyThreadPool(pool);
+    qed_test_free_random_graph(deps, 30);
+    return 1;
+}
+
+/* Submits a range of deps from another thread, then closes the scheduler. */
+struct qed_test_producer{
+    struct QED_OnlineScheduler *online;
+    struct QED_Dependency *deps;
+    unsigned first, end;
+    bool ok;
+};
+
+static void *qed_test_producer_thread(void *arg){
+    struct qed_test_producer *const producer = arg;
+    unsigned i;
+    producer->ok = true;
+    for(i = producer->first; i < producer->end; i++){
+        if(!QED_SubmitDependency(producer->online, producer->deps + i))
+            producer->ok = false;
+        if(i % 64 == 0)
+            sched_yield();
+    }
+    QED_CloseOnlineScheduler(producer->online);
+    return NULL;
+}
+
+static int QED_TestOnline(){
+    
+    static const unsigned num_threads[] = { 1, 2, 4 };
+    unsigned stamps[600], t, i;
+    struct QED_Dependency *const deps = qed_test_stamped_graph(600, 11, stamps);
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        struct QED_OnlineScheduler *const online = QED_CreateOnlineScheduler();
+        struct qed_test_producer producer;
+        struct qed_test_stamp stamp;
+        struct QED_ExecuteOptions options;
+        pthread_t thread;
+        
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        QED_ASSERT_INT_EQ(online != NULL, 1);
+        atomic_init(&stamp.counter, 0);
+        stamp.fail_every = 0;
+        QED_InitExecuteOptions(&options);
+        options.action_data = &stamp;
+        for(i = 0; i < 600; i++)
+            stamps[i] = 0;
+        
+        /* Some deps are there before the scheduler runs, and the rest arrive
+         * while it is running. */
+        for(i = 0; i < 200; i++)
+            QED_EXPECT_TRUE(QED_SubmitDependency(online, deps + i));
+        QED_EXPECT_FALSE(QED_SubmitDependency(online, deps + 5));
+        
+        producer.online = online;
+        producer.deps = deps;
+        producer.first = 200;
+        producer.end = 600;
+        QED_ASSERT_INT_EQ(pthread_create(&thread, NULL,
+            qed_test_producer_thread, &producer), 0);
+        QED_EXPECT_TRUE(QED_RunOnlineScheduler(online, pool, &options));
+        pthread_join(thread, NULL);
+        
+        QED_EXPECT_TRUE(producer.ok);
+        QED_EXPECT_INT_EQ(atomic_load(&stamp.counter), 600);
+        if(!qed_test_check_stamps(deps, 600, stamps))
+            return 0;
+        for(i = 0; i < 600; i++)
+            QED_ASSERT_INT_EQ(QED_OnlineStatus(online, deps + i), QED_eOk);
+        QED_EXPECT_FALSE(QED_SubmitDependency(online, deps + 600 - 1));
+        
+        QED_DestroyOnlineScheduler(online);
+        QED_DestroyThreadPool(pool);
+    }
+    
+    qed_test_free_random_graph(deps, 600);
+    return 1;
+}
+
+/* A tree where each dep submits its children while it is running. The
+ * children depend on their parent and on the root. */
+#define QED_TEST_TREE_SIZE 255
+#define QED_TEST_TREE_FAIL 200
+#define QED_TEST_TREE_LATE QED_TEST_TREE_SIZE
+
+struct qed_test_tree{
+    struct QED_OnlineScheduler *online;
+    struct QED_Dependency deps[QED_TEST_TREE_SIZE + 1];
+    struct QED_Dependency *edges[QED_TEST_TREE_SIZE + 1][2];
+    unsigned stamps[QED_TEST_TREE_SIZE + 1];
+    atomic_uint counter, submitted;
+    atomic_bool ok;
+};
+
+static void qed_test_tree_submit(struct qed_test_tree *tree, unsigned i){
+    if(!QED_SubmitDependency(tree->online, tree->deps + i))
+        atomic_store(&tree->ok, false);
+    if(atomic_fetch_add(&tree->submitted, 1) + 1 == QED_TEST_TREE_SIZE + 1)
+        QED_CloseOnlineScheduler(tree->online);
+}
+
+static int qed_test_tree_callback(void *action_data, void *user_data){
+    struct qed_test_tree *const tree = action_data;
+    const unsigned i = (unsigned*)user_data - tree->stamps;
+    tree->stamps[i] = atomic_fetch_add(&tree->counter, 1) + 1;
+    if((i * 2) + 2 < QED_TEST_TREE_SIZE){
+        qed_test_tree_submit(tree, (i * 2) + 1);
+        qed_test_tree_submit(tree, (i * 2) + 2);
+    }
+    /* The late dep depends on the one that fails, which may be waiting,
+     * running or done by the time it is submitted. */
+    if(i == (QED_TEST_TREE_FAIL - 1) / 2)
+        qed_test_tree_submit(tree, QED_TEST_TREE_LATE);
+    return (i == QED_TEST_TREE_FAIL) ? 1 : 0;
+}
+
+static int QED_TestOnlineDynamic(){
+    
+    static const unsigned num_threads[] = { 1, 3 };
+    struct qed_test_tree *const tree = calloc(1, sizeof(struct qed_test_tree));
+    unsigned t, i;
+    
+    QED_ASSERT_INT_EQ(tree != NULL, 1);
+    for(i = 0; i <= QED_TEST_TREE_SIZE; i++){
+        struct QED_Dependency *const dep = tree->deps + i;
+        dep->execute.func = qed_test_tree_callback;
+        dep->execute.user_data = tree->stamps + i;
+        dep->dependencies = tree->edges[i];
+        dep->num_dependencies = (i == 0) ? 0 : 2;
+        tree->edges[i][0] = tree->deps + ((i - 1) / 2);
+        tree->edges[i][1] = tree->deps;
+    }
+    tree->edges[QED_TEST_TREE_LATE][0] = tree->deps + ((QED_TEST_TREE_FAIL - 1) / 2);
+    tree->edges[QED_TEST_TREE_LATE][1] = tree->deps + QED_TEST_TREE_FAIL;
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        struct QED_ExecuteOptions options;
+        
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        QED_ASSERT_INT_EQ((tree->online = QED_CreateOnlineScheduler()) != NULL, 1);
+        atomic_init(&tree->counter, 0);
+        atomic_init(&tree->submitted, 1);
+        atomic_init(&tree->ok, true);
+        for(i = 0; i <= QED_TEST_TREE_SIZE; i++)
+            tree->stamps[i] = 0;
+        QED_InitExecuteOptions(&options);
+        options.action_data = tree;
+        options.error_mode = QED_eSkipDependents;
+        
+        QED_EXPECT_TRUE(QED_SubmitDependency(tree->online, tree->deps));
+        QED_EXPECT_FALSE(QED_RunOnlineScheduler(tree->online, pool, &options));
+        QED_EXPECT_TRUE(atomic_load(&tree->ok));
+        
+        /* Every dep in the tree ran after its parent, and only the late dep
+         * was skipped. */
+        QED_EXPECT_INT_EQ(atomic_load(&tree->counter), QED_TEST_TREE_SIZE);
+        for(i = 1; i < QED_TEST_TREE_SIZE; i++)
+            QED_ASSERT_INT_EQ(tree->stamps[(i - 1) / 2] < tree->stamps[i], 1);
+        for(i = 0; i < QED_TEST_TREE_SIZE; i++){
+            QED_ASSERT_INT_EQ(QED_OnlineStatus(tree->online, tree->deps + i),
+                (i == QED_TEST_TREE_FAIL) ? QED_eFailed : QED_eOk);
+        }
+        QED_EXPECT_INT_EQ(QED_OnlineResult(tree->online,
+            tree->deps + QED_TEST_TREE_FAIL), 1);
+        QED_EXPECT_INT_EQ(tree->stamps[QED_TEST_TREE_LATE], 0);
+        QED_EXPECT_INT_EQ(QED_OnlineStatus(tree->online,
+            tree->deps + QED_TEST_TREE_LATE), QED_eSkipped);
+        
+        QED_DestroyOnlineScheduler(tree->online);
+        QED_DestroyThreadPool(pool);
+    }
+    
+    free(tree);
+    return 1;
+}
+
+/* Checks that batches with the locality option hold the same deps as batches
+ * without it, and that each batch is sorted by the position of the latest
+ * dependency of each dep, then by user data. */
+static int qed_test_check_locality(struct QED_Batch **plain,
+    struct QED_Batch **batches,
+    unsigned num_batches){
+    
+    struct QED_HashTable *const table = calloc(1, QED_HASH_TABLE_SIZE);
+    unsigned b, i, e, position = 0;
+    
+    QED_ASSERT_INT_EQ(table != NULL, 1);
+    for(b = 0; b < num_batches; b++){
+        for(i = 0; i < plain[b]->num_dependencies; i++){
+            qed_hashdata_t unused;
+            QED_HashTableInsert(table, (qed_hashkey_t)plain[b]->dependencies[i],
+                b, &unused);
+        }
+    }
+    for(b = 0; b < num_batches; b++){
+        QED_ASSERT_INT_EQ(batches[b]->num_dependencies,
+            plain[b]->num_dependencies);
+        for(i = 0; i < batches[b]->num_dependencies; i++){
+            qed_hashdata_t batch = ~(qed_hashdata_t)0;
+            QED_HashTableGet(table, (qed_hashkey_t)batches[b]->dependencies[i],
+                &batch);
+            QED_ASSERT_INT_EQ(batch, b);
+        }
+    }
+    
+    /* Now map each dep to one more than its position. */
+    for(b = 0; b < num_batches; b++){
+        unsigned long previous_input = 0;
+        uintptr_t previous_user_data = 0;
+        for(i = 0; i < batches[b]->num_dependencies; i++){
+            const struct QED_Dependency *const dep = batches[b]->dependencies[i];
+            qed_hashdata_t input = 0;
+            for(e = 0; e < dep->num_dependencies; e++){
+                qed_hashdata_t p = 0;
+                QED_HashTableGet(table, (qed_hashkey_t)dep->dependencies[e], &p);
+                if(p > input)
+                    input = p;
+            }
+            QED_ASSERT_INT_EQ(input >= previous_input, 1);
+            if(input == previous_input && i != 0)
+                QED_ASSERT_INT_EQ(
+                    (uintptr_t)dep->execute.user_data >= previous_user_data, 1);
+            previous_input = input;
+            previous_user_data = (uintptr_t)dep->execute.user_data;
+        }
+        for(i = 0; i < batches[b]->num_dependencies; i++){
+            QED_HashTableSet(table, (qed_hashkey_t)batches[b]->dependencies[i],
+                ++position);
+        }
+    }
+    
+    QED_FreeHashTable(table, NULL);
+    free(table);
+    return 1;
+}
+
+static int QED_TestLocalityOrder(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy,
+        QED_eLookahead
+    };
+    struct QED_Dependency *const deps = qed_test_random_graph(500, 3, 17);
+    struct QED_Dependency *deps_ptr[500];
+    struct QED_ScheduleCache cache;
+    unsigned a, run, i;
+    
+    /* Deps with no dependencies are grouped by their user data. */
+    for(i = 0; i < 500; i++){
+        deps_ptr[i] = deps + i;
+        deps[i].execute.user_data = deps + ((i * 7) % 5);
+    }
+    QED_InitScheduleCache(&cache, 4);
+    
+    for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+        struct QED_BatchOptions options;
+        struct QED_Batch **plain;
+        unsigned num_plain;
+        
+        QED_InitBatchOptions(&options);
+        options.algorithm = algorithms[a];
+        options.max_batch_size = 16;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&plain, &num_plain,
+            deps_ptr, 500, &options), 1);
+        
+        /* The second run finds the schedule in the cache, and still has to
+         * be reordered. */
+        options.locality = true;
+        options.cache = &cache;
+        for(run = 0; run < 2; run++){
+            struct QED_Batch **batches;
+            unsigned num_batches;
+            QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches,
+                &num_batches, deps_ptr, 500, &options), 1);
+            QED_ASSERT_INT_EQ(num_batches, num_plain);
+            if(!qed_test_check_batches(batches, num_batches, 500, 16) ||
+                !qed_test_check_locality(plain, batches, num_batches))
+                return 0;
+            QED_FreeBatches(batches);
+        }
+        QED_FreeBatches(plain);
+    }
+    QED_EXPECT_INT_EQ(cache.hits, 2);
+    
+    QED_FreeScheduleCache(&cache);
+    qed_test_free_random_graph(deps, 500);
+    return 1;
+}
+
+static int QED_TestExecuteAffinity(){
+    
+    static const unsigned num_threads[] = { 1, 3 };
+    unsigned stamps[300], t, i;
+    int results[300];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(300, 13, stamps);
+    struct QED_Dependency *deps_ptr[300];
+    struct QED_BatchOptions batch_options;
+    struct QED_Batch **batches;
+    unsigned num_batches;
+    
+    for(i = 0; i < 300; i++)
+        deps_ptr[i] = deps + i;
+    QED_InitBatchOptions(&batch_options);
+    batch_options.max_batch_size = 32;
+    batch_options.locality = true;
+    QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&batches, &num_batches,
+        deps_ptr, 300, &batch_options), 1);
+    
+    for(t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]); t++){
+        struct QED_ThreadPool *const pool = QED_CreateThreadPool(num_threads[t]);
+        struct qed_test_stamp stamp;
+        struct QED_ExecuteOptions options;
+        unsigned b, base = 0, num_failed = 0;
+        
+        QED_ASSERT_INT_EQ(pool != NULL, 1);
+        atomic_init(&stamp.counter, 0);
+        stamp.fail_every = 0;
+        QED_InitExecuteOptions(&options);
+        options.action_data = &stamp;
+        options.results = results;
+        options.affinity = true;
+        for(i = 0; i < 300; i++)
+            stamps[i] = 0;
+        
+        QED_EXPECT_TRUE(QED_ExecuteBatches(pool, batches, num_batches, &options));
+        QED_EXPECT_INT_EQ(atomic_load(&stamp.counter), 300);
+        if(!qed_test_check_stamps(deps, 300, stamps))
+            return 0;
+        
+        /* Every share of every batch is run exactly once, with the results
+         * still in batch order. */
+        atomic_init(&stamp.counter, 0);
+        stamp.fail_every = 5;
+        QED_EXPECT_FALSE(QED_ExecuteBatches(pool, batches, num_batches, &options));
+        for(b = 0; b < num_batches; b++){
+            for(i = 0; i < batches[b]->num_dependencies; i++){
+                const unsigned d = batches[b]->dependencies[i] - deps;
+                QED_ASSERT_INT_EQ(results[base + i], (stamps[d] % 5 == 0));
+                num_failed += (results[base + i] != 0);
+            }
+            base += batches[b]->num_dependencies;
+        }
+        QED_EXPECT_INT_EQ(num_failed, 300 / 5);
+        
+        QED_DestroyThreadPool(pool);
+    }
+    
+    QED_FreeBatches(batches);
+    qed_test_free_random_graph(deps, 300);
+    return 1;
+}
+
+/* Sets row i of ancestors to the deps that dep i depends on, directly or not.
+ * Every dep only depends on deps with lower indices. */
+static void qed_test_ancestors(unsigned char *ancestors,
+    unsigned num_nodes,
+    unsigned i,
+    unsigned pred){
+    
+    unsigned j;
+    ancestors[(i * num_nodes) + pred] = 1;
+    for(j = 0; j < num_nodes; j++)
+        ancestors[(i * num_nodes) + j] |= ancestors[(pred * num_nodes) + j];
+}
+
+static int QED_TestReduceGraph(){
+    
+    static const enum QED_BatchAlgorithm algorithms[] = {
+        QED_eGreedy,
+        QED_eGreedy,
+        QED_eLookahead,
+        QED_ePacked
+    };
+    struct QED_Dependency *const deps = qed_test_random_graph(400, 6, 29);
+    struct QED_Dependency *deps_ptr[400];
+    unsigned indices[400];
+    unsigned char *const before = calloc(400 * 400, 1),
+        *const after = calloc(400 * 400, 1);
+    struct QED_Stats stats;
+    struct QED_Graph graph;
+    unsigned a, run, i, e, f, num_edges, num_removed;
+    
+    QED_ASSERT_INT_EQ(before != NULL && after != NULL, 1);
+    for(i = 0; i < 400; i++){
+        for(e = 0; e < deps[i].num_dependencies; e++)
+            qed_test_ancestors(before, 400, i, deps[i].dependencies[e] - deps);
+    }
+    
+    /* The inputs are shuffled, then nearly reversed, then reversed, so that
+     * the indices are not always in order. */
+    for(run = 0; run < 3; run++){
+        for(i = 0; i < 400; i++){
+            deps_ptr[i] = deps + ((run == 0) ? ((i * 7) % 400) :
+                (399 - ((run == 1) ? (i ^ 1) : i)));
+        }
+        
+        QED_InitStats(&stats);
+        QED_ASSERT_INT_EQ(QED_CompileGraph(&graph, deps_ptr, 400), 1);
+        num_edges = graph.num_edges;
+        QED_ASSERT_INT_EQ(QED_ReduceGraph(&graph, &stats, &num_removed), 1);
+        QED_ASSERT_INT_EQ(num_removed != 0, 1);
+        QED_ASSERT_INT_EQ(graph.num_edges, num_edges - num_removed);
+        QED_ASSERT_INT_EQ(graph.pred_offsets[400], graph.num_edges);
+        QED_ASSERT_INT_EQ(graph.succ_offsets[400], graph.num_edges);
+        if(QED_StatsEnabled())
+            QED_EXPECT_INT_EQ(stats.edges_removed, num_removed);
+        
+        /* The reduced graph reaches the same deps, and none of its edges
+         * can be reached through another. */
+        for(i = 0; i < 400; i++)
+            indices[graph.nodes[i] - deps] = i;
+        memset(after, 0, 400 * 400);
+        for(i = 0; i < 400; i++){
+            const unsigned node = indices[i];
+            const unsigned start = graph.pred_offsets[node],
+                end = graph.pred_offsets[node + 1];
+            for(e = start; e < end; e++){
+                const unsigned pred = graph.nodes[graph.preds[e]] - deps;
+                qed_test_ancestors(after, 400, i, pred);
+                for(f = start; f < end; f++){
+                    const unsigned other = graph.nodes[graph.preds[f]] - deps;
+                    if(e != f){
+                        QED_ASSERT_INT_EQ(other != pred, 1);
+                        QED_ASSERT_INT_EQ(before[(other * 400) + pred], 0);
+                    }
+                }
+            }
+        }
+        QED_EXPECT_INT_EQ(memcmp(before, after, 400 * 400), 0);
+        
+        /* The successors are the same edges, still sorted. */
+        for(i = 0; i < 400; i++){
+            for(e = graph.succ_offsets[i]; e < graph.succ_offsets[i + 1]; e++){
+                const unsigned succ = graph.succs[e];
+                bool found = false;
+                if(e != graph.succ_offsets[i])
+                    QED_ASSERT_INT_EQ(graph.succs[e - 1] < succ, 1);
+                for(f = graph.pred_offsets[succ];
+                    f < graph.pred_offsets[succ + 1]; f++)
+                    found |= graph.preds[f] == i;
+                QED_ASSERT_INT_EQ(found, 1);
+            }
+        }
+        QED_FreeGraph(&graph);
+    }
+    
+    /* The greedy batches are the same with fewer edges, and the other
+     * schedulers still give valid batches. */
+    for(a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++){
+        struct QED_BatchOptions options;
+        struct QED_Batch **plain, **reduced;
+        unsigned num_plain, num_reduced;
+        
+        QED_InitBatchOptions(&options);
+        options.algorithm = algorithms[a];
+        options.max_batch_size = 16;
+        options.num_workers = 4;
+        options.locality = (a == 1);
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&plain, &num_plain,
+            deps_ptr, 400, &options), 1);
+        options.reduce = true;
+        QED_ASSERT_INT_EQ(QED_CalculateBatchesWithOptions(&reduced,
+            &num_reduced, deps_ptr, 400, &options), 1);
+        if(!qed_test_check_batches(reduced, num_reduced, 400, 16))
+            return 0;
+        if(algorithms[a] == QED_eGreedy && !qed_test_same_batches(plain,
+            num_plain, deps, reduced, num_reduced, deps))
+            return 0;
+        QED_FreeBatches(plain);
+        QED_FreeBatches(reduced);
+    }
+    
+    free(before);
+    free(after);
+    qed_test_free_random_graph(deps, 400);
+    return 1;
+}
+
+/* A chain with an edge from every node to every later node, and a duplicate,
+ * reduces to just the chain. A graph with a cycle is not changed. */
+static int QED_TestReduceChain(){
+    
+    unsigned stamps[6];
+    struct QED_Dependency *const deps = qed_test_stamped_graph(6, 0, stamps);
+    struct QED_ThreadPool *const pool = QED_CreateThreadPool(2);
+    struct QED_GraphBuilder builder;
+    struct QED_ExecuteOptions options;
+    struct qed_test_stamp stamp;
+    struct QED_Graph graph;
+    unsigned i, j, num_removed;
+    
+    QED_ASSERT_INT_EQ(pool != NULL, 1);
+    QED_InitGraphBuilder(&builder);
+    for(i = 0; i < 6; i++){
+        QED_ASSERT_INT_EQ(QED_BuilderAddNode(&builder, deps[i].execute.func,
+            deps[i].execute.user_data), i);
+    }
+    for(i = 0; i < 6; i++){
+        for(j = 0; j < i; j++){
+            QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, i, j), 1);
+        }
+    }
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 5, 4), 1);
+    QED_ASSERT_INT_EQ(QED_BuildGraph(&builder, &graph), 1);
+    QED_ASSERT_INT_EQ(graph.num_edges, 16);
+    
+    QED_ASSERT_INT_EQ(QED_ReduceGraph(&graph, NULL, &num_removed), 1);
+    QED_ASSERT_INT_EQ(num_removed, 11);
+    QED_ASSERT_INT_EQ(graph.num_edges, 5);
+    QED_ASSERT_INT_EQ(graph.pred_offsets[0], 0);
+    for(i = 1; i < 6; i++){
+        QED_ASSERT_INT_EQ(graph.pred_offsets[i], i - 1);
+        QED_ASSERT_INT_EQ(graph.preds[i - 1], i - 1);
+        QED_ASSERT_INT_EQ(graph.succ_offsets[i], i);
+        QED_ASSERT_INT_EQ(graph.succs[i - 1], i);
+    }
+    /* The deps of the nodes are left alone. */
+    QED_ASSERT_INT_EQ(graph.nodes[5]->num_dependencies, 6);
+    
+    /* Reducing again finds nothing, and the chain still runs in order. */
+    QED_ASSERT_INT_EQ(QED_ReduceGraph(&graph, NULL, &num_removed), 1);
+    QED_ASSERT_INT_EQ(num_removed, 0);
+    atomic_init(&stamp.counter, 0);
+    stamp.fail_every = 0;
+    QED_InitExecuteOptions(&options);
+    options.action_data = &stamp;
+    QED_ASSERT_INT_EQ(QED_ExecuteGraph(pool, &graph, &options), 1);
+    for(i = 1; i < 6; i++)
+        QED_ASSERT_INT_EQ(stamps[i - 1] < stamps[i], 1);
+    QED_FreeGraph(&graph);
+    
+    QED_ASSERT_INT_EQ(QED_BuilderAddEdge(&builder, 0, 5), 1);
+    QED_ASSERT_INT_EQ(QED_BuildGraph(&builder, &graph), 1);
+    QED_ASSERT_INT_EQ(QED_ReduceGraph(&graph, NULL, &num_removed), 1);
+    QED_ASSERT_INT_EQ(num_removed, 0);
+    QED_ASSERT_INT_EQ(graph.num_edges, 17);
+    QED_FreeGraph(&graph);
+    
+    QED_FreeGraphBuilder(&builder);
+    QED_DestroyThreadPool(pool);
+    qed_test_free_random_graph(deps, 6);
+    return 1;
+}
+
 const struct QED_Test QED_Tests[QED_NUM_TESTS] = {
     QED_TEST(QED_TestZeroDependencies),
     QED_TEST(QED_TestOneDependencies),
     QED_TEST(QED_TestTwoSeparateDependencies),
     QED_TEST(QED_TestTwoLinkedDependencies),
     QED_TEST(QED_TestThreeTreeDependencies),
-    QED_TEST(QED_TestThreeInvertedTreeDependencies)
+    QED_TEST(QED_TestThreeInvertedTreeDependencies),
+    QED_TEST(QED_TestChainClosure),
+    QED_TEST(QED_TestGreedyMatchesIterate),
+    QED_TEST(QED_TestLookaheadCriticalPath),
+    QED_TEST(QED_TestLookaheadRandom),
+    QED_TEST(QED_TestBalancedBudget),
+    QED_TEST(QED_TestBalancedRandom),
+    QED_TEST(QED_TestBalancedBudgetReuse),
+    QED_TEST(QED_TestBalancedCycle),
+    QED_TEST(QED_TestScheduleCompiledGraph),
+    QED_TEST(QED_TestThreadPoolBarrier),
+    QED_TEST(QED_TestExecuteBatches),
+    QED_TEST(QED_TestDeque),
+    QED_TEST(QED_TestExecuteGraph),
+    QED_TEST(QED_TestExecuteGraphCycle),
+    QED_TEST(QED_TestHashTableGrowth),
+    QED_TEST(QED_TestHashTableRemove),
+    QED_TEST(QED_TestSingleAllocationBatches),
+    QED_TEST(QED_TestScheduleBuffer),
+    QED_TEST(QED_TestBatchIterator),
+    QED_TEST(QED_TestBatchIteratorCycle),
+    QED_TEST(QED_TestStats),
+    QED_TEST(QED_TestPackedWorkers),
+    QED_TEST(QED_TestPackedCriticalPath),
+    QED_TEST(QED_TestProfile),
+    QED_TEST(QED_TestProfileExecute),
+    QED_TEST(QED_TestProfileSkipped),
+    QED_TEST(QED_TestResourceBatches),
+    QED_TEST(QED_TestResourceExecute),
+    QED_TEST(QED_TestIncremental),
+    QED_TEST(QED_TestIncrementalLocal),
+    QED_TEST(QED_TestPartial),
+    QED_TEST(QED_TestPartialLocal),
+    QED_TEST(QED_TestExecuteErrorModes),
+    QED_TEST(QED_TestExecuteSkipCycle),
+    QED_TEST(QED_TestScheduleCache),
+    QED_TEST(QED_TestScheduleCacheEviction),
+    QED_TEST(QED_TestMappedSchedule),
+    QED_TEST(QED_TestMappedScheduleInvalid),
+    QED_TEST(QED_TestGreedyParallel),
+    QED_TEST(QED_TestGreedyParallelCycle),
+    QED_TEST(QED_TestGraphBuilder),
+    QED_TEST(QED_TestGraphBuilderEdges),
+    QED_TEST(QED_TestMultiSchedule),
+    QED_TEST(QED_TestMultiScheduleCycle),
+    QED_TEST(QED_TestOnline),
+    QED_TEST(QED_TestOnlineDynamic),
+    QED_TEST(QED_TestLocalityOrder),
+    QED_TEST(QED_TestExecuteAffinity),
+    QED_TEST(QED_TestReduceGraph),
+    QED_TEST(QED_TestReduceChain)
 };
 
 static char *strdup_to_lower(const char *str, char *buffer){
@@ -8,55 +8,137 @@
 
 #include "qed_tinyhash.h"
 
+#include "qed_stats.h"
+
+#include <assert.h>
 #include <stdlib.h>
 
-struct QED_HashEntry{
-    qed_hashkey_t key;
-    qed_hashdata_t data;
-    struct QED_HashEntry *next;
+/* The table is open-addressed with linear probing. Keys and data live in two
+ * flat arrays of the same capacity, allocated as a single block. A key of zero
+ * marks an empty slot, so the zero key itself is stored out-of-line.
+ *
+ * Removal uses backward-shift deletion, so there are never any tombstones and
+ * probe lengths only depend on the current load.
+ */
+struct QED_HashTable{
+    qed_hashkey_t *keys;
+    qed_hashdata_t *data;
+    uintptr_t capacity; /* Zero or a power of two. */
+    uintptr_t count; /* Does not include the zero key. */
+    uintptr_t has_zero;
+    qed_hashdata_t zero_data;
 };
 
-typedef struct QED_HashEntry *QED_HashEntryPtrStruct;
+/* Ensure that QED_HASH_TABLE_SIZE is kept up to date. */
+typedef char qed_hash_table_size_check[
+    (sizeof(struct QED_HashTable) == QED_HASH_TABLE_SIZE) ? 1 : -1];
 
 #ifdef __GNUC__
 __attribute__((const))
 #endif
 uintptr_t QED_Hash(qed_hashkey_t);
 
+/* Pointers are mostly zero in their low bits and share their high bits, so the
+ * whole key is mixed before it is masked down to the table size. These are the
+ * MurmurHash3 finalizers.
+ */
 uintptr_t QED_Hash(qed_hashkey_t p){
-    return (p >> 4) & (QED_HASH_TABLE_ENTRIES-1);
+#if UINTPTR_MAX > 0xFFFFFFFFu
+    p ^= p >> 33;
+    p *= (uintptr_t)0xFF51AFD7ED558CCDull;
+    p ^= p >> 33;
+    p *= (uintptr_t)0xC4CEB9FE1A85EC53ull;
+    p ^= p >> 33;
+#else
+    p ^= p >> 16;
+    p *= (uintptr_t)0x85EBCA6Bu;
+    p ^= p >> 13;
+    p *= (uintptr_t)0xC2B2AE35u;
+    p ^= p >> 16;
+#endif
+    return p;
 }
 
-struct QED_HashTable{
-    QED_HashEntryPtrStruct table[QED_HASH_TABLE_ENTRIES];
-};
+/* Grow when more than three quarters of the slots are used. */
+#define QED_HASH_TABLE_FULL(COUNT, CAPACITY) (((COUNT) << 2) > ((CAPACITY) * 3))
 
-static struct QED_HashEntry *qed_hash_table_get(struct QED_HashTable *table,
-    qed_hashkey_t key){
+static bool qed_hash_table_resize(struct QED_HashTable *table,
+    uintptr_t capacity){
+    
+    qed_hashkey_t *const old_keys = table->keys;
+    qed_hashdata_t *const old_data = table->data;
+    const uintptr_t old_capacity = table->capacity;
+    uintptr_t i;
+    
+    assert(capacity != 0 && (capacity & (capacity - 1)) == 0);
+    assert(!QED_HASH_TABLE_FULL(table->count, capacity));
+    
+    QED_STATS_ADD(hash_resizes, 1);
+    QED_STATS_ALLOC(capacity * (sizeof(qed_hashkey_t) + sizeof(qed_hashdata_t)));
     
-    struct QED_HashEntry *entry;
     {
-        const uintptr_t hash = QED_Hash(key);
-        entry = table->table[hash];
+        void *const block = calloc(capacity,
+            sizeof(qed_hashkey_t) + sizeof(qed_hashdata_t));
+        if(block == NULL)
+            return false;
+        table->keys = block;
+        table->data = (qed_hashdata_t*)(table->keys + capacity);
+        table->capacity = capacity;
     }
     
-    while(entry != NULL){
-        if(entry->key == key)
-            return entry;
-        entry = entry->next;
+    for(i = 0; i < old_capacity; i++){
+        const qed_hashkey_t key = old_keys[i];
+        if(key != 0){
+            const uintptr_t mask = capacity - 1;
+            uintptr_t slot = QED_Hash(key) & mask;
+            while(table->keys[slot] != 0)
+                slot = (slot + 1) & mask;
+            table->keys[slot] = key;
+            table->data[slot] = old_data[i];
+        }
     }
-    return NULL;
+    
+    free(old_keys);
+    return true;
+}
+
+/* Returns the slot holding the key, or the empty slot where it would go. */
+static uintptr_t qed_hash_table_find(const struct QED_HashTable *table,
+    qed_hashkey_t key){
+    
+    const uintptr_t mask = table->capacity - 1,
+        home = QED_Hash(key) & mask;
+    uintptr_t slot = home;
+    
+    assert(key != 0);
+    assert(table->capacity != 0);
+    
+    while(table->keys[slot] != key && table->keys[slot] != 0)
+        slot = (slot + 1) & mask;
+    
+    QED_STATS_LOOKUP(((slot - home) & mask) + 1);
+    return slot;
 }
 
 bool QED_HashTableGet(struct QED_HashTable *table, qed_hashkey_t key, qed_hashdata_t *out){
     
-    struct QED_HashEntry *const entry = qed_hash_table_get(table, key);
-    if(entry){
-        out[0] = entry->data;
-        return true;
+    if(key == 0){
+        if(table->has_zero){
+            out[0] = table->zero_data;
+            return true;
+        }
+        return false;
     }
-    else{
+    
+    if(table->capacity == 0)
         return false;
+    
+    {
+        const uintptr_t slot = qed_hash_table_find(table, key);
+        if(table->keys[slot] == 0)
+            return false;
+        out[0] = table->data[slot];
+        return true;
     }
 }
 
@@ -65,37 +147,63 @@ bool QED_HashTableInsert(struct QED_HashTable *table,
     qed_hashdata_t data,
     qed_hashdata_t *out){
     
-    struct QED_HashEntry *const entry = qed_hash_table_get(table, key);
-    if(entry){
-        out[0] = entry->data;
-        entry->data = data;
-        return true;
+    uintptr_t slot;
+    
+    if(key == 0){
+        const bool existed = table->has_zero != 0;
+        if(existed)
+            out[0] = table->zero_data;
+        table->has_zero = 1;
+        table->zero_data = data;
+        return existed;
     }
-    else{
-        const uintptr_t hash = QED_Hash(key);
-        struct QED_HashEntry **dest = table->table + hash,
-            *const first_entry = *dest,
-            *const new_entry = malloc(sizeof(struct QED_HashEntry));
-        
-        new_entry->key = key;
-        new_entry->data = data;
-        new_entry->next = first_entry;
+    
+    if(table->capacity != 0){
+        slot = qed_hash_table_find(table, key);
+        if(table->keys[slot] == key){
+            out[0] = table->data[slot];
+            table->data[slot] = data;
+            return true;
+        }
+    }
+    
+    if(table->capacity == 0 ||
+        QED_HASH_TABLE_FULL(table->count + 1, table->capacity)){
         
-        dest[0] = new_entry;
-        return false;
+        const uintptr_t capacity = (table->capacity == 0) ?
+            QED_HASH_TABLE_ENTRIES : (table->capacity << 1);
+        if(!qed_hash_table_resize(table, capacity)){
+            /* There is no way to report this through the existing API. */
+            abort();
+        }
+        slot = qed_hash_table_find(table, key);
     }
+    
+    table->keys[slot] = key;
+    table->data[slot] = data;
+    table->count++;
+    return false;
 }
 
 bool QED_HashTableSet(struct QED_HashTable *table,
     qed_hashkey_t key,
     qed_hashdata_t data){
-    struct QED_HashEntry *const entry = qed_hash_table_get(table, key);
-    if(entry){
-        entry->data = data;
-        return true;
+    
+    if(key == 0){
+        if(table->has_zero)
+            table->zero_data = data;
+        return table->has_zero != 0;
     }
-    else{
+    
+    if(table->capacity == 0)
         return false;
+    
+    {
+        const uintptr_t slot = qed_hash_table_find(table, key);
+        if(table->keys[slot] == 0)
+            return false;
+        table->data[slot] = data;
+        return true;
     }
 }
 
@@ -103,43 +211,68 @@ bool QED_HashTableRemove(struct QED_HashTable *table,
     qed_hashkey_t key,
     qed_hashdata_t *out){
     
-    struct QED_HashEntry *entry, *prev;
-    {
-        const uintptr_t hash = QED_Hash(key);
-        entry = table->table[hash];
-        /* Empty bucket */
-        if(entry == NULL)
+    uintptr_t hole, slot, mask;
+    
+    if(key == 0){
+        if(!table->has_zero)
             return false;
-        
-        if(entry->key == key){
-            /* This is the first key, clear the bucket. */
-            table->table[hash] = NULL;
-            free(entry);
-            return true;
-        }
+        out[0] = table->zero_data;
+        table->has_zero = 0;
+        table->zero_data = 0;
+        return true;
     }
     
-    /* First iteration, prev will at least be filled now. */
-    prev = entry;
-    entry = entry->next;
-    
-    while(entry){
-        if(entry->key == key){
-            
-            /* Stitch the list */
-            prev->next = entry->next;
-            
-            /* Set the output */
-            out[0] = entry->data;
-            
-            free(entry);
-            return true;
-        }
-        prev = entry;
-        entry = entry->next;
+    if(table->capacity == 0)
+        return false;
+    
+    hole = qed_hash_table_find(table, key);
+    if(table->keys[hole] == 0)
+        return false;
+    
+    out[0] = table->data[hole];
+    table->count--;
+    
+    /* Shift back any following entries that would no longer be reachable
+     * through the hole we are leaving. */
+    mask = table->capacity - 1;
+    slot = hole;
+    for(;;){
+        uintptr_t home;
+        slot = (slot + 1) & mask;
+        if(table->keys[slot] == 0)
+            break;
+        
+        home = QED_Hash(table->keys[slot]) & mask;
+        
+        /* Leave the entry if its home lies cyclically in (hole, slot]. */
+        if((hole <= slot) ? (hole < home && home <= slot) :
+            (hole < home || home <= slot))
+            continue;
+        
+        table->keys[hole] = table->keys[slot];
+        table->data[hole] = table->data[slot];
+        hole = slot;
     }
     
-    return false;
+    table->keys[hole] = 0;
+    table->data[hole] = 0;
+    return true;
+}
+
+bool QED_HashTableReserve(struct QED_HashTable *table, uintptr_t count){
+    uintptr_t capacity = (table->capacity == 0) ?
+        QED_HASH_TABLE_ENTRIES : table->capacity;
+    
+    while(QED_HASH_TABLE_FULL(count, capacity))
+        capacity <<= 1;
+    
+    if(capacity == table->capacity)
+        return true;
+    return qed_hash_table_resize(table, capacity);
+}
+
+uintptr_t QED_HashTableCount(const struct QED_HashTable *table){
+    return table->count + table->has_zero;
 }
 
 int QED_HashTableIterate(struct QED_HashTable *table,
@@ -147,28 +280,38 @@ int QED_HashTableIterate(struct QED_HashTable *table,
     void *arg,
     QED_HashTableIterCallback cb){
     
-    unsigned i = 0;
-    do{
-        struct QED_HashEntry *entry = table->table[i];
-        while(entry && accum >= 0){
-            accum = cb(accum, arg, entry->key, entry->data);
-            entry = entry->next;
-        }
-    }while(++i < QED_HASH_TABLE_ENTRIES);
+    uintptr_t i;
+    
+    QED_STATS_ADD(iterate_passes, 1);
+    
+    if(table->has_zero && accum >= 0)
+        accum = cb(accum, arg, 0, table->zero_data);
+    
+    for(i = 0; i < table->capacity && accum >= 0; i++){
+        const qed_hashkey_t key = table->keys[i];
+        if(key != 0)
+            accum = cb(accum, arg, key, table->data[i]);
+    }
     
     return accum;
 }
 
 void QED_FreeHashTable(struct QED_HashTable *table, QED_HashTableFreeCallback cb){
-    unsigned i;
-    for(i = 0; i < QED_HASH_TABLE_ENTRIES; i++){
-        struct QED_HashEntry *entry = table->table[i];
-        while(entry){
-            struct QED_HashEntry *const next = entry->next;
-            if(cb != NULL)
-                cb(entry->key, entry->data);
-            free(entry);
-            entry = next;
+    if(cb != NULL){
+        uintptr_t i;
+        if(table->has_zero)
+            cb(0, table->zero_data);
+        for(i = 0; i < table->capacity; i++){
+            if(table->keys[i] != 0)
+                cb(table->keys[i], table->data[i]);
         }
     }
+    
+    free(table->keys);
+    table->keys = NULL;
+    table->data = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->has_zero = 0;
+    table->zero_data = 0;
 }
@@ -13,10 +13,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Initial number of slots. The table doubles whenever it becomes more than
+ * three quarters full. */
 #define QED_HASH_TABLE_ENTRIES (64)
-#define QED_HASH_TABLE_SIZE (QED_HASH_TABLE_ENTRIES * sizeof(void*))
+#define QED_HASH_TABLE_SIZE (6 * sizeof(uintptr_t))
 
-/* Size is QED_HASH_TABLE_SIZE. Should be zero-initialized. */
+/* Size is QED_HASH_TABLE_SIZE. Should be zero-initialized. A zeroed table is
+ * empty and allocates no slots until the first insertion. */
 struct QED_HashTable;
 
 typedef uintptr_t qed_hashkey_t;
@@ -82,6 +85,20 @@ bool QED_HashTableRemove(struct QED_HashTable *,
     qed_hashkey_t,
     qed_hashdata_t *);
 
+/**
+ * @brief Makes room for at least the specified number of keys.
+ *
+ * Inserting up to that many keys will not cause the table to grow.
+ *
+ * @return false if the allocation failed.
+ */
+bool QED_HashTableReserve(struct QED_HashTable *, uintptr_t);
+
+/**
+ * @brief Gets the number of keys in the table.
+ */
+uintptr_t QED_HashTableCount(const struct QED_HashTable *);
+
 /**
  * @brief Calls a function for every entry in the hash table.
  *
@@ -90,6 +107,8 @@ bool QED_HashTableRemove(struct QED_HashTable *,
  * call is the return value of the previous call. If a value < 0 is returned,
  * iteration is stopped.
  *
+ * The callback may use QED_HashTableSet, but must not insert or remove keys.
+ *
  * @return The final value of the accumulator
  */
 int QED_HashTableIterate(struct QED_HashTable *,
@@ -97,6 +116,12 @@ int QED_HashTableIterate(struct QED_HashTable *,
     void*,
     QED_HashTableIterCallback);
 
+/**
+ * @brief Frees the storage of the table.
+ *
+ * The callback is called for every entry if it is not NULL. The table itself
+ * is not freed, and is left empty so that it can be reused.
+ */
 void QED_FreeHashTable(struct QED_HashTable *, QED_HashTableFreeCallback);
 
 #endif /* LIBQED_TINY_HASH_H */